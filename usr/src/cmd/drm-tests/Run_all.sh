@@ -31,7 +31,10 @@
 
 # Leaving out random (takes a while)
 # Also updatedraw (broken at the moment)
-TESTS="drmdevice dristat drmstat drmsl hash"
+# The benchmarks (gem_gtt_bind, gem_pread_bit17) are run by hand
+TESTS="drmdevice dristat drmstat drmsl hash
+	gem_ctx_pread gem_ctx_priority gem_exec_event gem_rect gem_wait_multi
+	drm_mm_fuzz idr_churn"
 
 run_all() {
 for f in $TESTS ; do
@@ -0,0 +1,131 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Read back, with pread and without any explicit wait, an object that
+ * the GPU has just written through a context's own PPGTT. The object is
+ * never bound in the global GTT, so pread has to wait for the batch by
+ * itself.
+ *
+ * Exits 0 on success or when the hardware has no per-context address
+ * spaces to test, 1 on failure.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "gem_util.h"
+
+#define	TARGET_DWORDS	1024	/* one page */
+#define	PASSES		8	/* stores per dword, to keep the GPU busy */
+#define	LOOPS		64
+
+#define	BATCH_DWORDS	(TARGET_DWORDS * PASSES * 4 + 2)
+#define	NRELOCS		(TARGET_DWORDS * PASSES)
+
+int
+main(int argc, char **argv)
+{
+	struct drm_i915_gem_relocation_entry *relocs;
+	struct drm_i915_gem_exec_object2 objs[2];
+	struct drm_i915_gem_execbuffer2 execbuf;
+	uint32_t *batch, *target;
+	uint32_t target_handle, batch_handle, ctx_id;
+	int fd, devid, loop, pass, i, n, r, ret;
+	int failed = 0;
+
+	fd = gem_open();
+	devid = gem_devid(fd);
+	if (!IS_GEN7(devid))
+		gem_skip("device 0x%04x is not gen7", devid);
+	if ((ctx_id = gem_context_create(fd)) == 0)
+		gem_skip("no hardware contexts");
+
+	batch = calloc(BATCH_DWORDS, sizeof (uint32_t));
+	relocs = calloc(NRELOCS, sizeof (*relocs));
+	target = calloc(TARGET_DWORDS, sizeof (uint32_t));
+	if (batch == NULL || relocs == NULL || target == NULL) {
+		perror("calloc");
+		return (1);
+	}
+
+	target_handle = gem_create(fd, TARGET_DWORDS * sizeof (uint32_t));
+	batch_handle = gem_create(fd, BATCH_DWORDS * sizeof (uint32_t));
+
+	for (loop = 0; loop < LOOPS && !failed; loop++) {
+		/*
+		 * Every pass but the last stores garbage, so a read that
+		 * does not wait for the whole batch sees it.
+		 */
+		for (pass = 0, n = 0, r = 0; pass < PASSES; pass++) {
+			for (i = 0; i < TARGET_DWORDS; i++) {
+				batch[n++] = MI_STORE_DWORD_IMM;
+				batch[n++] = 0;
+				relocs[r].target_handle = target_handle;
+				relocs[r].delta = i * sizeof (uint32_t);
+				relocs[r].offset = n * sizeof (uint32_t);
+				relocs[r].presumed_offset = -1;
+				relocs[r].read_domains =
+				    I915_GEM_DOMAIN_INSTRUCTION;
+				relocs[r].write_domain =
+				    I915_GEM_DOMAIN_INSTRUCTION;
+				r++;
+				batch[n++] = 0;
+				batch[n++] = pass == PASSES - 1 ?
+				    (loop << 16 | i) : 0xdeadbeef;
+			}
+		}
+		batch[n++] = MI_BATCH_BUFFER_END;
+		batch[n++] = 0;
+		gem_write(fd, batch_handle, 0, batch, n * sizeof (uint32_t));
+
+		(void) memset(objs, 0, sizeof (objs));
+		objs[0].handle = target_handle;
+		objs[1].handle = batch_handle;
+		objs[1].relocation_count = r;
+		objs[1].relocs_ptr = (uintptr_t)relocs;
+
+		(void) memset(&execbuf, 0, sizeof (execbuf));
+		execbuf.buffers_ptr = (uintptr_t)objs;
+		execbuf.buffer_count = 2;
+		execbuf.batch_len = n * sizeof (uint32_t);
+		execbuf.flags = I915_EXEC_RENDER;
+		i915_execbuffer2_set_context_id(execbuf, ctx_id);
+		if ((ret = gem_execbuf(fd, &execbuf)) != 0) {
+			printf("FAIL: execbuffer: %s\n", strerror(ret));
+			return (1);
+		}
+
+		/* No set_domain or wait: pread alone must be coherent */
+		gem_read(fd, target_handle, 0, target,
+		    TARGET_DWORDS * sizeof (uint32_t));
+		for (i = 0; i < TARGET_DWORDS; i++) {
+			if (target[i] != (loop << 16 | i)) {
+				printf("FAIL: loop %d dword %d: "
+				    "0x%08x, expected 0x%08x\n", loop, i,
+				    target[i], loop << 16 | i);
+				failed = 1;
+				break;
+			}
+		}
+	}
+
+	free(target);
+	free(relocs);
+	free(batch);
+	drmClose(fd);
+
+	if (!failed)
+		printf("PASS: %d batches read back\n", LOOPS);
+	return (failed);
+}
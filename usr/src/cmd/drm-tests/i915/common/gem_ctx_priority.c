@@ -0,0 +1,369 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Test submission priorities set with I915_CONTEXT_PARAM_PRIORITY: when a
+ * low and a high priority context are both waiting for the submission
+ * slot, the high one must be let through first, even though it started
+ * waiting last. Each writes its own marker into the same dword with
+ * MI_STORE_DWORD_IMM, so whichever batch went to the ring last leaves
+ * its marker behind. The per-context scheduler statistics must account
+ * for the wait.
+ *
+ * To get both contexts waiting, a third batch on the default context
+ * holds the slot. Its relocations are read only, so copying the presumed
+ * offsets back fails and execbuffer falls back to the slow path, which
+ * copies them all in with struct_mutex dropped but the slot still held.
+ * The bigger the list, the longer that takes; rounds where the contexts
+ * did not both get to wait are retried with a bigger one.
+ *
+ * Exits 0 on success or when the hardware has no contexts to test, 1 on
+ * failure.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "gem_util.h"
+
+#define	ROUNDS		4	/* conclusive rounds wanted */
+#define	ATTEMPTS	16
+#define	MIN_RELOCS	(256 * 1024)
+#define	MAX_RELOCS	(4 * 1024 * 1024)	/* 128MB of relocations */
+
+#define	LOW_MARKER	0x10ca1
+#define	HIGH_MARKER	0x4191
+
+static int failed;
+
+static void
+check(int cond, const char *what, long long got)
+{
+	if (!cond) {
+		(void) printf("FAIL: %s (got %lld)\n", what, got);
+		failed = 1;
+	}
+}
+
+static uint64_t
+ctx_stat(int fd, uint32_t ctx_id, uint64_t param)
+{
+	uint64_t value;
+	int ret;
+
+	if ((ret = gem_context_get_param(fd, ctx_id, param, &value)) != 0) {
+		(void) printf("FAIL: context %u getparam 0x%llx: %s\n",
+		    ctx_id, (unsigned long long)param, strerror(ret));
+		exit(1);
+	}
+	return (value);
+}
+
+struct submit {
+	int fd;
+	uint32_t ctx_id;
+	struct drm_i915_gem_exec_object2 objs[2];
+	struct drm_i915_gem_execbuffer2 execbuf;
+	volatile int done;
+	int ret;
+};
+
+static void *
+submit_thread(void *arg)
+{
+	struct submit *s = arg;
+
+	s->ret = gem_execbuf(s->fd, &s->execbuf);
+	s->done = 1;
+	return (NULL);
+}
+
+static void
+submit_start(struct submit *s, pthread_t *tid)
+{
+	s->done = 0;
+	if (pthread_create(tid, NULL, submit_thread, s) != 0) {
+		perror("pthread_create");
+		exit(1);
+	}
+}
+
+/* A batch on ctx_id storing marker into target */
+static void
+submit_store(struct submit *s, int fd, uint32_t ctx_id, uint32_t target,
+    uint32_t marker, struct drm_i915_gem_relocation_entry *reloc)
+{
+	uint32_t batch[6];
+
+	batch[0] = MI_STORE_DWORD_IMM;
+	batch[1] = 0;
+	batch[2] = 0;
+	batch[3] = marker;
+	batch[4] = MI_BATCH_BUFFER_END;
+	batch[5] = 0;
+
+	(void) memset(reloc, 0, sizeof (*reloc));
+	reloc->target_handle = target;
+	reloc->offset = 2 * sizeof (uint32_t);
+	reloc->presumed_offset = -1;
+	reloc->read_domains = I915_GEM_DOMAIN_INSTRUCTION;
+	reloc->write_domain = I915_GEM_DOMAIN_INSTRUCTION;
+
+	(void) memset(s, 0, sizeof (*s));
+	s->fd = fd;
+	s->ctx_id = ctx_id;
+	s->objs[0].handle = target;
+	s->objs[1].handle = gem_create(fd, 4096);
+	s->objs[1].relocation_count = 1;
+	s->objs[1].relocs_ptr = (uintptr_t)reloc;
+	gem_write(fd, s->objs[1].handle, 0, batch, sizeof (batch));
+
+	s->execbuf.buffers_ptr = (uintptr_t)s->objs;
+	s->execbuf.buffer_count = 2;
+	s->execbuf.batch_len = sizeof (batch);
+	s->execbuf.flags = I915_EXEC_RENDER;
+	i915_execbuffer2_set_context_id(s->execbuf, ctx_id);
+}
+
+/*
+ * A batch on the default context with nrelocs read only relocations, all
+ * pointing past its end into scratch.
+ */
+static struct drm_i915_gem_relocation_entry *
+submit_blocker(struct submit *s, int fd, uint32_t scratch, int nrelocs)
+{
+	struct drm_i915_gem_relocation_entry *relocs;
+	uint32_t batch[2];
+	size_t size = nrelocs * sizeof (*relocs);
+	int i;
+
+	relocs = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (relocs == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	for (i = 0; i < nrelocs; i++) {
+		relocs[i].target_handle = scratch;
+		relocs[i].offset = 2 * sizeof (uint32_t);
+		relocs[i].presumed_offset = -1;
+		relocs[i].read_domains = I915_GEM_DOMAIN_INSTRUCTION;
+	}
+	if (mprotect(relocs, size, PROT_READ) != 0) {
+		perror("mprotect");
+		exit(1);
+	}
+
+	batch[0] = MI_BATCH_BUFFER_END;
+	batch[1] = 0;
+
+	(void) memset(s, 0, sizeof (*s));
+	s->fd = fd;
+	s->objs[0].handle = scratch;
+	s->objs[1].handle = gem_create(fd, 4096);
+	s->objs[1].relocation_count = nrelocs;
+	s->objs[1].relocs_ptr = (uintptr_t)relocs;
+	gem_write(fd, s->objs[1].handle, 0, batch, sizeof (batch));
+
+	s->execbuf.buffers_ptr = (uintptr_t)s->objs;
+	s->execbuf.buffer_count = 2;
+	s->execbuf.batch_len = sizeof (batch);
+	s->execbuf.flags = I915_EXEC_RENDER;
+	return (relocs);
+}
+
+/* Wait for ctx_id to be queued for the slot, 0 if blocker got done first */
+static int
+wait_queued(int fd, uint32_t ctx_id, struct submit *blocker)
+{
+	while (!blocker->done) {
+		if (ctx_stat(fd, ctx_id, I915_CONTEXT_PARAM_SCHED_QUEUED) > 0)
+			return (1);
+		(void) usleep(100);
+	}
+	return (0);
+}
+
+/*
+ * One round: returns 1 if both contexts were seen waiting behind the
+ * blocker, 0 if the round proved nothing and should be retried.
+ */
+static int
+sched_round(int fd, uint32_t low, uint32_t high, uint32_t target,
+    uint32_t scratch, int nrelocs)
+{
+	struct drm_i915_gem_relocation_entry low_reloc, high_reloc, *relocs;
+	struct submit blocker, sl, sh;
+	pthread_t blocker_tid, low_tid, high_tid;
+	uint64_t low_wait, high_wait, low_sub, high_sub, base;
+	uint32_t value;
+	int conclusive;
+
+	relocs = submit_blocker(&blocker, fd, scratch, nrelocs);
+	submit_store(&sl, fd, low, target, LOW_MARKER, &low_reloc);
+	submit_store(&sh, fd, high, target, HIGH_MARKER, &high_reloc);
+	value = 0;
+	gem_write(fd, target, 0, &value, sizeof (value));
+
+	low_wait = ctx_stat(fd, low, I915_CONTEXT_PARAM_SCHED_WAIT_NS);
+	high_wait = ctx_stat(fd, high, I915_CONTEXT_PARAM_SCHED_WAIT_NS);
+	low_sub = ctx_stat(fd, low, I915_CONTEXT_PARAM_SCHED_SUBMITTED);
+	high_sub = ctx_stat(fd, high, I915_CONTEXT_PARAM_SCHED_SUBMITTED);
+	base = ctx_stat(fd, 0, I915_CONTEXT_PARAM_SCHED_SUBMITTED);
+
+	/*
+	 * The getparam ioctl takes struct_mutex too, so the blocker is only
+	 * seen submitted once it has dropped it on the slow path, slot held,
+	 * or is done altogether.
+	 */
+	submit_start(&blocker, &blocker_tid);
+	while (!blocker.done &&
+	    ctx_stat(fd, 0, I915_CONTEXT_PARAM_SCHED_SUBMITTED) == base)
+		(void) usleep(100);
+
+	/* Low first, so that it has waited the longest */
+	submit_start(&sl, &low_tid);
+	conclusive = wait_queued(fd, low, &blocker);
+	submit_start(&sh, &high_tid);
+	conclusive &= wait_queued(fd, high, &blocker);
+
+	(void) pthread_join(blocker_tid, NULL);
+	(void) pthread_join(low_tid, NULL);
+	(void) pthread_join(high_tid, NULL);
+	check(blocker.ret == 0, "the blocking execbuffer", blocker.ret);
+	check(sl.ret == 0, "the low priority execbuffer", sl.ret);
+	check(sh.ret == 0, "the high priority execbuffer", sh.ret);
+
+	check(ctx_stat(fd, low, I915_CONTEXT_PARAM_SCHED_SUBMITTED) ==
+	    low_sub + 1, "the low priority context counted its batch",
+	    ctx_stat(fd, low, I915_CONTEXT_PARAM_SCHED_SUBMITTED) - low_sub);
+	check(ctx_stat(fd, high, I915_CONTEXT_PARAM_SCHED_SUBMITTED) ==
+	    high_sub + 1, "the high priority context counted its batch",
+	    ctx_stat(fd, high, I915_CONTEXT_PARAM_SCHED_SUBMITTED) - high_sub);
+	check(ctx_stat(fd, low, I915_CONTEXT_PARAM_SCHED_QUEUED) == 0,
+	    "nothing is left queued on the low priority context",
+	    ctx_stat(fd, low, I915_CONTEXT_PARAM_SCHED_QUEUED));
+	check(ctx_stat(fd, high, I915_CONTEXT_PARAM_SCHED_QUEUED) == 0,
+	    "nothing is left queued on the high priority context",
+	    ctx_stat(fd, high, I915_CONTEXT_PARAM_SCHED_QUEUED));
+
+	low_wait = ctx_stat(fd, low, I915_CONTEXT_PARAM_SCHED_WAIT_NS) -
+	    low_wait;
+	high_wait = ctx_stat(fd, high, I915_CONTEXT_PARAM_SCHED_WAIT_NS) -
+	    high_wait;
+
+	if (conclusive) {
+		check(high_wait > 0, "the high priority context waited",
+		    high_wait);
+		/* Low queued first and got the slot last */
+		check(low_wait > high_wait,
+		    "the low priority context waited the longest",
+		    (long long)(low_wait - high_wait));
+		check(ctx_stat(fd, low, I915_CONTEXT_PARAM_SCHED_WAIT_MAX_NS) >=
+		    low_wait, "the low priority context's longest wait",
+		    ctx_stat(fd, low, I915_CONTEXT_PARAM_SCHED_WAIT_MAX_NS));
+
+		gem_sync(fd, target);
+		gem_read(fd, target, 0, &value, sizeof (value));
+		check(value == LOW_MARKER,
+		    "the high priority batch went to the ring first", value);
+	}
+
+	(void) munmap(relocs, nrelocs * sizeof (*relocs));
+	gem_close(fd, blocker.objs[1].handle);
+	gem_close(fd, sl.objs[1].handle);
+	gem_close(fd, sh.objs[1].handle);
+	return (conclusive);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t low, high, target, scratch;
+	int64_t high_prio;
+	uint64_t value;
+	int fd, devid, nrelocs, done, attempt, ret;
+
+	fd = gem_open();
+	devid = gem_devid(fd);
+	if (!IS_GEN7(devid))
+		gem_skip("device 0x%04x is not gen7", devid);
+	if ((low = gem_context_create(fd)) == 0)
+		gem_skip("no hardware contexts");
+	high = gem_context_create(fd);
+
+	/* Out of range, or raised without being master or root */
+	ret = gem_context_set_param(fd, low, I915_CONTEXT_PARAM_PRIORITY,
+	    I915_CONTEXT_MAX_USER_PRIORITY + 1);
+	check(ret == EINVAL, "a priority above the maximum is EINVAL", ret);
+	ret = gem_context_set_param(fd, low, I915_CONTEXT_PARAM_PRIORITY,
+	    (uint64_t)(I915_CONTEXT_MIN_USER_PRIORITY - 1));
+	check(ret == EINVAL, "a priority below the minimum is EINVAL", ret);
+	ret = gem_context_set_param(fd, high + 1, I915_CONTEXT_PARAM_PRIORITY,
+	    I915_CONTEXT_DEFAULT_PRIORITY);
+	check(ret == ENOENT, "a priority for no context is ENOENT", ret);
+
+	ret = gem_context_set_param(fd, low, I915_CONTEXT_PARAM_PRIORITY,
+	    (uint64_t)I915_CONTEXT_MIN_USER_PRIORITY);
+	check(ret == 0, "lowering a context's priority", ret);
+	high_prio = I915_CONTEXT_MAX_USER_PRIORITY;
+	ret = gem_context_set_param(fd, high, I915_CONTEXT_PARAM_PRIORITY,
+	    high_prio);
+	if (ret == EPERM) {
+		(void) printf("not master or root, high priority is %d\n",
+		    I915_CONTEXT_DEFAULT_PRIORITY);
+		high_prio = I915_CONTEXT_DEFAULT_PRIORITY;
+		ret = gem_context_set_param(fd, high,
+		    I915_CONTEXT_PARAM_PRIORITY, high_prio);
+	}
+	check(ret == 0, "raising a context's priority", ret);
+
+	value = ctx_stat(fd, low, I915_CONTEXT_PARAM_PRIORITY);
+	check((int64_t)value == I915_CONTEXT_MIN_USER_PRIORITY,
+	    "the low priority reads back", (int64_t)value);
+	value = ctx_stat(fd, high, I915_CONTEXT_PARAM_PRIORITY);
+	check((int64_t)value == high_prio, "the high priority reads back",
+	    (int64_t)value);
+	if (failed)
+		return (1);
+
+	target = gem_create(fd, 4096);
+	scratch = gem_create(fd, 4096);
+
+	nrelocs = MIN_RELOCS;
+	for (attempt = 0, done = 0; attempt < ATTEMPTS && done < ROUNDS &&
+	    !failed; attempt++) {
+		if (sched_round(fd, low, high, target, scratch, nrelocs))
+			done++;
+		else if (nrelocs < MAX_RELOCS)
+			nrelocs *= 2;
+	}
+
+	gem_close(fd, scratch);
+	gem_close(fd, target);
+	gem_context_destroy(fd, high);
+	gem_context_destroy(fd, low);
+	drmClose(fd);
+
+	if (failed)
+		return (1);
+	if (done == 0)
+		gem_skip("the contexts never both waited for the slot");
+	(void) printf("PASS: %d rounds in priority order, %d relocations\n",
+	    done, nrelocs);
+	return (0);
+}
@@ -0,0 +1,263 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Test I915_EXEC_FENCE_EVENT: batches submitted with it must each queue a
+ * struct drm_i915_event_fence on the fd once they complete, carrying the
+ * user_data passed in rsvd2 and the fence id passed back in it, in
+ * completion order. Batches submitted without it must not. Once the fd's
+ * event space is used up execbuffer must fail with EBUSY, and reading the
+ * events must give the space back. Events still pending when the fd is
+ * closed must simply be dropped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+
+#include "gem_util.h"
+
+#define	NBATCHES	16
+#define	USER_DATA	0x5eed000000000000ULL
+#define	TIMEOUT_MS	5000
+#define	EVENT_SPACE	4096	/* what drm_open_helper() sets aside */
+
+static int failed;
+
+static void
+check(int cond, const char *what, long long got)
+{
+	if (!cond) {
+		(void) printf("FAIL: %s (got %lld)\n", what, got);
+		failed = 1;
+	}
+}
+
+/* Returns 0 or the errno; *fence gets the fence id */
+static int
+exec_event(int fd, uint32_t batch, int event, uint64_t user_data,
+    uint32_t *fence)
+{
+	struct drm_i915_gem_exec_object2 obj;
+	struct drm_i915_gem_execbuffer2 execbuf;
+	int ret;
+
+	(void) memset(&obj, 0, sizeof (obj));
+	obj.handle = batch;
+
+	(void) memset(&execbuf, 0, sizeof (execbuf));
+	execbuf.buffers_ptr = (uintptr_t)&obj;
+	execbuf.buffer_count = 1;
+	execbuf.batch_len = 8;
+	execbuf.flags = I915_EXEC_RENDER;
+	if (event) {
+		execbuf.flags |= I915_EXEC_FENCE_EVENT;
+		execbuf.rsvd2 = user_data;
+	}
+	ret = gem_execbuf(fd, &execbuf);
+	if (fence != NULL)
+		*fence = (uint32_t)execbuf.rsvd2;
+	return (ret);
+}
+
+/*
+ * Read events into buf, waiting up to timeout_ms for the first. Returns
+ * the number of bytes read.
+ */
+static ssize_t
+read_events(int fd, void *buf, size_t size, int timeout_ms)
+{
+	struct pollfd pfd;
+	ssize_t len;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, timeout_ms) <= 0)
+		return (0);
+
+	if ((len = read(fd, buf, size)) < 0) {
+		perror("read");
+		exit(1);
+	}
+	return (len);
+}
+
+static void
+test_events(int fd, uint32_t batch)
+{
+	struct drm_i915_event_fence *ev;
+	struct drm_i915_event_fence buf[EVENT_SPACE / sizeof (*ev)];
+	uint32_t fence[NBATCHES];
+	hrtime_t submitted, last;
+	ssize_t len;
+	char *p;
+	int i, n, ret;
+
+	submitted = gethrtime();
+	for (i = 0; i < NBATCHES; i++) {
+		ret = exec_event(fd, batch, 1, USER_DATA + i, &fence[i]);
+		check(ret == 0, "execbuffer with an event", ret);
+		check(fence[i] != 0, "execbuffer returned a fence id", i);
+		if (i > 0)
+			check(fence[i] != fence[i - 1],
+			    "each batch gets its own fence id", fence[i]);
+	}
+
+	/* Events come back in completion order, one ring is in order */
+	n = 0;
+	last = submitted;
+	while (n < NBATCHES) {
+		len = read_events(fd, buf, sizeof (buf), TIMEOUT_MS);
+		if (len == 0) {
+			check(0, "every batch sent its event", n);
+			return;
+		}
+		for (p = (char *)buf; p < (char *)buf + len;
+		    p += ev->base.length) {
+			ev = (struct drm_i915_event_fence *)(void *)p;
+			check(ev->base.type == I915_EVENT_FENCE,
+			    "the event is a fence event", ev->base.type);
+			check(ev->base.length == sizeof (*ev),
+			    "the event has the fence event's length",
+			    ev->base.length);
+			if (ev->base.length == 0 || n >= NBATCHES)
+				return;
+			check(ev->user_data == USER_DATA + n,
+			    "events come in submission order with their "
+			    "user_data",
+			    (long long)(ev->user_data - USER_DATA));
+			check(ev->fence == fence[n],
+			    "the event's fence is the one execbuffer returned",
+			    ev->fence);
+			check(ev->flags == 0, "no reset was reported",
+			    ev->flags);
+			check((hrtime_t)ev->timestamp_ns >= last,
+			    "timestamps follow submission and each other",
+			    (long long)(ev->timestamp_ns - last));
+			last = ev->timestamp_ns;
+			n++;
+		}
+	}
+
+	/* No flag, no event */
+	ret = exec_event(fd, batch, 0, 0, NULL);
+	check(ret == 0, "execbuffer without an event", ret);
+	gem_sync(fd, batch);
+	len = read_events(fd, buf, sizeof (buf), 200);
+	check(len == 0, "a batch without the flag sent no event", len);
+}
+
+static void
+test_short_read(int fd, uint32_t batch)
+{
+	struct drm_i915_event_fence ev;
+	char small[8];
+	uint32_t fence;
+	ssize_t len;
+	int ret;
+
+	ret = exec_event(fd, batch, 1, USER_DATA, &fence);
+	check(ret == 0, "execbuffer with an event", ret);
+
+	/* A buffer too small for the event leaves it queued */
+	len = read_events(fd, small, sizeof (small), TIMEOUT_MS);
+	check(len == 0, "a short read returns nothing", len);
+	len = read_events(fd, &ev, sizeof (ev), TIMEOUT_MS);
+	check(len == sizeof (ev), "the event is still there after a short read",
+	    len);
+	check(len != sizeof (ev) || ev.fence == fence,
+	    "the event is the one queued before the short read", ev.fence);
+}
+
+/* Every event is charged to the fd's event space until it is read */
+static void
+test_event_space(int fd, uint32_t batch)
+{
+	char buf[EVENT_SPACE];
+	ssize_t len;
+	int queued, read_back, ret;
+
+	for (queued = 0; queued < 1024; queued++) {
+		ret = exec_event(fd, batch, 1, USER_DATA + queued, NULL);
+		if (ret != 0)
+			break;
+	}
+	check(ret == EBUSY, "execbuffer is EBUSY once event space is used up",
+	    ret);
+	check(queued > 0 && queued < 1024, "some events fit", queued);
+
+	read_back = 0;
+	while ((len = read_events(fd, buf, sizeof (buf), TIMEOUT_MS)) > 0) {
+		read_back += len / sizeof (struct drm_i915_event_fence);
+		if (read_back >= queued)
+			break;
+	}
+	check(read_back == queued, "every queued event was read", read_back);
+
+	ret = exec_event(fd, batch, 1, USER_DATA, NULL);
+	check(ret == 0, "reading the events gave the space back", ret);
+	len = read_events(fd, buf, sizeof (buf), TIMEOUT_MS);
+	check(len == sizeof (struct drm_i915_event_fence),
+	    "the event after the space came back", len);
+}
+
+/* Close an fd with events queued and in flight, for i915_gem_release */
+static void
+test_close(void)
+{
+	uint32_t batch;
+	int fd, i;
+
+	fd = gem_open();
+	batch = gem_batch_nop(fd);
+	for (i = 0; i < NBATCHES; i++)
+		(void) exec_event(fd, batch, 1, USER_DATA + i, NULL);
+	gem_sync(fd, batch);
+	for (i = 0; i < NBATCHES; i++)
+		(void) exec_event(fd, batch, 1, USER_DATA + i, NULL);
+	drmClose(fd);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct drm_i915_event_fence ev;
+	uint32_t batch;
+	int fd, ret;
+
+	fd = gem_open();
+	batch = gem_batch_nop(fd);
+
+	ret = exec_event(fd, batch, 1, USER_DATA, NULL);
+	if (ret == EINVAL)
+		gem_skip("no I915_EXEC_FENCE_EVENT");
+	check(ret == 0, "execbuffer with an event", ret);
+	check(read_events(fd, &ev, sizeof (ev), TIMEOUT_MS) == sizeof (ev),
+	    "the first batch sent its event", 0);
+
+	test_events(fd, batch);
+	test_short_read(fd, batch);
+	test_event_space(fd, batch);
+	test_close();
+
+	gem_close(fd, batch);
+	drmClose(fd);
+
+	if (!failed)
+		(void) printf("PASS: fence events\n");
+	return (failed);
+}
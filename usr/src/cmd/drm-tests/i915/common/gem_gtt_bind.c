@@ -0,0 +1,132 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Time binding objects into the global GTT and unbinding them again, by
+ * object size, to measure how fast the GTT page table is written.
+ *
+ * Each round creates an object, faults in its pages, binds it by passing
+ * it to execbuffer along with a batch that does nothing, waits for the
+ * batch and closes the object, which unbinds it. The same rounds are
+ * timed without the object in the execbuffer, and the difference is what
+ * the bind and unbind cost.
+ *
+ * Usage: gem_gtt_bind [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "gem_util.h"
+
+#define	MIN_SIZE	(4ULL << 10)
+#define	MAX_SIZE	(64ULL << 20)
+#define	ROUND_BYTES	(512ULL << 20)	/* bytes bound per size by default */
+
+static hrtime_t
+time_rounds(int fd, uint32_t batch, uint64_t size, int rounds, int bind)
+{
+	struct drm_i915_gem_exec_object2 objs[2];
+	struct drm_i915_gem_execbuffer2 execbuf;
+	hrtime_t start;
+	uint32_t handle;
+	int i, ret;
+
+	start = gethrtime();
+	for (i = 0; i < rounds; i++) {
+		handle = gem_create(fd, size);
+		/* Populate without dirtying, so bind has nothing to flush */
+		gem_set_domain(fd, handle, I915_GEM_DOMAIN_CPU, 0);
+
+		(void) memset(objs, 0, sizeof (objs));
+		objs[0].handle = handle;
+		objs[1].handle = batch;
+
+		(void) memset(&execbuf, 0, sizeof (execbuf));
+		execbuf.buffers_ptr = (uintptr_t)(bind ? &objs[0] : &objs[1]);
+		execbuf.buffer_count = bind ? 2 : 1;
+		execbuf.batch_len = 8;
+		execbuf.flags = I915_EXEC_RENDER;
+		if ((ret = gem_execbuf(fd, &execbuf)) != 0) {
+			(void) printf("FAIL: execbuffer of %llu bytes: %s\n",
+			    (u_longlong_t)size, strerror(ret));
+			exit(1);
+		}
+
+		gem_sync(fd, batch);
+		gem_close(fd, handle);
+	}
+
+	return (gethrtime() - start);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct drm_i915_gem_get_aperture aperture;
+	uint64_t size;
+	hrtime_t base, bind, ns;
+	uint32_t batch;
+	int fd, rounds, fixed = 0;
+
+	if (argc > 1)
+		fixed = atoi(argv[1]);
+
+	fd = gem_open();
+
+	(void) memset(&aperture, 0, sizeof (aperture));
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_GET_APERTURE, &aperture) != 0) {
+		perror("GEM_GET_APERTURE");
+		return (1);
+	}
+
+	batch = gem_batch_nop(fd);
+
+	/* Warm up: bind the batch, and let the backing store pool fill */
+	(void) time_rounds(fd, batch, MIN_SIZE, 16, 1);
+
+	(void) printf("%10s %8s %12s %12s %10s\n",
+	    "size", "rounds", "bind+unbind", "per page", "MB/s");
+	for (size = MIN_SIZE; size <= MAX_SIZE; size <<= 2) {
+		if (size > aperture.aper_available_size / 2) {
+			(void) printf("%9lluK skipped: %lluK of aperture "
+			    "available\n", (u_longlong_t)(size >> 10),
+			    (u_longlong_t)(aperture.aper_available_size >> 10));
+			continue;
+		}
+
+		rounds = fixed;
+		if (rounds <= 0) {
+			rounds = ROUND_BYTES / size;
+			if (rounds < 8)
+				rounds = 8;
+			if (rounds > 1024)
+				rounds = 1024;
+		}
+
+		base = time_rounds(fd, batch, size, rounds, 0);
+		bind = time_rounds(fd, batch, size, rounds, 1);
+		ns = bind > base ? (bind - base) / rounds : 0;
+
+		(void) printf("%9lluK %8d %10lluus %10lluns %10.1f\n",
+		    (u_longlong_t)(size >> 10), rounds,
+		    (u_longlong_t)(ns / 1000),
+		    (u_longlong_t)(ns / (size >> 12)),
+		    ns ? (double)size / ns * 1e9 / (1 << 20) : 0.0);
+	}
+
+	gem_close(fd, batch);
+	drmClose(fd);
+	return (0);
+}
@@ -0,0 +1,158 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Time pread and pwrite of an X-tiled object, by object size, against a
+ * plain memcpy of the same number of bytes. On machines whose bit 6
+ * swizzling depends on bit 17 of the physical address, tiled objects go
+ * through the kernel's bit-17 copy, which swizzles the affected pages
+ * through a bounce page; elsewhere they take the ordinary shmem path,
+ * and the numbers are only a baseline.
+ *
+ * Every size is also read back once after being written, so a broken
+ * swizzle shows up as a FAIL rather than just a number.
+ *
+ * Usage: gem_pread_bit17 [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "gem_util.h"
+
+#define	STRIDE		4096
+#define	ROUND_BYTES	(512ULL << 20)	/* bytes copied per size by default */
+
+static const uint64_t sizes[] = {
+	4ULL << 10, 64ULL << 10, 1ULL << 20, 16ULL << 20, 64ULL << 20
+};
+
+static const char *
+swizzle_name(uint32_t swizzle)
+{
+	switch (swizzle) {
+	case I915_BIT_6_SWIZZLE_NONE:
+		return ("none");
+	case I915_BIT_6_SWIZZLE_9:
+		return ("9");
+	case I915_BIT_6_SWIZZLE_9_10:
+		return ("9_10");
+	case I915_BIT_6_SWIZZLE_9_11:
+		return ("9_11");
+	case I915_BIT_6_SWIZZLE_9_10_11:
+		return ("9_10_11");
+	case I915_BIT_6_SWIZZLE_9_17:
+		return ("9_17");
+	case I915_BIT_6_SWIZZLE_9_10_17:
+		return ("9_10_17");
+	default:
+		return ("unknown");
+	}
+}
+
+static double
+mb_per_s(uint64_t size, int rounds, hrtime_t ns)
+{
+	return (ns ? (double)size * rounds / ns * 1e9 / (1 << 20) : 0.0);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t size;
+	hrtime_t start, copy_ns, write_ns, read_ns;
+	uint32_t handle, swizzle;
+	char *src, *dst;
+	int fd, rounds, i, s, ret, fixed = 0, failed = 0;
+
+	if (argc > 1)
+		fixed = atoi(argv[1]);
+
+	fd = gem_open();
+
+	size = sizes[sizeof (sizes) / sizeof (sizes[0]) - 1];
+	src = malloc(size);
+	dst = malloc(size);
+	if (src == NULL || dst == NULL) {
+		perror("malloc");
+		return (1);
+	}
+	for (i = 0; i < size / sizeof (uint32_t); i++)
+		((uint32_t *)(void *)src)[i] = i;
+	(void) memset(dst, 0, size);
+
+	(void) printf("%10s %8s %12s %12s %12s\n",
+	    "size", "rounds", "memcpy MB/s", "pwrite MB/s", "pread MB/s");
+	for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++) {
+		size = sizes[s];
+
+		handle = gem_create(fd, size);
+		ret = gem_set_tiling(fd, handle, I915_TILING_X, STRIDE,
+		    &swizzle);
+		if (ret != 0)
+			gem_skip("X tiling: %s", strerror(ret));
+		if (s == 0)
+			(void) printf("bit 6 swizzle %s, bit-17 copy %s\n",
+			    swizzle_name(swizzle),
+			    swizzle == I915_BIT_6_SWIZZLE_9_17 ||
+			    swizzle == I915_BIT_6_SWIZZLE_9_10_17 ?
+			    "in use" : "not in use");
+
+		/* Fault the pages in and check the copy both ways once */
+		gem_write(fd, handle, 0, src, size);
+		gem_read(fd, handle, 0, dst, size);
+		if (memcmp(src, dst, size) != 0) {
+			(void) printf("FAIL: %lluK read back differs\n",
+			    (u_longlong_t)(size >> 10));
+			failed = 1;
+		}
+
+		rounds = fixed;
+		if (rounds <= 0) {
+			rounds = ROUND_BYTES / size;
+			if (rounds < 8)
+				rounds = 8;
+			if (rounds > 1024)
+				rounds = 1024;
+		}
+
+		start = gethrtime();
+		for (i = 0; i < rounds; i++)
+			(void) memcpy(dst, src, size);
+		copy_ns = gethrtime() - start;
+
+		start = gethrtime();
+		for (i = 0; i < rounds; i++)
+			gem_write(fd, handle, 0, src, size);
+		write_ns = gethrtime() - start;
+
+		start = gethrtime();
+		for (i = 0; i < rounds; i++)
+			gem_read(fd, handle, 0, dst, size);
+		read_ns = gethrtime() - start;
+
+		(void) printf("%9lluK %8d %12.1f %12.1f %12.1f\n",
+		    (u_longlong_t)(size >> 10), rounds,
+		    mb_per_s(size, rounds, copy_ns),
+		    mb_per_s(size, rounds, write_ns),
+		    mb_per_s(size, rounds, read_ns));
+
+		gem_close(fd, handle);
+	}
+
+	free(dst);
+	free(src);
+	drmClose(fd);
+	return (failed);
+}
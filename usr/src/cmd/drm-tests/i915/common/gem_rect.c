@@ -0,0 +1,304 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Test the rectangle pread/pwrite ioctls against the fence: rectangles
+ * written with PWRITE_RECT into X- and Y-tiled objects, at x, y and
+ * widths that straddle tiles and swizzled halves, must read back byte
+ * for byte through a GTT mmap, which the fence detiles, and through
+ * PREAD_RECT. Bytes outside the rectangles, and between the end of a
+ * row and the pitch in the user buffer, must be left alone. Rectangles
+ * running off the side or the bottom of the surface, a pitch narrower
+ * than the rectangle and untiled objects must be EINVAL.
+ *
+ * Exits 0 on success or when the hardware has no 4KB tiles, 1 on failure.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "gem_util.h"
+
+#define	STRIDE		2048
+#define	SIZE		(1 << 20)
+#define	ROWS		(SIZE / STRIDE)
+#define	PAD		5	/* user buffer bytes past each row */
+#define	GUARD		0xee
+
+struct rect {
+	uint32_t x, y, width, height;
+};
+
+/* Chosen to start and end off X (512x8) and Y (128x32) tile boundaries */
+static const struct rect rects[] = {
+	{ 13, 5, 1000, 37 },
+	{ 509, 7, 7, 2 },
+	{ 127, 31, 130, 3 },
+	{ 1, 0, STRIDE - 1, 1 },
+	{ 100, ROWS - 33, 1900, 33 },
+	{ 0, 64, STRIDE, 8 }
+};
+#define	NRECTS	(sizeof (rects) / sizeof (rects[0]))
+
+static int failed;
+static int devid;
+static uint32_t rng = 0x1234567;
+
+static void
+check(int cond, const char *what, int got)
+{
+	if (!cond) {
+		(void) printf("FAIL: %s (got %d)\n", what, got);
+		failed = 1;
+	}
+}
+
+static uint8_t
+random_byte(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return (rng >> 24);
+}
+
+/* Returns 0 or the errno */
+static int
+prw_rect(int fd, unsigned long request, uint32_t handle,
+    const struct rect *r, uint32_t pitch, void *data)
+{
+	struct drm_i915_gem_prw_rect args;
+
+	(void) memset(&args, 0, sizeof (args));
+	args.handle = handle;
+	args.x = r->x;
+	args.y = r->y;
+	args.width = r->width;
+	args.height = r->height;
+	args.pitch = pitch;
+	args.data_ptr = (uintptr_t)data;
+	if (drmIoctl(fd, request, &args) != 0)
+		return (errno);
+	return (0);
+}
+
+/* Compare a surface with what it should hold, reporting the first miss */
+static void
+compare(const char *tiling, const char *how, const uint8_t *got,
+    const uint8_t *expect)
+{
+	uint32_t i;
+
+	for (i = 0; i < SIZE; i++) {
+		if (got[i] != expect[i]) {
+			(void) printf("FAIL: %s read back through %s differs "
+			    "at x %u y %u: 0x%02x, expected 0x%02x\n", tiling,
+			    how, i % STRIDE, i / STRIDE, got[i], expect[i]);
+			failed = 1;
+			return;
+		}
+	}
+}
+
+static void
+test_invalid(int fd, uint32_t handle, const char *tiling)
+{
+	struct drm_i915_gem_prw_rect args;
+	struct rect r;
+	uint8_t buf[64];
+	char what[80];
+	int ret;
+
+	r.x = STRIDE - 10;
+	r.y = 0;
+	r.width = 11;
+	r.height = 1;
+	ret = prw_rect(fd, DRM_IOCTL_I915_GEM_PWRITE_RECT, handle, &r,
+	    r.width, buf);
+	(void) snprintf(what, sizeof (what), "%s: x + width past the stride "
+	    "is EINVAL", tiling);
+	check(ret == EINVAL, what, ret);
+
+	r.x = 0;
+	r.width = 16;
+	ret = prw_rect(fd, DRM_IOCTL_I915_GEM_PREAD_RECT, handle, &r,
+	    r.width - 1, buf);
+	(void) snprintf(what, sizeof (what), "%s: a pitch under the width "
+	    "is EINVAL", tiling);
+	check(ret == EINVAL, what, ret);
+
+	r.y = ROWS - 1;
+	r.width = 1;
+	r.height = 2;
+	ret = prw_rect(fd, DRM_IOCTL_I915_GEM_PWRITE_RECT, handle, &r,
+	    r.width, buf);
+	(void) snprintf(what, sizeof (what), "%s: rows past the end of the "
+	    "object are EINVAL", tiling);
+	check(ret == EINVAL, what, ret);
+
+	(void) memset(&args, 0, sizeof (args));
+	args.handle = handle;
+	args.flags = 1;
+	args.width = args.height = args.pitch = 1;
+	args.data_ptr = (uintptr_t)buf;
+	ret = drmIoctl(fd, DRM_IOCTL_I915_GEM_PREAD_RECT, &args) != 0 ?
+	    errno : 0;
+	(void) snprintf(what, sizeof (what), "%s: unknown flags are EINVAL",
+	    tiling);
+	check(ret == EINVAL, what, ret);
+}
+
+/* Returns 0 if the tiling could not be tested */
+static int
+test_tiling(int fd, uint32_t tiling, const char *name)
+{
+	struct rect all = { 0, 0, STRIDE, ROWS };
+	const struct rect *r;
+	uint8_t *map, *shadow, *buf, *row;
+	uint32_t handle, pitch, i, y, x;
+	int ret, n;
+
+	handle = gem_create(fd, SIZE);
+	if ((ret = gem_set_tiling(fd, handle, tiling, STRIDE, NULL)) != 0) {
+		(void) printf("%s tiling: %s, not tested\n", name,
+		    strerror(ret));
+		gem_close(fd, handle);
+		return (0);
+	}
+
+	shadow = malloc(SIZE);
+	buf = malloc((STRIDE + PAD + 3) * ROWS);
+	if (shadow == NULL || buf == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	/* Fill through the fence, so pwrite starts from known contents */
+	map = gem_mmap_gtt(fd, handle, SIZE);
+	gem_set_domain(fd, handle, I915_GEM_DOMAIN_GTT, I915_GEM_DOMAIN_GTT);
+	for (i = 0; i < SIZE; i++)
+		shadow[i] = random_byte();
+	(void) memcpy(map, shadow, SIZE);
+
+	for (n = 0; n < NRECTS; n++) {
+		r = &rects[n];
+		pitch = r->width + PAD;
+		for (i = 0; i < pitch * r->height; i++)
+			buf[i] = random_byte();
+		ret = prw_rect(fd, DRM_IOCTL_I915_GEM_PWRITE_RECT, handle, r,
+		    pitch, buf);
+		if (ret == ENODEV || (ret == EINVAL && n == 0 &&
+		    tiling == I915_TILING_Y && IS_GEN3(devid))) {
+			/* Unknown swizzling, or 915's Y tiles, not 4KB */
+			(void) printf("%s tiling: PWRITE_RECT %s, not tested\n",
+			    name, strerror(ret));
+			(void) munmap(map, SIZE);
+			gem_close(fd, handle);
+			free(buf);
+			free(shadow);
+			return (0);
+		}
+		check(ret == 0, "PWRITE_RECT", ret);
+		for (y = 0; y < r->height; y++)
+			(void) memcpy(shadow + (r->y + y) * STRIDE + r->x,
+			    buf + y * pitch, r->width);
+	}
+
+	gem_set_domain(fd, handle, I915_GEM_DOMAIN_GTT, 0);
+	compare(name, "the GTT", map, shadow);
+
+	/* Read each rectangle back with a pitch of its own */
+	for (n = 0; n < NRECTS; n++) {
+		r = &rects[n];
+		pitch = r->width + PAD + 3;
+		(void) memset(buf, GUARD, pitch * r->height);
+		ret = prw_rect(fd, DRM_IOCTL_I915_GEM_PREAD_RECT, handle, r,
+		    pitch, buf);
+		check(ret == 0, "PREAD_RECT", ret);
+		for (y = 0; y < r->height; y++) {
+			row = buf + y * pitch;
+			if (memcmp(row, shadow + (r->y + y) * STRIDE + r->x,
+			    r->width) != 0) {
+				(void) printf("FAIL: %s rectangle %d row %u "
+				    "read back through PREAD_RECT differs\n",
+				    name, n, y);
+				failed = 1;
+				break;
+			}
+			for (x = r->width; x < pitch; x++) {
+				if (row[x] != GUARD) {
+					(void) printf("FAIL: %s rectangle %d "
+					    "row %u: PREAD_RECT wrote past "
+					    "the width\n", name, n, y);
+					failed = 1;
+					break;
+				}
+			}
+		}
+	}
+
+	/* And the whole surface, including what pwrite never touched */
+	ret = prw_rect(fd, DRM_IOCTL_I915_GEM_PREAD_RECT, handle, &all,
+	    STRIDE, buf);
+	check(ret == 0, "PREAD_RECT of the whole surface", ret);
+	compare(name, "PREAD_RECT", buf, shadow);
+
+	test_invalid(fd, handle, name);
+
+	(void) munmap(map, SIZE);
+	gem_close(fd, handle);
+	free(buf);
+	free(shadow);
+	return (1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct rect r = { 0, 0, 16, 1 };
+	uint8_t buf[16];
+	uint32_t handle;
+	int fd, tested, ret;
+
+	fd = gem_open();
+	devid = gem_devid(fd);
+	if (IS_GEN2(devid))
+		gem_skip("device 0x%04x has no 4KB tiles", devid);
+
+	tested = test_tiling(fd, I915_TILING_X, "X");
+	tested += test_tiling(fd, I915_TILING_Y, "Y");
+	if (tested == 0)
+		gem_skip("neither tiling could be tested");
+
+	handle = gem_create(fd, SIZE);
+	ret = prw_rect(fd, DRM_IOCTL_I915_GEM_PWRITE_RECT, handle, &r,
+	    r.width, buf);
+	check(ret == EINVAL, "PWRITE_RECT to an untiled object is EINVAL", ret);
+	ret = prw_rect(fd, DRM_IOCTL_I915_GEM_PREAD_RECT, handle, &r,
+	    r.width, buf);
+	check(ret == EINVAL, "PREAD_RECT from an untiled object is EINVAL",
+	    ret);
+	gem_close(fd, handle);
+
+	ret = prw_rect(fd, DRM_IOCTL_I915_GEM_PREAD_RECT, handle, &r,
+	    r.width, buf);
+	check(ret == ENOENT, "PREAD_RECT from a closed handle is ENOENT", ret);
+
+	drmClose(fd);
+
+	if (!failed)
+		(void) printf("PASS: %d tilings round-tripped\n", tested);
+	return (failed);
+}
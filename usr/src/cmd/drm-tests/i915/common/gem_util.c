@@ -0,0 +1,264 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Helpers shared by the i915 tests, see gem_util.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "gem_util.h"
+
+static void
+gem_fail(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+void
+gem_skip(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void) printf("SKIP: ");
+	va_start(ap, fmt);
+	(void) vprintf(fmt, ap);
+	va_end(ap);
+	(void) printf("\n");
+	exit(0);
+}
+
+int
+gem_open(void)
+{
+	int fd;
+
+	fd = drmOpen("i915", NULL);
+	if (fd < 0)
+		gem_skip("no i915 device");
+	return (fd);
+}
+
+int
+gem_getparam(int fd, int param)
+{
+	struct drm_i915_getparam gp;
+	int value = 0;
+
+	gp.param = param;
+	gp.value = &value;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GETPARAM, &gp) != 0)
+		return (0);
+	return (value);
+}
+
+int
+gem_devid(int fd)
+{
+	return (gem_getparam(fd, I915_PARAM_CHIPSET_ID));
+}
+
+uint32_t
+gem_create(int fd, uint64_t size)
+{
+	struct drm_i915_gem_create create;
+
+	(void) memset(&create, 0, sizeof (create));
+	create.size = size;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_CREATE, &create) != 0)
+		gem_fail("GEM_CREATE");
+	return (create.handle);
+}
+
+void
+gem_close(int fd, uint32_t handle)
+{
+	struct drm_gem_close close;
+
+	(void) memset(&close, 0, sizeof (close));
+	close.handle = handle;
+	if (drmIoctl(fd, DRM_IOCTL_GEM_CLOSE, &close) != 0)
+		gem_fail("GEM_CLOSE");
+}
+
+void
+gem_read(int fd, uint32_t handle, uint64_t offset, void *data, uint64_t size)
+{
+	struct drm_i915_gem_pread pread;
+
+	(void) memset(&pread, 0, sizeof (pread));
+	pread.handle = handle;
+	pread.offset = offset;
+	pread.size = size;
+	pread.data_ptr = (uintptr_t)data;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_PREAD, &pread) != 0)
+		gem_fail("GEM_PREAD");
+}
+
+void
+gem_write(int fd, uint32_t handle, uint64_t offset, const void *data,
+    uint64_t size)
+{
+	struct drm_i915_gem_pwrite pwrite;
+
+	(void) memset(&pwrite, 0, sizeof (pwrite));
+	pwrite.handle = handle;
+	pwrite.offset = offset;
+	pwrite.size = size;
+	pwrite.data_ptr = (uintptr_t)data;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_PWRITE, &pwrite) != 0)
+		gem_fail("GEM_PWRITE");
+}
+
+void
+gem_set_domain(int fd, uint32_t handle, uint32_t read, uint32_t write)
+{
+	struct drm_i915_gem_set_domain sd;
+
+	(void) memset(&sd, 0, sizeof (sd));
+	sd.handle = handle;
+	sd.read_domains = read;
+	sd.write_domain = write;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_SET_DOMAIN, &sd) != 0)
+		gem_fail("GEM_SET_DOMAIN");
+}
+
+/* Wait for the GPU to finish with handle, reads included */
+void
+gem_sync(int fd, uint32_t handle)
+{
+	gem_set_domain(fd, handle, I915_GEM_DOMAIN_GTT, I915_GEM_DOMAIN_GTT);
+}
+
+int
+gem_busy(int fd, uint32_t handle)
+{
+	struct drm_i915_gem_busy busy;
+
+	(void) memset(&busy, 0, sizeof (busy));
+	busy.handle = handle;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_BUSY, &busy) != 0)
+		gem_fail("GEM_BUSY");
+	return (busy.busy != 0);
+}
+
+int
+gem_set_tiling(int fd, uint32_t handle, uint32_t tiling, uint32_t stride,
+    uint32_t *swizzle)
+{
+	struct drm_i915_gem_set_tiling st;
+
+	(void) memset(&st, 0, sizeof (st));
+	st.handle = handle;
+	st.tiling_mode = tiling;
+	st.stride = tiling == I915_TILING_NONE ? 0 : stride;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_SET_TILING, &st) != 0)
+		return (errno);
+	if (st.tiling_mode != tiling)
+		return (EINVAL);
+	if (swizzle != NULL)
+		*swizzle = st.swizzle_mode;
+	return (0);
+}
+
+void *
+gem_mmap_gtt(int fd, uint32_t handle, uint64_t size)
+{
+	struct drm_i915_gem_mmap_gtt mg;
+	void *ptr;
+
+	(void) memset(&mg, 0, sizeof (mg));
+	mg.handle = handle;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_MMAP_GTT, &mg) != 0)
+		gem_fail("GEM_MMAP_GTT");
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+	    (off_t)mg.offset);
+	if (ptr == MAP_FAILED)
+		gem_fail("mmap");
+	return (ptr);
+}
+
+uint32_t
+gem_context_create(int fd)
+{
+	struct drm_i915_gem_context_create create;
+
+	(void) memset(&create, 0, sizeof (create));
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_CREATE, &create) != 0)
+		return (0);
+	return (create.ctx_id);
+}
+
+void
+gem_context_destroy(int fd, uint32_t ctx_id)
+{
+	struct drm_i915_gem_context_destroy destroy;
+
+	(void) memset(&destroy, 0, sizeof (destroy));
+	destroy.ctx_id = ctx_id;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_DESTROY, &destroy) != 0)
+		gem_fail("GEM_CONTEXT_DESTROY");
+}
+
+int
+gem_context_get_param(int fd, uint32_t ctx_id, uint64_t param,
+    uint64_t *value)
+{
+	struct drm_i915_gem_context_param p;
+
+	(void) memset(&p, 0, sizeof (p));
+	p.ctx_id = ctx_id;
+	p.param = param;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_GETPARAM, &p) != 0)
+		return (errno);
+	*value = p.value;
+	return (0);
+}
+
+int
+gem_context_set_param(int fd, uint32_t ctx_id, uint64_t param,
+    uint64_t value)
+{
+	struct drm_i915_gem_context_param p;
+
+	(void) memset(&p, 0, sizeof (p));
+	p.ctx_id = ctx_id;
+	p.param = param;
+	p.value = value;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_SETPARAM, &p) != 0)
+		return (errno);
+	return (0);
+}
+
+int
+gem_execbuf(int fd, struct drm_i915_gem_execbuffer2 *execbuf)
+{
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_EXECBUFFER2_WR, execbuf) != 0)
+		return (errno);
+	return (0);
+}
+
+uint32_t
+gem_batch_nop(int fd)
+{
+	uint32_t batch[2] = { MI_BATCH_BUFFER_END, 0 };
+	uint32_t handle;
+
+	handle = gem_create(fd, 4096);
+	gem_write(fd, handle, 0, batch, sizeof (batch));
+	return (handle);
+}
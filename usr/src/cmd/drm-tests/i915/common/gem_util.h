@@ -0,0 +1,62 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+#ifndef _GEM_UTIL_H
+#define	_GEM_UTIL_H
+
+/*
+ * Thin wrappers around the i915 GEM ioctls, shared by the tests in this
+ * directory. Unless noted otherwise they print the failing ioctl and exit
+ * with status 1, so a test only has to check what it is testing.
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "xf86drm.h"
+#include "i915_drm.h"
+#include "intel_chipset.h"
+
+#define	MI_STORE_DWORD_IMM	((0x20 << 23) | 2)
+#define	MI_BATCH_BUFFER_END	(0x0a << 23)
+
+/* Opens the i915 device, or exits 0 after printing SKIP */
+extern int gem_open(void);
+/* Returns 0 if the parameter is unknown */
+extern int gem_getparam(int, int);
+extern int gem_devid(int);
+extern void gem_skip(const char *, ...);
+
+extern uint32_t gem_create(int, uint64_t);
+extern void gem_close(int, uint32_t);
+extern void gem_read(int, uint32_t, uint64_t, void *, uint64_t);
+extern void gem_write(int, uint32_t, uint64_t, const void *, uint64_t);
+extern void gem_set_domain(int, uint32_t, uint32_t, uint32_t);
+extern void gem_sync(int, uint32_t);
+extern int gem_busy(int, uint32_t);
+/* Returns 0 or the errno; *swizzle gets the bit 6 swizzle mode if set */
+extern int gem_set_tiling(int, uint32_t, uint32_t, uint32_t, uint32_t *);
+extern void *gem_mmap_gtt(int, uint32_t, uint64_t);
+
+/* Returns 0 if the device has no hardware contexts */
+extern uint32_t gem_context_create(int);
+extern void gem_context_destroy(int, uint32_t);
+/* Return 0 or the errno */
+extern int gem_context_get_param(int, uint32_t, uint64_t, uint64_t *);
+extern int gem_context_set_param(int, uint32_t, uint64_t, uint64_t);
+
+/* Returns 0 or the errno */
+extern int gem_execbuf(int, struct drm_i915_gem_execbuffer2 *);
+
+/* A batch that does nothing, for binding objects or keeping a ring busy */
+extern uint32_t gem_batch_nop(int);
+
+#endif /* _GEM_UTIL_H */
@@ -0,0 +1,392 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Test DRM_IOCTL_I915_GEM_WAIT_MULTI: waiting for all or any of a set of
+ * objects, the idle_index and busy array it returns, polling with a zero
+ * timeout, relative, absolute, huge and negative timeouts, and the
+ * arguments it rejects.
+ *
+ * Objects are kept busy by a chain of batches of MI_NOOPs, calibrated to
+ * last about BUSY_NS, with the object in every batch of the chain. Each
+ * ring has its own batch, as sharing one would make the rings wait for
+ * each other.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "gem_util.h"
+
+#define	NOP_BYTES	(4 << 20)
+#define	BUSY_NS		200000000LL	/* 200ms */
+#define	SHORT_NS	2000000LL	/* a timeout well inside that */
+
+static uint32_t nop_batch[I915_EXEC_RING_MASK + 1];
+static int chain;
+static int failed;
+
+static void
+check(int cond, const char *what, int got)
+{
+	if (!cond) {
+		(void) printf("FAIL: %s (got %d)\n", what, got);
+		failed = 1;
+	}
+}
+
+static uint32_t
+nop(int fd, unsigned ring)
+{
+	uint32_t end = MI_BATCH_BUFFER_END;
+
+	if (nop_batch[ring] == 0) {
+		nop_batch[ring] = gem_create(fd, NOP_BYTES);
+		gem_write(fd, nop_batch[ring],
+		    NOP_BYTES - 2 * sizeof (uint32_t), &end, sizeof (end));
+	}
+	return (nop_batch[ring]);
+}
+
+static void
+exec_nop(int fd, uint32_t handle, unsigned ring)
+{
+	struct drm_i915_gem_exec_object2 objs[2];
+	struct drm_i915_gem_execbuffer2 execbuf;
+	int ret;
+
+	(void) memset(objs, 0, sizeof (objs));
+	objs[0].handle = handle;
+	objs[1].handle = nop(fd, ring);
+
+	(void) memset(&execbuf, 0, sizeof (execbuf));
+	execbuf.buffers_ptr = (uintptr_t)(handle != 0 ? &objs[0] : &objs[1]);
+	execbuf.buffer_count = handle != 0 ? 2 : 1;
+	execbuf.batch_len = NOP_BYTES;
+	execbuf.flags = ring;
+	if ((ret = gem_execbuf(fd, &execbuf)) != 0) {
+		(void) printf("FAIL: execbuffer: %s\n", strerror(ret));
+		exit(1);
+	}
+}
+
+/* Keep handle busy on ring for about BUSY_NS times scale */
+static void
+make_busy(int fd, uint32_t handle, unsigned ring, int scale)
+{
+	int i;
+
+	for (i = 0; i < chain * scale; i++)
+		exec_nop(fd, handle, ring);
+}
+
+static int
+wait_multi(int fd, uint32_t *handles, uint32_t *busy, int n, uint32_t flags,
+    int64_t *timeout_ns, uint32_t *idle_index)
+{
+	struct drm_i915_gem_wait_multi wm;
+	int ret = 0;
+
+	(void) memset(&wm, 0, sizeof (wm));
+	wm.handles_ptr = (uintptr_t)handles;
+	wm.busy_ptr = (uintptr_t)busy;
+	wm.num_handles = n;
+	wm.flags = flags;
+	wm.timeout_ns = *timeout_ns;
+	wm.idle_index = ~0U;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_WAIT_MULTI, &wm) != 0)
+		ret = errno;
+
+	/* The arguments are copied out on failure as well */
+	*timeout_ns = wm.timeout_ns;
+	if (idle_index != NULL)
+		*idle_index = wm.idle_index;
+	return (ret);
+}
+
+/* How many NOP batches back to back keep a ring busy for BUSY_NS */
+static void
+calibrate(int fd)
+{
+	uint32_t batch = nop(fd, I915_EXEC_RENDER);
+	hrtime_t start, ns;
+
+	exec_nop(fd, 0, I915_EXEC_RENDER);
+	gem_sync(fd, batch);
+
+	start = gethrtime();
+	exec_nop(fd, 0, I915_EXEC_RENDER);
+	gem_sync(fd, batch);
+	ns = gethrtime() - start;
+
+	chain = ns > 0 ? BUSY_NS / ns : 1;
+	if (chain < 1)
+		chain = 1;
+	if (chain > 4096)
+		chain = 4096;
+}
+
+static void
+test_invalid(int fd, uint32_t idle)
+{
+	uint32_t handles[2] = { idle, 0x7fffffff };
+	uint32_t *many;
+	int64_t timeout;
+	int ret;
+
+	timeout = 0;
+	ret = wait_multi(fd, handles, NULL, 0, I915_WAIT_ALL, &timeout, NULL);
+	check(ret == EINVAL, "no handles is EINVAL", ret);
+
+	many = calloc(I915_WAIT_MULTI_MAX + 1, sizeof (uint32_t));
+	timeout = 0;
+	ret = wait_multi(fd, many, NULL, I915_WAIT_MULTI_MAX + 1,
+	    I915_WAIT_ALL, &timeout, NULL);
+	check(ret == EINVAL, "more than I915_WAIT_MULTI_MAX handles is EINVAL",
+	    ret);
+	free(many);
+
+	timeout = 0;
+	ret = wait_multi(fd, handles, NULL, 1, 1 << 2, &timeout, NULL);
+	check(ret == EINVAL, "unknown flags are EINVAL", ret);
+
+	timeout = 0;
+	ret = wait_multi(fd, handles, NULL, 2, I915_WAIT_ALL, &timeout, NULL);
+	check(ret == ENOENT, "a bad handle is ENOENT", ret);
+}
+
+static void
+test_idle(int fd, uint32_t a, uint32_t b)
+{
+	uint32_t handles[2] = { a, b };
+	uint32_t busy[2] = { 7, 7 };
+	uint32_t idle;
+	int64_t timeout = 0;
+	int ret;
+
+	ret = wait_multi(fd, handles, busy, 2, I915_WAIT_ALL, &timeout, &idle);
+	check(ret == 0, "ALL on idle objects polls successfully", ret);
+	check(idle == 0, "idle_index is the first idle object", idle);
+	check(busy[0] == 0 && busy[1] == 0, "idle objects are not busy",
+	    busy[0] | busy[1] << 1);
+}
+
+/* A zero timeout only polls */
+static void
+test_poll(int fd, uint32_t a, uint32_t b)
+{
+	uint32_t handles[2] = { a, b };
+	uint32_t busy[2];
+	uint32_t idle;
+	int64_t timeout;
+	int ret;
+
+	make_busy(fd, a, I915_EXEC_RENDER, 1);
+
+	timeout = 0;
+	(void) memset(busy, 7, sizeof (busy));
+	ret = wait_multi(fd, handles, busy, 2, I915_WAIT_ALL, &timeout, &idle);
+	check(ret == ETIME, "ALL with one object busy polls ETIME", ret);
+	check(idle == 1, "idle_index is the idle object", idle);
+	check(busy[0] == 1 && busy[1] == 0, "busy[] has the busy object",
+	    busy[0] | busy[1] << 1);
+	check(timeout == 0, "no time remains after a poll", (int)timeout);
+
+	timeout = 0;
+	ret = wait_multi(fd, handles, busy, 2, I915_WAIT_ANY, &timeout, &idle);
+	check(ret == 0, "ANY with one object idle polls successfully", ret);
+	check(idle == 1, "ANY idle_index is the idle object", idle);
+
+	timeout = 0;
+	ret = wait_multi(fd, handles, busy, 1, I915_WAIT_ANY, &timeout, &idle);
+	check(ret == ETIME, "ANY with every object busy polls ETIME", ret);
+	check(idle == 1, "idle_index is num_handles if nothing is idle", idle);
+
+	gem_sync(fd, a);
+}
+
+static void
+test_relative(int fd, uint32_t a, uint32_t b)
+{
+	uint32_t handles[2] = { a, b };
+	uint32_t busy[2];
+	uint32_t idle;
+	int64_t timeout;
+	hrtime_t start, ns;
+	int ret;
+
+	/* Expires while a is still busy */
+	make_busy(fd, a, I915_EXEC_RENDER, 1);
+	timeout = SHORT_NS;
+	start = gethrtime();
+	ret = wait_multi(fd, handles, NULL, 1, I915_WAIT_ALL, &timeout, &idle);
+	ns = gethrtime() - start;
+	check(ret == ETIME, "a short relative timeout expires", ret);
+	check(ns >= SHORT_NS / 2, "the relative timeout was waited for",
+	    (int)(ns / 1000));
+	check(timeout == 0, "no time remains after a timeout", (int)timeout);
+
+	/* ALL returns once both are done, with the time that was left */
+	make_busy(fd, b, I915_EXEC_RENDER, 1);
+	timeout = 30 * BUSY_NS;
+	ret = wait_multi(fd, handles, busy, 2, I915_WAIT_ALL, &timeout, &idle);
+	check(ret == 0, "ALL waits for both objects", ret);
+	check(busy[0] == 0 && busy[1] == 0, "ALL leaves nothing busy",
+	    busy[0] | busy[1] << 1);
+	check(!gem_busy(fd, a) && !gem_busy(fd, b),
+	    "GEM_BUSY agrees with ALL", 0);
+	check(timeout > 0 && timeout < 30 * BUSY_NS,
+	    "a relative timeout returns the time remaining",
+	    (int)(timeout / 1000000));
+
+	/* ANY returns when a is done, with b still queued behind it */
+	make_busy(fd, a, I915_EXEC_RENDER, 1);
+	make_busy(fd, b, I915_EXEC_RENDER, 2);
+	timeout = 30 * BUSY_NS;
+	ret = wait_multi(fd, handles, busy, 2, I915_WAIT_ANY, &timeout, &idle);
+	check(ret == 0, "ANY waits for one object", ret);
+	check(idle == 0, "ANY idle_index is the object that finished", idle);
+	check(busy[0] == 0 && busy[1] == 1, "ANY leaves the other busy",
+	    busy[0] | busy[1] << 1);
+	gem_sync(fd, b);
+}
+
+static void
+test_abstime(int fd, uint32_t a)
+{
+	uint32_t handles[1] = { a };
+	int64_t timeout, deadline;
+	hrtime_t now;
+	int ret;
+
+	make_busy(fd, a, I915_EXEC_RENDER, 1);
+
+	deadline = gethrtime() + SHORT_NS;
+	timeout = deadline;
+	ret = wait_multi(fd, handles, NULL, 1,
+	    I915_WAIT_ALL | I915_WAIT_ABSTIME, &timeout, NULL);
+	now = gethrtime();
+	check(ret == ETIME, "a near deadline expires", ret);
+	check(now >= deadline, "the deadline was waited for",
+	    (int)((deadline - now) / 1000));
+	check(timeout == deadline, "an absolute timeout is left alone", 0);
+
+	timeout = gethrtime() - SHORT_NS;
+	ret = wait_multi(fd, handles, NULL, 1,
+	    I915_WAIT_ALL | I915_WAIT_ABSTIME, &timeout, NULL);
+	check(ret == ETIME, "a past deadline polls", ret);
+
+	timeout = gethrtime() + 30 * BUSY_NS;
+	ret = wait_multi(fd, handles, NULL, 1,
+	    I915_WAIT_ALL | I915_WAIT_ABSTIME, &timeout, NULL);
+	check(ret == 0, "a far deadline waits for the object", ret);
+	check(!gem_busy(fd, a), "the object is idle after the wait", 0);
+}
+
+static void
+test_forever(int fd, uint32_t a, uint32_t b)
+{
+	uint32_t handles[2] = { a, b };
+	uint32_t busy[2];
+	int64_t timeout;
+	int ret;
+
+	make_busy(fd, a, I915_EXEC_RENDER, 1);
+	make_busy(fd, b, I915_EXEC_RENDER, 1);
+	timeout = -1;
+	ret = wait_multi(fd, handles, busy, 2, I915_WAIT_ALL, &timeout, NULL);
+	check(ret == 0, "a negative timeout waits for both", ret);
+	check(busy[0] == 0 && busy[1] == 0, "nothing is busy after forever",
+	    busy[0] | busy[1] << 1);
+	check(timeout == -1, "a negative timeout is left alone", 0);
+
+	/* So far off that now + timeout would overflow */
+	make_busy(fd, a, I915_EXEC_RENDER, 1);
+	timeout = INT64_MAX;
+	ret = wait_multi(fd, handles, busy, 1, I915_WAIT_ALL, &timeout, NULL);
+	check(ret == 0, "an INT64_MAX timeout waits", ret);
+	check(timeout == INT64_MAX, "an INT64_MAX timeout is left alone", 0);
+}
+
+/* ANY across rings returns when the quicker ring is done */
+static void
+test_any_rings(int fd, uint32_t a, uint32_t b)
+{
+	uint32_t handles[2] = { a, b };
+	uint32_t busy[2];
+	uint32_t idle;
+	int64_t timeout;
+	hrtime_t start, ns;
+	int ret;
+
+	if (!gem_getparam(fd, I915_PARAM_HAS_BLT)) {
+		(void) printf("no blitter ring, ANY across rings skipped\n");
+		return;
+	}
+
+	make_busy(fd, a, I915_EXEC_RENDER, 8);
+	make_busy(fd, b, I915_EXEC_BLT, 1);
+	timeout = 30 * BUSY_NS;
+	start = gethrtime();
+	ret = wait_multi(fd, handles, busy, 2, I915_WAIT_ANY, &timeout, &idle);
+	ns = gethrtime() - start;
+	check(ret == 0, "ANY across rings waits for one object", ret);
+	check(idle == 1, "ANY across rings returns the blitter object", idle);
+	check(busy[0] == 1, "the render object is still busy", busy[0]);
+	check(ns < 4 * BUSY_NS, "ANY did not wait for the slower ring",
+	    (int)(ns / 1000000));
+	gem_sync(fd, a);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t a, b, handles[1];
+	int64_t timeout = 0;
+	int fd, i;
+
+	fd = gem_open();
+	a = gem_create(fd, 4096);
+	b = gem_create(fd, 4096);
+
+	handles[0] = a;
+	if (wait_multi(fd, handles, NULL, 1, I915_WAIT_ALL, &timeout,
+	    NULL) != 0)
+		gem_skip("no GEM_WAIT_MULTI");
+
+	calibrate(fd);
+	(void) printf("%d batches of %dMB keep a ring busy for %lldms\n",
+	    chain, NOP_BYTES >> 20, BUSY_NS / 1000000);
+
+	test_invalid(fd, a);
+	test_idle(fd, a, b);
+	test_poll(fd, a, b);
+	test_relative(fd, a, b);
+	test_abstime(fd, a);
+	test_forever(fd, a, b);
+	test_any_rings(fd, a, b);
+
+	for (i = 0; i <= I915_EXEC_RING_MASK; i++) {
+		if (nop_batch[i] != 0)
+			gem_close(fd, nop_batch[i]);
+	}
+	gem_close(fd, b);
+	gem_close(fd, a);
+	drmClose(fd);
+
+	if (!failed)
+		(void) printf("PASS: GEM_WAIT_MULTI\n");
+	return (failed);
+}
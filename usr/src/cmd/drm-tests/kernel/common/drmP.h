@@ -0,0 +1,60 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+#ifndef _DRMP_H
+#define	_DRMP_H
+
+/*
+ * Userland stand-in for the kernel's drmP.h, so that DRM sources that only
+ * need kmem, mutexes and the list and Linux compatibility macros can be
+ * built into a test program unchanged. It is found instead of the real
+ * one because the tests put this directory first on the include path.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/sysmacros.h>
+#include <sys/kmem.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+
+/* kmem_alloc(9F) */
+#define	kmem_alloc(size, flag)		malloc(size)
+#define	kmem_zalloc(size, flag)		calloc(1, (size))
+#define	kmem_free(ptr, size)		free(ptr)
+
+/* mutex(9F) */
+typedef pthread_mutex_t kmutex_t;
+#ifndef	MUTEX_DRIVER
+#define	MUTEX_DRIVER	4
+#endif
+#define	mutex_init(m, name, type, arg)	(void) pthread_mutex_init((m), NULL)
+#define	mutex_destroy(m)		(void) pthread_mutex_destroy(m)
+#define	mutex_enter(m)			(void) pthread_mutex_lock(m)
+#define	mutex_exit(m)			(void) pthread_mutex_unlock(m)
+
+#define	ASSERT(x)	assert(x)
+#define	lowbit(x)	__builtin_ffsll((long long)(x))
+
+#include "drm_linux.h"
+#include "drm_linux_list.h"
+
+#define	BUG_ON(x)	assert(!(x))
+#define	DRM_ERROR(...)	(void) fprintf(stderr, "drm: " __VA_ARGS__)
+#define	DRM_DEBUG(...)	do { } while (0)
+
+#endif /* _DRMP_H */
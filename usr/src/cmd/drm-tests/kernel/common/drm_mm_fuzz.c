@@ -0,0 +1,729 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Fuzz and time the drm_mm hole index against the walk of the hole list
+ * that it replaced. drm_mm.c is built from the kernel source, see drmP.h
+ * in this directory.
+ *
+ * The fuzzer makes random allocations, range restricted allocations,
+ * best fit allocations, removals, replacements and eviction scans, first
+ * without and then with a color_adjust hook. After every step it checks
+ * that:
+ *  - the size and address trees hold exactly the holes on the node list,
+ *    under their current start and size, and that the address tree is
+ *    balanced and its subtree maxima are right;
+ *  - searches agree with a walk of the hole list: the same hole for plain
+ *    first fit, the lowest addressed hole that fits for range restricted
+ *    first fit, a smallest hole that fits for best fit, and nothing when
+ *    the walk finds nothing.
+ *
+ * The benchmark then fragments a range into a given number of holes and
+ * times best fit and range restricted searches through the index and
+ * through the list walk, as drm_mm.c did them before the index.
+ *
+ * Usage: drm_mm_fuzz [-s seed] [-n steps] [-b holes]
+ */
+
+#include "drmP.h"
+#include "drm_mm.h"
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define	MM_START	16UL
+#define	MM_SIZE		(1UL << 20)
+#define	MAX_NODES	2048
+
+static uint64_t rng_state;
+static int step;
+
+static struct drm_mm_node *nodes[MAX_NODES];
+static int embedded[MAX_NODES];
+static int nnodes;
+
+static uint64_t
+rnd(void)
+{
+	/* xorshift64*, so that a seed replays the same run everywhere */
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (rng_state * 2685821657736338717ULL);
+}
+
+static unsigned long
+rnd_range(unsigned long n)
+{
+	return (n == 0 ? 0 : (unsigned long)(rnd() % n));
+}
+
+/* Mostly small sizes, some up to a sixteenth of the range */
+static unsigned long
+rnd_size(void)
+{
+	return (1 + rnd_range(1UL << rnd_range(17)));
+}
+
+static unsigned
+rnd_alignment(void)
+{
+	static const unsigned align[] = { 0, 0, 0, 1, 2, 4, 16, 64, 3, 24 };
+
+	return (align[rnd_range(sizeof (align) / sizeof (align[0]))]);
+}
+
+static void
+fail(const char *what)
+{
+	(void) printf("FAIL: step %d: %s\n", step, what);
+	exit(1);
+}
+
+#define	expect(cond, what)	\
+	do { if (!(cond)) fail(what); } while (0)
+
+/* Keep a unit free between neighbours of different colors, as i915 does */
+static void
+color_adjust(struct drm_mm_node *node, unsigned long color,
+    unsigned long *start, unsigned long *end)
+{
+	if (node->color != color)
+		(*start)++;
+	if (!list_empty(&node->node_list)) {
+		node = list_entry(node->node_list.next, struct drm_mm_node,
+		    node_list);
+		if (node->allocated && node->color != color)
+			(*end)--;
+	}
+}
+
+/*
+ * The hole list walks, as drm_mm.c had them before the hole index, for
+ * the benchmark.
+ */
+static int
+old_check_free_hole(unsigned long start, unsigned long end,
+    unsigned long size, unsigned alignment)
+{
+	if (end - start < size)
+		return (0);
+
+	if (alignment) {
+		unsigned tmp = start % alignment;
+		if (tmp)
+			start += alignment - tmp;
+	}
+
+	return (end >= start + size);
+}
+
+static struct drm_mm_node *
+old_search_free_generic(const struct drm_mm *mm, unsigned long size,
+    unsigned alignment, unsigned long color, bool best_match)
+{
+	struct drm_mm_node *entry;
+	struct drm_mm_node *best;
+	unsigned long adj_start;
+	unsigned long adj_end;
+	unsigned long best_size;
+
+	best = NULL;
+	best_size = ~0UL;
+
+	drm_mm_for_each_hole(entry, mm, adj_start, adj_end) {
+		if (mm->color_adjust) {
+			mm->color_adjust(entry, color, &adj_start, &adj_end);
+			if (adj_end <= adj_start)
+				continue;
+		}
+
+		if (!old_check_free_hole(adj_start, adj_end, size, alignment))
+			continue;
+
+		if (!best_match)
+			return (entry);
+
+		if (entry->size < best_size) {
+			best = entry;
+			best_size = entry->size;
+		}
+	}
+
+	return (best);
+}
+
+static struct drm_mm_node *
+old_search_free_in_range_generic(const struct drm_mm *mm, unsigned long size,
+    unsigned alignment, unsigned long color, unsigned long start,
+    unsigned long end, bool best_match)
+{
+	struct drm_mm_node *entry;
+	struct drm_mm_node *best;
+	unsigned long adj_start;
+	unsigned long adj_end;
+	unsigned long best_size;
+
+	best = NULL;
+	best_size = ~0UL;
+
+	drm_mm_for_each_hole(entry, mm, adj_start, adj_end) {
+		if (adj_start < start)
+			adj_start = start;
+		if (adj_end > end)
+			adj_end = end;
+
+		if (mm->color_adjust) {
+			mm->color_adjust(entry, color, &adj_start, &adj_end);
+			if (adj_end <= adj_start)
+				continue;
+		}
+
+		if (!old_check_free_hole(adj_start, adj_end, size, alignment))
+			continue;
+
+		if (!best_match)
+			return (entry);
+
+		if (entry->size < best_size) {
+			best = entry;
+			best_size = entry->size;
+		}
+	}
+
+	return (best);
+}
+
+/*
+ * What a walk of the hole list finds: the first hole on the list that
+ * fits, the lowest addressed one and a smallest one.
+ */
+struct walk {
+	struct drm_mm_node *first;
+	struct drm_mm_node *lowest;
+	struct drm_mm_node *smallest;
+	unsigned long smallest_size;
+};
+
+static int
+walk_fits(const struct drm_mm *mm, struct drm_mm_node *entry,
+    unsigned long size, unsigned alignment, unsigned long color,
+    unsigned long start, unsigned long end)
+{
+	unsigned long adj_start = drm_mm_hole_node_start(entry);
+	unsigned long adj_end = drm_mm_hole_node_end(entry);
+
+	if (adj_start < start)
+		adj_start = start;
+	if (adj_end > end)
+		adj_end = end;
+
+	if (mm->color_adjust) {
+		mm->color_adjust(entry, color, &adj_start, &adj_end);
+		if (adj_end <= adj_start)
+			return (0);
+	}
+
+	return (old_check_free_hole(adj_start, adj_end, size, alignment));
+}
+
+static void
+walk_holes(const struct drm_mm *mm, unsigned long size, unsigned alignment,
+    unsigned long color, unsigned long start, unsigned long end,
+    struct walk *w)
+{
+	struct drm_mm_node *entry;
+	unsigned long hole_start, hole_end;
+
+	(void) memset(w, 0, sizeof (*w));
+	drm_mm_for_each_hole(entry, mm, hole_start, hole_end) {
+		if (!walk_fits(mm, entry, size, alignment, color, start, end))
+			continue;
+		if (w->first == NULL)
+			w->first = entry;
+		if (w->lowest == NULL ||
+		    hole_start < drm_mm_hole_node_start(w->lowest))
+			w->lowest = entry;
+		if (w->smallest == NULL ||
+		    hole_end - hole_start < w->smallest_size) {
+			w->smallest = entry;
+			w->smallest_size = hole_end - hole_start;
+		}
+	}
+}
+
+static void
+check_search(struct drm_mm *mm, unsigned long size, unsigned alignment,
+    unsigned long color, unsigned long start, unsigned long end, int range)
+{
+	struct drm_mm_node *got;
+	struct walk w;
+
+	walk_holes(mm, size, alignment, color, start, end, &w);
+
+	if (range) {
+		got = drm_mm_search_free_in_range_generic(mm, size, alignment,
+		    color, start, end, 0);
+		expect(got == w.lowest, "range first fit is not the lowest "
+		    "fitting hole");
+		got = drm_mm_search_free_in_range_generic(mm, size, alignment,
+		    color, start, end, 1);
+	} else {
+		got = drm_mm_search_free_generic(mm, size, alignment, color,
+		    0);
+		expect(got == w.first, "first fit differs from the list walk");
+		got = drm_mm_search_free_generic(mm, size, alignment, color,
+		    1);
+	}
+
+	expect((got == NULL) == (w.smallest == NULL),
+	    "best fit and the list walk disagree on whether a hole fits");
+	if (got != NULL) {
+		expect(walk_fits(mm, got, size, alignment, color, start, end),
+		    "best fit returned a hole that does not fit");
+		expect(drm_mm_hole_node_end(got) -
+		    drm_mm_hole_node_start(got) == w.smallest_size,
+		    "best fit did not return a smallest hole");
+	}
+}
+
+/* Height of the address tree under n, checking it on the way */
+static int
+check_addr_tree(struct drm_mm_node *n, struct drm_mm_node **inorder,
+    int *count, int max)
+{
+	struct drm_mm_node *l, *r;
+	unsigned long sub_max;
+	int hl, hr;
+
+	if (n == NULL)
+		return (0);
+
+	l = n->hole_addr_left;
+	r = n->hole_addr_right;
+	hl = check_addr_tree(l, inorder, count, max);
+	expect(*count < max, "address tree holds more nodes than holes");
+	inorder[(*count)++] = n;
+	hr = check_addr_tree(r, inorder, count, max);
+
+	expect(n->hole_follows, "address tree holds a node without a hole");
+	expect(hl - hr <= 1 && hr - hl <= 1, "address tree is unbalanced");
+	expect(n->hole_addr_height == MAX(hl, hr) + 1,
+	    "address tree height is stale");
+
+	sub_max = n->hole_size;
+	if (l != NULL && l->subtree_max_hole > sub_max)
+		sub_max = l->subtree_max_hole;
+	if (r != NULL && r->subtree_max_hole > sub_max)
+		sub_max = r->subtree_max_hole;
+	expect(n->subtree_max_hole == sub_max,
+	    "address tree subtree maximum is stale");
+
+	return (n->hole_addr_height);
+}
+
+static void
+check_hole(struct drm_mm *mm, struct drm_mm_node *n, int *holes)
+{
+	unsigned long start = __drm_mm_hole_node_start(n);
+	unsigned long end = __drm_mm_hole_node_end(n);
+
+	if (!n->hole_follows) {
+		expect(start == end, "a node without a hole is not followed "
+		    "by the next one");
+		return;
+	}
+
+	expect(start < end, "empty hole");
+	expect(n->hole_start == start && n->hole_size == end - start,
+	    "hole indexed under a stale start or size");
+	expect(avl_find(&mm->holes_size, n, NULL) == n,
+	    "hole missing from the size tree");
+	(*holes)++;
+}
+
+static void
+check_index(struct drm_mm *mm)
+{
+	static struct drm_mm_node *inorder[MAX_NODES + 1];
+	struct drm_mm_node *n;
+	struct list_head *pos;
+	unsigned long end = MM_START;
+	int holes = 0, stacked = 0, count = 0, i;
+
+	/* The head node is on its own list, so drm_mm_for_each_node won't do */
+	check_hole(mm, &mm->head_node, &holes);
+	list_for_each(pos, &mm->head_node.node_list) {
+		n = list_entry(pos, struct drm_mm_node, node_list);
+		expect(n->start >= end, "nodes overlap or are out of order");
+		end = n->start + n->size;
+		check_hole(mm, n, &holes);
+	}
+	expect(end <= MM_START + MM_SIZE, "node past the end of the range");
+
+	list_for_each(pos, &mm->hole_stack)
+		stacked++;
+	expect(stacked == holes, "hole stack and hole_follows disagree");
+	expect(avl_numnodes(&mm->holes_size) == (ulong_t)holes,
+	    "size tree holds stale holes");
+
+	(void) check_addr_tree(mm->holes_addr, inorder, &count,
+	    MAX_NODES + 1);
+	expect(count == holes, "address tree holds stale holes");
+	for (i = 1; i < count; i++)
+		expect(inorder[i - 1]->hole_start < inorder[i]->hole_start,
+		    "address tree is out of order");
+}
+
+static void
+add_node(struct drm_mm_node *node, int is_embedded)
+{
+	nodes[nnodes] = node;
+	embedded[nnodes] = is_embedded;
+	nnodes++;
+}
+
+static void
+remove_node(int i)
+{
+	if (embedded[i]) {
+		drm_mm_remove_node(nodes[i]);
+		free(nodes[i]);
+	} else {
+		drm_mm_put_block(nodes[i]);
+	}
+	nodes[i] = nodes[--nnodes];
+	embedded[i] = embedded[nnodes];
+}
+
+static void
+random_range(unsigned long *start, unsigned long *end)
+{
+	*start = MM_START + rnd_range(MM_SIZE);
+	*end = *start + 1 + rnd_range(MM_START + MM_SIZE - *start);
+}
+
+static void
+op_insert(struct drm_mm *mm, int colors, int range, int best)
+{
+	struct drm_mm_node *node, *hole;
+	unsigned long size = rnd_size();
+	unsigned long color = rnd_range(colors);
+	unsigned long start = 0, end = ~0UL;
+	unsigned alignment = rnd_alignment();
+	int ret;
+
+	if (range)
+		random_range(&start, &end);
+	check_search(mm, size, alignment, color, start, end, range);
+
+	if (best) {
+		if (range)
+			hole = drm_mm_search_free_in_range_generic(mm, size,
+			    alignment, color, start, end, 1);
+		else
+			hole = drm_mm_search_free_generic(mm, size, alignment,
+			    color, 1);
+		if (hole == NULL)
+			return;
+		if (range)
+			node = drm_mm_get_block_range_generic(hole, size,
+			    alignment, color, start, end, 0);
+		else
+			node = drm_mm_get_block_generic(hole, size, alignment,
+			    color, 0);
+		expect(node != NULL, "get_block failed");
+		add_node(node, 0);
+	} else {
+		node = calloc(1, sizeof (*node));
+		if (range)
+			ret = drm_mm_insert_node_in_range_generic(mm, node,
+			    size, alignment, color, start, end);
+		else
+			ret = drm_mm_insert_node_generic(mm, node, size,
+			    alignment, color);
+		if (ret != 0) {
+			expect(ret == -ENOSPC, "insert failed other than "
+			    "with ENOSPC");
+			free(node);
+			return;
+		}
+		add_node(node, 1);
+	}
+
+	expect(node->size == size && node->color == color,
+	    "node has the wrong size or color");
+	expect(alignment == 0 || node->start % alignment == 0,
+	    "node is misaligned");
+	expect(node->start >= start && node->start + size <= end,
+	    "node is outside its range");
+}
+
+static void
+op_create_block(struct drm_mm *mm)
+{
+	struct drm_mm_node *hole, *node;
+	unsigned long hole_start, hole_end, start, size;
+	int pick = rnd_range(16);
+
+	/* Any hole will do, the stack order is as random as anything */
+	drm_mm_for_each_hole(hole, mm, hole_start, hole_end) {
+		if (pick-- == 0)
+			break;
+	}
+	if (hole == NULL)
+		return;
+
+	hole_start = drm_mm_hole_node_start(hole);
+	hole_end = drm_mm_hole_node_end(hole);
+	start = hole_start + rnd_range(hole_end - hole_start);
+	size = 1 + rnd_range(hole_end - start);
+	node = drm_mm_create_block(mm, start, size, 0);
+	expect(node != NULL && node->start == start && node->size == size,
+	    "create_block did not create the block asked for");
+	add_node(node, 0);
+}
+
+static void
+op_replace(void)
+{
+	struct drm_mm_node *node;
+	int i;
+
+	if (nnodes == 0)
+		return;
+	i = rnd_range(nnodes);
+	node = calloc(1, sizeof (*node));
+	drm_mm_replace_node(nodes[i], node);
+	if (embedded[i])
+		free(nodes[i]);
+	else
+		kfree(nodes[i], sizeof (struct drm_mm_node));
+	nodes[i] = node;
+	embedded[i] = 1;
+}
+
+/*
+ * Scan for room the way eviction does, evict what the scan asks for and
+ * check that the first fit search then returns the hole just made.
+ */
+static void
+op_scan(struct drm_mm *mm, int colors)
+{
+	static int order[MAX_NODES], evict[MAX_NODES];
+	struct drm_mm_node *hole;
+	unsigned long size = rnd_size();
+	unsigned long color = rnd_range(colors);
+	unsigned long hit_start, hit_end;
+	unsigned alignment = rnd_alignment();
+	int i, j, n, found = 0;
+
+	if (nnodes == 0)
+		return;
+
+	drm_mm_init_scan(mm, size, alignment, color);
+	for (n = 0; n < nnodes && !found; n++) {
+		order[n] = rnd_range(nnodes);
+		for (j = 0; j < n; j++) {
+			if (order[j] == order[n])
+				break;
+		}
+		if (j < n) {
+			n--;
+			continue;
+		}
+		found = drm_mm_scan_add_block(nodes[order[n]]);
+	}
+	hit_start = mm->scan_hit_start;
+	hit_end = mm->scan_hit_end;
+
+	/* Blocks come off the scan list in the reverse order, as in i915 */
+	for (i = n - 1; i >= 0; i--)
+		evict[i] = drm_mm_scan_remove_block(nodes[order[i]]);
+	check_index(mm);
+	if (!found)
+		return;
+
+	/* Highest index first, so that remove_node's moves are harmless */
+	for (i = nnodes - 1; i >= 0; i--) {
+		for (j = 0; j < n; j++) {
+			if (order[j] == i && evict[j])
+				break;
+		}
+		if (j < n)
+			remove_node(i);
+	}
+
+	hole = drm_mm_search_free_generic(mm, size, alignment, color, 0);
+	expect(hole != NULL && drm_mm_hole_node_start(hole) <= hit_start &&
+	    drm_mm_hole_node_end(hole) >= hit_end,
+	    "first fit after eviction is not the hole just made");
+}
+
+static void
+fuzz(int steps, int colors)
+{
+	struct drm_mm mm;
+	uint64_t op;
+
+	drm_mm_init(&mm, MM_START, MM_SIZE);
+	if (colors > 1)
+		mm.color_adjust = color_adjust;
+	check_index(&mm);
+
+	for (step = 0; step < steps; step++) {
+		op = rnd_range(100);
+		if (nnodes == MAX_NODES || (op < 40 && nnodes > 0))
+			remove_node(rnd_range(nnodes));
+		else if (op < 60)
+			op_insert(&mm, colors, 0, 0);
+		else if (op < 75)
+			op_insert(&mm, colors, 1, 0);
+		else if (op < 83)
+			op_insert(&mm, colors, 0, 1);
+		else if (op < 91)
+			op_insert(&mm, colors, 1, 1);
+		else if (op < 94)
+			op_create_block(&mm);
+		else if (op < 97)
+			op_replace();
+		else
+			op_scan(&mm, colors);
+		check_index(&mm);
+	}
+
+	while (nnodes > 0)
+		remove_node(nnodes - 1);
+	check_index(&mm);
+	expect(drm_mm_clean(&mm), "not clean after removing every node");
+	drm_mm_takedown(&mm);
+}
+
+static void
+bench(int holes)
+{
+	struct drm_mm mm;
+	struct drm_mm_node *node, *got;
+	struct list_head *pos, *next;
+	unsigned long start, end, span;
+	hrtime_t t0, t_best, t_old_best, t_range, t_old_range;
+	int i, n, searches = 1000;
+	uint64_t seed;
+
+	/* Nodes of 1 to 64 units, every other one freed again */
+	span = (unsigned long)holes * 2 * 64;
+	drm_mm_init(&mm, 0, span);
+	for (i = 0; i < holes * 2; i++) {
+		node = calloc(1, sizeof (*node));
+		if (drm_mm_insert_node(&mm, node, 1 + rnd_range(64), 0) != 0) {
+			free(node);
+			break;
+		}
+	}
+	n = 0;
+	list_for_each_safe(pos, next, &mm.head_node.node_list) {
+		node = list_entry(pos, struct drm_mm_node, node_list);
+		if (n++ % 2 == 0) {
+			drm_mm_remove_node(node);
+			free(node);
+		}
+	}
+
+	/* Each pair runs the same searches, from the same seed */
+	seed = rng_state;
+	t0 = gethrtime();
+	for (i = 0; i < searches; i++)
+		got = drm_mm_search_free_generic(&mm, 1 + rnd_range(64), 0,
+		    0, 1);
+	t_best = gethrtime() - t0;
+	rng_state = seed;
+	t0 = gethrtime();
+	for (i = 0; i < searches; i++)
+		got = old_search_free_generic(&mm, 1 + rnd_range(64), 0, 0, 1);
+	t_old_best = gethrtime() - t0;
+
+	/* Ranges of a sixteenth, in the upper half, behind most holes */
+	seed = rng_state;
+	t0 = gethrtime();
+	for (i = 0; i < searches; i++) {
+		start = span / 2 + rnd_range(span / 2 - span / 16);
+		end = start + span / 16;
+		got = drm_mm_search_free_in_range_generic(&mm,
+		    1 + rnd_range(64), 0, 0, start, end, 0);
+	}
+	t_range = gethrtime() - t0;
+	rng_state = seed;
+	t0 = gethrtime();
+	for (i = 0; i < searches; i++) {
+		start = span / 2 + rnd_range(span / 2 - span / 16);
+		end = start + span / 16;
+		got = old_search_free_in_range_generic(&mm,
+		    1 + rnd_range(64), 0, 0, start, end, 0);
+	}
+	t_old_range = gethrtime() - t0;
+	(void) got;
+
+	(void) printf("%8d %12lld %12lld %12lld %12lld\n", holes,
+	    (longlong_t)(t_best / searches),
+	    (longlong_t)(t_old_best / searches),
+	    (longlong_t)(t_range / searches),
+	    (longlong_t)(t_old_range / searches));
+
+	list_for_each_safe(pos, next, &mm.head_node.node_list) {
+		node = list_entry(pos, struct drm_mm_node, node_list);
+		drm_mm_remove_node(node);
+		free(node);
+	}
+	drm_mm_takedown(&mm);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t seed = (uint64_t)time(NULL);
+	int steps = 50000, holes = 0, c, n;
+
+	while ((c = getopt(argc, argv, "s:n:b:")) != -1) {
+		switch (c) {
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			steps = atoi(optarg);
+			break;
+		case 'b':
+			holes = atoi(optarg);
+			break;
+		default:
+			(void) fprintf(stderr, "usage: %s [-s seed] "
+			    "[-n steps] [-b holes]\n", argv[0]);
+			return (2);
+		}
+	}
+
+	(void) printf("seed %llu\n", (u_longlong_t)seed);
+	rng_state = seed | 1;
+	fuzz(steps, 1);
+	fuzz(steps, 4);
+	(void) printf("PASS: %d steps without and with color_adjust\n", steps);
+
+	(void) printf("\n%8s %12s %12s %12s %12s\n", "holes",
+	    "best ns", "list ns", "range ns", "list ns");
+	if (holes > 0) {
+		bench(holes);
+	} else {
+		for (n = 1024; n <= 65536; n *= 4)
+			bench(n);
+	}
+
+	return (0);
+}
@@ -0,0 +1,439 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Check and time the idr in drm_sun_idr.c, built from the kernel source,
+ * see drmP.h in this directory.
+ *
+ * The check churns ids against a plain array, expecting each allocation
+ * to return the lowest free id at or above its start and every find,
+ * replace and remove to agree with the array. It then has idr_for_each()
+ * callbacks remove the id they are called for, and ids further on, and
+ * checks that every remaining id is visited once, in order, and that
+ * nothing removed is. Last it allocates right up to IDR_MAX_ID.
+ *
+ * The benchmark allocates 1K to 1M ids, looks them up in random order,
+ * churns them by removing a random id and allocating again, and removes
+ * them all, printing the time per operation.
+ *
+ * Usage: idr_churn [-s seed] [-n steps] [-b ids]
+ */
+
+#include "drmP.h"
+#include "drm_sun_idr.h"
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+
+/* Ids in use at most while checking, and the range they come from */
+#define	CHECK_IDS	4096
+#define	CHECK_SPAN	(CHECK_IDS * 2)
+
+static uint64_t rng_state;
+static int step;
+
+static void *ref[CHECK_SPAN + IDR_SIZE];
+static uint64_t serial;
+
+static uint64_t
+rnd(void)
+{
+	/* xorshift64*, so that a seed replays the same run everywhere */
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (rng_state * 2685821657736338717ULL);
+}
+
+static uint32_t
+rnd_range(uint32_t n)
+{
+	return (n == 0 ? 0 : (uint32_t)(rnd() % n));
+}
+
+static void
+fail(const char *what)
+{
+	(void) printf("FAIL: step %d: %s\n", step, what);
+	exit(1);
+}
+
+#define	expect(cond, what)	\
+	do { if (!(cond)) fail(what); } while (0)
+
+/* A distinct, non-NULL object for every allocation */
+static void *
+new_obj(void)
+{
+	return ((void *)(uintptr_t)(++serial << 1));
+}
+
+static int
+alloc(struct idr *idrp, void *obj, int start, int *id)
+{
+	expect(idr_pre_get(idrp, KM_SLEEP) != 0, "idr_pre_get failed");
+	return (idr_get_new_above(idrp, obj, start, id));
+}
+
+static void
+check_alloc(struct idr *idrp, int *count)
+{
+	void *obj = new_obj();
+	int start, id, want;
+
+	start = rnd_range(4) == 0 ? rnd_range(CHECK_SPAN) : 0;
+	for (want = start; ref[want] != NULL; want++)
+		;
+	if (want >= CHECK_SPAN)
+		return;
+
+	expect(alloc(idrp, obj, start, &id) == 0, "allocation failed");
+	expect(id == want, "allocation is not the lowest free id above start");
+	ref[id] = obj;
+	(*count)++;
+}
+
+static void
+check_remove(struct idr *idrp, int *count)
+{
+	uint32_t id = rnd_range(CHECK_SPAN);
+
+	if (ref[id] == NULL) {
+		expect(idr_remove(idrp, id) == -EINVAL,
+		    "removing a free id did not fail with EINVAL");
+		return;
+	}
+	expect(idr_remove(idrp, id) == 0, "removing an id failed");
+	ref[id] = NULL;
+	(*count)--;
+}
+
+static void
+check_replace(struct idr *idrp)
+{
+	uint32_t id = rnd_range(CHECK_SPAN);
+	void *obj = new_obj();
+
+	if (ref[id] == NULL) {
+		expect(idr_replace(idrp, obj, id) == (void *)(-EINVAL),
+		    "replacing a free id did not fail with EINVAL");
+		return;
+	}
+	expect(idr_replace(idrp, obj, id) == ref[id],
+	    "replace did not return the old object");
+	ref[id] = obj;
+}
+
+static void
+check_find(struct idr *idrp)
+{
+	uint32_t id;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		id = rnd_range(CHECK_SPAN + IDR_SIZE);
+		expect(idr_find(idrp, id) == ref[id],
+		    "find does not return what was stored");
+	}
+	/* Far beyond anything allocated, and beyond the tree's reach */
+	expect(idr_find(idrp, CHECK_SPAN << 6) == NULL, "found a free id");
+	expect(idr_find(idrp, ~0U) == NULL, "found an id past IDR_MAX_ID");
+}
+
+static void
+churn(int steps)
+{
+	struct idr idr;
+	uint32_t op;
+	int count = 0, i;
+
+	idr_init(&idr);
+	(void) memset(ref, 0, sizeof (ref));
+
+	for (step = 0; step < steps; step++) {
+		op = rnd_range(100);
+		/* Drift between almost empty and almost full */
+		if (count >= CHECK_IDS || (op < 45 && count > 0 &&
+		    (step / 4096) % 2 == 1))
+			check_remove(&idr, &count);
+		else if (op < 60)
+			check_alloc(&idr, &count);
+		else if (op < 70)
+			check_remove(&idr, &count);
+		else if (op < 75)
+			check_replace(&idr);
+		else
+			check_find(&idr);
+	}
+
+	for (i = 0; i < CHECK_SPAN; i++) {
+		if (ref[i] != NULL)
+			expect(idr_remove(&idr, i) == 0,
+			    "removing an id failed");
+	}
+	expect(idr.top == NULL, "layers left after removing every id");
+	idr_destroy(&idr);
+}
+
+/*
+ * idr_for_each() callback state: ids to remove from within the callback,
+ * relative to the one it is called for, and what was visited.
+ */
+struct each {
+	struct idr *idrp;
+	int remove_self;
+	int remove_next;	/* also remove this many ids further on */
+	int stop_at;		/* return nonzero at this id, or -1 */
+	int last;
+	int visits;
+};
+
+static int
+each_fn(int id, void *obj, void *data)
+{
+	struct each *e = data;
+	int i;
+
+	expect(id > e->last, "idr_for_each went backwards or repeated an id");
+	expect(ref[id] != NULL, "idr_for_each visited a free id");
+	expect(obj == ref[id], "idr_for_each passed the wrong object");
+	e->last = id;
+	e->visits++;
+
+	if (id == e->stop_at)
+		return (id);
+
+	if (e->remove_self) {
+		expect(idr_remove(e->idrp, id) == 0,
+		    "removing the current id from idr_for_each failed");
+		ref[id] = NULL;
+	}
+	for (i = id + 1; i < CHECK_SPAN && i <= id + e->remove_next; i++) {
+		if (ref[i] != NULL) {
+			expect(idr_remove(e->idrp, i) == 0,
+			    "removing a later id from idr_for_each failed");
+			ref[i] = NULL;
+		}
+	}
+	return (0);
+}
+
+static int
+fill(struct idr *idrp)
+{
+	int i, id, count = 0;
+
+	(void) memset(ref, 0, sizeof (ref));
+	for (i = 0; i < CHECK_SPAN; i++) {
+		ref[i] = new_obj();
+		expect(alloc(idrp, ref[i], 0, &id) == 0 && id == i,
+		    "filling the idr failed");
+	}
+	/* Leave holes, some of them whole leaves */
+	for (i = 0; i < CHECK_SPAN; i++) {
+		if (rnd_range(3) == 0 || (i / IDR_SIZE) % 7 == 3) {
+			expect(idr_remove(idrp, i) == 0,
+			    "removing an id failed");
+			ref[i] = NULL;
+		} else {
+			count++;
+		}
+	}
+	return (count);
+}
+
+static void
+for_each_remove(void)
+{
+	struct idr idr;
+	struct each e;
+	int count, left, i;
+
+	step = -1;
+	idr_init(&idr);
+
+	/* Callbacks that stop early return their value */
+	count = fill(&idr);
+	(void) memset(&e, 0, sizeof (e));
+	e.idrp = &idr;
+	e.last = -1;
+	for (e.stop_at = CHECK_SPAN / 2; ref[e.stop_at] == NULL; e.stop_at++)
+		;
+	expect(idr_for_each(&idr, each_fn, &e) == e.stop_at,
+	    "idr_for_each did not return the callback's value");
+	expect(e.last == e.stop_at, "idr_for_each went on after a stop");
+
+	/* Each callback removes its own id, and sometimes the next ones */
+	for (i = 0; i < 3; i++) {
+		(void) memset(&e, 0, sizeof (e));
+		e.idrp = &idr;
+		e.remove_self = 1;
+		e.remove_next = i * 5;
+		e.stop_at = -1;
+		e.last = -1;
+		expect(idr_for_each(&idr, each_fn, &e) == 0,
+		    "idr_for_each failed");
+		expect(idr.top == NULL, "ids left after removing them all");
+		expect(e.visits <= count, "idr_for_each made too many visits");
+		if (i == 0)
+			expect(e.visits == count,
+			    "idr_for_each skipped an id");
+		count = fill(&idr);
+	}
+
+	/* Only later ids are removed, the rest must all still be there */
+	(void) memset(&e, 0, sizeof (e));
+	e.idrp = &idr;
+	e.remove_next = 1;
+	e.stop_at = -1;
+	e.last = -1;
+	expect(idr_for_each(&idr, each_fn, &e) == 0, "idr_for_each failed");
+	for (i = 0, left = 0; i < CHECK_SPAN; i++) {
+		expect(idr_find(&idr, i) == ref[i],
+		    "idr_for_each lost an id it did not remove");
+		if (ref[i] != NULL)
+			left++;
+	}
+	expect(e.visits == left, "idr_for_each visited a removed id");
+
+	idr_remove_all(&idr);
+	expect(idr.top == NULL, "idr_remove_all left layers");
+	idr_destroy(&idr);
+}
+
+static void
+max_id(void)
+{
+	struct idr idr;
+	int id;
+
+	step = -1;
+	idr_init(&idr);
+	expect(alloc(&idr, new_obj(), IDR_MAX_ID - 2, &id) == 0 &&
+	    id == IDR_MAX_ID - 2, "allocating below IDR_MAX_ID failed");
+	expect(alloc(&idr, new_obj(), IDR_MAX_ID - 2, &id) == 0 &&
+	    id == IDR_MAX_ID - 1, "allocating the last id failed");
+	expect(alloc(&idr, new_obj(), IDR_MAX_ID - 2, &id) == -1,
+	    "allocating past IDR_MAX_ID did not return -1");
+	expect(alloc(&idr, new_obj(), 0, &id) == 0 && id == 0,
+	    "allocating id 0 under a full top failed");
+	expect(idr_get_new_above(&idr, new_obj(), -1, &id) == -EINVAL,
+	    "a negative start did not fail with EINVAL");
+	expect(idr_remove(&idr, IDR_MAX_ID - 1) == 0 &&
+	    idr_remove(&idr, IDR_MAX_ID - 2) == 0 &&
+	    idr_remove(&idr, 0) == 0, "removing the ids failed");
+	expect(idr.top == NULL, "layers left after removing every id");
+	idr_destroy(&idr);
+}
+
+static void
+bench(int n)
+{
+	struct idr idr;
+	uint32_t *order;
+	hrtime_t t0, t_alloc, t_find, t_churn, t_remove;
+	void *obj = new_obj();
+	int i, j, id;
+
+	order = malloc(n * sizeof (uint32_t));
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	for (i = n - 1; i > 0; i--) {
+		j = rnd_range(i + 1);
+		id = order[i];
+		order[i] = order[j];
+		order[j] = id;
+	}
+
+	idr_init(&idr);
+	t0 = gethrtime();
+	for (i = 0; i < n; i++) {
+		if (idr_get_new_above(&idr, obj, 0, &id) != 0 || id != i)
+			fail("allocation failed");
+	}
+	t_alloc = gethrtime() - t0;
+
+	t0 = gethrtime();
+	for (i = 0; i < n; i++) {
+		if (idr_find(&idr, order[i]) != obj)
+			fail("find failed");
+	}
+	t_find = gethrtime() - t0;
+
+	/* The id just freed is the lowest free one, so it comes back */
+	t0 = gethrtime();
+	for (i = 0; i < n; i++) {
+		if (idr_remove(&idr, order[i]) != 0 ||
+		    idr_get_new_above(&idr, obj, 0, &id) != 0 ||
+		    id != (int)order[i])
+			fail("churn failed");
+	}
+	t_churn = gethrtime() - t0;
+
+	t0 = gethrtime();
+	for (i = 0; i < n; i++) {
+		if (idr_remove(&idr, order[i]) != 0)
+			fail("remove failed");
+	}
+	t_remove = gethrtime() - t0;
+
+	(void) printf("%8d %10lld %10lld %10lld %10lld\n", n,
+	    (longlong_t)(t_alloc / n), (longlong_t)(t_find / n),
+	    (longlong_t)(t_churn / n), (longlong_t)(t_remove / n));
+
+	idr_destroy(&idr);
+	free(order);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t seed = (uint64_t)time(NULL);
+	int steps = 200000, ids = 0, c, n;
+
+	while ((c = getopt(argc, argv, "s:n:b:")) != -1) {
+		switch (c) {
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			steps = atoi(optarg);
+			break;
+		case 'b':
+			ids = atoi(optarg);
+			break;
+		default:
+			(void) fprintf(stderr, "usage: %s [-s seed] "
+			    "[-n steps] [-b ids]\n", argv[0]);
+			return (2);
+		}
+	}
+
+	(void) printf("seed %llu\n", (u_longlong_t)seed);
+	rng_state = seed | 1;
+	churn(steps);
+	for_each_remove();
+	max_id();
+	(void) printf("PASS: %d steps, idr_for_each removals, IDR_MAX_ID\n",
+	    steps);
+
+	(void) printf("\n%8s %10s %10s %10s %10s\n", "ids",
+	    "alloc ns", "find ns", "churn ns", "remove ns");
+	if (ids > 0) {
+		bench(ids);
+	} else {
+		for (n = 1000; n <= 1000000; n *= 10)
+			bench(n);
+	}
+
+	return (0);
+}
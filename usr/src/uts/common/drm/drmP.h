@@ -579,6 +579,10 @@ struct drm_history_list {
 	void *ring_ptr;			/**< current ring ptr */
 };
 
+/*
+ * Translations loaded through a GEM object's fake offset mapping, one per
+ * run of a devmap handle, see drm_gem_seg_add().
+ */
 struct gem_map_list {
 	struct list_head head;		/**< list head */
 	devmap_cookie_t dhp;
@@ -638,19 +642,51 @@ struct drm_gem_object {
 	struct drm_map_list maplist;
 	ddi_dma_handle_t dma_hdl;
 	ddi_acc_handle_t acc_hdl;
-	caddr_t kaddr;
+	caddr_t kaddr;		/* NULL until drm_gem_object_populate() */
 	size_t real_size;	/* real size of memory */
 	pfn_t *pfnarray;
+	int gen;		/* selects the backing store allocator */
 	caddr_t gtt_map_kaddr;
 
 	struct gfxp_pmem_cookie	mempool_cookie;
 
+	kmutex_t seg_lock;	/* protects seg_list */
 	struct list_head seg_list;
 
 	struct list_head track_list;	/* for i915 mdb */
 	struct list_head his_list;
 };
 
+/*
+ * Recycled GEM backing store (drm_gem.c). The DDI allocation behind a
+ * freed GEM object is kept, zeroed in the background and handed to the
+ * next object with the same page count. Runs are bucketed by
+ * highbit(pgcnt); larger objects always go back to the system.
+ */
+#define	DRM_GEM_POOL_BUCKETS	11
+
+struct drm_gem_pool_run {
+	struct list_head head;
+	pgcnt_t pgcnt;			/* pages asked for */
+	ddi_dma_handle_t dma_hdl;
+	ddi_acc_handle_t acc_hdl;
+	caddr_t kaddr;
+	size_t real_size;
+	pfn_t *pfnarray;
+};
+
+struct drm_gem_pool {
+	kmutex_t lock;
+	struct list_head dirty;		/* waiting to be zeroed */
+	struct list_head free[DRM_GEM_POOL_BUCKETS];	/* zeroed */
+	size_t bytes;			/* in dirty and free */
+	boolean_t zeroing;		/* zero task dispatched */
+	ddi_taskq_t *taskq;
+	kmem_cache_t *cache;		/* runs, and the reclaim hook */
+	volatile uint64_t hits;
+	volatile uint64_t misses;
+};
+
 typedef struct drm_lock_data {
 	struct drm_hw_lock *hw_lock;	/**< Hardware lock */
 	/** Private of lock holder's file (NULL=kernel) */
@@ -928,7 +964,13 @@ struct drm_driver {
 
 	int (*gem_open_object) (struct drm_gem_object *, struct drm_file *);
 	void (*gem_close_object) (struct drm_gem_object *, struct drm_file *);
-	void (*gem_fault) (struct drm_gem_object *obj);
+	/*
+	 * Make [*offp, *offp + *lenp) of the object's fake offset mapping
+	 * ready to load, possibly widening it to what was made ready.
+	 * Returns 0 on success.
+	 */
+	int (*gem_fault) (struct drm_gem_object *obj, offset_t *offp,
+	    size_t *lenp);
 
 	/* vga arb irq handler */
 	void (*vgaarb_irq)(struct drm_device *dev, bool state);
@@ -1210,10 +1252,14 @@ struct drm_device {
 	kmutex_t dma_lock;		/* protects dev->dma */
 	kmutex_t irq_lock;		/* protects irq condition checks */
 
-	kmutex_t page_fault_lock;
-
 	kstat_t *asoft_ksp;		/* kstat support */
 
+	/* GEM bytes created but not yet backed, and bytes actually backed */
+	volatile uint64_t gem_deferred_bytes;
+	volatile uint64_t gem_materialized_bytes;
+	struct drm_gem_pool gem_pool;
+	kmem_cache_t *gem_seg_cache;	/* struct gem_map_list */
+
 	struct list_head gem_objects_list;
 	spinlock_t track_lock;
 
@@ -1552,6 +1598,8 @@ int drm_gem_object_init(struct drm_device *dev,
 			struct drm_gem_object *obj, size_t size, int gen);
 int drm_gem_private_object_init(struct drm_device *dev,
 			struct drm_gem_object *obj, size_t size);
+int drm_gem_object_populate(struct drm_gem_object *obj);
+void drm_gem_object_depopulate(struct drm_gem_object *obj);
 void drm_gem_object_handle_free(struct drm_gem_object *obj);
 
 extern void
@@ -1587,6 +1635,11 @@ void drm_gem_open(struct drm_device *dev, struct drm_file *file_private);
 void drm_gem_release(struct drm_device *dev, struct drm_file *file_private);
 int drm_gem_create_mmap_offset(struct drm_gem_object *obj);
 void drm_gem_mmap(struct drm_gem_object *obj, pfn_t pfn);
+void drm_gem_mmap_range(struct drm_gem_object *obj, offset_t off, size_t len,
+    pfn_t pfn);
+void drm_gem_seg_add(struct drm_gem_object *obj, devmap_cookie_t dhp,
+    offset_t off, size_t len);
+void drm_gem_seg_unload(struct drm_gem_object *obj);
 void drm_gem_release_mmap(struct drm_gem_object *obj);
 void drm_gem_free_mmap_offset(struct drm_gem_object *obj);
 
@@ -43,6 +43,8 @@
 #ifndef _DRM_MM_H_
 #define _DRM_MM_H_
 
+#include <sys/avl.h>
+
 /*
  * Generic range manager structs
  */
@@ -60,11 +62,29 @@ struct drm_mm_node {
 	unsigned long start;
 	unsigned long size;
 	struct drm_mm *mm;
+
+	/*
+	 * Hole index, valid while hole_follows is set.  hole_start and
+	 * hole_size are the values the hole was indexed under; the hole is
+	 * re-indexed whenever its neighbours change.
+	 */
+	avl_node_t hole_size_link;
+	struct drm_mm_node *hole_addr_left;
+	struct drm_mm_node *hole_addr_right;
+	int hole_addr_height;
+	unsigned long hole_start;
+	unsigned long hole_size;
+	unsigned long subtree_max_hole;
 };
 
 struct drm_mm {
 	/* List of free memory blocks, most recently freed ordered. */
 	struct list_head hole_stack;
+	/* Holes ordered by (size, start), for best-fit searches. */
+	avl_tree_t holes_size;
+	/* Holes ordered by start, each subtree annotated with the largest
+	 * hole it contains, for first-fit searches within a range. */
+	struct drm_mm_node *holes_addr;
 	/* head_node.node_list is the list of all memory nodes, ordered
 	 * according to the (increasing) start address of the memory node. */
 	struct drm_mm_node head_node;
@@ -28,30 +28,32 @@
 #ifndef __DRM_IDR_H__
 #define __DRM_IDR_H__
 
-#include <sys/avl.h>
-
-struct idr_used_id {
-	struct avl_node link;
-	uint32_t id;
-	void *obj;
-};
-
-struct idr_free_id {
-	struct idr_free_id *next;
-	uint32_t id;
-};
+/*
+ * Ids are kept in a radix tree of IDR_SIZE-way layers. Each layer has a
+ * bitmap of its slots that are full: in a leaf a slot is full when the id
+ * is allocated, in an inner layer when every id below it is. Allocation
+ * follows the first clear bit down the tree, so neither it nor a lookup
+ * costs more than one step per layer, and memory is only allocated once
+ * for every IDR_SIZE ids.
+ */
+#define	IDR_BITS	6
+#define	IDR_SIZE	(1 << IDR_BITS)
+#define	IDR_MASK	(IDR_SIZE - 1)
+#define	IDR_MAX_ID	0x7fffffff	/* ids are below this */
+#define	IDR_MAX_LAYERS	((31 + IDR_BITS - 1) / IDR_BITS)
+#define	IDR_FREE_MAX	(IDR_MAX_LAYERS * 2)
 
-struct idr_free_id_range {
-	struct idr_free_id_range *next;
-	uint32_t start;
-	uint32_t end;
-	uint32_t min_unused_id;
-	struct idr_free_id *free_ids;
+struct idr_layer {
+	uint64_t full;
+	int count;			/* ids in a leaf, children otherwise */
+	void *ary[IDR_SIZE];
 };
 
 struct idr {
-	struct avl_tree used_ids;
-	struct idr_free_id_range *free_id_ranges;
+	struct idr_layer *top;
+	int layers;
+	struct idr_layer *id_free;	/* spare layers, chained by ary[0] */
+	int id_free_cnt;
 	kmutex_t lock;
 };
 
@@ -65,19 +67,22 @@ extern int idr_for_each(struct idr *idrp, int (*fn)(int id, void *obj, void *dat
 extern void idr_remove_all(struct idr *idrp);
 extern void idr_destroy(struct idr* idrp);
 
-#define DRM_GEM_OBJIDR_HASHNODE 1024
+/*
+ * GEM handle table, one per file (and one per device for flink names).
+ * Objects are indexed directly by handle. A free slot holds the handle
+ * freed before it, tagged with the low bit, so freed handles are handed
+ * out again first and the numbering stays dense. Handle 0 is never used.
+ */
+#define	IDR_LIST_MIN_SIZE	64
 
 struct idr_list {
-	struct idr_list *next, *prev;
-	void *obj;
-	uint32_t	handle;
-	caddr_t	contain_ptr;
+	uintptr_t *table;
+	uint32_t size;		/* slots in table */
+	uint32_t unused;	/* no slot from here on was ever used */
+	uint32_t free;		/* last freed handle, 0 if none */
+	uint32_t count;		/* handles in use */
 };
 
-#define	idr_list_for_each(entry, head) \
-	for (int key = 0; key < DRM_GEM_OBJIDR_HASHNODE; key++) \
-		list_for_each(entry, &(head)->next[key])
-
 extern int idr_list_pre_get(struct idr_list *head, int flag);
 extern void idr_list_init(struct idr_list *head);
 extern int idr_list_get_new_above(struct idr_list *head,
@@ -87,4 +92,7 @@ extern void *idr_list_find(struct idr_list *head, uint32_t name);
 extern int idr_list_remove(struct idr_list *head, uint32_t name);
 extern void idr_list_free(struct idr_list *head);
 extern int idr_list_empty(struct idr_list *head);
+extern int idr_list_for_each(struct idr_list *head,
+				int (*fn)(int id, void *obj, void *data),
+				void *data);
 #endif /* __DRM_IDR_H__ */
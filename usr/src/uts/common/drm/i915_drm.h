@@ -263,6 +263,10 @@ typedef struct _drm_i915_sarea {
 #define DRM_I915_GEM_CONTEXT_GETPARAM	0x34
 #define DRM_I915_GEM_CONTEXT_SETPARAM	0x35
 #define DRM_I915_PERF_OPEN		0x36
+/* illumos extensions, numbered clear of the upstream range */
+#define DRM_I915_GEM_WAIT_MULTI		0x50
+#define DRM_I915_GEM_PREAD_RECT		0x51
+#define DRM_I915_GEM_PWRITE_RECT	0x52
 
 #define DRM_IOCTL_I915_INIT		DRM_IOW( DRM_COMMAND_BASE + DRM_I915_INIT, drm_i915_init_t)
 #define DRM_IOCTL_I915_FLUSH		DRM_IO ( DRM_COMMAND_BASE + DRM_I915_FLUSH)
@@ -299,6 +303,8 @@ typedef struct _drm_i915_sarea {
 #define DRM_IOCTL_I915_GEM_CREATE	DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_GEM_CREATE, struct drm_i915_gem_create)
 #define DRM_IOCTL_I915_GEM_PREAD	DRM_IOW (DRM_COMMAND_BASE + DRM_I915_GEM_PREAD, struct drm_i915_gem_pread)
 #define DRM_IOCTL_I915_GEM_PWRITE	DRM_IOW (DRM_COMMAND_BASE + DRM_I915_GEM_PWRITE, struct drm_i915_gem_pwrite)
+#define DRM_IOCTL_I915_GEM_PREAD_RECT	DRM_IOW (DRM_COMMAND_BASE + DRM_I915_GEM_PREAD_RECT, struct drm_i915_gem_prw_rect)
+#define DRM_IOCTL_I915_GEM_PWRITE_RECT	DRM_IOW (DRM_COMMAND_BASE + DRM_I915_GEM_PWRITE_RECT, struct drm_i915_gem_prw_rect)
 #define DRM_IOCTL_I915_GEM_MMAP		DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_GEM_MMAP, struct drm_i915_gem_mmap)
 #define DRM_IOCTL_I915_GEM_MMAP_GTT	DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_GEM_MMAP_GTT, struct drm_i915_gem_mmap_gtt)
 #define DRM_IOCTL_I915_GEM_SET_DOMAIN	DRM_IOW (DRM_COMMAND_BASE + DRM_I915_GEM_SET_DOMAIN, struct drm_i915_gem_set_domain)
@@ -313,6 +319,7 @@ typedef struct _drm_i915_sarea {
 #define DRM_IOCTL_I915_SET_SPRITE_COLORKEY DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_SET_SPRITE_COLORKEY, struct drm_intel_sprite_colorkey)
 #define DRM_IOCTL_I915_GET_SPRITE_COLORKEY DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_GET_SPRITE_COLORKEY, struct drm_intel_sprite_colorkey)
 #define DRM_IOCTL_I915_GEM_WAIT		DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_GEM_WAIT, struct drm_i915_gem_wait)
+#define DRM_IOCTL_I915_GEM_WAIT_MULTI	DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_GEM_WAIT_MULTI, struct drm_i915_gem_wait_multi)
 #define DRM_IOCTL_I915_GEM_CONTEXT_CREATE	DRM_IOWR (DRM_COMMAND_BASE + DRM_I915_GEM_CONTEXT_CREATE, struct drm_i915_gem_context_create)
 #define DRM_IOCTL_I915_GEM_CONTEXT_DESTROY	DRM_IOW (DRM_COMMAND_BASE + DRM_I915_GEM_CONTEXT_DESTROY, struct drm_i915_gem_context_destroy)
 #define DRM_IOCTL_I915_REG_READ			DRM_IOWR (DRM_COMMAND_BASE + DRM_I915_REG_READ, struct drm_i915_reg_read)
@@ -584,6 +591,34 @@ struct drm_i915_gem_pwrite {
 	__u64 data_ptr;
 };
 
+/**
+ * Reads or writes a rectangle of an X- or Y-tiled object, the kernel doing
+ * the detiling and bit 6 swizzling. The rectangle is in bytes and rows of
+ * the surface described by the object's tiling and stride, so x and width
+ * are in bytes, not pixels. The user buffer holds it linearly.
+ */
+struct drm_i915_gem_prw_rect {
+	/** Handle for the object being read or written. */
+	__u32 handle;
+	/** Must be 0. */
+	__u32 flags;
+	/** Top left corner of the rectangle, in bytes and rows */
+	__u32 x;
+	__u32 y;
+	/** Size of the rectangle, in bytes and rows */
+	__u32 width;
+	__u32 height;
+	/** Bytes between the start of each row in the user buffer */
+	__u32 pitch;
+	__u32 pad;
+	/**
+	 * Pointer to the user buffer.
+	 *
+	 * This is a fixed-size type for 32/64 compatibility.
+	 */
+	__u64 data_ptr;
+};
+
 struct drm_i915_gem_mmap {
 	/** Handle for the object being mapped. */
 	__u32 handle;
@@ -931,6 +966,16 @@ struct drm_i915_gem_execbuffer2 {
 
 #define __I915_EXEC_UNKNOWN_FLAGS (-(I915_EXEC_FENCE_OUT<<1))
 
+/*
+ * illumos extension. Setting I915_EXEC_FENCE_EVENT queues a
+ * struct drm_i915_event_fence on the DRM fd once the batch completes, to
+ * be collected with read(2) and poll(2) alongside vblank and flip events.
+ * rsvd2 carries the event's user_data in, and returns the fence id (the
+ * request seqno) when DRM_IOCTL_I915_GEM_EXECBUFFER2_WR is used. A fence
+ * id of 0 means no event will be sent.
+ */
+#define I915_EXEC_FENCE_EVENT		(1<<24)
+
 #define I915_EXEC_CONTEXT_ID_MASK	(0xffffffff)
 #define i915_execbuffer2_set_context_id(eb2, context) \
 	(eb2).rsvd1 = context & I915_EXEC_CONTEXT_ID_MASK
@@ -1252,6 +1297,19 @@ struct drm_intel_sprite_colorkey {
 	__u32 flags;
 };
 
+#define I915_EVENT_FENCE	0x80000000
+
+struct drm_i915_event_fence {
+	struct drm_event base;
+	__u64 user_data;
+	/** Fence id returned by execbuffer */
+	__u32 fence;
+#define I915_FENCE_EVENT_RESET	(1<<0)	/* request lost to a GPU reset */
+	__u32 flags;
+	/** gethrtime() at which completion was noticed */
+	__u64 timestamp_ns;
+};
+
 struct drm_i915_gem_wait {
 	/** Handle of BO we shall wait on */
 	__u32 bo_handle;
@@ -1260,10 +1318,36 @@ struct drm_i915_gem_wait {
 	__s64 timeout_ns;
 };
 
+#define I915_WAIT_MULTI_MAX	4096
+
+struct drm_i915_gem_wait_multi {
+	/** Pointer to an array of num_handles __u32 BO handles */
+	__u64 handles_ptr;
+	/**
+	 * Optional pointer to an array of num_handles __u32, each set to 1
+	 * if that BO was still busy on return and 0 otherwise.
+	 */
+	__u64 busy_ptr;
+	__u32 num_handles;
+#define I915_WAIT_ALL		(0<<0)	/* until every BO is idle */
+#define I915_WAIT_ANY		(1<<0)	/* until at least one BO is idle */
+#define I915_WAIT_ABSTIME	(1<<1)	/* timeout_ns is a gethrtime() deadline */
+	__u32 flags;
+	/**
+	 * Nanoseconds to wait, negative to wait forever, 0 to only poll.
+	 * A relative timeout returns the time remaining.
+	 */
+	__s64 timeout_ns;
+	/** Returns the index of an idle BO, or num_handles if none is */
+	__u32 idle_index;
+	__u32 pad;
+};
+
 struct drm_i915_gem_context_create {
 	/*  output: id of new context*/
 	__u32 ctx_id;
-	__u32 pad;
+	/*  input: scheduling priority, see I915_CONTEXT_PARAM_PRIORITY */
+	__s32 priority;
 };
 
 struct drm_i915_gem_context_destroy {
@@ -1329,6 +1413,20 @@ struct drm_i915_gem_context_param {
 #define I915_CONTEXT_PARAM_GTT_SIZE	0x3
 #define I915_CONTEXT_PARAM_NO_ERROR_CAPTURE	0x4
 #define I915_CONTEXT_PARAM_BANNABLE	0x5
+#define I915_CONTEXT_PARAM_PRIORITY	0x6
+#define   I915_CONTEXT_MAX_USER_PRIORITY	1023 /* inclusive */
+#define   I915_CONTEXT_DEFAULT_PRIORITY		0
+#define   I915_CONTEXT_MIN_USER_PRIORITY	-1023 /* inclusive */
+/* illumos extensions, read only: submission scheduler statistics */
+#define I915_CONTEXT_PARAM_SCHED_QUEUED		0x80000001 /* waiting now */
+#define I915_CONTEXT_PARAM_SCHED_INFLIGHT	0x80000002 /* on the GPU */
+#define I915_CONTEXT_PARAM_SCHED_SUBMITTED	0x80000003 /* batches */
+#define I915_CONTEXT_PARAM_SCHED_WAIT_NS	0x80000004 /* total wait */
+#define I915_CONTEXT_PARAM_SCHED_WAIT_MAX_NS	0x80000005 /* longest wait */
+#define I915_CONTEXT_PARAM_SCHED_GPU_NS		0x80000006 /* GPU time */
+/* illumos extensions, read only: the context's own PPGTT, if any */
+#define I915_CONTEXT_PARAM_VM_BOUND		0x80000007 /* bytes bound */
+#define I915_CONTEXT_PARAM_VM_OBJECTS		0x80000008 /* objects bound */
 	__u64 value;
 };
 
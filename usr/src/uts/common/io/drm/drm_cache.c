@@ -39,27 +39,61 @@
 extern void clflush_insn(caddr_t addr);
 extern void mfence_insn(void);
 
+#ifdef X86FSET_CLFLUSHOPT
+/* clflushopt is encoded as clflush with a 0x66 prefix */
 static void
-drm_clflush_page(caddr_t page)
+clflushopt_insn(caddr_t addr)
+{
+	__asm__ __volatile__(".byte 0x66; clflush %0"
+	    : "+m" (*(volatile char *)addr));
+}
+#define	drm_has_clflushopt()	\
+	is_x86_feature(x86_featureset, X86FSET_CLFLUSHOPT)
+#else
+#define	drm_has_clflushopt()	0
+#endif
+
+static void
+drm_clflush_page(caddr_t page, int opt)
 {
 	unsigned int i;
 
 	if (page == NULL)
 		return;
 
+#ifdef X86FSET_CLFLUSHOPT
+	if (opt) {
+		for (i = 0; i < PAGE_SIZE; i += x86_clflush_size)
+			clflushopt_insn(page + i);
+		return;
+	}
+#endif
 	for (i = 0; i < PAGE_SIZE; i += x86_clflush_size)
 		clflush_insn(page + i);
-	mfence_insn();
 }
 
+/*
+ * Write back and invalidate the CPU cache lines of num_pages pages.
+ *
+ * The whole batch is fenced once rather than page by page: clflush is
+ * already ordered against other clflushes and writes, clflushopt only
+ * against fences, so a fence on either side covers every line.
+ */
 void
 drm_clflush_pages(caddr_t *pages, unsigned long num_pages)
 {
+	unsigned long i;
+	int opt;
 
-	if (is_x86_feature(x86_featureset, X86FSET_CLFSH)) {
-		unsigned long i;
+	if (!is_x86_feature(x86_featureset, X86FSET_CLFSH) || num_pages == 0)
+		return;
 
-		for (i = 0; i < num_pages; i++)
-			drm_clflush_page(pages[i]);
-	}
+	opt = drm_has_clflushopt();
+	if (opt)
+		mfence_insn();
+
+	for (i = 0; i < num_pages; i++)
+		drm_clflush_page(pages[i], opt);
+
+	mfence_insn();
 }
@@ -72,6 +72,232 @@ int drm_use_mem_pool = 0;
 /* memory pool is used for all platforms now */
 #define	HAS_MEM_POOL(gen)	((gen > 30) && (drm_use_mem_pool))
 
+/* Most backing store, in MB, kept around for reuse by dev->gem_pool */
+int drm_gem_pool_max_mb = 64;
+
+static void
+drm_gem_pool_run_free(struct drm_gem_pool_run *run)
+{
+	kmem_free(run->pfnarray, btopr(run->real_size) * sizeof (pfn_t));
+	(void) ddi_dma_unbind_handle(run->dma_hdl);
+	ddi_dma_mem_free(&run->acc_hdl);
+	ddi_dma_free_handle(&run->dma_hdl);
+}
+
+static int
+drm_gem_pool_bucket(pgcnt_t pgcnt)
+{
+	int bucket = highbit(pgcnt) - 1;
+
+	return (bucket < DRM_GEM_POOL_BUCKETS ? bucket : -1);
+}
+
+/*
+ * Give every pooled run back to the system. Runs that the zero task is
+ * working on are not on any list and are freed by the next drain.
+ */
+static void
+drm_gem_pool_drain(struct drm_gem_pool *pool)
+{
+	struct drm_gem_pool_run *run, *next;
+	struct list_head victims;
+	int i;
+
+	INIT_LIST_HEAD(&victims);
+
+	mutex_enter(&pool->lock);
+	for (i = -1; i < DRM_GEM_POOL_BUCKETS; i++) {
+		struct list_head *list = i < 0 ? &pool->dirty : &pool->free[i];
+
+		list_for_each_entry_safe(run, next, struct drm_gem_pool_run,
+		    list, head) {
+			list_move_tail(&run->head, &victims, (caddr_t)run);
+			pool->bytes -= run->real_size;
+		}
+	}
+	mutex_exit(&pool->lock);
+
+	list_for_each_entry_safe(run, next, struct drm_gem_pool_run,
+	    &victims, head) {
+		list_del(&run->head);
+		drm_gem_pool_run_free(run);
+		kmem_cache_free(pool->cache, run);
+	}
+}
+
+static void
+drm_gem_pool_reclaim(void *arg)
+{
+	struct drm_device *dev = arg;
+
+	drm_gem_pool_drain(&dev->gem_pool);
+}
+
+/*
+ * Zero freed runs off the allocation path, so that a later hit costs no
+ * more than taking a run off a list.
+ */
+static void
+drm_gem_pool_zero(void *arg)
+{
+	struct drm_gem_pool *pool = arg;
+	struct drm_gem_pool_run *run;
+
+	mutex_enter(&pool->lock);
+	while (!list_empty(&pool->dirty)) {
+		run = list_entry(pool->dirty.next,
+		    struct drm_gem_pool_run, head);
+		list_del(&run->head);
+		mutex_exit(&pool->lock);
+
+		bzero(run->kaddr, run->real_size);
+
+		mutex_enter(&pool->lock);
+		list_add(&run->head,
+		    &pool->free[drm_gem_pool_bucket(run->pgcnt)],
+		    (caddr_t)run);
+	}
+	pool->zeroing = B_FALSE;
+	mutex_exit(&pool->lock);
+}
+
+/*
+ * Back obj with a zeroed run of pgcnt pages from the pool. Returns 0 on a
+ * hit, -1 if the caller has to allocate from DDI.
+ */
+static int
+drm_gem_pool_get(struct drm_device *dev, struct drm_gem_object *obj,
+    pgcnt_t pgcnt)
+{
+	struct drm_gem_pool *pool = &dev->gem_pool;
+	struct drm_gem_pool_run *run;
+	int bucket = drm_gem_pool_bucket(pgcnt);
+
+	if (bucket < 0)
+		return (-1);
+
+	mutex_enter(&pool->lock);
+	list_for_each_entry(run, struct drm_gem_pool_run,
+	    &pool->free[bucket], head) {
+		if (run->pgcnt == pgcnt) {
+			list_del(&run->head);
+			pool->bytes -= run->real_size;
+			mutex_exit(&pool->lock);
+
+			obj->dma_hdl = run->dma_hdl;
+			obj->acc_hdl = run->acc_hdl;
+			obj->kaddr = run->kaddr;
+			obj->real_size = run->real_size;
+			obj->pfnarray = run->pfnarray;
+			kmem_cache_free(pool->cache, run);
+
+			atomic_inc_64(&pool->hits);
+			return (0);
+		}
+	}
+	mutex_exit(&pool->lock);
+
+	atomic_inc_64(&pool->misses);
+	return (-1);
+}
+
+/*
+ * Take over the DDI backing store of obj for reuse. Returns -1 if the
+ * pool is full or the object is not poolable, and the caller frees it.
+ */
+static int
+drm_gem_pool_put(struct drm_device *dev, struct drm_gem_object *obj)
+{
+	struct drm_gem_pool *pool = &dev->gem_pool;
+	struct drm_gem_pool_run *run;
+	pgcnt_t pgcnt = btopr(obj->size);
+	boolean_t dispatch;
+
+	if (pool->cache == NULL || drm_gem_pool_bucket(pgcnt) < 0)
+		return (-1);
+
+	run = kmem_cache_alloc(pool->cache, KM_NOSLEEP);
+	if (run == NULL)
+		return (-1);
+
+	mutex_enter(&pool->lock);
+	if (pool->bytes + obj->real_size >
+	    (size_t)drm_gem_pool_max_mb << 20) {
+		mutex_exit(&pool->lock);
+		kmem_cache_free(pool->cache, run);
+		return (-1);
+	}
+
+	run->pgcnt = pgcnt;
+	run->dma_hdl = obj->dma_hdl;
+	run->acc_hdl = obj->acc_hdl;
+	run->kaddr = obj->kaddr;
+	run->real_size = obj->real_size;
+	run->pfnarray = obj->pfnarray;
+	list_add_tail(&run->head, &pool->dirty, (caddr_t)run);
+	pool->bytes += run->real_size;
+
+	dispatch = !pool->zeroing;
+	pool->zeroing = B_TRUE;
+	mutex_exit(&pool->lock);
+
+	if (dispatch && ddi_taskq_dispatch(pool->taskq, drm_gem_pool_zero,
+	    pool, DDI_NOSLEEP) != DDI_SUCCESS) {
+		/* left dirty until the next put gets the task going */
+		mutex_enter(&pool->lock);
+		pool->zeroing = B_FALSE;
+		mutex_exit(&pool->lock);
+	}
+
+	return (0);
+}
+
+static void
+drm_gem_pool_init(struct drm_device *dev)
+{
+	struct drm_gem_pool *pool = &dev->gem_pool;
+	char name[32];
+	int i;
+
+	mutex_init(&pool->lock, NULL, MUTEX_DRIVER, NULL);
+	INIT_LIST_HEAD(&pool->dirty);
+	for (i = 0; i < DRM_GEM_POOL_BUCKETS; i++)
+		INIT_LIST_HEAD(&pool->free[i]);
+	pool->bytes = 0;
+	pool->zeroing = B_FALSE;
+	pool->hits = pool->misses = 0;
+
+	(void) snprintf(name, sizeof (name), "drm_gem_pool_%d",
+	    ddi_get_instance(dev->devinfo));
+	pool->taskq = ddi_taskq_create(dev->devinfo, name, 1,
+	    TASKQ_DEFAULTPRI, 0);
+	if (pool->taskq == NULL) {
+		/* pool->cache stays NULL, nothing is ever pooled */
+		DRM_ERROR("failed to create %s taskq", name);
+		return;
+	}
+	pool->cache = kmem_cache_create(name,
+	    sizeof (struct drm_gem_pool_run), 0, NULL, NULL,
+	    drm_gem_pool_reclaim, dev, NULL, 0);
+}
+
+static void
+drm_gem_pool_fini(struct drm_device *dev)
+{
+	struct drm_gem_pool *pool = &dev->gem_pool;
+
+	if (pool->taskq != NULL) {
+		ddi_taskq_destroy(pool->taskq);
+		pool->taskq = NULL;
+	}
+	if (pool->cache != NULL) {
+		drm_gem_pool_drain(pool);
+		kmem_cache_destroy(pool->cache);
+		pool->cache = NULL;
+	}
+	mutex_destroy(&pool->lock);
+}
+
 /**
  * Initialize the GEM device fields
  */
@@ -79,19 +305,30 @@ int drm_use_mem_pool = 0;
 int
 drm_gem_init(struct drm_device *dev)
 {
+	char name[32];
 
 	spin_lock_init(&dev->object_name_lock);
 	idr_list_init(&dev->object_name_idr);
 
 	gfxp_mempool_init();
+	drm_gem_pool_init(dev);
+
+	(void) snprintf(name, sizeof (name), "drm_gem_seg_%d",
+	    ddi_get_instance(dev->devinfo));
+	dev->gem_seg_cache = kmem_cache_create(name,
+	    sizeof (struct gem_map_list), 0, NULL, NULL, NULL, NULL, NULL, 0);
 
 	return 0;
 }
 
 void
-/* LINTED */
 drm_gem_destroy(struct drm_device *dev)
 {
+	if (dev->gem_seg_cache != NULL) {
+		kmem_cache_destroy(dev->gem_seg_cache);
+		dev->gem_seg_cache = NULL;
+	}
+	drm_gem_pool_fini(dev);
 }
 
 static void
@@ -237,6 +474,10 @@ drm_gem_object_internal(struct drm_device *dev, struct drm_gem_object *obj,
 	pfn_t tmp_pfn;
 	int ret, num = 0;
 
+	/* Recycled runs were checked when they were first allocated */
+	if (!HAS_MEM_POOL(gen) && drm_gem_pool_get(dev, obj, btopr(size)) == 0)
+		return (0);
+
 alloc_again:
 	if (HAS_MEM_POOL(gen)) {
 		uint32_t mode;
@@ -270,13 +511,18 @@ alloc_again:
 /*
  * Initialize an already allocate GEM object of the specified size with
  * shmfs backing store.
+ *
+ * Only the bookkeeping (map, handle, refcount) is set up here; the pages
+ * and the umem cookie behind the object are allocated on first use by
+ * drm_gem_object_populate(). Userland routinely creates buffers that are
+ * never touched, or only touched much later, so this keeps object
+ * creation cheap and the memory footprint close to what is really used.
  */
 int
 drm_gem_object_init(struct drm_device *dev, struct drm_gem_object *obj,
 				size_t size, int gen)
 {
 	drm_local_map_t *map;
-	int ret;
 
 	if (size == 0) {
 		DRM_DEBUG("size == 0");	
@@ -285,15 +531,13 @@ drm_gem_object_init(struct drm_device *dev, struct drm_gem_object *obj,
 
 	obj->dev = dev;
 	obj->size = size;
-
-	ret = drm_gem_object_internal(dev, obj, size, gen);
-	if (ret)
-		return (-1);
+	obj->gen = gen;
+	obj->real_size = ptob(btopr(size));
 
 	map = drm_alloc(sizeof (struct drm_local_map), DRM_MEM_MAPS);
 	if (map == NULL) {
 		DRM_DEBUG("map == NULL");
-		goto err5;
+		return (-1);
 	}
 
 	map->handle = obj;
@@ -303,17 +547,13 @@ drm_gem_object_init(struct drm_device *dev, struct drm_gem_object *obj,
 	map->type = _DRM_GEM;
 	map->callback = 0;
 	map->flags = _DRM_WRITE_COMBINING | _DRM_REMOVABLE;
-	map->umem_cookie =
-	    gfxp_umem_cookie_init(obj->kaddr, obj->real_size);
-	if (map->umem_cookie == NULL) {
-		DRM_DEBUG("umem_cookie == NULL");
-		goto err6;
-	}
+	map->umem_cookie = NULL;
 
 	obj->maplist.map = map;
 	if (drm_map_handle(dev, &obj->maplist)) {
 		DRM_DEBUG("drm_map_handle failed");
-		goto err7;
+		drm_free(map, sizeof (struct drm_local_map), DRM_MEM_MAPS);
+		return (-1);
 	}
 
 	kref_init(&obj->refcount);
@@ -329,17 +569,83 @@ drm_gem_object_init(struct drm_device *dev, struct drm_gem_object *obj,
 		drm_gem_object_track(obj, "obj init", 0, 0, NULL);
 	}
 
+	mutex_init(&obj->seg_lock, NULL, MUTEX_DRIVER, NULL);
 	INIT_LIST_HEAD(&obj->seg_list);
 
+	atomic_add_64(&dev->gem_deferred_bytes, obj->real_size);
+
 	return (0);
+}
+
+/**
+ * Allocate the backing store of a GEM object created by
+ * drm_gem_object_init(), if it has not been allocated yet.
+ *
+ * Must be called before obj->kaddr, obj->pfnarray or the umem cookie of
+ * the object map are used. The caller serializes against other users of
+ * the object (dev->struct_mutex for driver objects).
+ */
+int
+drm_gem_object_populate(struct drm_gem_object *obj)
+{
+	struct drm_device *dev = obj->dev;
+	struct drm_local_map *map = obj->maplist.map;
+	size_t reserved = obj->real_size;
+
+	if (obj->kaddr != NULL)
+		return (0);
+
+	if (drm_gem_object_internal(dev, obj, obj->size, obj->gen)) {
+		obj->real_size = reserved;
+		return (-ENOMEM);
+	}
+
+	map->umem_cookie =
+	    gfxp_umem_cookie_init(obj->kaddr, obj->real_size);
+	if (map->umem_cookie == NULL) {
+		DRM_DEBUG("umem_cookie == NULL");
+		drm_gem_object_free_internal(obj, obj->gen);
+		obj->pfnarray = NULL;
+		obj->real_size = reserved;
+		return (-ENOMEM);
+	}
+	map->size = obj->real_size;
+
+	atomic_add_64(&dev->gem_deferred_bytes, -(int64_t)reserved);
+	atomic_add_64(&dev->gem_materialized_bytes, obj->real_size);
+
+	return (0);
+}
+
+/**
+ * Give the backing store of a GEM object back to the system, keeping the
+ * object itself. The contents are lost; a later drm_gem_object_populate()
+ * allocates fresh pages. The caller makes sure nothing maps the pages any
+ * more, neither the GTT nor a user mapping through the umem cookie.
+ */
+void
+drm_gem_object_depopulate(struct drm_gem_object *obj)
+{
+	struct drm_device *dev = obj->dev;
+	struct drm_local_map *map = obj->maplist.map;
+	size_t size = obj->real_size;
+
+	if (obj->kaddr == NULL)
+		return;
 
-err7:
 	gfxp_umem_cookie_destroy(map->umem_cookie);
-err6:
-	drm_free(map, sizeof (struct drm_local_map), DRM_MEM_MAPS);
-err5:
-	drm_gem_object_free_internal(obj, gen);
-	return (-1);
+	map->umem_cookie = NULL;
+
+	drm_gem_object_free_internal(obj, obj->gen);
+	obj->pfnarray = NULL;
+	obj->dma_hdl = NULL;
+	obj->acc_hdl = NULL;
+
+	obj->real_size = ptob(btopr(obj->size));
+	map->size = obj->real_size;
+
+	atomic_add_64(&dev->gem_materialized_bytes, -(int64_t)size);
+	atomic_add_64(&dev->gem_deferred_bytes, obj->real_size);
 }
 
 /**
@@ -647,13 +953,8 @@ void
 /* LINTED E_FUNC_ARG_UNUSED */
 drm_gem_release(struct drm_device *dev, struct drm_file *file_private)
 {
-	struct idr_list  *entry;
-	struct drm_gem_object *obj;
-
-	idr_list_for_each(entry, &file_private->object_idr) {
-		obj = (struct drm_gem_object *)entry->obj;
-		(void) drm_gem_object_release_handle(obj->name, obj, (void *)file_private);
-	}
+	(void) idr_list_for_each(&file_private->object_idr,
+	    drm_gem_object_release_handle, file_private);
 	idr_list_free(&file_private->object_idr);
 }
 
@@ -677,19 +978,34 @@ drm_gem_object_release(struct drm_gem_object *obj)
 	}
 
 	(void) idr_remove(&dev->map_idr, obj->maplist.user_token >> PAGE_SHIFT);
+
+	/* Each mapping held a reference, and unloaded its runs when done */
+	ASSERT(list_empty(&obj->seg_list));
+	mutex_destroy(&obj->seg_lock);
+
+	/* Objects that were never touched have no backing store to free */
+	if (obj->kaddr == NULL) {
+		drm_free(map, sizeof (struct drm_local_map), DRM_MEM_MAPS);
+		atomic_add_64(&dev->gem_deferred_bytes,
+		    -(int64_t)obj->real_size);
+		return;
+	}
+
 	gfxp_umem_cookie_destroy(map->umem_cookie);
 	drm_free(map, sizeof (struct drm_local_map), DRM_MEM_MAPS);
 
-	kmem_free(obj->pfnarray, btopr(obj->real_size) * sizeof (pfn_t));
-
 	if (obj->dma_hdl == NULL) {
+		kmem_free(obj->pfnarray, btopr(obj->real_size) * sizeof (pfn_t));
 		gfxp_free_mempool(&obj->mempool_cookie, obj->kaddr, obj->real_size);
-	} else {
+	} else if (drm_gem_pool_put(dev, obj) != 0) {
+		kmem_free(obj->pfnarray, btopr(obj->real_size) * sizeof (pfn_t));
 		(void) ddi_dma_unbind_handle(obj->dma_hdl);
 		ddi_dma_mem_free(&obj->acc_hdl);
 		ddi_dma_free_handle(&obj->dma_hdl);
 	}
 	obj->kaddr = NULL;
+
+	atomic_add_64(&dev->gem_materialized_bytes, -(int64_t)obj->real_size);
 }
 
 /**
@@ -758,10 +1074,109 @@ drm_gem_create_mmap_offset(struct drm_gem_object *obj)
 
 void
 drm_gem_mmap(struct drm_gem_object *obj, pfn_t pfn)
+{
+	drm_gem_mmap_range(obj, 0, obj->real_size, pfn);
+}
+
+/* Map len bytes at pfn behind the fake offset mapping, from off on */
+void
+drm_gem_mmap_range(struct drm_gem_object *obj, offset_t off, size_t len,
+    pfn_t pfn)
 {
 	ASSERT(obj->gtt_map_kaddr != NULL);
+	ASSERT(off + len <= obj->real_size);
 	/* Does hat_devload() */
-	gfxp_load_kernel_space(pfn, obj->real_size, GFXP_MEMORY_WRITECOMBINED, obj->gtt_map_kaddr);
+	gfxp_load_kernel_space(pfn, len, GFXP_MEMORY_WRITECOMBINED,
+	    obj->gtt_map_kaddr + off);
+}
+
+/*
+ * Record that [off, off + len) of the mapping through dhp has been
+ * loaded, for drm_gem_seg_unload(). The runs of a handle are kept sorted,
+ * merged with the ones they overlap or touch, so that an object faulted
+ * in a page at a time still ends up with a single segment per mapping.
+ * Each object has its own lock, faults on different objects don't
+ * contend, and one extending a run allocates nothing.
+ */
+void
+drm_gem_seg_add(struct drm_gem_object *obj, devmap_cookie_t dhp,
+    offset_t off, size_t len)
+{
+	struct drm_device *dev = obj->dev;
+	struct gem_map_list *seg, *next, *new = NULL;
+	offset_t end = off + len;
+
+again:
+	mutex_enter(&obj->seg_lock);
+	list_for_each_entry(seg, struct gem_map_list, &obj->seg_list, head) {
+		if ((uintptr_t)seg->dhp < (uintptr_t)dhp)
+			continue;
+		if (seg->dhp != dhp || seg->mapoffset > end)
+			break;
+		if (seg->mapoffset + seg->maplen < off)
+			continue;
+
+		/* Overlapping or adjacent, extend it over the new run */
+		if (off < seg->mapoffset) {
+			seg->maplen += seg->mapoffset - off;
+			seg->mapoffset = off;
+		}
+		if (end > seg->mapoffset + seg->maplen)
+			seg->maplen = end - seg->mapoffset;
+
+		/* and over the runs that now touch it */
+		for (;;) {
+			next = list_entry(seg->head.next, struct gem_map_list,
+			    head);
+			if (next == NULL || next->dhp != dhp ||
+			    next->mapoffset > seg->mapoffset + seg->maplen)
+				break;
+			end = MAX(seg->mapoffset + seg->maplen,
+			    next->mapoffset + next->maplen);
+			seg->maplen = end - seg->mapoffset;
+			list_del(&next->head);
+			kmem_cache_free(dev->gem_seg_cache, next);
+		}
+		mutex_exit(&obj->seg_lock);
+
+		if (new != NULL)
+			kmem_cache_free(dev->gem_seg_cache, new);
+		return;
+	}
+
+	if (new == NULL) {
+		/* Don't sleep for memory with the lock held */
+		mutex_exit(&obj->seg_lock);
+		new = kmem_cache_alloc(dev->gem_seg_cache, KM_SLEEP);
+		goto again;
+	}
+
+	/* A run of its own, before seg or last */
+	new->dhp = dhp;
+	new->mapoffset = off;
+	new->maplen = len;
+	if (seg != NULL)
+		list_add_tail(&new->head, &seg->head, (caddr_t)new);
+	else
+		list_add_tail(&new->head, &obj->seg_list, (caddr_t)new);
+	mutex_exit(&obj->seg_lock);
+}
+
+/* Unload, and forget, every run drm_gem_seg_add() recorded */
+void
+drm_gem_seg_unload(struct drm_gem_object *obj)
+{
+	struct drm_device *dev = obj->dev;
+	struct gem_map_list *seg, *temp;
+
+	mutex_enter(&obj->seg_lock);
+	list_for_each_entry_safe(seg, temp, struct gem_map_list,
+	    &obj->seg_list, head) {
+		(void) devmap_unload(seg->dhp, seg->mapoffset, seg->maplen);
+		list_del(&seg->head);
+		kmem_cache_free(dev->gem_seg_cache, seg);
+	}
+	mutex_exit(&obj->seg_lock);
 }
 
 void
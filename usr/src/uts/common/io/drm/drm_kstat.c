@@ -37,9 +37,17 @@ static char *drmkstat_name[] = {
 	"IOCTLs",
 	"locks",
 	"unlocks",
+	"gem_deferred_bytes",
+	"gem_materialized_bytes",
+	"gem_pool_hits",
+	"gem_pool_misses",
+	"gem_pool_bytes",
 	NULL
 };
 
+/* The first entries above mirror dev->counts[], the rest are 64-bit */
+#define	DRM_KSTAT_NCOUNTS	5
+
 static int
 drm_kstat_update(kstat_t *ksp, int flag)
 {
@@ -53,9 +61,14 @@ drm_kstat_update(kstat_t *ksp, int flag)
 	sc = ksp->ks_private;
 	knp = ksp->ks_data;
 
-	for (tmp = 1; tmp < 6; tmp++) {
+	for (tmp = 1; tmp <= DRM_KSTAT_NCOUNTS; tmp++) {
 		(knp++)->value.ui32 = sc->counts[tmp];
 	}
+	(knp++)->value.ui64 = sc->gem_deferred_bytes;
+	(knp++)->value.ui64 = sc->gem_materialized_bytes;
+	(knp++)->value.ui64 = sc->gem_pool.hits;
+	(knp++)->value.ui64 = sc->gem_pool.misses;
+	(knp++)->value.ui64 = sc->gem_pool.bytes;
 
 	return (0);
 }
@@ -68,6 +81,7 @@ drm_init_kstats(struct drm_device *sc)
 	kstat_named_t *knp;
 	char *np;
 	char **aknp;
+	int i;
 
 	instance = ddi_get_instance(sc->devinfo);
 	aknp = drmkstat_name;
@@ -79,8 +93,10 @@ drm_init_kstats(struct drm_device *sc)
 
 	ksp->ks_private = sc;
 	ksp->ks_update = drm_kstat_update;
-	for (knp = ksp->ks_data; (np = (*aknp)) != NULL; knp++, aknp++) {
-		kstat_named_init(knp, np, KSTAT_DATA_UINT32);
+	for (knp = ksp->ks_data, i = 0; (np = (*aknp)) != NULL;
+	    knp++, aknp++, i++) {
+		kstat_named_init(knp, np, (i < DRM_KSTAT_NCOUNTS) ?
+		    KSTAT_DATA_UINT32 : KSTAT_DATA_UINT64);
 	}
 	kstat_install(ksp);
 
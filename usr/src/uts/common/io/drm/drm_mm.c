@@ -35,12 +35,11 @@
  * Generic simple memory manager implementation. Intended to be used as a base
  * class implementation for more advanced memory managers.
  *
- * Note that the algorithm used is quite simple and there might be substantial
- * performance gains if a smarter free list is implemented. Currently it is just an
- * unordered stack of free regions. This could easily be improved if an RB-tree
- * is used instead. At least if we expect heavy fragmentation.
- *
- * Aligned allocations can also see improvement.
+ * Free regions are kept on a most-recently-freed stack, which plain first-fit
+ * searches walk so that eviction finds the hole it just made. Best-fit searches
+ * use an AVL tree of holes ordered by size, and range-restricted searches use
+ * an address ordered tree where every subtree records its largest hole, so
+ * neither has to visit every hole of a fragmented address space.
  *
  * Authors:
  * Thomas Hellström <thomas-at-tungstengraphics-dot-com>
@@ -102,6 +101,176 @@ int drm_mm_pre_get(struct drm_mm *mm)
 	return 0;
 }
 
+/*
+ * Hole index.
+ *
+ * Every node with hole_follows set is present in both mm->holes_size and
+ * mm->holes_addr, keyed by the hole_start/hole_size it was added with.
+ * Anything that changes where a hole starts or ends must drop the affected
+ * holes from the index first and add them back afterwards.  The eviction
+ * scan is the exception: it only borrows hole_follows and node_list and
+ * restores both before anything else may touch the allocator.
+ */
+static int drm_mm_hole_size_compare(const void *a, const void *b)
+{
+	const struct drm_mm_node *na = a, *nb = b;
+
+	if (na->hole_size != nb->hole_size)
+		return (na->hole_size < nb->hole_size ? -1 : 1);
+	if (na->hole_start != nb->hole_start)
+		return (na->hole_start < nb->hole_start ? -1 : 1);
+	return 0;
+}
+
+static int drm_mm_hole_addr_height(struct drm_mm_node *node)
+{
+	return node ? node->hole_addr_height : 0;
+}
+
+static void drm_mm_hole_addr_update(struct drm_mm_node *node)
+{
+	struct drm_mm_node *l = node->hole_addr_left;
+	struct drm_mm_node *r = node->hole_addr_right;
+
+	node->hole_addr_height = max(drm_mm_hole_addr_height(l),
+	    drm_mm_hole_addr_height(r)) + 1;
+	node->subtree_max_hole = node->hole_size;
+	if (l && l->subtree_max_hole > node->subtree_max_hole)
+		node->subtree_max_hole = l->subtree_max_hole;
+	if (r && r->subtree_max_hole > node->subtree_max_hole)
+		node->subtree_max_hole = r->subtree_max_hole;
+}
+
+static struct drm_mm_node *drm_mm_hole_addr_rotate_right(struct drm_mm_node *node)
+{
+	struct drm_mm_node *l = node->hole_addr_left;
+
+	node->hole_addr_left = l->hole_addr_right;
+	l->hole_addr_right = node;
+	drm_mm_hole_addr_update(node);
+	drm_mm_hole_addr_update(l);
+	return l;
+}
+
+static struct drm_mm_node *drm_mm_hole_addr_rotate_left(struct drm_mm_node *node)
+{
+	struct drm_mm_node *r = node->hole_addr_right;
+
+	node->hole_addr_right = r->hole_addr_left;
+	r->hole_addr_left = node;
+	drm_mm_hole_addr_update(node);
+	drm_mm_hole_addr_update(r);
+	return r;
+}
+
+static struct drm_mm_node *drm_mm_hole_addr_balance(struct drm_mm_node *node)
+{
+	struct drm_mm_node *l = node->hole_addr_left;
+	struct drm_mm_node *r = node->hole_addr_right;
+	int balance = drm_mm_hole_addr_height(l) - drm_mm_hole_addr_height(r);
+
+	if (balance > 1) {
+		if (drm_mm_hole_addr_height(l->hole_addr_left) <
+		    drm_mm_hole_addr_height(l->hole_addr_right))
+			node->hole_addr_left = drm_mm_hole_addr_rotate_left(l);
+		return drm_mm_hole_addr_rotate_right(node);
+	}
+	if (balance < -1) {
+		if (drm_mm_hole_addr_height(r->hole_addr_right) <
+		    drm_mm_hole_addr_height(r->hole_addr_left))
+			node->hole_addr_right = drm_mm_hole_addr_rotate_right(r);
+		return drm_mm_hole_addr_rotate_left(node);
+	}
+
+	drm_mm_hole_addr_update(node);
+	return node;
+}
+
+static struct drm_mm_node *drm_mm_hole_addr_insert(struct drm_mm_node *root,
+						   struct drm_mm_node *node)
+{
+	if (root == NULL) {
+		node->hole_addr_left = NULL;
+		node->hole_addr_right = NULL;
+		drm_mm_hole_addr_update(node);
+		return node;
+	}
+
+	if (node->hole_start < root->hole_start)
+		root->hole_addr_left =
+		    drm_mm_hole_addr_insert(root->hole_addr_left, node);
+	else
+		root->hole_addr_right =
+		    drm_mm_hole_addr_insert(root->hole_addr_right, node);
+
+	return drm_mm_hole_addr_balance(root);
+}
+
+static struct drm_mm_node *drm_mm_hole_addr_remove_first(struct drm_mm_node *root,
+							 struct drm_mm_node **first)
+{
+	if (root->hole_addr_left == NULL) {
+		*first = root;
+		return root->hole_addr_right;
+	}
+
+	root->hole_addr_left =
+	    drm_mm_hole_addr_remove_first(root->hole_addr_left, first);
+	return drm_mm_hole_addr_balance(root);
+}
+
+static struct drm_mm_node *drm_mm_hole_addr_remove(struct drm_mm_node *root,
+						   struct drm_mm_node *node)
+{
+	struct drm_mm_node *next;
+
+	BUG_ON(root == NULL);
+
+	if (node->hole_start < root->hole_start) {
+		root->hole_addr_left =
+		    drm_mm_hole_addr_remove(root->hole_addr_left, node);
+		return drm_mm_hole_addr_balance(root);
+	}
+	if (node->hole_start > root->hole_start) {
+		root->hole_addr_right =
+		    drm_mm_hole_addr_remove(root->hole_addr_right, node);
+		return drm_mm_hole_addr_balance(root);
+	}
+
+	BUG_ON(root != node);
+
+	if (node->hole_addr_right == NULL)
+		return node->hole_addr_left;
+	if (node->hole_addr_left == NULL)
+		return node->hole_addr_right;
+
+	node->hole_addr_right =
+	    drm_mm_hole_addr_remove_first(node->hole_addr_right, &next);
+	next->hole_addr_left = node->hole_addr_left;
+	next->hole_addr_right = node->hole_addr_right;
+	return drm_mm_hole_addr_balance(next);
+}
+
+static void drm_mm_hole_index_add(struct drm_mm_node *node)
+{
+	struct drm_mm *mm = node->mm;
+
+	node->hole_start = __drm_mm_hole_node_start(node);
+	node->hole_size = __drm_mm_hole_node_end(node) - node->hole_start;
+
+	avl_add(&mm->holes_size, node);
+	mm->holes_addr = drm_mm_hole_addr_insert(mm->holes_addr, node);
+}
+
+static void drm_mm_hole_index_del(struct drm_mm_node *node)
+{
+	struct drm_mm *mm = node->mm;
+
+	avl_remove(&mm->holes_size, node);
+	mm->holes_addr = drm_mm_hole_addr_remove(mm->holes_addr, node);
+}
+
+
 static void drm_mm_insert_helper(struct drm_mm_node *hole_node,
 				 struct drm_mm_node *node,
 				 unsigned long size, unsigned alignment,
@@ -115,6 +284,8 @@ static void drm_mm_insert_helper(struct drm_mm_node *hole_node,
 
 	BUG_ON(node->allocated);
 
+	drm_mm_hole_index_del(hole_node);
+
 	if (mm->color_adjust)
 		mm->color_adjust(hole_node, color, &adj_start, &adj_end);
 
@@ -144,7 +315,11 @@ static void drm_mm_insert_helper(struct drm_mm_node *hole_node,
 	if (__drm_mm_hole_node_start(node) < hole_end) {
 		list_add(&node->hole_stack, &mm->hole_stack, (caddr_t)node);
 		node->hole_follows = 1;
+		drm_mm_hole_index_add(node);
 	}
+
+	if (hole_node->hole_follows)
+		drm_mm_hole_index_add(hole_node);
 }
 
 struct drm_mm_node *drm_mm_create_block(struct drm_mm *mm,
@@ -170,18 +345,22 @@ struct drm_mm_node *drm_mm_create_block(struct drm_mm *mm,
 		node->mm = mm;
 		node->allocated = 1;
 
+		drm_mm_hole_index_del(hole);
+
 		INIT_LIST_HEAD(&node->hole_stack);
 		list_add(&node->node_list, &hole->node_list, (caddr_t)node);
 
 		if (start == hole_start) {
 			hole->hole_follows = 0;
 			list_del_init(&hole->hole_stack);
-		}
+		} else
+			drm_mm_hole_index_add(hole);
 
 		node->hole_follows = 0;
 		if (end != hole_end) {
 			list_add(&node->hole_stack, &mm->hole_stack, (caddr_t)node);
 			node->hole_follows = 1;
+			drm_mm_hole_index_add(node);
 		}
 
 		return node;
@@ -248,6 +427,8 @@ static void drm_mm_insert_helper_range(struct drm_mm_node *hole_node,
 
 	BUG_ON(!hole_node->hole_follows || node->allocated);
 
+	drm_mm_hole_index_del(hole_node);
+
 	if (adj_start < start)
 		adj_start = start;
 	if (adj_end > end)
@@ -283,7 +464,11 @@ static void drm_mm_insert_helper_range(struct drm_mm_node *hole_node,
 	if (__drm_mm_hole_node_start(node) < hole_end) {
 		list_add(&node->hole_stack, &mm->hole_stack, (caddr_t)node);
 		node->hole_follows = 1;
+		drm_mm_hole_index_add(node);
 	}
+
+	if (hole_node->hole_follows)
+		drm_mm_hole_index_add(hole_node);
 }
 
 struct drm_mm_node *drm_mm_get_block_range_generic(struct drm_mm_node *hole_node,
@@ -354,6 +539,7 @@ void drm_mm_remove_node(struct drm_mm_node *node)
 		BUG_ON(__drm_mm_hole_node_start(node) ==
 		       __drm_mm_hole_node_end(node));
 		list_del(&node->hole_stack);
+		drm_mm_hole_index_del(node);
 	/* LINTED */
 	} else
 		BUG_ON(__drm_mm_hole_node_start(node) !=
@@ -363,11 +549,16 @@ void drm_mm_remove_node(struct drm_mm_node *node)
 	if (!prev_node->hole_follows) {
 		prev_node->hole_follows = 1;
 		list_add(&prev_node->hole_stack, &mm->hole_stack, (caddr_t)prev_node);
-	} else
+	} else {
 		list_move(&prev_node->hole_stack, &mm->hole_stack, (caddr_t)prev_node);
+		drm_mm_hole_index_del(prev_node);
+	}
 
 	list_del(&node->node_list);
 	node->allocated = 0;
+
+	/* prev_node's hole now also covers node and any hole after it */
+	drm_mm_hole_index_add(prev_node);
 }
 
 /*
@@ -406,6 +597,108 @@ static int check_free_hole(unsigned long start, unsigned long end,
 	return end >= start + size;
 }
 
+/*
+ * Adjust a candidate hole for the allocation's range and color and check
+ * whether it can take size bytes at the requested alignment.
+ */
+static int drm_mm_hole_fits(const struct drm_mm *mm, struct drm_mm_node *entry,
+			    unsigned long size, unsigned alignment,
+			    unsigned long color,
+			    unsigned long start, unsigned long end)
+{
+	unsigned long adj_start = entry->hole_start;
+	unsigned long adj_end = entry->hole_start + entry->hole_size;
+
+	if (adj_start < start)
+		adj_start = start;
+	if (adj_end > end)
+		adj_end = end;
+	if (adj_end <= adj_start)
+		return 0;
+
+	if (mm->color_adjust) {
+		mm->color_adjust(entry, color, &adj_start, &adj_end);
+		if (adj_end <= adj_start)
+			return 0;
+	}
+
+	return check_free_hole(adj_start, adj_end, size, alignment);
+}
+
+/*
+ * Smallest hole that fits.  Holes are visited in increasing size starting
+ * at the first one of at least size bytes, so only holes rejected by the
+ * range, alignment or color_adjust are skipped over.
+ */
+static struct drm_mm_node *drm_mm_search_best_fit(const struct drm_mm *mm,
+						  unsigned long size,
+						  unsigned alignment,
+						  unsigned long color,
+						  unsigned long start,
+						  unsigned long end)
+{
+	avl_tree_t *tree = (avl_tree_t *)&mm->holes_size;
+	struct drm_mm_node key, *entry;
+	avl_index_t where;
+
+	key.hole_size = size;
+	key.hole_start = 0;
+	entry = avl_find(tree, &key, &where);
+	if (entry == NULL)
+		entry = avl_nearest(tree, where, AVL_AFTER);
+
+	for (; entry != NULL; entry = AVL_NEXT(tree, entry)) {
+		if (drm_mm_hole_fits(mm, entry, size, alignment, color,
+		    start, end))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Lowest addressed hole in [start, end) that fits.  Subtrees whose largest
+ * hole is smaller than size, or that lie entirely outside the range, are
+ * never entered.
+ */
+static struct drm_mm_node *drm_mm_search_first_fit(const struct drm_mm *mm,
+						   struct drm_mm_node *root,
+						   unsigned long size,
+						   unsigned alignment,
+						   unsigned long color,
+						   unsigned long start,
+						   unsigned long end)
+{
+	struct drm_mm_node *entry;
+
+	while (root != NULL && root->subtree_max_hole >= size) {
+		/* holes to the left all end at or before root's start */
+		if (root->hole_start > start) {
+			entry = drm_mm_search_first_fit(mm,
+			    root->hole_addr_left, size, alignment, color,
+			    start, end);
+			if (entry != NULL)
+				return entry;
+		}
+
+		if (root->hole_start >= end)
+			break;
+
+		if (root->hole_size >= size &&
+		    drm_mm_hole_fits(mm, root, size, alignment, color,
+		    start, end))
+			return root;
+
+		/* holes to the right all start after root's end */
+		if (root->hole_start + root->hole_size >= end)
+			break;
+
+		root = root->hole_addr_right;
+	}
+
+	return NULL;
+}
+
 struct drm_mm_node *drm_mm_search_free_generic(const struct drm_mm *mm,
 					       unsigned long size,
 					       unsigned alignment,
@@ -413,17 +706,22 @@ struct drm_mm_node *drm_mm_search_free_generic(const struct drm_mm *mm,
 					       bool best_match)
 {
 	struct drm_mm_node *entry;
-	struct drm_mm_node *best;
 	unsigned long adj_start;
 	unsigned long adj_end;
-	unsigned long best_size;
 
 	BUG_ON(mm->scanned_blocks);
 
-	best = NULL;
-	best_size = ~0UL;
+	if (best_match)
+		return drm_mm_search_best_fit(mm, size, alignment, color,
+		    0, ~0UL);
+
+	if (mm->holes_addr == NULL || mm->holes_addr->subtree_max_hole < size)
+		return NULL;
 
 	drm_mm_for_each_hole(entry, mm, adj_start, adj_end) {
+		if (adj_end - adj_start < size)
+			continue;
+
 		if (mm->color_adjust) {
 			mm->color_adjust(entry, color, &adj_start, &adj_end);
 			if (adj_end <= adj_start)
@@ -433,16 +731,10 @@ struct drm_mm_node *drm_mm_search_free_generic(const struct drm_mm *mm,
 		if (!check_free_hole(adj_start, adj_end, size, alignment))
 			continue;
 
-		if (!best_match)
-			return entry;
-
-		if (entry->size < best_size) {
-			best = entry;
-			best_size = entry->size;
-		}
+		return entry;
 	}
 
-	return best;
+	return NULL;
 }
 
 struct drm_mm_node *drm_mm_search_free_in_range_generic(const struct drm_mm *mm,
@@ -453,42 +745,14 @@ struct drm_mm_node *drm_mm_search_free_in_range_generic(const struct drm_mm *mm,
 							unsigned long end,
 							bool best_match)
 {
-	struct drm_mm_node *entry;
-	struct drm_mm_node *best;
-	unsigned long adj_start;
-	unsigned long adj_end;
-	unsigned long best_size;
-
 	BUG_ON(mm->scanned_blocks);
 
-	best = NULL;
-	best_size = ~0UL;
-
-	drm_mm_for_each_hole(entry, mm, adj_start, adj_end) {
-		if (adj_start < start)
-			adj_start = start;
-		if (adj_end > end)
-			adj_end = end;
-
-		if (mm->color_adjust) {
-			mm->color_adjust(entry, color, &adj_start, &adj_end);
-			if (adj_end <= adj_start)
-				continue;
-		}
-
-		if (!check_free_hole(adj_start, adj_end, size, alignment))
-			continue;
-
-		if (!best_match)
-			return entry;
+	if (best_match)
+		return drm_mm_search_best_fit(mm, size, alignment, color,
+		    start, end);
 
-		if (entry->size < best_size) {
-			best = entry;
-			best_size = entry->size;
-		}
-	}
-
-	return best;
+	return drm_mm_search_first_fit(mm, mm->holes_addr, size, alignment,
+	    color, start, end);
 }
 
 /**
@@ -496,8 +760,17 @@ struct drm_mm_node *drm_mm_search_free_in_range_generic(const struct drm_mm *mm,
  */
 void drm_mm_replace_node(struct drm_mm_node *old, struct drm_mm_node *new)
 {
+	if (old->hole_follows)
+		drm_mm_hole_index_del(old);
+
+	/* list_replace() leaves contain_ptr, which list_entry() needs, alone */
 	list_replace(&old->node_list, &new->node_list);
-	list_replace(&old->hole_stack, &new->hole_stack);
+	new->node_list.contain_ptr = (caddr_t)new;
+	if (old->hole_follows) {
+		list_replace(&old->hole_stack, &new->hole_stack);
+		new->hole_stack.contain_ptr = (caddr_t)new;
+	} else
+		INIT_LIST_HEAD(&new->hole_stack);
 	new->hole_follows = old->hole_follows;
 	new->mm = old->mm;
 	new->start = old->start;
@@ -506,6 +779,9 @@ void drm_mm_replace_node(struct drm_mm_node *old, struct drm_mm_node *new)
 
 	old->allocated = 0;
 	new->allocated = 1;
+
+	if (new->hole_follows)
+		drm_mm_hole_index_add(new);
 }
 
 /**
@@ -676,6 +952,12 @@ void drm_mm_init(struct drm_mm * mm, unsigned long start, unsigned long size)
 	mm->head_node.node_list.contain_ptr = (caddr_t)&mm->head_node;
 	list_add_tail(&mm->head_node.hole_stack, &mm->hole_stack, (caddr_t)&mm->head_node);
 	mm->color_adjust = NULL;
+
+	avl_create(&mm->holes_size, drm_mm_hole_size_compare,
+	    sizeof (struct drm_mm_node),
+	    offsetof(struct drm_mm_node, hole_size_link));
+	mm->holes_addr = NULL;
+	drm_mm_hole_index_add(&mm->head_node);
 }
 
 
@@ -697,6 +979,9 @@ void drm_mm_takedown(struct drm_mm * mm)
 	spin_unlock(&mm->unused_lock);
 
 	BUG_ON(mm->num_unused != 0);
+
+	drm_mm_hole_index_del(&mm->head_node);
+	avl_destroy(&mm->holes_size);
 }
 
 static unsigned long drm_mm_debug_hole(struct drm_mm_node *entry,
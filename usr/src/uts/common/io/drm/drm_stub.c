@@ -246,7 +246,6 @@ static int drm_fill_in_dev(struct drm_device * dev, struct pci_dev *pdev,
 	mutex_init(&dev->ctxlist_mutex, NULL, MUTEX_DRIVER, NULL);
 	mutex_init(&dev->irq_lock, NULL, MUTEX_DRIVER, (void *)pdev->intr_block);
 	mutex_init(&dev->track_lock, NULL, MUTEX_DRIVER, (void *)pdev->intr_block);
-	mutex_init(&dev->page_fault_lock, NULL, MUTEX_DRIVER, NULL);
 
 	dev->pdev = pdev;
 	dev->pci_device = pdev->device;
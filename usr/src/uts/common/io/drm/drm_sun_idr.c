@@ -30,132 +30,163 @@
 #include "drm_linux_list.h"
 #include "drm_sun_idr.h"
 
-static inline int
-fr_isfull(struct idr_free_id_range *range)
-{
-	return range->min_unused_id >= range->end;
-}
+#define	IDR_LAYER_FULL		(~0ULL)
+#define	idr_shift(layers)	(((layers) - 1) * IDR_BITS)
 
-static struct idr_free_id_range *
-fr_new(int start)
+static struct idr_layer *
+idr_layer_alloc(struct idr *idrp)
 {
-	struct idr_free_id_range *this;
+	struct idr_layer *l;
 
-	this = kmem_zalloc(sizeof(struct idr_free_id_range), KM_SLEEP);
-	this->start = start;
-	this->end = 0x7fffffff;
-	this->min_unused_id = start;
+	if ((l = idrp->id_free) != NULL) {
+		idrp->id_free = l->ary[0];
+		idrp->id_free_cnt--;
+		l->ary[0] = NULL;
+		return (l);
+	}
 
-	return this;
+	return (kmem_zalloc(sizeof (struct idr_layer), KM_NOSLEEP));
 }
 
-static struct idr_free_id_range *
-fr_destroy(struct idr_free_id_range *range)
+/* l must be empty, so that it can be handed out again as it is */
+static void
+idr_layer_free(struct idr *idrp, struct idr_layer *l)
 {
-	struct idr_free_id_range *ret;
-	struct idr_free_id *id;
+	if (idrp->id_free_cnt < IDR_FREE_MAX) {
+		l->ary[0] = idrp->id_free;
+		idrp->id_free = l;
+		idrp->id_free_cnt++;
+	} else
+		kmem_free(l, sizeof (struct idr_layer));
+}
 
-	while (range->free_ids) {
-		id = range->free_ids;
-		range->free_ids = range->free_ids->next;
-		kmem_free(id, sizeof(struct idr_free_id));
+static void
+idr_layer_destroy(struct idr_layer *l, int shift)
+{
+	int i;
+
+	if (shift > 0) {
+		for (i = 0; i < IDR_SIZE; i++)
+			if (l->ary[i] != NULL)
+				idr_layer_destroy(l->ary[i], shift - IDR_BITS);
 	}
+	kmem_free(l, sizeof (struct idr_layer));
+}
 
-	ret = range->next;
-	kmem_free(range, sizeof(struct idr_free_id_range));
+/* First bit at or above i that is set in map, or -1 */
+static int
+idr_next_bit(uint64_t map, int i)
+{
+	if (i >= IDR_SIZE)
+		return (-1);
 
-	return ret;
+	map &= IDR_LAYER_FULL << i;
+	return (map == 0 ? -1 : lowbit(map) - 1);
 }
 
-static struct idr_free_id_range *
-fr_get(struct idr_free_id_range *list, int start)
+/* Add a layer on top, so that the tree covers IDR_SIZE times more ids */
+static int
+idr_grow(struct idr *idrp)
 {
-	struct idr_free_id_range *entry = list;
+	struct idr_layer *l;
+
+	if (idrp->top != NULL) {
+		if ((l = idr_layer_alloc(idrp)) == NULL)
+			return (-ENOMEM);
+		l->ary[0] = idrp->top;
+		l->count = 1;
+		if (idrp->top->full == IDR_LAYER_FULL)
+			l->full = 1;
+		idrp->top = l;
+	}
+	idrp->layers++;
 
-	while (entry && (entry->start != start))
-		entry = entry->next;
-	return entry;
+	return (0);
 }
 
-static struct idr_free_id_range *
-fr_insert(struct idr_free_id_range *list, int start)
+/*
+ * Leaf layer that holds id, or NULL. The layers walked through on the way
+ * down are stored in pa[], top first, if pa is not NULL.
+ */
+static struct idr_layer *
+idr_lookup_leaf(struct idr *idrp, uint32_t id, struct idr_layer **pa)
 {
-	struct idr_free_id_range *prev = list;
-	struct idr_free_id_range *n;
-	struct idr_free_id *id, **pid;
-
-	while (prev->next && prev->next->start < start)
-		prev = prev->next;
-
-	n = fr_new(start);
-
-	/* link the new range */
-	n->next = prev->next;
-	prev->next = n;
-
-	/* change the end of the ranges */
-	prev->end = start;
-	if (n->next)
-		n->end = n->next->start;
-
-	if (fr_isfull(prev)) {
-		/* change the min_unused_id of the ranges */
-		n->min_unused_id = prev->min_unused_id;
-		prev->min_unused_id = start;
-
-		/* link free id to the new range */
-		pid = &prev->free_ids;
-		while (*pid) {
-			if ((*pid)->id < start) {
-				pid = &((*pid)->next);
-				continue;
-			}
-			id = *pid;
-
-			/* remove from the prev range */
-			(*pid) = id->next;
-
-			/* link to the new range */
-			id->next = n->free_ids;
-			n->free_ids = id;
-		}
+	struct idr_layer *l = idrp->top;
+	int shift;
+
+	if (l == NULL || ((uint64_t)id >> (idrp->layers * IDR_BITS)) != 0)
+		return (NULL);
+
+	for (shift = idr_shift(idrp->layers); shift > 0; shift -= IDR_BITS) {
+		if (pa != NULL)
+			*pa++ = l;
+		l = l->ary[(id >> shift) & IDR_MASK];
+		if (l == NULL)
+			return (NULL);
 	}
 
-	return n;
+	return (l);
 }
 
+/*
+ * Lowest free id >= start below layer l, which covers the ids from base
+ * on. Missing layers on the way are allocated.
+ */
 static int
-idr_compare(const void *a, const void *b)
+idr_sub_alloc(struct idr *idrp, struct idr_layer *l, int shift,
+    uint64_t base, uint64_t start, uint64_t *idp)
 {
-	const struct idr_used_id *pa = a;
-	const struct idr_used_id *pb = b;
+	struct idr_layer *child;
+	uint64_t sub;
+	int i, ret;
+
+	i = start > base ? (start - base) >> shift : 0;
+	for (; (i = idr_next_bit(~l->full, i)) >= 0; i++) {
+		sub = base + ((uint64_t)i << shift);
+		if (shift == 0) {
+			*idp = sub;
+			return (0);
+		}
 
-	if (pa->id < pb->id)
-		return (-1);
-	else if (pa->id > pb->id)
-		return (1);
-	else
-		return (0);
+		if ((child = l->ary[i]) == NULL) {
+			if ((child = idr_layer_alloc(idrp)) == NULL)
+				return (-ENOMEM);
+			l->ary[i] = child;
+			l->count++;
+		}
+
+		ret = idr_sub_alloc(idrp, child, shift - IDR_BITS, sub,
+		    MAX(start, sub), idp);
+		if (ret != -ENOSPC)
+			return (ret);
+	}
+
+	return (-ENOSPC);
 }
 
+/* Lowest allocated id >= start below layer l */
 static int
-idr_get_free_id_in_range(struct idr_free_id_range* range)
+idr_sub_next(struct idr_layer *l, int shift, uint64_t base, uint64_t start,
+    uint32_t *idp)
 {
-	struct idr_free_id *idp;
-	int id;
-
-	if (range->free_ids) {
-		idp = range->free_ids;
-		range->free_ids = idp->next;
-		id = idp->id;
-		kmem_free(idp, sizeof(struct idr_free_id));
-		return (id);
+	uint64_t sub;
+	int i;
+
+	i = start > base ? (start - base) >> shift : 0;
+	if (shift == 0) {
+		if ((i = idr_next_bit(l->full, i)) < 0)
+			return (-1);
+		*idp = (uint32_t)(base + i);
+		return (0);
 	}
 
-	if (!fr_isfull(range)) {
-		id = range->min_unused_id;
-		range->min_unused_id++;
-		return (id);
+	for (; i < IDR_SIZE; i++) {
+		if (l->ary[i] == NULL)
+			continue;
+		sub = base + ((uint64_t)i << shift);
+		if (idr_sub_next(l->ary[i], shift - IDR_BITS, sub,
+		    MAX(start, sub), idp) == 0)
+			return (0);
 	}
 
 	return (-1);
@@ -164,115 +195,124 @@ idr_get_free_id_in_range(struct idr_free_id_range* range)
 void
 idr_init(struct idr *idrp)
 {
-	avl_create(&idrp->used_ids, idr_compare, sizeof(struct idr_used_id),
-	    offsetof(struct idr_used_id, link));
-
-	idrp->free_id_ranges = fr_new(0);
+	idrp->top = NULL;
+	idrp->layers = 1;
+	idrp->id_free = NULL;
+	idrp->id_free_cnt = 0;
 	mutex_init(&idrp->lock, NULL, MUTEX_DRIVER, NULL);
 }
 
 int
 idr_get_new_above(struct idr *idrp, void *obj, int start, int *newid)
 {
-	struct idr_used_id *used;
-	struct idr_free_id_range *range;
-	int id;
+	struct idr_layer *pa[IDR_MAX_LAYERS];
+	struct idr_layer *l;
+	uint64_t id;
+	int i, n, shift, ret;
 
 	if (start < 0)
 		return (-EINVAL);
 	mutex_enter(&idrp->lock);
-	range = fr_get(idrp->free_id_ranges, start);
-	if (!range)
-		range = fr_insert(idrp->free_id_ranges, start);
-
-	while (range) {
-		id = idr_get_free_id_in_range(range);
-		if (id >= 0)
-			goto got_id;
-		range = range->next;
-	}
-	mutex_exit(&idrp->lock);
-	return (-1);
 
-got_id:
-	used = kmem_alloc(sizeof(struct idr_used_id), KM_NOSLEEP);
-	if (!used) {
-		mutex_exit(&idrp->lock);
-		return (-ENOMEM);
+	while (((uint64_t)start >> (idrp->layers * IDR_BITS)) != 0) {
+		if ((ret = idr_grow(idrp)) != 0)
+			goto out;
 	}
 
-	used->id = id;
-	used->obj = obj;
-	avl_add(&idrp->used_ids, used);
-
-	*newid = id;
-	mutex_exit(&idrp->lock);
-	return (0);
-}
-
-static struct idr_used_id *
-idr_find_used_id(struct idr *idrp, uint32_t id)
-{
-	struct idr_used_id match;
-	struct idr_used_id *ret;
-
-	match.id = id;
+	for (;;) {
+		if (idrp->top == NULL &&
+		    (idrp->top = idr_layer_alloc(idrp)) == NULL) {
+			ret = -ENOMEM;
+			goto out;
+		}
 
-	ret = avl_find(&idrp->used_ids, &match, NULL);
-	if (ret) {
-		return (ret);
+		ret = idr_sub_alloc(idrp, idrp->top, idr_shift(idrp->layers),
+		    0, start, &id);
+		if (ret != -ENOSPC)
+			break;
+		/* everything from start on is taken, look further up */
+		if (idrp->layers == IDR_MAX_LAYERS ||
+		    (ret = idr_grow(idrp)) != 0)
+			break;
+	}
+	if (ret == -ENOSPC || (ret == 0 && id >= IDR_MAX_ID))
+		ret = -1;
+	if (ret != 0)
+		goto out;
+
+	l = idr_lookup_leaf(idrp, (uint32_t)id, pa);
+	i = id & IDR_MASK;
+	l->ary[i] = obj;
+	l->full |= 1ULL << i;
+	l->count++;
+
+	/* a full layer makes its slot in the parent full */
+	n = idrp->layers - 1;
+	for (shift = IDR_BITS; l->full == IDR_LAYER_FULL && n > 0;
+	    shift += IDR_BITS) {
+		l = pa[--n];
+		l->full |= 1ULL << ((id >> shift) & IDR_MASK);
 	}
 
-	return (NULL);
+	*newid = (int)id;
+out:
+	mutex_exit(&idrp->lock);
+	return (ret);
 }
 
 void *
 idr_find(struct idr *idrp, uint32_t id)
 {
-	struct idr_used_id *ret;
+	struct idr_layer *l;
+	void *obj = NULL;
 
 	mutex_enter(&idrp->lock);
-	ret = idr_find_used_id(idrp, id);
-	if (ret) {
-		mutex_exit(&idrp->lock);
-		return (ret->obj);
-	}
-
+	l = idr_lookup_leaf(idrp, id, NULL);
+	if (l != NULL)
+		obj = l->ary[id & IDR_MASK];
 	mutex_exit(&idrp->lock);
-	return (NULL);
+
+	return (obj);
 }
 
 int
 idr_remove(struct idr *idrp, uint32_t id)
 {
-	struct idr_free_id_range *range;
-	struct idr_used_id *ide;
-	struct idr_free_id *fid;
+	struct idr_layer *pa[IDR_MAX_LAYERS];
+	struct idr_layer *l, *parent;
+	int i, n, shift;
 
 	mutex_enter(&idrp->lock);
-	ide = idr_find_used_id(idrp, id);
-	if (!ide) {
+	l = idr_lookup_leaf(idrp, id, pa);
+	i = id & IDR_MASK;
+	if (l == NULL || (l->full & (1ULL << i)) == 0) {
 		mutex_exit(&idrp->lock);
 		return (-EINVAL);
 	}
 
-	fid = kmem_alloc(sizeof(struct idr_free_id), KM_NOSLEEP);
-	if (!fid) {
-		mutex_exit(&idrp->lock);
-		return (-ENOMEM);
+	l->ary[i] = NULL;
+	l->full &= ~(1ULL << i);
+	l->count--;
+
+	/* nothing is full on the way up any more, and empty layers go */
+	n = idrp->layers - 1;
+	for (shift = IDR_BITS; n > 0; shift += IDR_BITS) {
+		parent = pa[--n];
+		i = (id >> shift) & IDR_MASK;
+		parent->full &= ~(1ULL << i);
+		if (l->count == 0) {
+			parent->ary[i] = NULL;
+			parent->count--;
+			idr_layer_free(idrp, l);
+		}
+		l = parent;
+	}
+	if (l->count == 0) {
+		idr_layer_free(idrp, l);
+		idrp->top = NULL;
 	}
-	fid->id = id;
-
 
-	range = idrp->free_id_ranges;
-	while (range->end <= id)
-		range = range->next;
-	fid->next = range->free_ids;
-	range->free_ids = fid;
-	avl_remove(&idrp->used_ids, ide);
-	kmem_free(ide, sizeof (struct idr_used_id));
 	mutex_exit(&idrp->lock);
-
 	return (0);
 }
 
@@ -286,17 +326,19 @@ idr_remove_all(struct idr *idrp)
 void *
 idr_replace(struct idr *idrp, void *obj, uint32_t id)
 {
-	struct idr_used_id *ide;
+	struct idr_layer *l;
 	void *ret;
+	int i = id & IDR_MASK;
+
 	mutex_enter(&idrp->lock);
-	ide = idr_find_used_id(idrp, id);
-	if (!ide) {
+	l = idr_lookup_leaf(idrp, id, NULL);
+	if (l == NULL || (l->full & (1ULL << i)) == 0) {
 		mutex_exit(&idrp->lock);
 		return (void*)(-EINVAL);
 	}
 
-	ret = ide->obj;
-	ide->obj = obj;
+	ret = l->ary[i];
+	l->ary[i] = obj;
 	mutex_exit(&idrp->lock);
 	return ret;
 }
@@ -304,50 +346,69 @@ idr_replace(struct idr *idrp, void *obj, uint32_t id)
 int
 idr_for_each(struct idr *idrp, int (*fn)(int id, void *p, void *data), void *data)
 {
-	struct idr_used_id *ide;
+	struct idr_layer *l;
+	uint64_t next = 0;
+	uint32_t id;
 	int ret = 0;
 
-	ide = avl_first(&idrp->used_ids);
-	while (ide) {
-		ret = fn(ide->id, ide->obj, data);
+	/* fn may remove the id it is called for, so look up the next afresh */
+	while (idrp->top != NULL &&
+	    idr_sub_next(idrp->top, idr_shift(idrp->layers), 0, next, &id) == 0) {
+		l = idr_lookup_leaf(idrp, id, NULL);
+		ret = fn(id, l->ary[id & IDR_MASK], data);
 		if (ret)
 			break;
-
-		/* idr node has been removed by fn */
-		ide = AVL_NEXT(&idrp->used_ids, ide);
+		next = (uint64_t)id + 1;
 	}
 
 	return ret;
 }
 
+/*
+ * Make sure the next idr_get_new_above() does not need to allocate
+ * memory. Returns 0 if that failed.
+ */
 int
-/* LINTED */
-idr_pre_get(struct idr *idrp, int flag) {
-	return (-1);
+idr_pre_get(struct idr *idrp, int flag)
+{
+	struct idr_layer *l;
+
+	mutex_enter(&idrp->lock);
+	while (idrp->id_free_cnt < IDR_MAX_LAYERS) {
+		mutex_exit(&idrp->lock);
+		l = kmem_zalloc(sizeof (struct idr_layer), flag);
+		if (l == NULL)
+			return (0);
+		mutex_enter(&idrp->lock);
+		idr_layer_free(idrp, l);
+	}
+	mutex_exit(&idrp->lock);
+
+	return (1);
 }
 
 void
 idr_destroy(struct idr *idrp)
 {
-	struct idr_free_id_range *range;
-	struct idr_used_id *ide;
-	void *cookie = NULL;
+	struct idr_layer *l;
 
-	while (ide = avl_destroy_nodes(&idrp->used_ids, &cookie))
-		kmem_free(ide, sizeof (struct idr_used_id));
-	avl_destroy(&idrp->used_ids);
+	if (idrp->top != NULL)
+		idr_layer_destroy(idrp->top, idr_shift(idrp->layers));
+	idrp->top = NULL;
 
-	range = idrp->free_id_ranges;
-	while (range)
-		range = fr_destroy(range);
-	idrp->free_id_ranges = NULL;
+	while ((l = idrp->id_free) != NULL) {
+		idrp->id_free = l->ary[0];
+		kmem_free(l, sizeof (struct idr_layer));
+	}
+	idrp->id_free_cnt = 0;
 
 	mutex_destroy(&idrp->lock);
 }
 
 
-uint32_t fr_id = 0;
-uint32_t fr_time = 0;
+#define	IDR_LIST_FREE(next)	(((uintptr_t)(next) << 1) | 1)
+#define	IDR_LIST_IS_FREE(v)	(((v) & 1) != 0)
+#define	IDR_LIST_NEXT(v)	((uint32_t)((v) >> 1))
 
 int
 /* LINTED */
@@ -356,16 +417,36 @@ idr_list_pre_get(struct idr_list *head, int flag) {
 }
 
 void
-idr_list_init(struct idr_list  *head)
+idr_list_init(struct idr_list *head)
+{
+	head->table = NULL;
+	head->size = 0;
+	head->unused = 1;
+	head->free = 0;
+	head->count = 0;
+}
+
+static int
+idr_list_grow(struct idr_list *head)
 {
-	struct idr_list  *entry;
-	/* HASH for accelerate */
-	entry = kmem_zalloc(DRM_GEM_OBJIDR_HASHNODE
-			* sizeof (struct idr_list), KM_SLEEP);
-	head->next = entry;
-	for (int i = 0; i < DRM_GEM_OBJIDR_HASHNODE; i++) {
-		INIT_LIST_HEAD(&entry[i]);
+	uint32_t size;
+	uintptr_t *table;
+
+	if (head->size >= IDR_MAX_ID)
+		return (-ENOSPC);
+	size = head->size ? MIN(head->size * 2, IDR_MAX_ID) : IDR_LIST_MIN_SIZE;
+
+	table = kmem_zalloc(size * sizeof (uintptr_t), KM_NOSLEEP);
+	if (table == NULL)
+		return (-ENOMEM);
+	if (head->table != NULL) {
+		bcopy(head->table, table, head->size * sizeof (uintptr_t));
+		kmem_free(head->table, head->size * sizeof (uintptr_t));
 	}
+	head->table = table;
+	head->size = size;
+
+	return (0);
 }
 
 int
@@ -373,45 +454,25 @@ idr_list_get_new_above(struct idr_list *head,
 			void *obj,
 			int *handlep)
 {
-	struct idr_list  *entry, *node, *temp;
-	int key, id;
-	void *obj_temp;
-
-	ASSERT(fr_id <= 0x7fffffff);
-	id = ++fr_id;
-	if (id == 0x7fffffff) {
-		fr_time++;
-		id = fr_id = 1;
+	uint32_t handle;
+	int ret;
+
+	ASSERT(obj != NULL && !IDR_LIST_IS_FREE((uintptr_t)obj));
+
+	if (head->free != 0) {
+		handle = head->free;
+		head->free = IDR_LIST_NEXT(head->table[handle]);
+	} else {
+		if (head->unused >= head->size &&
+		    (ret = idr_list_grow(head)) != 0)
+			return (ret);
+		handle = head->unused++;
 	}
-	if (fr_time) {
-		/* find available id */
-		do {
-			obj_temp = idr_list_find(head, id);
-		} while ((obj_temp != NULL) && (++id < 0x7fffffff));
-		if (id < 0x7fffffff) {
-			fr_id = id;
-		} else {
-			fr_id = 0;
-			return (-EAGAIN);
-		}
-	}
-	entry = kmem_zalloc(sizeof (*entry), KM_NOSLEEP);
-	if (entry == NULL)
-		return (-1);
-	ASSERT(id <= 0x7fffffff);
-	key = id % DRM_GEM_OBJIDR_HASHNODE;
-	entry->obj = obj;
-	entry->handle = id;
-
-	/* list add */
-	node = &head->next[key];
-	temp = node->next;
-	entry->prev = node;
-	entry->next = node->next;
-	temp->prev = entry;
-	node->next = entry;
-
-	*handlep = id;
+
+	head->table[handle] = (uintptr_t)obj;
+	head->count++;
+
+	*handlep = handle;
 	return (0);
 }
 
@@ -419,70 +480,63 @@ void *
 idr_list_find(struct idr_list	*head,
 		uint32_t	name)
 {
-	struct idr_list  *entry;
-	int key;
-	key = name % DRM_GEM_OBJIDR_HASHNODE;
-
-	list_for_each(entry, &head->next[key]) {
-		if (entry->handle == name)
-			return (entry->obj);
-	}
-	return (NULL);
-}
+	uintptr_t v;
 
-#define	list_del_idr_list_node(ptr)			\
-do {							\
-	struct idr_list *n_node = (ptr)->next;		\
-	struct idr_list *p_node = (ptr)->prev;		\
-	n_node->prev = (ptr)->prev;			\
-	p_node->next = (ptr)->next;			\
-	(ptr)->prev = NULL;				\
-	(ptr)->next = NULL;				\
-} while (*"\0")
+	if (name == 0 || name >= head->unused)
+		return (NULL);
 
+	v = head->table[name];
+	return (IDR_LIST_IS_FREE(v) ? NULL : (void *)v);
+}
 
 int
 idr_list_remove(struct idr_list	*head,
 		uint32_t	name)
 {
-	struct idr_list  *entry, *temp;
-	int key;
-	key = name % DRM_GEM_OBJIDR_HASHNODE;
-
-	list_for_each_safe(entry, temp, &head->next[key]) {
-		if (entry->handle == name) {
-			list_del_idr_list_node(entry);
-			kmem_free(entry, sizeof (*entry));
-			return (0);
-		}
+	if (idr_list_find(head, name) == NULL) {
+		DRM_ERROR("Failed to remove the object %d", name);
+		return (-1);
 	}
-	DRM_ERROR("Failed to remove the object %d", name);
-	return (-1);
+
+	head->table[name] = IDR_LIST_FREE(head->free);
+	head->free = name;
+
+	/* start over from a small table once everything is gone */
+	if (--head->count == 0)
+		idr_list_free(head);
+
+	return (0);
 }
 
 void
 idr_list_free(struct idr_list	*head)
 {
-	struct idr_list  *entry, *temp;
-	for (int key = 0; key < DRM_GEM_OBJIDR_HASHNODE; key++) {
-		list_for_each_safe(entry, temp, &head->next[key]) {
-			list_del_idr_list_node(entry);
-			kmem_free(entry, sizeof (*entry));
-		}
-	}
-	kmem_free(head->next,
-			DRM_GEM_OBJIDR_HASHNODE * sizeof (struct idr_list));
-	head->next = NULL;
+	if (head->table != NULL)
+		kmem_free(head->table, head->size * sizeof (uintptr_t));
+	idr_list_init(head);
 }
 
 int
 idr_list_empty(struct idr_list	*head)
 {
-	int empty;
-	for (int key = 0; key < DRM_GEM_OBJIDR_HASHNODE; key++) {
-		empty = list_empty(&(head)->next[key]);
-		if (!empty)
-			return (empty);
+	return (head->count == 0);
+}
+
+int
+idr_list_for_each(struct idr_list *head,
+		int (*fn)(int id, void *obj, void *data),
+		void *data)
+{
+	uint32_t handle;
+	int ret;
+
+	for (handle = 1; handle < head->unused; handle++) {
+		if (IDR_LIST_IS_FREE(head->table[handle]))
+			continue;
+		ret = fn(handle, (void *)head->table[handle], data);
+		if (ret)
+			return (ret);
 	}
-	return (1);
+
+	return (0);
 }
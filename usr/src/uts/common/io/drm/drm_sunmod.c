@@ -270,7 +270,8 @@ drm_gem_map(devmap_cookie_t dhc, dev_t dev_id, uint_t flags,
  * This is called by segdev_fault() to fault in pages for the given
  * offset+len.  If the (GTT) device range has been configured with a
  * fake offset for mmap, call the device's gem_fault handler to setup
- * the GTT resources for this mapping.
+ * the GTT resources for this mapping.  The handler may widen the range,
+ * so that neighbouring pages are loaded along without faulting too.
  *
  * We should always call devmap_load(), as we're just interposing
  * on these fault calls to (sometimes) setup GTT resources.
@@ -279,9 +280,10 @@ static int
 drm_gem_map_access(devmap_cookie_t dhp, void *pvt, offset_t offset, size_t len,
 		uint_t type, uint_t rw)
 {
+	devmap_handle_t *dhp_p = (devmap_handle_t *)dhp;
 	struct drm_device *dev;
 	struct drm_gem_object *obj;
-	struct gem_map_list *seg;
+	offset_t objoff, end;
 
 	obj = (struct drm_gem_object *)pvt;
 
@@ -293,8 +295,20 @@ drm_gem_map_access(devmap_cookie_t dhp, void *pvt, offset_t offset, size_t len,
 	if (obj != NULL && obj->gtt_map_kaddr != NULL) {
 		dev = obj->dev;
 		/* Could also check map->callback */
-		if (dev->driver->gem_fault != NULL)
-			dev->driver->gem_fault(obj);
+		if (dev->driver->gem_fault != NULL) {
+			objoff = offset - dhp_p->dh_uoff + dhp_p->dh_roff;
+			if (dev->driver->gem_fault(obj, &objoff, &len))
+				return (DDI_FAILURE);
+
+			/* Back to the user offsets, within this handle */
+			offset = objoff + dhp_p->dh_uoff - dhp_p->dh_roff;
+			end = offset + len;
+			if (offset < dhp_p->dh_uoff)
+				offset = dhp_p->dh_uoff;
+			if (end > dhp_p->dh_uoff + dhp_p->dh_len)
+				end = dhp_p->dh_uoff + dhp_p->dh_len;
+			len = end - offset;
+		}
 	}
 
 	/* Internal devmap_default_access(9F) */
@@ -306,18 +320,8 @@ drm_gem_map_access(devmap_cookie_t dhp, void *pvt, offset_t offset, size_t len,
 	 * Save list of loaded translations for later use in
 	 * (i.e.) i915_gem_release_mmap()
 	 */
-	if (obj != NULL) {
-		dev = obj->dev;
-		seg = drm_alloc(sizeof (struct gem_map_list), DRM_MEM_MAPS);
-		if (seg != NULL) {
-			mutex_lock(&dev->page_fault_lock);
-			seg->dhp = dhp;
-			seg->mapoffset = offset;
-			seg->maplen = len;
-			list_add_tail(&seg->head, &obj->seg_list, (caddr_t)seg);
-			mutex_unlock(&dev->page_fault_lock);
-		}
-	}
+	if (obj != NULL)
+		drm_gem_seg_add(obj, dhp, offset, len);
 	return (DDI_SUCCESS);
 }
 
@@ -353,7 +357,6 @@ drm_gem_unmap(devmap_cookie_t dhc, void *pvt, offset_t off, size_t len,
 	struct ddi_umem_cookie *ncp;
 	struct drm_device *dev;
 	struct drm_gem_object *obj;
-	struct gem_map_list *entry, *temp;
 	boolean_t last_ref = B_FALSE;
 
 	_NOTE(ARGUNUSED(off, len))
@@ -371,17 +374,7 @@ drm_gem_unmap(devmap_cookie_t dhc, void *pvt, offset_t off, size_t len,
 	 * as segdev_unmap() has done a hat_unload() for the
 	 * entire segment by the time we get here.
 	 */
-	mutex_lock(&dev->page_fault_lock);
-	if (!list_empty(&obj->seg_list)) {
-		list_for_each_entry_safe(entry, temp, struct gem_map_list,
-		    &obj->seg_list, head) {
-			(void) devmap_unload(entry->dhp, entry->mapoffset,
-			    entry->maplen);
-			list_del(&entry->head);
-			drm_free(entry, sizeof (struct gem_map_list), DRM_MEM_MAPS);
-		}
-	}
-	mutex_unlock(&dev->page_fault_lock);
+	drm_gem_seg_unload(obj);
 
 	/*
 	 * Manage dh_cookie ref counts
@@ -28,10 +28,12 @@ I915_OBJS = \
 	i915_gem_evict.o \
 	i915_gem_execbuffer.o \
 	i915_gem_gtt.o \
+	i915_gem_sched.o \
 	i915_gem_stolen.o \
 	i915_gem_tiling.o \
 	i915_io32.o \
 	i915_irq.o \
+	i915_kstat.o \
 	i915_suspend.o \
 	i915_ums.o \
 	intel_bios.o \
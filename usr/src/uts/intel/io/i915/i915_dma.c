@@ -146,6 +146,7 @@ void i915_kernel_lost_context(struct drm_device * dev)
 	ring->space = ring->head - (ring->tail + I915_RING_FREE_SPACE);
 	if (ring->space < 0)
 		ring->space += ring->size;
+	intel_ring_resync_pos(ring);
 
 	if (!dev->primary->master)
 		return;
@@ -1501,9 +1502,13 @@ int i915_driver_load(struct drm_device *dev, unsigned long flags)
 	if (MDB_TRACK_ENABLE)
 		INIT_LIST_HEAD(&dev_priv->batch_list);
 
+	if (i915_init_kstats(dev))
+		DRM_ERROR("failed to create i915 kstats");
+
 	return 0;
 
 out_gem_unload:
+	i915_gem_unload(dev);
 	destroy_workqueue(dev_priv->other_wq);
 out_mtrrfree:
 	destroy_workqueue(dev_priv->wq);
@@ -1529,6 +1534,9 @@ int i915_driver_unload(struct drm_device *dev)
 	i915_gem_retire_requests(dev);
 	mutex_unlock(&dev->struct_mutex);
 
+	i915_fini_kstats(dev);
+	i915_gem_unload(dev);
+
 	destroy_workqueue(dev_priv->other_wq);
 	destroy_workqueue(dev_priv->wq);
 
@@ -1671,6 +1679,7 @@ int i915_driver_open(struct drm_device *dev, struct drm_file *file_priv)
 	INIT_LIST_HEAD(&i915_file_priv->mm.request_list);
 
 	idr_init(&i915_file_priv->context_idr);
+	i915_sched_entity_init(&i915_file_priv->sched);
 
 	i915_file_priv->status = 1;
 	file_priv->driver_priv = i915_file_priv;
@@ -1785,7 +1794,7 @@ struct drm_ioctl_desc i915_ioctls[] = {
 	I915_IOCTL_DEF(DRM_IOCTL_I915_HWS_ADDR, i915_set_status_page, DRM_AUTH|DRM_MASTER|DRM_ROOT_ONLY, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_INIT, i915_gem_init_ioctl, DRM_AUTH|DRM_MASTER|DRM_ROOT_ONLY|DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_EXECBUFFER, i915_gem_execbuffer, DRM_AUTH|DRM_UNLOCKED, NULL, NULL),
-	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_EXECBUFFER2, i915_gem_execbuffer2, DRM_AUTH|DRM_UNLOCKED, NULL, NULL),
+	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_EXECBUFFER2_WR, i915_gem_execbuffer2, DRM_AUTH|DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_PIN, i915_gem_pin_ioctl, DRM_AUTH|DRM_ROOT_ONLY|DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_UNPIN, i915_gem_unpin_ioctl, DRM_AUTH|DRM_ROOT_ONLY|DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_BUSY, i915_gem_busy_ioctl, DRM_AUTH|DRM_UNLOCKED, NULL, NULL),
@@ -1797,6 +1806,8 @@ struct drm_ioctl_desc i915_ioctls[] = {
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_CREATE, i915_gem_create_ioctl, DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_PREAD, i915_gem_pread_ioctl, DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_PWRITE, i915_gem_pwrite_ioctl, DRM_UNLOCKED, NULL, NULL),
+	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_PREAD_RECT, i915_gem_pread_rect_ioctl, DRM_UNLOCKED, NULL, NULL),
+	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_PWRITE_RECT, i915_gem_pwrite_rect_ioctl, DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_MMAP, i915_gem_mmap_ioctl, DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_MMAP_GTT, i915_gem_mmap_gtt_ioctl, DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_SET_DOMAIN, i915_gem_set_domain_ioctl, DRM_UNLOCKED, NULL, NULL),
@@ -1811,9 +1822,12 @@ struct drm_ioctl_desc i915_ioctls[] = {
 	I915_IOCTL_DEF(DRM_IOCTL_I915_SET_SPRITE_COLORKEY, intel_sprite_set_colorkey, DRM_MASTER|DRM_CONTROL_ALLOW|DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GET_SPRITE_COLORKEY, intel_sprite_get_colorkey, DRM_MASTER|DRM_CONTROL_ALLOW|DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_WAIT, i915_gem_wait_ioctl, DRM_AUTH|DRM_UNLOCKED, NULL, NULL),
+	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_WAIT_MULTI, i915_gem_wait_multi_ioctl, DRM_AUTH|DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_CONTEXT_CREATE, i915_gem_context_create_ioctl, DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_CONTEXT_DESTROY, i915_gem_context_destroy_ioctl, DRM_UNLOCKED, NULL, NULL),
 	I915_IOCTL_DEF(DRM_IOCTL_I915_REG_READ, i915_reg_read_ioctl, DRM_UNLOCKED, NULL, NULL),
+	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_CONTEXT_GETPARAM, i915_gem_context_getparam_ioctl, DRM_UNLOCKED, NULL, NULL),
+	I915_IOCTL_DEF(DRM_IOCTL_I915_GEM_CONTEXT_SETPARAM, i915_gem_context_setparam_ioctl, DRM_UNLOCKED, NULL, NULL),
 };
 
 int i915_max_ioctl = DRM_ARRAY_SIZE(i915_ioctls);
@@ -73,11 +73,29 @@ int i915_vbt_sdvo_panel_type = -1;
 
 bool i915_try_reset = false; 
 bool i915_enable_hangcheck = true;
+/* 1 aliasing PPGTT, 2 also one per context (gen7), -1 auto */
 int i915_enable_ppgtt = -1;
 
 int i915_disable_power_well = 1;
 int i915_enable_ips = 1;
 
+/* seqno waits spin this long (us) before sleeping on the user interrupt */
+int i915_wait_spin_us = 20;
+/* period (ms) at which a sleeping seqno wait rechecks for a missed IRQ */
+int i915_wait_watchdog_ms = 10;
+/* wake only satisfied waiters on a user interrupt; 0 wakes every waiter */
+int i915_wait_sorted = 1;
+/* a waiting submission gains one priority level per this many us waited */
+int i915_sched_age_us = 1000;
+/* contexts kept pinned after switching away, up to I915_CTX_CACHE_MAX */
+int i915_ctx_cache_size = 4;
+/* retire requests from the user interrupt rather than only the 1s timer */
+int i915_retire_irq = 1;
+/* delay (us) from a user interrupt to the retire pass, to batch IRQs */
+int i915_retire_coalesce_us = 0;
+/* GTT mmap faults map this much (KB) around the faulting page at once */
+int i915_fault_prefault_kb = 1024;
+
 static void *i915_statep;
 
 static int i915_info(dev_info_t *, ddi_info_cmd_t, void *, void **);
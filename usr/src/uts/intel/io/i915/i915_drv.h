@@ -253,6 +253,8 @@ struct drm_i915_fence_reg {
 	struct list_head lru_list;
 	struct drm_i915_gem_object *obj;
 	int pin_count;
+	uint64_t val;		/* last value written, if val_valid */
+	bool val_valid;
 };
 
 #define I2C_NAME_SIZE	20
@@ -481,6 +483,14 @@ struct i915_gtt {
 				uint32_t type);
 	void (*gtt_insert_entries)(struct drm_i915_gem_object *obj,
 				   enum i915_cache_level cache_level);
+	/* num_pages of obj from first_page on, at gtt_offset */
+	void (*gtt_clear_view)(struct drm_i915_gem_object *obj,
+			       unsigned first_page, unsigned num_pages,
+			       uint32_t gtt_offset);
+	void (*gtt_insert_view)(struct drm_i915_gem_object *obj,
+				unsigned first_page, unsigned num_pages,
+				uint32_t gtt_offset,
+				enum i915_cache_level cache_level);
 	gen6_gtt_pte_t (*pte_encode)(struct drm_device *dev,
 				     uint64_t addr,
 				     enum i915_cache_level level);
@@ -489,6 +499,8 @@ struct i915_gtt {
 
 #define I915_PPGTT_PD_ENTRIES 512
 #define I915_PPGTT_PT_ENTRIES 1024
+#define I915_PPGTT_SIZE \
+	((unsigned long)I915_PPGTT_PD_ENTRIES * I915_PPGTT_PT_ENTRIES * PAGE_SIZE)
 struct i915_hw_ppgtt {
 	struct drm_device *dev;
 	unsigned num_pd_entries;
@@ -511,6 +523,31 @@ struct i915_hw_ppgtt {
 				     enum i915_cache_level level);
 	int (*enable)(struct drm_device *dev);
 	void (*cleanup)(struct i915_hw_ppgtt *ppgtt);
+
+	/*
+	 * A context's own address space, see i915_ppgtt_create(). The
+	 * aliasing PPGTT mirrors the global GTT and has none of this.
+	 */
+	struct drm_mm_node *pd_node;	/* page directory's global GTT slot */
+	struct drm_mm mm;
+	struct list_head vma_list;	/* bound, least recently used first */
+	struct list_head link;		/* on mm.ppgtt_list */
+	unsigned long bound;		/* bytes bound */
+	int vma_count;
+};
+
+/*
+ * An object's binding into a context's PPGTT. Holds the object's pages
+ * pinned; pin_count keeps it in place while an execbuffer uses it.
+ */
+struct i915_vma {
+	struct drm_mm_node *node;
+	struct drm_i915_gem_object *obj;
+	struct i915_hw_ppgtt *ppgtt;
+	struct list_head obj_link;	/* on obj->vma_list */
+	struct list_head vm_link;	/* on ppgtt->vma_list */
+	struct list_head evict_link;
+	unsigned int pin_count;
 };
 
 struct i915_ctx_hang_stats {
@@ -523,6 +560,28 @@ struct i915_ctx_hang_stats {
 
 /* This must match up with the value previously used for execbuf2.rsvd1. */
 #define DEFAULT_CONTEXT_ID 0
+/*
+ * Submission scheduling state of a context, or of a file's batches on the
+ * default context. See i915_gem_sched.c; protected by i915_sched.lock.
+ */
+struct i915_sched_entity {
+	int priority;
+	int queued;		/* submissions waiting for the slot */
+	int inflight;		/* requests not yet retired */
+	uint64_t vruntime;	/* GPU ns used, floored on return from idle */
+	uint64_t submitted;
+	uint64_t wait_ns;
+	uint64_t wait_max_ns;
+	uint64_t gpu_ns;
+};
+
+struct i915_sched {
+	kmutex_t lock;
+	bool busy;		/* a submitter holds the slot */
+	struct list_head waiters;
+	uint64_t vruntime_floor;
+};
+
 struct i915_hw_context {
 	struct kref ref;
 	int id;
@@ -531,6 +590,10 @@ struct i915_hw_context {
 	struct intel_ring_buffer *ring;
 	struct drm_i915_gem_object *obj;
 	struct i915_ctx_hang_stats hang_stats;
+	struct i915_sched_entity sched;
+	u64 last_switch;	/* ring->ctx_switches when last switched to */
+	u32 cache_hits;		/* switches to it found it still pinned */
+	struct i915_hw_ppgtt *ppgtt;	/* own address space, if any */
 };
 
 enum no_fbc_reason {
@@ -833,6 +896,13 @@ struct i915_gem_mm {
 	 * (presumably uncached) pages still attached.
 	 */
 	struct list_head unbound_list;
+	/**
+	 * Objects userspace marked I915_MADV_DONTNEED, oldest first.
+	 * Their backing pages are released under memory pressure by
+	 * the reclaim callback of purge_cache.
+	 */
+	struct list_head purgeable_list;
+	kmem_cache_t *purge_cache;
 
 	/** Usable portion of the GTT for GEM */
 	unsigned long stolen_base; /* limited to low memory (32-bit) */
@@ -841,6 +911,12 @@ struct i915_gem_mm {
 
 	/** PPGTT used for aliasing the PPGTT with the GTT */
 	struct i915_hw_ppgtt *aliasing_ppgtt;
+	/** Contexts get their own PPGTT, see i915_enable_ppgtt */
+	bool full_ppgtt;
+	struct list_head ppgtt_list;
+
+	/** Objects GTT mmapped through a partial view, see i915_gem_fault() */
+	struct list_head fault_view_list;
 
 	/**
 	 * List of objects currently involved in rendering.
@@ -878,6 +954,20 @@ struct i915_gem_mm {
 	struct work_struct retire_work;
 	struct timer_list retire_timer;
 
+	/**
+	 * While a ring has requests outstanding it holds a user IRQ
+	 * reference, and each user interrupt queues retire_irq_work
+	 * (after i915_retire_coalesce_us, if set) so completed objects
+	 * are retired promptly. retire_timer remains as the fallback.
+	 * retire_irq_pending is set while a retire pass is queued, so
+	 * interrupts arriving meanwhile are folded into it. Once
+	 * retire_irq_shutdown is set at unload nothing is queued any more.
+	 */
+	struct work_struct retire_irq_work;
+	timeout_id_t retire_irq_timer;
+	volatile uint_t retire_irq_pending;
+	volatile uint_t retire_irq_shutdown;
+
 	/**
 	 * Are we in a non-interruptible section of code like
 	 * modesetting?
@@ -1007,6 +1097,62 @@ struct intel_vbt_data {
 	struct child_device_config *child_dev;
 };
 
+/*
+ * Driver statistics, exported through the i915:<instance>:i915stat kstat
+ * (see i915_kstat.c, which names each counter).
+ */
+enum i915_stat {
+	I915_STAT_WAIT_SPIN,		/* seqno waits completed while spinning */
+	I915_STAT_WAIT_SLEEP,		/* seqno waits that slept on the IRQ */
+	I915_STAT_WAIT_MISSED_IRQ,	/* sleeps ended by the missed-IRQ watchdog */
+	I915_STAT_WAIT_WOKEN,		/* waiters signalled by the user IRQ */
+	I915_STAT_WAIT_SPURIOUS,	/* wakeups with the seqno not yet passed */
+	I915_STAT_RELOC_APPLIED,	/* relocations written into objects */
+	I915_STAT_RELOC_SKIPPED,	/* relocations whose presumed offset held */
+	I915_STAT_RETIRE_IRQ,		/* retire passes run from the user IRQ */
+	I915_STAT_RETIRE_LAT_NS,	/* total ns from user IRQ to retirement */
+	I915_STAT_SCHED_WAIT,		/* execbuffers that waited for the slot */
+	I915_STAT_SCHED_WAIT_NS,	/* total ns spent waiting for it */
+	I915_STAT_RING_STALL,		/* intel_ring_begin waits for space */
+	I915_STAT_RING_STALL_NS,	/* total ns spent waiting for it */
+	I915_STAT_FENCE_HIT,		/* objects that still had their fence */
+	I915_STAT_FENCE_MISS,		/* objects given a fence register */
+	I915_STAT_FENCE_STEAL,		/* misses that took another's fence */
+	I915_STAT_FENCE_WRITE_SKIPPED,	/* fence writes of the value it held */
+	I915_STAT_PPGTT_SWITCH,		/* page directory loads on a ring */
+	I915_STAT_VMA_BIND,		/* objects bound into a context's PPGTT */
+	I915_STAT_VMA_EVICT,		/* and unbound to make room there */
+	I915_STAT_GTT_FAULT,		/* GTT mmap faults */
+	I915_STAT_GTT_FAULT_BYTES,	/* bytes they mapped */
+	I915_STAT_GTT_FAULT_VIEW,	/* partial views bound for them */
+	I915_STAT_NUM
+};
+
+#define	I915_STAT_INC(dev_priv, stat) \
+	atomic_inc_64(&(dev_priv)->stats[(stat)])
+#define	I915_STAT_ADD(dev_priv, stat, n) \
+	atomic_add_64(&(dev_priv)->stats[(stat)], (n))
+
+/*
+ * Latency histograms, each exported as its own kstat in the i915 module
+ * with log2 microsecond buckets (see i915_kstat.c).
+ */
+enum i915_hist {
+	I915_HIST_RING_STALL,		/* waits for ring space */
+	I915_HIST_EXEC_LOCK,		/* execbuffer phases, see */
+	I915_HIST_EXEC_LOOKUP,		/* i915_gem_do_execbuffer() */
+	I915_HIST_EXEC_RESERVE,
+	I915_HIST_EXEC_RELOC,
+	I915_HIST_EXEC_FLUSH,
+	I915_HIST_EXEC_SWITCH,
+	I915_HIST_EXEC_DISPATCH,
+	I915_HIST_EXEC_TOTAL,
+	I915_HIST_GTT_FAULT,		/* GTT mmap faults */
+	I915_HIST_NUM
+};
+
+#define	I915_HIST_BUCKETS	24	/* <1us, <2us, ... <2^22us, >= 2^22us */
+
 typedef struct drm_i915_private {
 	struct drm_device *dev;
 
@@ -1101,6 +1247,7 @@ typedef struct drm_i915_private {
 	bool no_aux_handshake;
 
 	struct drm_i915_fence_reg fence_regs[I915_MAX_NUM_FENCES]; /* assume 965 */
+	u32 fence_free; /* bit per fence register with no object */
 	int fence_reg_start; /* 4 if userland hasn't ioctl'd us yet */
 	int num_fence_regs; /* 8 on pre-965, 16 otherwise */
 
@@ -1129,6 +1276,9 @@ typedef struct drm_i915_private {
 
 	struct i915_gem_mm mm;
 
+	/* Execbuffer submission slot, see i915_gem_sched.c */
+	struct i915_sched sched;
+
 	/* Kernel Modesetting */
 
 	struct sdvo_device_mapping sdvo_mappings[2];
@@ -1188,6 +1338,12 @@ typedef struct drm_i915_private {
 
 	struct drm_i915_gem_object *fbcon_obj;
 
+	kstat_t *ksp;
+	volatile uint64_t stats[I915_STAT_NUM];
+	kstat_t *hist_ksp[I915_HIST_NUM];
+	kstat_t *ctx_ksp;
+	volatile uint64_t hist[I915_HIST_NUM][I915_HIST_BUCKETS];
+
 	/* Old dri1 support infrastructure, beware the dragons ya fools entering
 	 * here! */
 	struct i915_dri1_state dri1;
@@ -1242,6 +1398,10 @@ struct drm_i915_gem_object {
 	struct list_head mm_list;
 	/** This object's place on eviction list */
 	struct list_head exec_list;
+	/** This object's place on mm.purgeable_list while DONTNEED */
+	struct list_head purge_list;
+	/** Its bindings into contexts' PPGTTs, struct i915_vma */
+	struct list_head vma_list;
 
 	/**
 	 * This is set if the object is on the active or flushing lists
@@ -1262,6 +1422,8 @@ struct drm_i915_gem_object {
 	 * Protected by dev->struct_mutex.
 	 */
 	signed int fence_reg;
+	/** The fence register last held, preferred when it's free again */
+	signed int fence_hint;
 	
 	/**
 	 * Advice: are the backing pages purgeable?
@@ -1307,6 +1469,16 @@ struct drm_i915_gem_object {
 	unsigned int fault_mappable;
 	unsigned int pin_mappable;
 
+	/**
+	 * Slot of mappable GTT space the object is faulted through when
+	 * it is not bound there as a whole, mapping fault_view_offset on.
+	 */
+	struct drm_mm_node *fault_view;
+	unsigned long fault_view_offset;
+	struct list_head fault_view_link;
+	/** Pages of the GTT mmap loaded, one bit per page */
+	unsigned long *fault_loaded;
+
 	/*
 	 * Is the GPU currently using a fence to access this buffer,
 	 */
@@ -1320,6 +1492,8 @@ struct drm_i915_gem_object {
 	unsigned int has_dma_mapping;
 
 	caddr_t *page_list;
+	/** Pages the CPU may hold cache lines for, one bit per page */
+	unsigned long *cpu_dirty;
 	int pages_pin_count;
 	
 	/**
@@ -1396,6 +1570,7 @@ struct drm_i915_gem_request {
 
 	/** Postion in the ringbuffer of the end of the request */
 	u32 tail;
+	u64 tail_pos;	/* and as a running ring position */
 
 	/** Context related to this request */
 	struct i915_hw_context *ctx;
@@ -1405,6 +1580,7 @@ struct drm_i915_gem_request {
 
 	/** Time at which this request was emitted, in jiffies. */
 	unsigned long emitted_jiffies;
+	hrtime_t emitted_ns;
 
 	/** global list entry for this request */
 	struct list_head list;
@@ -1412,6 +1588,14 @@ struct drm_i915_gem_request {
 	struct drm_i915_file_private *file_priv;
 	/** file_priv list entry for this request */
 	struct list_head client_list;
+
+	/** Completion event for I915_EXEC_FENCE_EVENT, under event_lock */
+	struct drm_i915_pending_fence *fence;
+};
+
+struct drm_i915_pending_fence {
+	struct drm_pending_event base;
+	struct drm_i915_event_fence event;
 };
 
 struct drm_i915_file_private {
@@ -1424,6 +1608,7 @@ struct drm_i915_file_private {
 	struct idr context_idr;
 
 	struct i915_ctx_hang_stats hang_stats;
+	struct i915_sched_entity sched;	/* for the default context */
 };
 
 #if defined(__sun)
@@ -1578,6 +1763,14 @@ extern bool i915_try_reset;
 extern int i915_enable_ppgtt;
 extern int i915_disable_power_well;
 extern int i915_enable_ips;
+extern int i915_wait_spin_us;
+extern int i915_wait_watchdog_ms;
+extern int i915_wait_sorted;
+extern int i915_sched_age_us;
+extern int i915_ctx_cache_size;
+extern int i915_retire_irq;
+extern int i915_retire_coalesce_us;
+extern int i915_fault_prefault_kb;
 
 extern int i915_suspend(struct drm_device *dev);
 extern int i915_resume(struct drm_device *dev);
@@ -1620,6 +1813,8 @@ extern void gpu_top_handler(void *data);
 /* i915_irq.c */
 void i915_hangcheck_elapsed(void* data);
 void i915_handle_error(struct drm_device *dev, bool wedged);
+int i915_waiter_compare(const void *a, const void *b);
+void i915_ring_wake_waiters(struct intel_ring_buffer *ring, bool all);
 
 extern void intel_irq_init(struct drm_device *dev);
 extern void intel_pm_init(struct drm_device *dev);
@@ -1646,6 +1841,8 @@ int i915_gem_init_ioctl(DRM_IOCTL_ARGS);
 int i915_gem_create_ioctl(DRM_IOCTL_ARGS);
 int i915_gem_pread_ioctl(DRM_IOCTL_ARGS);
 int i915_gem_pwrite_ioctl(DRM_IOCTL_ARGS);
+int i915_gem_pread_rect_ioctl(DRM_IOCTL_ARGS);
+int i915_gem_pwrite_rect_ioctl(DRM_IOCTL_ARGS);
 int i915_gem_mmap_ioctl(DRM_IOCTL_ARGS);
 int i915_gem_mmap_gtt_ioctl(DRM_IOCTL_ARGS);
 int i915_gem_set_domain_ioctl(DRM_IOCTL_ARGS);
@@ -1665,7 +1862,9 @@ int i915_gem_set_tiling(DRM_IOCTL_ARGS);
 int i915_gem_get_tiling(DRM_IOCTL_ARGS);
 int i915_gem_get_aperture_ioctl(DRM_IOCTL_ARGS);
 int i915_gem_wait_ioctl(DRM_IOCTL_ARGS);
+int i915_gem_wait_multi_ioctl(DRM_IOCTL_ARGS);
 void i915_gem_load(struct drm_device *dev);
+void i915_gem_unload(struct drm_device *dev);
 int i915_gem_init_object(struct drm_gem_object *obj);
 void i915_gem_object_init(struct drm_i915_gem_object *obj,
 			 const struct drm_i915_gem_object_ops *ops);
@@ -1679,6 +1878,8 @@ int i915_gem_object_pin(struct drm_i915_gem_object *obj,
 void i915_gem_object_unpin(struct drm_i915_gem_object *obj);
 int i915_gem_object_unbind(struct drm_i915_gem_object *obj, uint32_t type);
 void i915_gem_release_mmap(struct drm_i915_gem_object *obj);
+int i915_gem_object_release_fault_view(struct drm_i915_gem_object *obj);
+int i915_gem_release_fault_views(struct drm_device *dev);
 void i915_gem_lastclose(struct drm_device *dev);
 
 static inline void i915_gem_object_pin_pages(struct drm_i915_gem_object *obj)
@@ -1740,6 +1941,7 @@ i915_gem_object_unpin_fence(struct drm_i915_gem_object *obj)
 }
 
 void i915_gem_retire_requests(struct drm_device *dev);
+void i915_gem_retire_irq_kick(drm_i915_private_t *dev_priv);
 void i915_gem_retire_requests_ring(struct intel_ring_buffer *ring);
 int i915_gem_check_wedge(struct i915_gpu_error *error,
 				      bool interruptible);
@@ -1756,6 +1958,8 @@ static inline bool i915_terminally_wedged(struct i915_gpu_error *error)
 
 void i915_gem_reset(struct drm_device *dev);
 void i915_gem_clflush_object(struct drm_i915_gem_object *obj);
+void i915_gem_clflush_range(struct drm_i915_gem_object *obj,
+    uint64_t offset, uint64_t size);
 int i915_gem_object_set_domain(struct drm_i915_gem_object *obj,
 			       uint32_t read_domains,
 			       uint32_t write_domain);
@@ -1767,6 +1971,10 @@ void i915_gem_init_swizzling(struct drm_device *dev);
 void i915_gem_cleanup_ringbuffer(struct drm_device *dev);
 int i915_gpu_idle(struct drm_device *dev);
 int i915_gem_idle(struct drm_device *dev, uint32_t type);
+struct drm_i915_pending_fence *i915_gem_fence_event_alloc(struct drm_device *dev,
+    struct drm_file *file, uint64_t user_data);
+void i915_gem_fence_event_free(struct drm_device *dev,
+    struct drm_i915_pending_fence *fence);
 int __i915_add_request(struct intel_ring_buffer *ring,
 		       struct drm_file *file,
 		       struct drm_i915_gem_object *batch_obj,
@@ -1775,7 +1983,7 @@ int __i915_add_request(struct intel_ring_buffer *ring,
 	__i915_add_request(ring, NULL, NULL, seqno)
 int i915_wait_seqno(struct intel_ring_buffer *ring,
 				 uint32_t seqno);
-void i915_gem_fault(struct drm_gem_object *obj);
+int i915_gem_fault(struct drm_gem_object *obj, offset_t *offp, size_t *lenp);
 int i915_gem_object_set_to_gtt_domain(struct drm_i915_gem_object *obj,
 				  bool write);
 int
@@ -1807,11 +2015,34 @@ void i915_gem_restore_fences(struct drm_device *dev);
 void i915_gem_context_init(struct drm_device *dev);
 void i915_gem_context_fini(struct drm_device *dev);
 void i915_gem_context_close(struct drm_device *dev, struct drm_file *file);
+void i915_gem_context_cache_flush(struct drm_device *dev);
 int i915_switch_context(struct intel_ring_buffer *ring,
 			struct drm_file *file, int to_id);
 void i915_gem_context_free(struct kref *ctx_ref);
 void i915_gem_context_reference(struct i915_hw_context *ctx);
 void i915_gem_context_unreference(struct i915_hw_context *ctx);
+struct i915_sched_entity *
+i915_gem_context_sched_entity(struct drm_file *file, u32 id,
+			      struct i915_hw_context **ctxp);
+struct i915_hw_ppgtt *
+i915_gem_context_get_ppgtt(struct drm_file *file, u32 id,
+			   struct i915_hw_context **ctxp);
+int i915_gem_context_getparam_ioctl(DRM_IOCTL_ARGS);
+int i915_gem_context_setparam_ioctl(DRM_IOCTL_ARGS);
+
+/* i915_gem_sched.c */
+void i915_sched_init(struct drm_device *dev);
+void i915_sched_fini(struct drm_device *dev);
+void i915_sched_entity_init(struct i915_sched_entity *entity);
+int i915_sched_enter(struct drm_device *dev, struct i915_sched_entity *entity,
+    struct i915_hw_context *ctx);
+void i915_sched_exit(struct drm_device *dev);
+void i915_sched_request_add(struct drm_device *dev,
+    struct i915_sched_entity *entity);
+void i915_sched_request_retire(struct drm_device *dev,
+    struct i915_sched_entity *entity, uint64_t gpu_ns);
+uint64_t i915_sched_entity_stat(struct drm_device *dev,
+    struct i915_sched_entity *entity, uint64_t param);
 
 struct i915_ctx_hang_stats *
 i915_gem_context_get_hang_stats(struct intel_ring_buffer *ring,
@@ -1827,12 +2058,27 @@ void i915_ppgtt_bind_object(struct i915_hw_ppgtt *ppgtt,
 			    enum i915_cache_level cache_level);
 void i915_ppgtt_unbind_object(struct i915_hw_ppgtt *ppgtt,
 			      struct drm_i915_gem_object *obj);
+struct i915_hw_ppgtt *i915_ppgtt_create(struct drm_device *dev);
+void i915_ppgtt_destroy(struct i915_hw_ppgtt *ppgtt);
+int i915_ppgtt_switch(struct intel_ring_buffer *ring,
+		      struct i915_hw_ppgtt *ppgtt);
+struct i915_vma *i915_vma_lookup(struct i915_hw_ppgtt *ppgtt,
+				 struct drm_i915_gem_object *obj);
+int i915_vma_bind(struct i915_hw_ppgtt *ppgtt,
+		  struct drm_i915_gem_object *obj,
+		  uint32_t alignment, struct i915_vma **vmap);
+int i915_vma_unbind(struct i915_vma *vma);
+int i915_gem_object_unbind_vmas(struct drm_i915_gem_object *obj);
 
 void i915_gem_restore_gtt_mappings(struct drm_device *dev);
 int i915_gem_gtt_prepare_object(struct drm_i915_gem_object *obj);
 void i915_gem_gtt_bind_object(struct drm_i915_gem_object *obj,
 				enum i915_cache_level cache_level);
 void i915_gem_gtt_unbind_object(struct drm_i915_gem_object *obj, uint32_t type);
+void i915_gem_gtt_bind_view(struct drm_i915_gem_object *obj,
+			    struct drm_mm_node *node, unsigned long offset);
+void i915_gem_gtt_unbind_view(struct drm_i915_gem_object *obj,
+			      struct drm_mm_node *node, unsigned long offset);
 void i915_gem_gtt_finish_object(struct drm_i915_gem_object *obj);
 int i915_gem_init_global_gtt(struct drm_device *dev);
 void i915_gem_setup_global_gtt(struct drm_device *dev, unsigned long start,
@@ -1852,6 +2098,10 @@ int i915_gem_evict_something(struct drm_device *dev, int min_size,
 					  bool mappable,
 					  bool nonblock);
 int i915_gem_evict_everything(struct drm_device *dev);
+int i915_ppgtt_evict_something(struct i915_hw_ppgtt *ppgtt,
+			       unsigned long min_size, unsigned alignment,
+			       unsigned cache_level);
+int i915_ppgtt_evict_everything(struct i915_hw_ppgtt *ppgtt);
 
 /* i915_gem_stolen.c */
 int i915_gem_init_stolen(struct drm_device *dev);
@@ -1876,9 +2126,24 @@ inline static bool i915_gem_object_needs_bit17_swizzle(struct drm_i915_gem_objec
 		obj->tiling_mode != I915_TILING_NONE;
 }
 
+/* Bit 17 of the physical address of the object's nth page */
+inline static bool i915_gem_object_page_bit17(struct drm_i915_gem_object *obj,
+					      pgcnt_t n)
+{
+	return (ptob((uint64_t)obj->base.pfnarray[n]) & (1 << 17)) != 0;
+}
+
 void i915_gem_detect_bit_6_swizzle(struct drm_device *dev);
+void i915_gem_swizzle_copy(caddr_t page, caddr_t linear, int offset,
+			   int length, bool is_read);
 void i915_gem_object_do_bit_17_swizzle(struct drm_i915_gem_object *obj);
 void i915_gem_object_save_bit_17_swizzle(struct drm_i915_gem_object *obj);
+int i915_gem_object_rect_range(struct drm_i915_gem_object *obj,
+			       struct drm_i915_gem_prw_rect *args,
+			       uint64_t *offset, uint64_t *size);
+int i915_gem_object_rect_copy(struct drm_i915_gem_object *obj,
+			      struct drm_i915_gem_prw_rect *args,
+			      bool is_read);
 
 /* i915_gem_debug.c */
 void i915_gem_command_decode(uint32_t *data, int count, 
@@ -1897,6 +2162,12 @@ void i915_gem_object_check_coherency(struct drm_i915_gem_object *obj,
 void i915_gem_dump_object(struct drm_i915_gem_object *obj, int len,
 			  const char *where, uint32_t mark);
 
+/* i915_kstat.c */
+int i915_init_kstats(struct drm_device *dev);
+void i915_fini_kstats(struct drm_device *dev);
+void i915_hist_add(drm_i915_private_t *dev_priv, enum i915_hist hist,
+    hrtime_t ns);
+
 /* i915_suspend.c */
 extern int i915_save_state(struct drm_device *dev);
 extern int i915_restore_state(struct drm_device *dev);
@@ -36,9 +36,15 @@
 #include "i915_drm.h"
 #include "i915_drv.h"
 #include "intel_drv.h"
+#include <sys/int_limits.h>
 
 static void i915_gem_object_flush_gtt_write_domain(struct drm_i915_gem_object *obj);
+static void i915_gem_object_finish_gtt(struct drm_i915_gem_object *obj);
+static int i915_gem_object_wait_rendering(struct drm_i915_gem_object *obj,
+					  bool readonly);
 static void i915_gem_object_flush_cpu_write_domain(struct drm_i915_gem_object *obj);
+static void i915_gem_object_mark_cpu_dirty(struct drm_i915_gem_object *obj,
+					   uint64_t offset, uint64_t size);
 static int i915_gem_object_bind_to_gtt(struct drm_i915_gem_object *obj,
 						    unsigned alignment,
 						    bool map_and_fenceable,
@@ -250,76 +256,84 @@ i915_gem_create_ioctl(DRM_IOCTL_ARGS)
 			       args->size, &args->handle);
 }
 
-static inline void
-slow_shmem_bit17_copy(caddr_t gpu_page,
-		      int gpu_offset,
-		      uint32_t *cpu_page,
-		      int cpu_offset,
-		      int length,
-		      int is_read)
+/*
+ * Copy size bytes at offset in a bit-17 swizzled object to (is_read) or
+ * from the user. Runs of pages whose bit 17 is clear go straight to
+ * copyout/copyin; the others are swizzled through a bounce page, so every
+ * page costs at most one user copy.
+ */
+static int
+i915_gem_shmem_bit17_copy(struct drm_i915_gem_object *obj, uint64_t offset,
+			  caddr_t user_data, uint64_t size, bool is_read)
 {
+	pgcnt_t n, end;
+	caddr_t bounce = NULL;
+	int page_offset;
+	uint64_t length;
+	int ret = 0;
 
-	int ret;
-	/* Use the unswizzled path if this page isn't affected. */
-	if ((page_to_phys(gpu_page) & (1 << 17)) == 0) {
-		if (is_read)
-			ret = DRM_COPY_TO_USER(cpu_page + cpu_offset,
-					       gpu_page + gpu_offset, length);
-		else
-			ret = DRM_COPY_FROM_USER(gpu_page + gpu_offset,
-					       cpu_page + cpu_offset, length);
-		if (ret)
-			DRM_ERROR("slow_shmem_bit17_copy unswizzled path failed, ret = %d", ret);
-		return;
-	}
-
-	/* Copy the data, XORing A6 with A17 (1). The user already knows he's
-	 * XORing with the other bits (A9 for Y, A9 and A10 for X)
-	 */
-	while (length > 0) {
-		int cacheline_end = ALIGN(gpu_offset + 1, 64);
-		int this_length = min(cacheline_end - gpu_offset, length);
-		int swizzled_gpu_offset = gpu_offset ^ 64;
-
-		if (is_read) {
-			ret = DRM_COPY_TO_USER(cpu_page + cpu_offset,
-			       gpu_page + swizzled_gpu_offset,
-			       this_length);
+	while (size > 0) {
+		n = offset >> PAGE_SHIFT;
+		page_offset = offset & (PAGE_SIZE - 1);
+
+		if (!i915_gem_object_page_bit17(obj, n)) {
+			for (end = n + 1; ptob(end) < offset + size; end++)
+				if (i915_gem_object_page_bit17(obj, end))
+					break;
+			length = MIN(ptob(end) - offset, size);
+			if (is_read)
+				ret = DRM_COPY_TO_USER(user_data,
+				    obj->base.kaddr + offset, length);
+			else
+				ret = DRM_COPY_FROM_USER(
+				    obj->base.kaddr + offset, user_data,
+				    length);
 		} else {
-			ret = DRM_COPY_FROM_USER(gpu_page + swizzled_gpu_offset,
-			       cpu_page + cpu_offset,
-			       this_length);
+			if (bounce == NULL)
+				bounce = kmem_alloc(PAGE_SIZE, KM_SLEEP);
+			length = MIN(PAGE_SIZE - page_offset, size);
+			if (is_read) {
+				i915_gem_swizzle_copy(obj->page_list[n],
+				    bounce + page_offset, page_offset,
+				    length, true);
+				ret = DRM_COPY_TO_USER(user_data,
+				    bounce + page_offset, length);
+			} else {
+				ret = DRM_COPY_FROM_USER(bounce + page_offset,
+				    user_data, length);
+				if (ret == 0)
+					i915_gem_swizzle_copy(
+					    obj->page_list[n],
+					    bounce + page_offset,
+					    page_offset, length, false);
+			}
+		}
+		if (ret) {
+			DRM_ERROR("shmem_bit17_copy failed, ret = %d", ret);
+			ret = -EFAULT;
+			break;
 		}
-		cpu_offset += this_length;
-		gpu_offset += this_length;
-		length -= this_length;
+
+		offset += length;
+		user_data += length;
+		size -= length;
 	}
-	if (ret)
-		DRM_ERROR("slow_shmem_bit17_copy failed, ret = %d", ret);
 
+	if (bounce != NULL)
+		kmem_free(bounce, PAGE_SIZE);
+	return ret;
 }
 
-int
-/* LINTED */
-i915_gem_shmem_pread(struct drm_device *dev,
-		      struct drm_i915_gem_object *obj,
-		      struct drm_i915_gem_pread *args,
-		      struct drm_file *file_priv)
+/*
+ * Get obj's pages and make [offset, offset + size) coherent for reading
+ * through its kernel mapping. On success the pages are left pinned.
+ */
+static int
+i915_gem_shmem_prepare_read(struct drm_i915_gem_object *obj,
+			    uint64_t offset, uint64_t size)
 {
-	ssize_t remain, page_length;
-	uint32_t offset;
-	uint64_t first_data_page;
-	int shmem_page_index, shmem_page_offset;
-	int data_page_index,  data_page_offset;
-	int ret = 0;
-	uint64_t data_ptr = args->data_ptr;
-	int do_bit17_swizzling;
 	int needs_clflush = 0;
-	uint32_t *user_data = (uint32_t *)(uintptr_t)args->data_ptr;
-
-	remain = args->size;
-
-	do_bit17_swizzling = i915_gem_object_needs_bit17_swizzle(obj);
+	int ret;
 
 	if (!(obj->base.read_domains & I915_GEM_DOMAIN_CPU)) {
 		/* If we're not in the cpu read domain, set ourself into the gtt
@@ -335,51 +349,45 @@ i915_gem_shmem_pread(struct drm_device *dev,
 		}
 	}
 
+	/* Bound only in a context's PPGTT, the GPU may still be writing */
+	if (obj->gtt_space == NULL) {
+		ret = i915_gem_object_wait_rendering(obj, true);
+		if (ret)
+			return ret;
+	}
+
 	ret = i915_gem_object_get_pages(obj);
 	if (ret)
 		return ret;
 
 	i915_gem_object_pin_pages(obj);
 
-	first_data_page = data_ptr / PAGE_SIZE;
+	if (needs_clflush)
+		i915_gem_clflush_range(obj, offset, size);
 
-	offset = args->offset;
+	return 0;
+}
 
-	if (needs_clflush)
-		i915_gem_clflush_object(obj);
+int
+/* LINTED */
+i915_gem_shmem_pread(struct drm_device *dev,
+		      struct drm_i915_gem_object *obj,
+		      struct drm_i915_gem_pread *args,
+		      struct drm_file *file_priv)
+{
+	int ret = 0;
+	int do_bit17_swizzling;
+	uint32_t *user_data = (uint32_t *)(uintptr_t)args->data_ptr;
+
+	do_bit17_swizzling = i915_gem_object_needs_bit17_swizzle(obj);
+
+	ret = i915_gem_shmem_prepare_read(obj, args->offset, args->size);
+	if (ret)
+		return ret;
 
 	if (do_bit17_swizzling) {
-		while (remain > 0) {
-			/* Operation in this page
-			 *
-			 * shmem_page_index = page number within shmem file
-			 * shmem_page_offset = offset within page in shmem file
-			 * data_page_index = page number in get_user_pages return
-			 * data_page_offset = offset with data_page_index page.
-			 * page_length = bytes to copy for this page
-			 */
-			shmem_page_index = offset / DRM_PAGE_SIZE;
-			shmem_page_offset = offset & ~DRM_PAGE_MASK;
-			data_page_index = data_ptr / DRM_PAGE_SIZE - first_data_page;
-			data_page_offset = data_ptr & ~DRM_PAGE_MASK;
-
-			page_length = remain;
-			if ((shmem_page_offset + page_length) > DRM_PAGE_SIZE)
-				page_length = PAGE_SIZE - shmem_page_offset;
-			if ((data_page_offset + page_length) > DRM_PAGE_SIZE)
-				page_length = PAGE_SIZE - data_page_offset;
-
-				slow_shmem_bit17_copy(obj->page_list[shmem_page_index],
-						shmem_page_offset,
-						user_data + data_page_index * DRM_PAGE_SIZE,
-						data_page_offset,
-						page_length,
-						1);
-
-			remain -= page_length;
-			data_ptr += page_length;
-			offset += page_length;
-		}
+		ret = i915_gem_shmem_bit17_copy(obj, args->offset,
+		    (caddr_t)user_data, args->size, true);
 	} else {
 		ret = DRM_COPY_TO_USER((caddr_t)user_data,
 					obj->base.kaddr + args->offset,
@@ -387,6 +395,7 @@ i915_gem_shmem_pread(struct drm_device *dev,
 		if (ret)
 			DRM_ERROR("shmem_pread_copy failed, ret = %d", ret);
 	}
+	i915_gem_object_mark_cpu_dirty(obj, args->offset, args->size);
 	i915_gem_object_unpin_pages(obj);
 	return ret;
 }
@@ -472,48 +481,41 @@ out:
 	return ret;
 }
 
-int
-i915_gem_shmem_pwrite(struct drm_device *dev,
-			struct drm_i915_gem_object *obj,
-		      struct drm_i915_gem_pwrite *args,
-		      /* LINTED */
-		      struct drm_file *file_priv)
+/*
+ * Get obj's pages and make [offset, offset + size) ready to be written
+ * through its kernel mapping. On success the pages are left pinned, and
+ * i915_gem_shmem_finish_write is to be called with needs_clflush_after.
+ */
+static int
+i915_gem_shmem_prepare_write(struct drm_i915_gem_object *obj,
+			     uint64_t offset, uint64_t size,
+			     int *needs_clflush_after)
 {
-	ssize_t remain, page_length;
-	uint32_t offset;
-	uint64_t first_data_page;
-	int shmem_page_index, shmem_page_offset;
-	int data_page_index,  data_page_offset;
-	int ret = 0;
-	uint64_t data_ptr = args->data_ptr;
-	int needs_clflush_after = 0;
 	int needs_clflush_before = 0;
-	int do_bit17_swizzling;
-	uint32_t *user_data = (uint32_t *)(uintptr_t)args->data_ptr;
-
-	remain = args->size;
-
-	/* Pin the user pages containing the data.  We can't fault while
-	 * holding the struct mutex, and all of the pwrite implementations
-	 * want to hold it while dereferencing the user data.
-	 */
-	first_data_page = data_ptr / PAGE_SIZE;
-
-	do_bit17_swizzling = i915_gem_object_needs_bit17_swizzle(obj);
+	int ret;
 
+	*needs_clflush_after = 0;
 	if (obj->base.write_domain != I915_GEM_DOMAIN_CPU) {
 		/* If we're not in the cpu write domain, set ourself into the gtt
 		 * write domain and manually flush cachelines (if required). This
 		 * optimizes for the case when the gpu will use the data
 		 * right away and we therefore have to clflush anyway. */
 		if (obj->cache_level == I915_CACHE_NONE)
-			needs_clflush_after = 1;
+			*needs_clflush_after = 1;
 		if (obj->gtt_space) {
 			ret = i915_gem_object_set_to_gtt_domain(obj, true);
 			if (ret)
 				return ret;
 		}
 	}
+
+	/* Bound only in a context's PPGTT, the GPU may still be using it */
+	if (obj->gtt_space == NULL) {
+		ret = i915_gem_object_wait_rendering(obj, false);
+		if (ret)
+			return ret;
+	}
+
 	/* Same trick applies for invalidate partially written cachelines before
 	 * writing.  */
 	if (!(obj->base.read_domains & I915_GEM_DOMAIN_CPU)
@@ -527,43 +529,49 @@ i915_gem_shmem_pwrite(struct drm_device *dev,
 	i915_gem_object_pin_pages(obj);
 
 	if (needs_clflush_before)
-		i915_gem_clflush_object(obj);
+		i915_gem_clflush_range(obj, offset, size);
 
-	offset = args->offset;
 	obj->dirty = 1;
+	return 0;
+}
+
+static void
+i915_gem_shmem_finish_write(struct drm_i915_gem_object *obj,
+			    uint64_t offset, uint64_t size,
+			    int needs_clflush_after)
+{
+	i915_gem_object_mark_cpu_dirty(obj, offset, size);
+
+	if (needs_clflush_after) {
+		i915_gem_clflush_range(obj, offset, size);
+		i915_gem_chipset_flush(obj->base.dev);
+	}
+
+	i915_gem_object_unpin_pages(obj);
+}
+
+int
+i915_gem_shmem_pwrite(struct drm_device *dev,
+			struct drm_i915_gem_object *obj,
+		      struct drm_i915_gem_pwrite *args,
+		      /* LINTED */
+		      struct drm_file *file_priv)
+{
+	int ret = 0;
+	int needs_clflush_after;
+	int do_bit17_swizzling;
+	uint32_t *user_data = (uint32_t *)(uintptr_t)args->data_ptr;
+
+	do_bit17_swizzling = i915_gem_object_needs_bit17_swizzle(obj);
+
+	ret = i915_gem_shmem_prepare_write(obj, args->offset, args->size,
+					   &needs_clflush_after);
+	if (ret)
+		return ret;
 
 	if (do_bit17_swizzling) {
-		while (remain > 0) {
-			/* Operation in this page
-			 *
-			 * shmem_page_index = page number within shmem file
-			 * shmem_page_offset = offset within page in shmem file
-			 * data_page_index = page number in get_user_pages return
-			 * data_page_offset = offset with data_page_index page.
-			 * page_length = bytes to copy for this page
-			 */
-			shmem_page_index = offset / DRM_PAGE_SIZE;
-			shmem_page_offset = offset & ~DRM_PAGE_MASK;
-			data_page_index = data_ptr / DRM_PAGE_SIZE - first_data_page;
-			data_page_offset = data_ptr & ~DRM_PAGE_MASK;
-
-			page_length = remain;
-			if ((shmem_page_offset + page_length) > DRM_PAGE_SIZE)
-				page_length = PAGE_SIZE - shmem_page_offset;
-			if ((data_page_offset + page_length) > DRM_PAGE_SIZE)
-				page_length = PAGE_SIZE - data_page_offset;
-
-				slow_shmem_bit17_copy(obj->page_list[shmem_page_index],
-						shmem_page_offset,
-						user_data + data_page_index * DRM_PAGE_SIZE,
-						data_page_offset,
-						page_length,
-						0);
-
-			remain -= page_length;
-			data_ptr += page_length;
-			offset += page_length;
-		}
+		ret = i915_gem_shmem_bit17_copy(obj, args->offset,
+		    (caddr_t)user_data, args->size, false);
 	} else {
 		ret = DRM_COPY_FROM_USER(obj->base.kaddr + args->offset,
 				(caddr_t)user_data,
@@ -572,10 +580,8 @@ i915_gem_shmem_pwrite(struct drm_device *dev,
 			DRM_ERROR("shmem_pwrite_copy failed, ret = %d", ret);
 	}
 
-	i915_gem_object_unpin_pages(obj);
-
-	if (needs_clflush_after)
-		i915_gem_chipset_flush(dev);
+	i915_gem_shmem_finish_write(obj, args->offset, args->size,
+				    needs_clflush_after);
 	return ret;
 }
 
@@ -651,6 +657,85 @@ unlock:
 	return ret;
 }
 
+static int
+i915_gem_rect_ioctl(struct drm_device *dev, struct drm_i915_gem_prw_rect *args,
+		    struct drm_file *file, bool is_read)
+{
+	struct drm_i915_gem_object *obj;
+	uint64_t offset, size;
+	int needs_clflush_after;
+	int ret;
+
+	ret = i915_mutex_lock_interruptible(dev);
+	if (ret)
+		return ret;
+
+	obj = to_intel_bo(drm_gem_object_lookup(dev, file, args->handle));
+	if (&obj->base == NULL) {
+		ret = -ENOENT;
+		goto unlock;
+	}
+
+	if (obj->phys_obj) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = i915_gem_object_rect_range(obj, args, &offset, &size);
+	if (ret)
+		goto out;
+
+	if (is_read) {
+		ret = i915_gem_shmem_prepare_read(obj, offset, size);
+		if (ret)
+			goto out;
+		ret = i915_gem_object_rect_copy(obj, args, true);
+		i915_gem_object_mark_cpu_dirty(obj, offset, size);
+		i915_gem_object_unpin_pages(obj);
+	} else {
+		ret = i915_gem_shmem_prepare_write(obj, offset, size,
+						   &needs_clflush_after);
+		if (ret)
+			goto out;
+		ret = i915_gem_object_rect_copy(obj, args, false);
+		i915_gem_shmem_finish_write(obj, offset, size,
+					    needs_clflush_after);
+	}
+
+	TRACE_GEM_OBJ_HISTORY(obj, is_read ? "pread rect" : "pwrite rect");
+
+out:
+	drm_gem_object_unreference(&obj->base);
+unlock:
+	mutex_unlock(&dev->struct_mutex);
+	return ret;
+}
+
+/**
+ * Reads a rectangle of a tiled object, detiled, without going through a
+ * fence or the mappable aperture.
+ *
+ * On error, the contents of *data are undefined.
+ */
+int
+/* LINTED */
+i915_gem_pread_rect_ioctl(DRM_IOCTL_ARGS)
+{
+	return i915_gem_rect_ioctl(dev, data, file, true);
+}
+
+/**
+ * Writes a rectangle of a tiled object from linear user data.
+ *
+ * On error, the contents of the rectangle are undefined.
+ */
+int
+/* LINTED */
+i915_gem_pwrite_rect_ioctl(DRM_IOCTL_ARGS)
+{
+	return i915_gem_rect_ioctl(dev, data, file, false);
+}
+
 int
 i915_gem_check_wedge(struct i915_gpu_error *error,
 		     bool interruptible)
@@ -695,7 +780,7 @@ i915_gem_check_olr(struct intel_ring_buffer *ring, u32 seqno)
  * @seqno: duh!
  * @reset_counter: reset sequence associated with the given seqno
  * @interruptible: do an interruptible wait (normally yes)
- * @timeout: in - how long to wait (NULL forever); out - how much time remaining
+ * @timeout: ticks to wait, 0 for the default of 3 seconds, negative for no bound
  *
  * Note: It is of utmost importance that the passed in seqno and reset_counter
  * values have been read by the caller in an smp safe manner. Where read-side
@@ -713,8 +798,13 @@ static int __wait_seqno(struct intel_ring_buffer *ring, u32 seqno,
 {
 	drm_i915_private_t *dev_priv = ring->dev->dev_private;
 	clock_t wait_time = timeout;
-	bool wait_forever = false;
-	int ret = 0, end = 0;
+	clock_t end_time, watchdog, left;
+	bool forever = timeout < 0;
+	hrtime_t spin_end;
+	struct i915_waiter waiter;
+	kcondvar_t *cv;
+	bool sorted;
+	int ret = 0, end;
 
 	if (i915_seqno_passed(ring->get_seqno(ring, true), seqno))
 		return 0;
@@ -723,58 +813,116 @@ static int __wait_seqno(struct intel_ring_buffer *ring, u32 seqno,
 		wait_time = 3 * DRM_HZ;
 	}
 
+#define EXIT_COND(lazy) \
+	(i915_seqno_passed(ring->get_seqno(ring, (lazy)), seqno) || \
+	 i915_reset_in_progress(&dev_priv->gpu_error) || \
+	 reset_counter != atomic_read(&dev_priv->gpu_error.reset_counter))
+
+	/*
+	 * Most waits are for work the GPU is about to finish, so spin on
+	 * the status page for a short while before paying for an interrupt
+	 * and a sleep. Only the status page is read here: frequently reading
+	 * CS registers may hang some GEN7 platforms.
+	 */
+	spin_end = gethrtime() + (hrtime_t)i915_wait_spin_us * 1000;
+	while (!EXIT_COND(true) && gethrtime() < spin_end)
+		udelay(1);
+
+	if (EXIT_COND(true)) {
+		I915_STAT_INC(dev_priv, I915_STAT_WAIT_SPIN);
+		goto check;
+	}
+
 	if (!ring->irq_get(ring))
 		return -ENODEV;
 
-#define EXIT_COND \
-	(i915_seqno_passed(ring->get_seqno(ring, false), seqno) || \
-	 i915_reset_in_progress(&dev_priv->gpu_error) || \
-	 reset_counter != atomic_read(&dev_priv->gpu_error.reset_counter))
-	do {
-		/* busy check is faster than cv wait on gen6+ */
-		if (IS_GEN6(ring->dev)) {
-			if (wait_for(EXIT_COND, jiffies_to_msecs(wait_time)))
-				ret = -EBUSY;	
-		} else if (IS_GEN7(ring->dev) && !IS_HASWELL(ring->dev)) {
-			/*
-			 * Frequently read CS register may cause my GEN7 platform hang,
-			 * but it's crucial for missed IRQ issue.
-			 * So the first wait busy check the seqno,
-			 * the second wait force correct ordering
-			 * between irq and seqno writes then check again.
-			 */
-			u32 *regs = ring->status_page.page_addr;
-			if (wait_for(i915_seqno_passed(regs[I915_GEM_HWS_INDEX],
-				seqno) || i915_reset_in_progress(&dev_priv->gpu_error) ||
-				reset_counter != atomic_read(&dev_priv->gpu_error.reset_counter),
-				 2500)) {
-				if (wait_for(i915_seqno_passed(ring->get_seqno(ring, false),
-					seqno) || i915_reset_in_progress(&dev_priv->gpu_error) ||
-					reset_counter != atomic_read(&dev_priv->gpu_error.reset_counter),
-					500)) {
-					ret = -EBUSY;
-				}
-			}
-		} else {
-			DRM_WAIT(ret, &ring->irq_queue, EXIT_COND);
+	I915_STAT_INC(dev_priv, I915_STAT_WAIT_SLEEP);
+
+	/*
+	 * Sleep until the user interrupt fires, but wake up every watchdog
+	 * period and check the seqno with forced coherency, so that a lost
+	 * or early interrupt costs us at most one period.
+	 */
+	watchdog = drv_usectohz(i915_wait_watchdog_ms * 1000);
+	if (watchdog < 1)
+		watchdog = 1;
+	end_time = ddi_get_lbolt() + wait_time;
+
+	/*
+	 * With i915_wait_sorted we sleep on our own cv, queued by seqno, and
+	 * the interrupt signals only us once our seqno passes. Otherwise
+	 * every waiter sleeps on irq_queue and every interrupt wakes them all.
+	 */
+	sorted = i915_wait_sorted != 0;
+	if (sorted) {
+		waiter.seqno = seqno;
+		waiter.woken = true;
+		cv_init(&waiter.cv, NULL, CV_DRIVER, NULL);
+		cv = &waiter.cv;
+	} else {
+		cv = &ring->irq_queue.cv;
+	}
+
+	mutex_enter(&ring->irq_queue.lock);
+	while (!EXIT_COND(true)) {
+		left = end_time - ddi_get_lbolt();
+		if (!forever && left <= 0) {
+			ret = -EBUSY;
+			break;
+		}
+		if (forever || left > watchdog)
+			left = watchdog;
+
+		if (sorted && waiter.woken) {
+			waiter.woken = false;
+			avl_add(&ring->waiters, &waiter);
 		}
 
-		/* We need to check whether any gpu reset happened in between
-		 * the caller grabbing the seqno and now ... */
-		if (reset_counter != atomic_read(&dev_priv->gpu_error.reset_counter))
-			ret = -EAGAIN;
+		if (interruptible)
+			end = cv_reltimedwait_sig(cv, &ring->irq_queue.lock,
+			    left, TR_CLOCK_TICK);
+		else
+			end = cv_reltimedwait(cv, &ring->irq_queue.lock,
+			    left, TR_CLOCK_TICK);
 
-		/* ... but upgrade the -EGAIN to an -EIO if the gpu is truely
-		 * gone. */
-		end = i915_gem_check_wedge(&dev_priv->gpu_error, interruptible);
-		if (end)
-			ret = end;
-	} while (end == 0 && wait_forever);
+		if (end == 0) {
+			ret = -EINTR;
+			break;
+		}
+		if (end == -1) {
+			if (EXIT_COND(false)) {
+				I915_STAT_INC(dev_priv,
+				    I915_STAT_WAIT_MISSED_IRQ);
+				break;
+			}
+		} else if (!EXIT_COND(true)) {
+			I915_STAT_INC(dev_priv, I915_STAT_WAIT_SPURIOUS);
+		}
+	}
+	if (sorted && !waiter.woken)
+		avl_remove(&ring->waiters, &waiter);
+	mutex_exit(&ring->irq_queue.lock);
 
+	if (sorted)
+		cv_destroy(&waiter.cv);
 
 	ring->irq_put(ring);
+
+check:
 #undef EXIT_COND
-	if (ret) {
+	/* We need to check whether any gpu reset happened in between
+	 * the caller grabbing the seqno and now ... */
+	if (reset_counter != atomic_read(&dev_priv->gpu_error.reset_counter))
+		ret = -EAGAIN;
+
+	/* ... but upgrade the -EGAIN to an -EIO if the gpu is truely
+	 * gone. */
+	end = i915_gem_check_wedge(&dev_priv->gpu_error, interruptible);
+	if (end)
+		ret = end;
+
+	/* A timeout the caller asked for is not worth reporting */
+	if (ret && ret != -EINTR && !(ret == -EBUSY && timeout != 0)) {
 		if ((gpu_dump > 0) && !IS_GEN7(ring->dev)) {
 			ring_dump(ring->dev, ring);
 			register_dump(ring->dev);
@@ -1026,6 +1174,22 @@ i915_gem_mmap_ioctl(DRM_IOCTL_ARGS)
 		return -E2BIG;
 	}
 
+	/* The CPU mapping is backed directly by the object pages */
+	mutex_lock(&dev->struct_mutex);
+	if (to_intel_bo(obj)->madv != I915_MADV_WILLNEED) {
+		DRM_ERROR("Attempting to mmap a purgeable buffer\n");
+		drm_gem_object_unreference(obj);
+		mutex_unlock(&dev->struct_mutex);
+		return -EINVAL;
+	}
+	ret = drm_gem_object_populate(obj);
+	if (ret) {
+		drm_gem_object_unreference(obj);
+		mutex_unlock(&dev->struct_mutex);
+		return ret;
+	}
+	mutex_unlock(&dev->struct_mutex);
+
 	ret = ddi_devmap_segmap(dev_id, (off_t)obj->maplist.user_token,
 	    ttoproc(curthread)->p_as, &vvaddr, obj->maplist.map->size,
 	    PROT_ALL, PROT_ALL, MAP_SHARED, credp);
@@ -1041,16 +1205,170 @@ i915_gem_mmap_ioctl(DRM_IOCTL_ARGS)
 	return 0;
 }
 
-void
-i915_gem_fault(struct drm_gem_object *obj)
+/*
+ * GTT mmap faults are served a window at a time: i915_fault_prefault_kb
+ * around the faulting page, rounded to whole rows of tiles, is made ready
+ * and loaded into the user's mapping at once, and only the pages of the
+ * mapping actually touched are ever loaded.
+ *
+ * An object is bound into the mappable aperture as a whole, as long as it
+ * takes at most half of it and fits without stalling. Otherwise just the
+ * window is bound, into a slot of mappable GTT space of its own, the
+ * object's partial view, which moves along as other windows are touched.
+ * A tiled object gets its fence on the view. Before gen4 fences must be
+ * power-of-two sized and aligned, so there tiled objects still have to be
+ * bound as a whole.
+ */
+static unsigned long
+i915_gem_fault_window(struct drm_i915_gem_object *obj)
+{
+	unsigned long window = (unsigned long)MAX(i915_fault_prefault_kb, 0) << 10;
+	unsigned long row;
+
+	window = roundup(MAX(window, PAGE_SIZE), PAGE_SIZE);
+	if (obj->tiling_mode != I915_TILING_NONE) {
+		row = obj->stride * (obj->tiling_mode == I915_TILING_Y ? 32 : 8);
+		window = roundup(window, row);
+	}
+	return window;
+}
+
+static bool
+i915_gem_fault_can_view(struct drm_i915_gem_object *obj)
+{
+	return obj->tiling_mode == I915_TILING_NONE ||
+	    INTEL_INFO(obj->base.dev)->gen >= 4;
+}
+
+/* Bind [offset, offset + size) of obj into a partial view */
+static int
+i915_gem_object_bind_fault_view(struct drm_i915_gem_object *obj,
+				unsigned long offset, unsigned long size)
+{
+	struct drm_device *dev = obj->base.dev;
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	struct drm_mm_node *node;
+	int ret;
+
+	ret = i915_gem_object_get_pages(obj);
+	if (ret)
+		return ret;
+
+	node = kzalloc(sizeof(*node), GFP_KERNEL);
+	if (node == NULL)
+		return -ENOMEM;
+
+	for (;;) {
+		ret = drm_mm_insert_node_in_range_generic(&dev_priv->mm.gtt_space,
+		    node, size, 0, obj->cache_level,
+		    0, dev_priv->gtt.mappable_end);
+		if (ret == 0)
+			break;
+
+		ret = i915_gem_evict_something(dev, size, 0, obj->cache_level,
+		    true, false);
+		if (ret) {
+			kfree(node, sizeof(*node));
+			return ret;
+		}
+	}
+
+	i915_gem_object_pin_pages(obj);
+	obj->fault_view = node;
+	obj->fault_view_offset = offset;
+	i915_gem_gtt_bind_view(obj, node, offset);
+	list_add_tail(&obj->fault_view_link, &dev_priv->mm.fault_view_list,
+	    (caddr_t)obj);
+	I915_STAT_INC(dev_priv, I915_STAT_GTT_FAULT_VIEW);
+
+	return 0;
+}
+
+/*
+ * Unbind obj's partial view, revoking the user mappings through it. The
+ * object can't have had a fence for a binding of its own meanwhile, see
+ * i915_gem_object_pin(), so its fence goes too.
+ */
+int
+i915_gem_object_release_fault_view(struct drm_i915_gem_object *obj)
+{
+	struct drm_mm_node *node = obj->fault_view;
+	int ret;
+
+	if (node == NULL)
+		return 0;
+
+	ret = i915_gem_object_put_fence(obj);
+	if (ret)
+		return ret;
+
+	i915_gem_object_finish_gtt(obj);
+	i915_gem_gtt_unbind_view(obj, node, obj->fault_view_offset);
+	drm_mm_put_block(node);
+	obj->fault_view = NULL;
+	list_del_init(&obj->fault_view_link);
+	i915_gem_object_unpin_pages(obj);
+
+	return 0;
+}
+
+/*
+ * Release every partial view to make room in the mappable aperture, they
+ * are made again on the next fault. Returns the number released.
+ */
+int
+i915_gem_release_fault_views(struct drm_device *dev)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	struct drm_i915_gem_object *obj, *next;
+	int count = 0;
+
+	list_for_each_entry_safe(obj, next, struct drm_i915_gem_object,
+	    &dev_priv->mm.fault_view_list, fault_view_link) {
+		if (i915_gem_object_release_fault_view(obj) == 0)
+			count++;
+	}
+
+	return count;
+}
+
+/* Load the pages of [start, end) not loaded yet, byte 0 being at base */
+static void
+i915_gem_fault_load(struct drm_i915_gem_object *obj, unsigned long base,
+		    unsigned long start, unsigned long end)
+{
+	struct drm_device *dev = obj->base.dev;
+	pgcnt_t i, run, last;
+
+	last = btop(end);
+	for (i = btop(start); i < last; i = run) {
+		if (test_bit(i, obj->fault_loaded)) {
+			run = i + 1;
+			continue;
+		}
+
+		for (run = i; run < last && !test_bit(run, obj->fault_loaded);
+		    run++)
+			set_bit(run, obj->fault_loaded);
+		drm_gem_mmap_range(&obj->base, ptob(i), ptob(run - i),
+		    dev->agp_aperbase + base + ptob(i));
+	}
+	obj->base.maplist.map->gtt_mmap = 1;
+}
+
+int
+i915_gem_fault(struct drm_gem_object *obj, offset_t *offp, size_t *lenp)
 {
 	struct drm_device *dev = obj->dev;
+	drm_i915_private_t *dev_priv = dev->dev_private;
 	struct drm_i915_gem_object *obj_priv = to_intel_bo(obj);
-	uint64_t start;
+	hrtime_t fault_start = gethrtime();
+	unsigned long window, start, end, base;
+	bool use_view, pinned = false;
 	int ret = 0;
 
-	if (obj->maplist.map->gtt_mmap)
-		return;
+	if (*offp >= obj->size)
+		return -EFAULT;
 
 	/* Now bind it into the GTT if needed */
 	mutex_lock(&dev->struct_mutex);
@@ -1063,9 +1381,52 @@ i915_gem_fault(struct drm_gem_object *obj)
 		goto unlock;
 	}
 
-	ret = i915_gem_object_pin(obj_priv, 0, true, false);
-	if (ret)
-		goto unlock;
+	if (obj_priv->fault_loaded == NULL)
+		obj_priv->fault_loaded = kmem_zalloc(
+		    BITS_TO_LONGS(btop(obj->size)) * sizeof(long), KM_SLEEP);
+
+	window = i915_gem_fault_window(obj_priv);
+	start = (*offp / window) * window;
+	end = MIN(start + window, obj->size);
+	if (end < *offp + *lenp)
+		end = MIN(roundup(*offp + *lenp, PAGE_SIZE), obj->size);
+
+	use_view = obj_priv->fault_view != NULL;
+	if (!use_view) {
+		if (!i915_gem_fault_can_view(obj_priv))
+			ret = i915_gem_object_pin(obj_priv, 0, true, false);
+		else if (obj->size <= dev_priv->gtt.mappable_end / 2 ||
+		    (obj_priv->gtt_space != NULL &&
+		    obj_priv->map_and_fenceable))
+			ret = i915_gem_object_pin(obj_priv, 0, true, true);
+		else
+			ret = -ENOSPC;
+
+		if (ret == 0)
+			pinned = true;
+		else if (ret == -ENOSPC && i915_gem_fault_can_view(obj_priv))
+			use_view = true;
+		else
+			goto unlock;
+	}
+
+	if (use_view) {
+		/* Move the view over if the window isn't within it */
+		if (obj_priv->fault_view != NULL &&
+		    (start < obj_priv->fault_view_offset ||
+		    end > obj_priv->fault_view_offset +
+		    obj_priv->fault_view->size)) {
+			ret = i915_gem_object_release_fault_view(obj_priv);
+			if (ret)
+				goto unlock;
+		}
+		if (obj_priv->fault_view == NULL) {
+			ret = i915_gem_object_bind_fault_view(obj_priv, start,
+			    end - start);
+			if (ret)
+				goto unlock;
+		}
+	}
 
 	ret = i915_gem_object_set_to_gtt_domain(obj_priv, 1);
 	if (ret)
@@ -1077,17 +1438,29 @@ i915_gem_fault(struct drm_gem_object *obj)
 
 	obj_priv->fault_mappable = true;
 
-	start = (dev->agp_aperbase + obj_priv->gtt_offset);
+	if (use_view)
+		base = obj_priv->fault_view->start -
+		    obj_priv->fault_view_offset;
+	else
+		base = obj_priv->gtt_offset;
 
-	/* Finally, remap it using the new GTT offset */
-	drm_gem_mmap(obj, start);
+	/* Finally, remap the window using the new GTT offset */
+	i915_gem_fault_load(obj_priv, base, start, end);
 
-	obj->maplist.map->gtt_mmap = 1;
+	*offp = start;
+	*lenp = end - start;
+
+	I915_STAT_INC(dev_priv, I915_STAT_GTT_FAULT);
+	I915_STAT_ADD(dev_priv, I915_STAT_GTT_FAULT_BYTES, end - start);
+	i915_hist_add(dev_priv, I915_HIST_GTT_FAULT,
+	    gethrtime() - fault_start);
 
 unpin:
-	i915_gem_object_unpin(obj_priv);
+	if (pinned)
+		i915_gem_object_unpin(obj_priv);
 unlock:
 	mutex_unlock(&dev->struct_mutex);
+	return ret;
 }
 
 /**
@@ -1104,9 +1477,21 @@ unlock:
 static int
 i915_gem_create_mmap_offset(struct drm_i915_gem_object *obj)
 {
-	struct ddi_umem_cookie *umem_cookie = obj->base.maplist.map->umem_cookie;
+	struct ddi_umem_cookie *umem_cookie;
 	int ret;
 
+	/* Repopulating a purged object would hide the purge */
+	if (obj->madv != I915_MADV_WILLNEED) {
+		DRM_ERROR("Attempting to mmap a purgeable buffer\n");
+		return -EINVAL;
+	}
+
+	/* The devmap setup needs the umem cookie of the backing store */
+	ret = drm_gem_object_populate(&obj->base);
+	if (ret)
+		return ret;
+	umem_cookie = obj->base.maplist.map->umem_cookie;
+
 	if (obj->base.gtt_map_kaddr == NULL) {
 		ret = drm_gem_create_mmap_offset(&obj->base);
 		if (ret) {
@@ -1143,21 +1528,13 @@ i915_gem_create_mmap_offset(struct drm_i915_gem_object *obj)
 void
 i915_gem_release_mmap(struct drm_i915_gem_object *obj)
 {
-	struct drm_device *dev = obj->base.dev;
-	struct gem_map_list *entry, *temp;
-
 	if (obj->base.maplist.map->gtt_mmap) {
-		mutex_lock(&dev->page_fault_lock);
-		if (!list_empty(&obj->base.seg_list)) {
-			list_for_each_entry_safe(entry, temp, struct gem_map_list, &obj->base.seg_list, head) {
-				devmap_unload(entry->dhp, entry->mapoffset, entry->maplen);
-				list_del(&entry->head);
-				drm_free(entry, sizeof (struct gem_map_list), DRM_MEM_MAPS);
-			}
-		}
-		mutex_unlock(&dev->page_fault_lock);
+		drm_gem_seg_unload(&obj->base);
 		drm_gem_release_mmap(&obj->base);
 		obj->base.maplist.map->gtt_mmap = 0;
+		if (obj->fault_loaded != NULL)
+			(void) memset(obj->fault_loaded, 0,
+			    BITS_TO_LONGS(btop(obj->base.size)) * sizeof(long));
 	}
 }
 
@@ -1166,6 +1543,11 @@ i915_gem_free_mmap_offset(struct drm_i915_gem_object *obj)
 {
 	drm_gem_free_mmap_offset(&obj->base);
 	obj->mmap_offset = 0;
+	if (obj->fault_loaded != NULL) {
+		kmem_free(obj->fault_loaded,
+		    BITS_TO_LONGS(btop(obj->base.size)) * sizeof(long));
+		obj->fault_loaded = NULL;
+	}
 }
 
 uint32_t
@@ -1236,7 +1618,10 @@ i915_gem_mmap_gtt(struct drm_file *file,
 		goto unlock;
 	}
 
-	if (obj->base.size > dev_priv->gtt.mappable_end) {
+	/* Larger objects are faulted through partial views, except tiled
+	 * ones before gen4, see i915_gem_fault() */
+	if (obj->base.size > dev_priv->gtt.mappable_end &&
+	    !i915_gem_fault_can_view(obj)) {
 		ret = -E2BIG;
 		goto out;
 	}
@@ -1280,6 +1665,44 @@ i915_gem_mmap_gtt_ioctl(DRM_IOCTL_ARGS)
 	return i915_gem_mmap_gtt(file, dev, args->handle, &args->offset);
 }
 
+static inline bool
+i915_gem_object_is_purgeable(struct drm_i915_gem_object *obj)
+{
+	return obj->madv == I915_MADV_DONTNEED;
+}
+
+/*
+ * The pages of an object mapped into a process are referenced by the
+ * devmap handles of that mapping; they have to stay until it goes away.
+ */
+static bool
+i915_gem_object_can_truncate(struct drm_i915_gem_object *obj)
+{
+	struct drm_local_map *map = obj->base.maplist.map;
+
+	/* Objects without GEM backing store (stolen) have nothing to give */
+	if (map == NULL)
+		return false;
+
+	return map->umem_cookie == NULL || map->umem_cookie->cook_refcnt == 0;
+}
+
+/* Immediately discard the backing storage */
+static void
+i915_gem_object_truncate(struct drm_i915_gem_object *obj)
+{
+	if (!i915_gem_object_can_truncate(obj))
+		return;
+
+	if (obj->mmap_offset)
+		i915_gem_free_mmap_offset(obj);
+
+	drm_gem_object_depopulate(&obj->base);
+
+	obj->madv = __I915_MADV_PURGED;
+	list_del_init(&obj->purge_list);
+}
+
 static void
 i915_gem_object_put_pages_gtt(struct drm_i915_gem_object *obj)
 {
@@ -1301,6 +1724,9 @@ i915_gem_object_put_pages_gtt(struct drm_i915_gem_object *obj)
 	kmem_free(obj->page_list,
 	    btop(obj->base.size) * sizeof(caddr_t));
 	obj->page_list = NULL;
+	kmem_free(obj->cpu_dirty,
+	    BITS_TO_LONGS(btop(obj->base.size)) * sizeof(long));
+	obj->cpu_dirty = NULL;
 }
 
 static int
@@ -1320,15 +1746,88 @@ i915_gem_object_put_pages(struct drm_i915_gem_object *obj)
 	obj->page_list = NULL;
 
 	list_del(&obj->global_list);
+
+	if (i915_gem_object_is_purgeable(obj))
+		i915_gem_object_truncate(obj);
+
 	return 0;
 }
 
+/*
+ * Walk the purgeable list and release the backing store of every idle
+ * object on it. Returns the number of bytes given back.
+ * Called with struct_mutex held.
+ */
+static long
+i915_gem_purge(struct drm_i915_private *dev_priv)
+{
+	struct drm_i915_gem_object *obj, *next;
+	long count = 0;
+
+	list_for_each_entry_safe(obj, next, struct drm_i915_gem_object,
+	    &dev_priv->mm.purgeable_list, purge_list) {
+		if (obj->active || obj->pin_count)
+			continue;
+		if (!i915_gem_object_can_truncate(obj))
+			continue;
+
+		/* Its PPGTT bindings and fault view hold the pages, the
+		 * object is idle */
+		if (i915_gem_object_unbind_vmas(obj))
+			continue;
+		if (i915_gem_object_release_fault_view(obj))
+			continue;
+		if (obj->pages_pin_count)
+			continue;
+
+		if (i915_gem_object_unbind(obj, 1))
+			continue;
+		if (i915_gem_object_put_pages(obj))
+			continue;
+
+		/* put_pages() only truncates objects that had pages */
+		if (obj->madv != __I915_MADV_PURGED)
+			i915_gem_object_truncate(obj);
+		count += obj->base.size;
+	}
+
+	return count;
+}
+
+/*
+ * kmem reclaim callback, run by the kmem reaper when the system is short
+ * of memory. Never block the reaper on the GEM lock, just try again on
+ * the next round.
+ */
+static void
+i915_gem_reclaim(void *arg)
+{
+	struct drm_device *dev = arg;
+	struct drm_i915_private *dev_priv = dev->dev_private;
+	long count;
+
+	if (!mutex_tryenter(&dev->struct_mutex))
+		return;
+
+	count = i915_gem_purge(dev_priv);
+	mutex_unlock(&dev->struct_mutex);
+
+	if (count)
+		DRM_DEBUG("purged %ld bytes of GEM objects", count);
+}
+
 static int
 i915_gem_object_get_pages_gtt(struct drm_i915_gem_object *obj)
 {
 	pgcnt_t np = btop(obj->base.size);
 	caddr_t va;
 	long i;
+	int ret;
+
+	/* First use of the object, allocate its backing store now */
+	ret = drm_gem_object_populate(&obj->base);
+	if (ret)
+		return ret;
 
 	obj->page_list = kmem_zalloc(np * sizeof(caddr_t), KM_SLEEP);
 	if (obj->page_list == NULL) {
@@ -1340,6 +1839,10 @@ i915_gem_object_get_pages_gtt(struct drm_i915_gem_object *obj)
 		obj->page_list[i] = va;
 	}
 
+	/* Nothing is known about the cache yet, the first flush does it all */
+	obj->cpu_dirty = kmem_alloc(BITS_TO_LONGS(np) * sizeof(long), KM_SLEEP);
+	(void) memset(obj->cpu_dirty, 0xff, BITS_TO_LONGS(np) * sizeof(long));
+
 	if (i915_gem_object_needs_bit17_swizzle(obj))
 		i915_gem_object_do_bit_17_swizzle(obj);
 	return 0;
@@ -1363,6 +1866,11 @@ i915_gem_object_get_pages(struct drm_i915_gem_object *obj)
 	if (obj->page_list)
 		return 0;
 
+	if (obj->madv != I915_MADV_WILLNEED) {
+		DRM_ERROR("Attempting to obtain a purgeable object\n");
+		return -EINVAL;
+	}
+
 	BUG_ON(obj->pages_pin_count);
 
 	ret = ops->get_pages(obj);
@@ -1394,8 +1902,12 @@ i915_gem_object_move_to_active(struct drm_i915_gem_object *obj,
 		obj->active = 1;
 	}
 
-	/* Move from whatever list we were on to the tail of execution. */
-	list_move_tail(&obj->mm_list, &dev_priv->mm.active_list, (caddr_t)obj);
+	/* Move from whatever list we were on to the tail of execution.
+	 * Objects only bound into contexts' PPGTTs are not on the GTT lists.
+	 */
+	if (obj->gtt_space)
+		list_move_tail(&obj->mm_list, &dev_priv->mm.active_list,
+		    (caddr_t)obj);
 	list_move_tail(&obj->ring_list, &ring->active_list, (caddr_t)obj);
 	obj->last_read_seqno = seqno;
 
@@ -1422,7 +1934,9 @@ i915_gem_object_move_to_inactive(struct drm_i915_gem_object *obj)
 	BUG_ON(obj->base.write_domain & ~I915_GEM_GPU_DOMAINS);
 	BUG_ON(!obj->active);
 
-	list_move_tail(&obj->mm_list, &dev_priv->mm.inactive_list, (caddr_t)obj);
+	if (obj->gtt_space)
+		list_move_tail(&obj->mm_list, &dev_priv->mm.inactive_list,
+		    (caddr_t)obj);
 
 	list_del_init(&obj->ring_list);
 	obj->ring = NULL;
@@ -1545,6 +2059,7 @@ int __i915_add_request(struct intel_ring_buffer *ring,
 	 * position of the head.
 	 */
 	request_ring_position = intel_ring_get_tail(ring);
+	request->tail_pos = ring->pos;
 
 	ret = ring->add_request(ring);
 	if (ret) {
@@ -1558,6 +2073,7 @@ int __i915_add_request(struct intel_ring_buffer *ring,
 	request->tail = request_ring_position;
 	request->ctx = ring->last_context;
 	request->batch_obj = obj;
+	request->fence = NULL;
 
 	/* Whilst this request exists, batch_obj will be on the
 	 * active_list, and so will hold the active reference. Only when this
@@ -1574,6 +2090,10 @@ int __i915_add_request(struct intel_ring_buffer *ring,
 	list_add_tail(&request->list, &ring->request_list, (caddr_t)request);
 	request->file_priv = NULL;
 
+	/* Keep the user interrupt on until the ring goes idle again */
+	if (i915_retire_irq && !ring->retire_irq && ring->irq_get(ring))
+		ring->retire_irq = true;
+
 	if (file) {
 		struct drm_i915_file_private *file_priv = file->driver_priv;
 		if (file_priv->status == 1) {
@@ -1585,6 +2105,12 @@ int __i915_add_request(struct intel_ring_buffer *ring,
 		}
 	}
 
+	request->emitted_ns = gethrtime();
+	if (request->ctx != NULL && request->ctx->file_priv != NULL)
+		i915_sched_request_add(ring->dev, &request->ctx->sched);
+	else if (request->file_priv != NULL)
+		i915_sched_request_add(ring->dev, &request->file_priv->sched);
+
 	ring->outstanding_lazy_request = 0;
 
 	if (!dev_priv->mm.suspended && !dev_priv->gpu_hang) {
@@ -1710,8 +2236,120 @@ static void i915_set_reset_status(struct intel_ring_buffer *ring,
 	}
 }
 
+static void
+i915_gem_fence_event_destroy(void *e, size_t size)
+{
+	/* drm_read and drm_events_release pass the size of a vblank event */
+	kfree(e, sizeof (struct drm_i915_pending_fence));
+}
+
+/*
+ * Reserve space in file's event queue for a fence event and allocate it.
+ * Returns NULL if the client has too many unread events.
+ */
+struct drm_i915_pending_fence *
+i915_gem_fence_event_alloc(struct drm_device *dev, struct drm_file *file,
+    uint64_t user_data)
+{
+	struct drm_i915_pending_fence *fence;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->event_lock, flags);
+	if (file->event_space < sizeof (fence->event)) {
+		spin_unlock_irqrestore(&dev->event_lock, flags);
+		return NULL;
+	}
+	file->event_space -= sizeof (fence->event);
+	spin_unlock_irqrestore(&dev->event_lock, flags);
+
+	fence = kzalloc(sizeof (*fence), GFP_KERNEL);
+	fence->event.base.type = I915_EVENT_FENCE;
+	fence->event.base.length = sizeof (fence->event);
+	fence->event.user_data = user_data;
+	fence->base.event = &fence->event.base;
+	fence->base.file_priv = file;
+	fence->base.pid = file->pid;
+	fence->base.destroy = i915_gem_fence_event_destroy;
+
+	return fence;
+}
+
+/* Give back a fence event that will not be sent */
+void
+i915_gem_fence_event_free(struct drm_device *dev,
+    struct drm_i915_pending_fence *fence)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->event_lock, flags);
+	fence->base.file_priv->event_space += sizeof (fence->event);
+	spin_unlock_irqrestore(&dev->event_lock, flags);
+
+	kfree(fence, sizeof (*fence));
+}
+
+static void
+i915_gem_request_signal_fence(struct drm_i915_gem_request *request)
+{
+	struct drm_device *dev = request->ring->dev;
+	struct drm_i915_pending_fence *fence;
+	struct drm_file *file;
+	unsigned long flags;
+
+	if (request->fence == NULL)
+		return;
+
+	spin_lock_irqsave(&dev->event_lock, flags);
+	fence = request->fence;
+	request->fence = NULL;
+	if (fence == NULL) {
+		spin_unlock_irqrestore(&dev->event_lock, flags);
+		return;
+	}
+	file = fence->base.file_priv;
+	fence->event.timestamp_ns = gethrtime();
+	list_add_tail(&fence->base.link, &file->event_list,
+	    (caddr_t)&fence->base);
+	DRM_WAKEUP(&file->event_wait);
+	spin_unlock_irqrestore(&dev->event_lock, flags);
+
+	pollwakeup(&file->drm_pollhead, POLLIN | POLLRDNORM);
+}
+
+/*
+ * Charge the GPU time of a completed request to the context, or the file,
+ * that submitted it. The GPU started on it when it was emitted or when
+ * the previous request on the ring retired, whichever was later.
+ */
+static void
+i915_gem_request_charge(struct drm_i915_gem_request *request)
+{
+	struct intel_ring_buffer *ring = request->ring;
+	struct drm_i915_file_private *file_priv = request->file_priv;
+	hrtime_t now = gethrtime();
+	hrtime_t start = MAX(request->emitted_ns, ring->last_retired_ns);
+	uint64_t gpu_ns = now > start ? now - start : 0;
+
+	ring->last_retired_ns = now;
+
+	if (request->ctx != NULL && request->ctx->file_priv != NULL) {
+		i915_sched_request_retire(ring->dev, &request->ctx->sched,
+		    gpu_ns);
+		return;
+	}
+	if (file_priv == NULL)
+		return;
+
+	spin_lock(&file_priv->mm.lock);
+	if (request->file_priv)
+		i915_sched_request_retire(ring->dev, &file_priv->sched, gpu_ns);
+	spin_unlock(&file_priv->mm.lock);
+}
+
 static void i915_gem_free_request(struct drm_i915_gem_request *request)
 {
+	i915_gem_request_signal_fence(request);
+	i915_gem_request_charge(request);
 	list_del(&request->list);
 	i915_gem_request_remove_from_client(request);
 
@@ -1721,6 +2359,15 @@ static void i915_gem_free_request(struct drm_i915_gem_request *request)
 	kfree(request, sizeof(*request));
 }
 
+static void
+i915_gem_retire_irq_put(struct intel_ring_buffer *ring)
+{
+	if (ring->retire_irq && list_empty(&ring->request_list)) {
+		ring->irq_put(ring);
+		ring->retire_irq = false;
+	}
+}
+
 static void i915_gem_reset_ring_lists(struct drm_i915_private *dev_priv,
 				      struct intel_ring_buffer *ring)
 {
@@ -1737,8 +2384,12 @@ static void i915_gem_reset_ring_lists(struct drm_i915_private *dev_priv,
 					   struct drm_i915_gem_request,
 					   list);
 
-		if (request->seqno > completed_seqno)
+		if (request->seqno > completed_seqno) {
 			i915_set_reset_status(ring, request, acthd);
+			if (request->fence)
+				request->fence->event.flags |=
+				    I915_FENCE_EVENT_RESET;
+		}
 
 		i915_gem_free_request(request);
 	}
@@ -1752,6 +2403,8 @@ static void i915_gem_reset_ring_lists(struct drm_i915_private *dev_priv,
 
 		i915_gem_object_move_to_inactive(obj);
 	}
+
+	i915_gem_retire_irq_put(ring);
 }
 
 void i915_gem_restore_fences(struct drm_device *dev)
@@ -1762,6 +2415,9 @@ void i915_gem_restore_fences(struct drm_device *dev)
 	for (i = 0; i < dev_priv->num_fence_regs; i++) {
 		struct drm_i915_fence_reg *reg = &dev_priv->fence_regs[i];
 
+		/* The registers may have been reset under us */
+		reg->val_valid = false;
+
 		/*
 		 * Commit delayed tiling changes if we have an object still
 		 * attached to the fence, otherwise just clear the fence.
@@ -1828,7 +2484,7 @@ i915_gem_retire_requests_ring(struct intel_ring_buffer *ring)
 		 * of tail of the request to update the last known position
 		 * of the GPU head.
 		 */
-		ring->last_retired_head = request->tail;
+		ring->retired_pos = request->tail_pos;
 
 		i915_gem_free_request(request);
 	}
@@ -1855,6 +2511,8 @@ i915_gem_retire_requests_ring(struct intel_ring_buffer *ring)
 		ring->trace_irq_seqno = 0;
 	}
 
+	i915_gem_retire_irq_put(ring);
+
 	WARN_ON(i915_verify_lists(ring->dev));
 }
 
@@ -1906,14 +2564,87 @@ i915_gem_retire_work_handler(struct work_struct *work)
 	if (idle)
 		intel_mark_idle(dev);
 	mutex_unlock(&dev->struct_mutex);
-}
+}
+
+void
+i915_gem_retire_work_timer(void *device)
+{
+	struct drm_device *dev = (struct drm_device *)device;
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	queue_work(dev_priv->wq, &dev_priv->mm.retire_work);
+}
+
+static void
+i915_gem_retire_irq_dispatch(drm_i915_private_t *dev_priv)
+{
+	/* Called from interrupt or callout context, so must not block */
+	if (ddi_taskq_dispatch(dev_priv->wq->taskq,
+	    dev_priv->mm.retire_irq_work.func, &dev_priv->mm.retire_irq_work,
+	    DDI_NOSLEEP) != DDI_SUCCESS)
+		dev_priv->mm.retire_irq_pending = 0;
+}
+
+static void
+i915_gem_retire_irq_timer(void *arg)
+{
+	i915_gem_retire_irq_dispatch(arg);
+}
+
+/*
+ * Queue a retire pass, called from the user interrupt. Nothing is queued
+ * if a pass is already pending; it will pick up this interrupt's seqno.
+ */
+void
+i915_gem_retire_irq_kick(drm_i915_private_t *dev_priv)
+{
+	if (dev_priv->mm.retire_irq_shutdown)
+		return;
+	if (atomic_cas_uint(&dev_priv->mm.retire_irq_pending, 0, 1) != 0)
+		return;
+
+	if (i915_retire_coalesce_us > 0)
+		dev_priv->mm.retire_irq_timer = timeout(i915_gem_retire_irq_timer,
+		    dev_priv, drv_usectohz(i915_retire_coalesce_us));
+	else
+		i915_gem_retire_irq_dispatch(dev_priv);
+}
+
+static void
+i915_gem_retire_irq_work_handler(struct work_struct *work)
+{
+	drm_i915_private_t *dev_priv = container_of(work, drm_i915_private_t,
+						mm.retire_irq_work);
+	struct drm_device *dev = dev_priv->dev;
+	struct intel_ring_buffer *ring;
+	hrtime_t irq_time, now;
+	int i;
+
+	dev_priv->mm.retire_irq_pending = 0;
+
+	/* Whoever holds the lock may not retire, so try again shortly */
+	if (!mutex_tryenter(&dev->struct_mutex)) {
+		if (!dev_priv->mm.retire_irq_shutdown &&
+		    atomic_cas_uint(&dev_priv->mm.retire_irq_pending,
+		    0, 1) == 0)
+			dev_priv->mm.retire_irq_timer = timeout(
+			    i915_gem_retire_irq_timer, dev_priv, 1);
+		return;
+	}
+
+	i915_gem_retire_requests(dev);
+	mutex_unlock(&dev->struct_mutex);
 
-void
-i915_gem_retire_work_timer(void *device)
-{
-	struct drm_device *dev = (struct drm_device *)device;
-	drm_i915_private_t *dev_priv = dev->dev_private;
-	queue_work(dev_priv->wq, &dev_priv->mm.retire_work);
+	now = gethrtime();
+	for_each_ring(ring, dev_priv, i) {
+		irq_time = (hrtime_t)atomic_swap_64(
+		    (volatile uint64_t *)&ring->retire_irq_time, 0);
+		if (irq_time == 0)
+			continue;
+
+		I915_STAT_INC(dev_priv, I915_STAT_RETIRE_IRQ);
+		I915_STAT_ADD(dev_priv, I915_STAT_RETIRE_LAT_NS,
+		    now - irq_time);
+	}
 }
 
 /**
@@ -2022,6 +2753,206 @@ out:
 	return ret;
 }
 
+struct i915_wait_multi_entry {
+	struct intel_ring_buffer *ring;
+	u32 seqno;
+};
+
+static bool
+i915_wait_multi_busy(struct i915_wait_multi_entry *w)
+{
+	if (w->seqno != 0 &&
+	    i915_seqno_passed(w->ring->get_seqno(w->ring, true), w->seqno))
+		w->seqno = 0;
+	return (w->seqno != 0);
+}
+
+/**
+ * i915_gem_wait_multi_ioctl - implements DRM_IOCTL_I915_GEM_WAIT_MULTI
+ * @DRM_IOCTL_ARGS: standard ioctl arguments
+ *
+ * Waits until all (I915_WAIT_ALL) or any (I915_WAIT_ANY) of a set of objects
+ * are idle. struct_mutex is taken once to flush every object and sample its
+ * last seqno; the waits themselves are done unlocked, as in the wait ioctl.
+ * With I915_WAIT_ALL we wait for the last seqno of each ring. With
+ * I915_WAIT_ANY we wait for the first seqno of the only ring involved, or
+ * poll each ring in watchdog sized slices if the objects span several.
+ *
+ * Returns 0 once the condition is met, -ETIME if it was not met in time,
+ * or an error as for the wait ioctl. The busy array, idle_index and the
+ * remaining relative timeout are returned in every case.
+ */
+int
+i915_gem_wait_multi_ioctl(DRM_IOCTL_ARGS)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	struct drm_i915_gem_wait_multi *args = data;
+	struct i915_wait_multi_entry *waits = NULL, *w;
+	struct i915_wait_multi_entry target[I915_NUM_RINGS];
+	struct drm_i915_gem_object *obj;
+	struct intel_ring_buffer *ring;
+	uint32_t *handles;
+	hrtime_t now, deadline = 0;
+	clock_t ticks, slice;
+	unsigned reset_counter;
+	int nrings, nbusy, first, i, j, n = args->num_handles;
+	bool any = (args->flags & I915_WAIT_ANY) != 0;
+	bool forever = args->timeout_ns < 0;
+	int ret = 0;
+
+	if (args->flags & ~(I915_WAIT_ANY | I915_WAIT_ABSTIME))
+		return -EINVAL;
+	if (n == 0 || n > I915_WAIT_MULTI_MAX)
+		return -EINVAL;
+
+	now = gethrtime();
+	if (args->flags & I915_WAIT_ABSTIME)
+		deadline = args->timeout_ns;
+	else if (args->timeout_ns > INT64_MAX - now)
+		forever = true;		/* too far off to ever expire */
+	else
+		deadline = now + args->timeout_ns;
+
+	handles = kmem_alloc(n * sizeof (*handles), KM_SLEEP);
+	waits = kmem_zalloc(n * sizeof (*waits), KM_SLEEP);
+	args->idle_index = n;
+
+	if (DRM_COPY_FROM_USER(handles,
+	    (void __user *)(uintptr_t)args->handles_ptr,
+	    n * sizeof (*handles))) {
+		ret = -EFAULT;
+		goto free;
+	}
+
+	ret = i915_mutex_lock_interruptible(dev);
+	if (ret)
+		goto free;
+
+	for (i = 0; i < n; i++) {
+		obj = to_intel_bo(drm_gem_object_lookup(dev, file,
+		    handles[i]));
+		if (&obj->base == NULL) {
+			ret = -ENOENT;
+			break;
+		}
+
+		/* Need to make sure the object gets inactive eventually. */
+		ret = i915_gem_object_flush_active(obj);
+		if (ret == 0 && obj->active) {
+			waits[i].ring = obj->ring;
+			waits[i].seqno = obj->last_read_seqno;
+		}
+		drm_gem_object_unreference(&obj->base);
+		if (ret)
+			break;
+	}
+
+	reset_counter = atomic_read(&dev_priv->gpu_error.reset_counter);
+	mutex_unlock(&dev->struct_mutex);
+	if (ret)
+		goto free;
+
+	first = 0;
+	for (;;) {
+		/* Reduce to the seqno to wait for on each ring */
+		(void) memset(target, 0, sizeof (target));
+		nrings = nbusy = 0;
+		for (i = 0; i < n; i++) {
+			w = &waits[i];
+			if (!i915_wait_multi_busy(w)) {
+				if (args->idle_index == n)
+					args->idle_index = i;
+				continue;
+			}
+			nbusy++;
+
+			ring = w->ring;
+			if (target[ring->id].seqno == 0) {
+				target[ring->id] = *w;
+				nrings++;
+			} else if (any ?
+			    i915_seqno_passed(target[ring->id].seqno, w->seqno) :
+			    i915_seqno_passed(w->seqno, target[ring->id].seqno)) {
+				/* the earliest for any, the latest for all */
+				target[ring->id].seqno = w->seqno;
+			}
+		}
+
+		if (nbusy == 0 || (any && nbusy < n))
+			break;
+
+		now = gethrtime();
+		if (!forever && now >= deadline) {
+			ret = -ETIME;
+			break;
+		}
+
+		/*
+		 * Wait on one ring at a time. For any, more than one ring
+		 * means we cannot know which finishes first, so only wait a
+		 * slice on one of them before looking at all of them again,
+		 * starting from the next ring on each pass so that a slow
+		 * ring does not keep the others from being waited on.
+		 */
+		slice = 0;
+		if (any && nrings > 1) {
+			slice = drv_usectohz(i915_wait_watchdog_ms * 1000);
+			if (slice < 1)
+				slice = 1;
+		}
+
+		for (j = 0; j < I915_NUM_RINGS; j++) {
+			w = &target[(first + j) % I915_NUM_RINGS];
+			if (w->seqno == 0)
+				continue;
+
+			/* The rings share what is left of the timeout */
+			if (forever) {
+				ticks = -1;
+			} else {
+				now = gethrtime();
+				if (now >= deadline) {
+					ret = -ETIME;
+					break;
+				}
+				ticks = drv_usectohz((deadline - now) / 1000);
+				if (ticks < 1)
+					ticks = 1;
+			}
+			if (slice != 0 && (forever || slice < ticks))
+				ticks = slice;
+
+			ret = __wait_seqno(w->ring, w->seqno, reset_counter,
+			    true, ticks);
+			if (ret == -EBUSY)
+				ret = 0;
+			if (ret || any)
+				break;
+		}
+		if (ret)
+			break;
+		first = (first + j + 1) % I915_NUM_RINGS;
+	}
+
+	if (!forever && !(args->flags & I915_WAIT_ABSTIME)) {
+		now = gethrtime();
+		args->timeout_ns = now < deadline ? deadline - now : 0;
+	}
+
+	if (args->busy_ptr != 0) {
+		for (i = 0; i < n; i++)
+			handles[i] = i915_wait_multi_busy(&waits[i]);
+		if (DRM_COPY_TO_USER((void __user *)(uintptr_t)args->busy_ptr,
+		    handles, n * sizeof (*handles)))
+			ret = -EFAULT;
+	}
+
+free:
+	kmem_free(waits, n * sizeof (*waits));
+	kmem_free(handles, n * sizeof (*handles));
+	return ret;
+}
+
 /**
  * i915_gem_object_sync - sync an object to a ring.
  *
@@ -2157,21 +3088,49 @@ int i915_gpu_idle(struct drm_device *dev)
 	return 0;
 }
 
-static void i965_write_fence_reg(struct drm_device *dev, int reg,
+static uint64_t i965_fence_value(struct drm_device *dev,
 				 struct drm_i915_gem_object *obj)
 {
-	drm_i915_private_t *dev_priv = dev->dev_private;
-	int fence_reg;
+	u32 start, size;
 	int fence_pitch_shift;
+	uint64_t val;
 
-	if (INTEL_INFO(dev)->gen >= 6) {
-		fence_reg = FENCE_REG_SANDYBRIDGE_0;
+	if (INTEL_INFO(dev)->gen >= 6)
 		fence_pitch_shift = SANDYBRIDGE_FENCE_PITCH_SHIFT;
-	} else {
-		fence_reg = FENCE_REG_965_0;
+	else
 		fence_pitch_shift = I965_FENCE_PITCH_SHIFT;
+
+	/* A partial view starts on a tile row, and is fenced on its own */
+	if (obj->fault_view != NULL) {
+		start = obj->fault_view->start;
+		size = obj->fault_view->size;
+	} else {
+		start = obj->gtt_offset;
+		size = obj->gtt_space->size;
 	}
 
+	val = (uint64_t)((start + size - 4096) &
+			 0xfffff000) << 32;
+	val |= start & 0xfffff000;
+	val |= (uint64_t)((obj->stride / 128) - 1) << fence_pitch_shift;
+	if (obj->tiling_mode == I915_TILING_Y)
+		val |= 1 << I965_FENCE_TILING_Y_SHIFT;
+	val |= I965_FENCE_REG_VALID;
+
+	return val;
+}
+
+static void i965_write_fence_reg(struct drm_device *dev, int reg,
+				 uint64_t val)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	int fence_reg;
+
+	if (INTEL_INFO(dev)->gen >= 6)
+		fence_reg = FENCE_REG_SANDYBRIDGE_0;
+	else
+		fence_reg = FENCE_REG_965_0;
+
 	fence_reg += reg * 8;
 
 	/* To w/a incoherency with non-atomic 64-bit register updates,
@@ -2186,18 +3145,7 @@ static void i965_write_fence_reg(struct drm_device *dev, int reg,
 	I915_WRITE(fence_reg, 0);
 	POSTING_READ(fence_reg);
 
-	if (obj) {
-		u32 size = obj->gtt_space->size;
-		uint64_t val;
-
-		val = (uint64_t)((obj->gtt_offset + size - 4096) &
-				 0xfffff000) << 32;
-		val |= obj->gtt_offset & 0xfffff000;
-		val |= (uint64_t)((obj->stride / 128) - 1) << fence_pitch_shift;
-		if (obj->tiling_mode == I915_TILING_Y)
-			val |= 1 << I965_FENCE_TILING_Y_SHIFT;
-		val |= I965_FENCE_REG_VALID;
-
+	if (val) {
 		I915_WRITE(fence_reg + 4, val >> 32);
 		POSTING_READ(fence_reg + 4);
 
@@ -2209,79 +3157,85 @@ static void i965_write_fence_reg(struct drm_device *dev, int reg,
 	}
 }
 
-static void i915_write_fence_reg(struct drm_device *dev, int reg,
+static uint64_t i915_fence_value(struct drm_device *dev,
 				 struct drm_i915_gem_object *obj)
 {
-	drm_i915_private_t *dev_priv = dev->dev_private;
+	u32 size = obj->gtt_space->size;
+	int pitch_val;
+	int tile_width;
 	u32 val;
 
-	if (obj) {
-		u32 size = obj->gtt_space->size;
-		int pitch_val;
-		int tile_width;
-
-		if((obj->gtt_offset & ~I915_FENCE_START_MASK) ||
-		     (size & -size) != size ||
-		     (obj->gtt_offset & (size - 1)))
-		     DRM_ERROR("object 0x%08x [fenceable? %d] not 1M or pot-size (0x%08x) aligned\n",
-		     obj->gtt_offset, obj->map_and_fenceable, size);
-
-		if (obj->tiling_mode == I915_TILING_Y && HAS_128_BYTE_Y_TILING(dev))
-			tile_width = 128;
-		else
-			tile_width = 512;
-
-		/* Note: pitch better be a power of two tile widths */
-		pitch_val = obj->stride / tile_width;
-		pitch_val = ffs(pitch_val) - 1;
-
-		val = obj->gtt_offset;
-		if (obj->tiling_mode == I915_TILING_Y)
-			val |= 1 << I830_FENCE_TILING_Y_SHIFT;
-		val |= I915_FENCE_SIZE_BITS(size);
-		val |= pitch_val << I830_FENCE_PITCH_SHIFT;
-		val |= I830_FENCE_REG_VALID;
-	} else
-		val = 0;
+	if((obj->gtt_offset & ~I915_FENCE_START_MASK) ||
+	     (size & -size) != size ||
+	     (obj->gtt_offset & (size - 1)))
+	     DRM_ERROR("object 0x%08x [fenceable? %d] not 1M or pot-size (0x%08x) aligned\n",
+	     obj->gtt_offset, obj->map_and_fenceable, size);
+
+	if (obj->tiling_mode == I915_TILING_Y && HAS_128_BYTE_Y_TILING(dev))
+		tile_width = 128;
+	else
+		tile_width = 512;
+
+	/* Note: pitch better be a power of two tile widths */
+	pitch_val = obj->stride / tile_width;
+	pitch_val = ffs(pitch_val) - 1;
+
+	val = obj->gtt_offset;
+	if (obj->tiling_mode == I915_TILING_Y)
+		val |= 1 << I830_FENCE_TILING_Y_SHIFT;
+	val |= I915_FENCE_SIZE_BITS(size);
+	val |= pitch_val << I830_FENCE_PITCH_SHIFT;
+	val |= I830_FENCE_REG_VALID;
+
+	return val;
+}
+
+static void i915_write_fence_reg(struct drm_device *dev, int reg,
+				 uint64_t val)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
 
 	if (reg < 8)
 		reg = FENCE_REG_830_0 + reg * 4;
 	else
 		reg = FENCE_REG_945_8 + (reg - 8) * 4;
 
-	I915_WRITE(reg, val);
+	I915_WRITE(reg, (u32)val);
 	POSTING_READ(reg);
 }
 
-static void i830_write_fence_reg(struct drm_device *dev, int reg,
-				struct drm_i915_gem_object *obj)
+static uint64_t i830_fence_value(struct drm_device *dev,
+				 struct drm_i915_gem_object *obj)
 {
-	drm_i915_private_t *dev_priv = dev->dev_private;
+	u32 size = obj->gtt_space->size;
+	uint32_t pitch_val;
 	uint32_t val;
 
-	if (obj) {
-		u32 size = obj->gtt_space->size;
-		uint32_t pitch_val;
-
-		if((obj->gtt_offset & ~I830_FENCE_START_MASK) ||
-		     (size & -size) != size ||
-		     (obj->gtt_offset & (size - 1)))
-		     DRM_ERROR("object 0x%08x not 512K or pot-size 0x%08x aligned\n",
-		     obj->gtt_offset, size);
-
-		pitch_val = obj->stride / 128;
-		pitch_val = ffs(pitch_val) - 1;
-
-		val = obj->gtt_offset;
-		if (obj->tiling_mode == I915_TILING_Y)
-			val |= 1 << I830_FENCE_TILING_Y_SHIFT;
-		val |= I830_FENCE_SIZE_BITS(size);
-		val |= pitch_val << I830_FENCE_PITCH_SHIFT;
-		val |= I830_FENCE_REG_VALID;
-	} else
-		val = 0;
+	if((obj->gtt_offset & ~I830_FENCE_START_MASK) ||
+	     (size & -size) != size ||
+	     (obj->gtt_offset & (size - 1)))
+	     DRM_ERROR("object 0x%08x not 512K or pot-size 0x%08x aligned\n",
+	     obj->gtt_offset, size);
+
+	pitch_val = obj->stride / 128;
+	pitch_val = ffs(pitch_val) - 1;
+
+	val = obj->gtt_offset;
+	if (obj->tiling_mode == I915_TILING_Y)
+		val |= 1 << I830_FENCE_TILING_Y_SHIFT;
+	val |= I830_FENCE_SIZE_BITS(size);
+	val |= pitch_val << I830_FENCE_PITCH_SHIFT;
+	val |= I830_FENCE_REG_VALID;
 
-	I915_WRITE(FENCE_REG_830_0 + reg * 4, val);
+	return val;
+}
+
+static void i830_write_fence_reg(struct drm_device *dev, int reg,
+				 uint64_t val)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+
+	I915_WRITE(FENCE_REG_830_0 + reg * 4, (u32)val);
 	POSTING_READ(FENCE_REG_830_0 + reg * 4);
 }
 
@@ -2290,30 +3244,56 @@ inline static bool i915_gem_object_needs_mb(struct drm_i915_gem_object *obj)
 	return obj && obj->base.read_domains & I915_GEM_DOMAIN_GTT;
 }
 
+/*
+ * Point fence register reg at obj, or disable it if obj is NULL. The value
+ * last written to each register is cached, and rewriting the same value
+ * is skipped.
+ */
 static void i915_gem_write_fence(struct drm_device *dev, int reg,
 				 struct drm_i915_gem_object *obj)
 {
 	struct drm_i915_private *dev_priv = dev->dev_private;
+	struct drm_i915_fence_reg *fence = &dev_priv->fence_regs[reg];
+	uint64_t val = 0;
+
+	if(obj && (!obj->stride || !obj->tiling_mode))
+		DRM_ERROR("bogus fence setup with stride: 0x%x, tiling mode: %i\n",
+			obj->stride, obj->tiling_mode);
+
+	if (obj) {
+		switch (INTEL_INFO(dev)->gen) {
+		case 7:
+		case 6:
+		case 5:
+		case 4: val = i965_fence_value(dev, obj); break;
+		case 3: val = i915_fence_value(dev, obj); break;
+		case 2: val = i830_fence_value(dev, obj); break;
+		default: BUG();
+		}
+	}
+
+	if (fence->val_valid && fence->val == val) {
+		I915_STAT_INC(dev_priv, I915_STAT_FENCE_WRITE_SKIPPED);
+		return;
+	}
 
 	/* Ensure that all CPU reads are completed before installing a fence
 	 * and all writes before removing the fence.
 	 */
-	if (i915_gem_object_needs_mb(dev_priv->fence_regs[reg].obj))
+	if (i915_gem_object_needs_mb(fence->obj))
 		membar_producer();
 
-	if(obj && (!obj->stride || !obj->tiling_mode))
-		DRM_ERROR("bogus fence setup with stride: 0x%x, tiling mode: %i\n",
-			obj->stride, obj->tiling_mode);
-
 	switch (INTEL_INFO(dev)->gen) {
 	case 7:
 	case 6:
 	case 5:
-	case 4: i965_write_fence_reg(dev, reg, obj); break;
-	case 3: i915_write_fence_reg(dev, reg, obj); break;
-	case 2: i830_write_fence_reg(dev, reg, obj); break;
+	case 4: i965_write_fence_reg(dev, reg, val); break;
+	case 3: i915_write_fence_reg(dev, reg, val); break;
+	case 2: i830_write_fence_reg(dev, reg, val); break;
 	default: BUG();
 	}
+	fence->val = val;
+	fence->val_valid = true;
 
 	/* And similarly be paranoid that no direct access to this region
 	 * is reordered to before the fence is installed.
@@ -2339,11 +3319,14 @@ static void i915_gem_object_update_fence(struct drm_i915_gem_object *obj,
 
 	if (enable) {
 		obj->fence_reg = reg;
+		obj->fence_hint = reg;
 		fence->obj = obj;
+		dev_priv->fence_free &= ~(1U << reg);
 		list_move_tail(&fence->lru_list, &dev_priv->mm.fence_list, (caddr_t)fence);
 	} else {
 		obj->fence_reg = I915_FENCE_REG_NONE;
 		fence->obj = NULL;
+		dev_priv->fence_free |= 1U << reg;
 		list_del_init(&fence->lru_list);
 	}
 	obj->fence_dirty = false;
@@ -2386,28 +3369,32 @@ i915_gem_object_put_fence(struct drm_i915_gem_object *obj)
 	return 0;
 }
 
-static struct drm_i915_fence_reg *
-i915_find_fence_reg(struct drm_device *dev)
+/* Fence registers between fence_reg_start and num_fence_regs */
+static inline u32 i915_fence_reg_mask(struct drm_i915_private *dev_priv)
 {
-	struct drm_i915_private *dev_priv = dev->dev_private;
-	struct drm_i915_fence_reg *reg, *avail;
-	int i;
+	u32 mask = dev_priv->num_fence_regs >= 32 ? ~0U :
+	    (1U << dev_priv->num_fence_regs) - 1;
 
-	/* First try to find a free reg */
-	avail = NULL;
-	for (i = dev_priv->fence_reg_start; i < dev_priv->num_fence_regs; i++) {
-		reg = &dev_priv->fence_regs[i];
-		if (!reg->obj)
-			return reg;
+	if (dev_priv->fence_reg_start >= 32)
+		return 0;
+	return mask & ~((1U << dev_priv->fence_reg_start) - 1);
+}
 
-		if (!reg->pin_count)
-			avail = reg;
-	}
+static struct drm_i915_fence_reg *
+i915_find_fence_reg(struct drm_device *dev, struct drm_i915_gem_object *obj)
+{
+	struct drm_i915_private *dev_priv = dev->dev_private;
+	struct drm_i915_fence_reg *reg;
+	u32 avail = dev_priv->fence_free & i915_fence_reg_mask(dev_priv);
 
-	if (avail == NULL)
-		return NULL;
+	/* First try for a free reg, preferably the one obj last had */
+	if (obj->fence_hint != I915_FENCE_REG_NONE &&
+	    (avail & (1U << obj->fence_hint)))
+		return &dev_priv->fence_regs[obj->fence_hint];
+	if (avail)
+		return &dev_priv->fence_regs[ffs(avail) - 1];
 
-	/* None available, try to steal one or wait for a user to finish */
+	/* None available, steal the least recently used unpinned one */
 	list_for_each_entry(reg, struct drm_i915_fence_reg, &dev_priv->mm.fence_list, lru_list) {
 		if (reg->pin_count)
 			continue;
@@ -2456,10 +3443,11 @@ i915_gem_object_get_fence(struct drm_i915_gem_object *obj)
 		if (!obj->fence_dirty) {
 			list_move_tail(&reg->lru_list,
 				       &dev_priv->mm.fence_list, (caddr_t)reg);
+			I915_STAT_INC(dev_priv, I915_STAT_FENCE_HIT);
 			return 0;
 		}
 	} else if (enable) {
-		reg = i915_find_fence_reg(dev);
+		reg = i915_find_fence_reg(dev, obj);
 		if (reg == NULL)
 			return -EDEADLK;
 
@@ -2471,7 +3459,9 @@ i915_gem_object_get_fence(struct drm_i915_gem_object *obj)
 				return ret;
 
 			i915_gem_object_fence_lost(old);
+			I915_STAT_INC(dev_priv, I915_STAT_FENCE_STEAL);
 		}
+		I915_STAT_INC(dev_priv, I915_STAT_FENCE_MISS);
 	} else
 		return 0;
 
@@ -2644,7 +3634,9 @@ search_free:
 	}
 
 	list_move_tail(&obj->global_list, &dev_priv->mm.bound_list, (caddr_t)obj);
-	list_add_tail(&obj->mm_list, &dev_priv->mm.inactive_list, (caddr_t)obj);
+	/* It may be busy already through a context's PPGTT */
+	list_add_tail(&obj->mm_list, obj->active ? &dev_priv->mm.active_list :
+	    &dev_priv->mm.inactive_list, (caddr_t)obj);
 
 	obj->gtt_space = node;
 	obj->gtt_offset = node->start;
@@ -2663,14 +3655,41 @@ search_free:
 	return 0;
 }
 
+/*
+ * Record that the CPU may now hold cache lines for the pages backing
+ * [offset, offset + size) of the object.
+ */
+static void
+i915_gem_object_mark_cpu_dirty(struct drm_i915_gem_object *obj,
+    uint64_t offset, uint64_t size)
+{
+	pgcnt_t i, last;
+
+	if (obj->cpu_dirty == NULL || size == 0)
+		return;
+
+	last = btopr(offset + size);
+	for (i = btop(offset); i < last; i++)
+		set_bit(i, obj->cpu_dirty);
+}
+
+/*
+ * Flush the CPU cache lines of the pages backing [offset, offset + size)
+ * that may be cached, and forget about them until they are touched
+ * again. Pages that have not been accessed by the CPU since their last
+ * flush are skipped.
+ */
 void
-i915_gem_clflush_object(struct drm_i915_gem_object *obj)
+i915_gem_clflush_range(struct drm_i915_gem_object *obj,
+    uint64_t offset, uint64_t size)
 {
+	pgcnt_t i, run, last;
+
 	/* If we don't have a page list set up, then we're not pinned
 	 * to GPU, and we can ignore the cache flush because it'll happen
 	 * again at bind time.
 	 */
-	if (obj->page_list == NULL)
+	if (obj->page_list == NULL || size == 0)
 		return;
 
 	/*
@@ -2691,10 +3710,32 @@ i915_gem_clflush_object(struct drm_i915_gem_object *obj)
 	if (obj->cache_level != I915_CACHE_NONE)
 		return;
 
-	drm_clflush_pages(obj->page_list, obj->base.size / PAGE_SIZE);
+	last = btopr(offset + size);
+	for (i = btop(offset); i < last; i = run) {
+		/* skip 32 clean pages at a time */
+		if (((uint_t *)(void *)obj->cpu_dirty)[i >> 5] == 0) {
+			run = (i | 0x1f) + 1;
+			continue;
+		}
+		if (!test_bit(i, obj->cpu_dirty)) {
+			run = i + 1;
+			continue;
+		}
+
+		for (run = i; run < last && test_bit(run, obj->cpu_dirty);
+		    run++)
+			clear_bit(run, obj->cpu_dirty);
+		drm_clflush_pages(&obj->page_list[i], run - i);
+	}
 	TRACE_GEM_OBJ_HISTORY(obj, "clflush");
 }
 
+void
+i915_gem_clflush_object(struct drm_i915_gem_object *obj)
+{
+	i915_gem_clflush_range(obj, 0, obj->base.size);
+}
+
 /** Flushes the GTT write domain for the object if it's dirty. */
 static void
 i915_gem_object_flush_gtt_write_domain(struct drm_i915_gem_object *obj)
@@ -2742,7 +3783,7 @@ i915_gem_object_set_to_gtt_domain(struct drm_i915_gem_object *obj, int write)
 	int ret;
 
 	/* Not valid to be called on unbound objects. */
-	if (obj->gtt_space == NULL)
+	if (obj->gtt_space == NULL && obj->fault_view == NULL)
 		return -EINVAL;
 
 	if (obj->base.write_domain == I915_GEM_DOMAIN_GTT)
@@ -2801,6 +3842,15 @@ int i915_gem_object_set_cache_level(struct drm_i915_gem_object *obj,
 			return ret;
 	}
 
+	/* PPGTT bindings and fault views are simply made again at their
+	 * next use */
+	ret = i915_gem_object_unbind_vmas(obj);
+	if (ret)
+		return ret;
+	ret = i915_gem_object_release_fault_view(obj);
+	if (ret)
+		return ret;
+
 	if (obj->gtt_space) {
 		ret = i915_gem_object_finish_gpu(obj);
 		if (ret)
@@ -2839,6 +3889,7 @@ int i915_gem_object_set_cache_level(struct drm_i915_gem_object *obj,
 
 		obj->base.read_domains = I915_GEM_DOMAIN_CPU;
 		obj->base.write_domain = I915_GEM_DOMAIN_CPU;
+		i915_gem_object_mark_cpu_dirty(obj, 0, obj->base.size);
 	}
 
 	obj->cache_level = cache_level;
@@ -3008,6 +4059,9 @@ i915_gem_object_set_to_cpu_domain(struct drm_i915_gem_object *obj, bool write)
 		i915_gem_clflush_object(obj);
 
 		obj->base.read_domains |= I915_GEM_DOMAIN_CPU;
+
+		/* Any page may be pulled into the cache through the CPU mmap */
+		i915_gem_object_mark_cpu_dirty(obj, 0, obj->base.size);
 	}
 
 	/* It should now be out of any other write domains, and we can update
@@ -3021,6 +4075,13 @@ i915_gem_object_set_to_cpu_domain(struct drm_i915_gem_object *obj, bool write)
 	if (write) {
 		obj->base.read_domains = I915_GEM_DOMAIN_CPU;
 		obj->base.write_domain = I915_GEM_DOMAIN_CPU;
+
+		/*
+		 * A flush of the previous CPU write domain left CPU in the
+		 * read domains but cleared every page; any of them may be
+		 * written through the CPU mmap from now on.
+		 */
+		i915_gem_object_mark_cpu_dirty(obj, 0, obj->base.size);
 	}
 
 	return 0;
@@ -3087,6 +4148,13 @@ i915_gem_object_pin(struct drm_i915_gem_object *obj,
 	if ((obj->pin_count == DRM_I915_GEM_OBJECT_MAX_PIN_COUNT))
 		return -EBUSY;
 
+	/* Its fence will be for the binding from now on */
+	if (map_and_fenceable) {
+		ret = i915_gem_object_release_fault_view(obj);
+		if (ret)
+			return ret;
+	}
+
 	if (obj->gtt_space != NULL) {
 		if ((alignment && obj->gtt_offset & (alignment - 1)) ||
 		    (map_and_fenceable && !obj->map_and_fenceable)) {
@@ -3263,11 +4331,54 @@ int
 /* LINTED */
 i915_gem_madvise_ioctl(DRM_IOCTL_ARGS)
 {
+	struct drm_i915_private *dev_priv = dev->dev_private;
 	struct drm_i915_gem_madvise *args = data;
+	struct drm_i915_gem_object *obj;
+	int ret;
 
-	/* Don't enable buffer catch */
-	args->retained = 0;
-	return 0;
+	switch (args->madv) {
+	case I915_MADV_DONTNEED:
+	case I915_MADV_WILLNEED:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ret = i915_mutex_lock_interruptible(dev);
+	if (ret)
+		return ret;
+
+	obj = to_intel_bo(drm_gem_object_lookup(dev, file, args->handle));
+	if (&obj->base == NULL) {
+		ret = -ENOENT;
+		goto unlock;
+	}
+
+	if (obj->pin_count) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (obj->madv != __I915_MADV_PURGED) {
+		obj->madv = args->madv;
+		if (args->madv == I915_MADV_DONTNEED)
+			list_move_tail(&obj->purge_list,
+			    &dev_priv->mm.purgeable_list, (caddr_t)obj);
+		else
+			list_del_init(&obj->purge_list);
+	}
+
+	/* if the object is no longer attached, discard its backing storage */
+	if (i915_gem_object_is_purgeable(obj) && obj->page_list == NULL)
+		i915_gem_object_truncate(obj);
+
+	args->retained = obj->madv != __I915_MADV_PURGED;
+
+out:
+	drm_gem_object_unreference(&obj->base);
+unlock:
+	mutex_unlock(&dev->struct_mutex);
+	return ret;
 }
 
 void i915_gem_object_init(struct drm_i915_gem_object *obj,
@@ -3277,10 +4388,14 @@ void i915_gem_object_init(struct drm_i915_gem_object *obj,
 	INIT_LIST_HEAD(&obj->global_list);
 	INIT_LIST_HEAD(&obj->ring_list);
 	INIT_LIST_HEAD(&obj->exec_list);
+	INIT_LIST_HEAD(&obj->purge_list);
+	INIT_LIST_HEAD(&obj->vma_list);
+	INIT_LIST_HEAD(&obj->fault_view_link);
 
 	obj->ops = ops;
 
 	obj->fence_reg = I915_FENCE_REG_NONE;
+	obj->fence_hint = I915_FENCE_REG_NONE;
 	obj->madv = I915_MADV_WILLNEED;
 	/* Avoid an unnecessary call to unbind on the first bind. */
 	obj->map_and_fenceable = true;
@@ -3368,6 +4483,10 @@ void i915_gem_free_object(struct drm_gem_object *gem_obj)
 		dev_priv->mm.interruptible = was_interruptible;
 	}
 
+	/* Being unreferenced, it is idle and can't fail to unbind */
+	WARN_ON(i915_gem_object_unbind_vmas(obj));
+	WARN_ON(i915_gem_object_release_fault_view(obj));
+
 	/* Stolen objects don't hold a ref, but do hold pin count. Fix that up
 	 * before progressing. */
 	if (obj->stolen)
@@ -3378,6 +4497,7 @@ void i915_gem_free_object(struct drm_gem_object *gem_obj)
 	i915_gem_object_put_pages(obj);
 	if (obj->mmap_offset)
 		i915_gem_free_mmap_offset(obj);
+	list_del_init(&obj->purge_list);
 
 //	if (obj->base.import_attach)
 //		drm_prime_gem_destroy(&obj->base, NULL);
@@ -3429,6 +4549,7 @@ i915_gem_idle(struct drm_device *dev, uint32_t type)
 	/* Cancel the retire work handler, wait for it to finish if running
 	 */
 	del_timer_sync(&dev_priv->mm.retire_timer);
+	(void) untimeout(dev_priv->mm.retire_irq_timer);
 	cancel_delayed_work(dev_priv->wq);
 
 	return 0;
@@ -3630,6 +4751,13 @@ int i915_gem_init(struct drm_device *dev)
 		}
 
 		/* copy old content to fb buffer */
+		if (drm_gem_object_populate(&dev_priv->fbcon_obj->base)) {
+			DRM_ERROR("failed to allocate framebuffer pages");
+			mutex_unlock(&dev->struct_mutex);
+			i915_teardown_scratch_page(dev);
+			i915_gem_free_object(&dev_priv->fbcon_obj->base);
+			return (-ENOMEM);
+		}
 		(void) memcpy(dev_priv->fbcon_obj->base.kaddr, dev->old_gtt, size);
 
 		/* Flush everything out, we'll be doing GTT only from now on */
@@ -3745,6 +4873,7 @@ init_ring_lists(struct intel_ring_buffer *ring)
 void
 i915_gem_load(struct drm_device *dev)
 {
+	char name[32];
 	int i;
 	drm_i915_private_t *dev_priv = dev->dev_private;
 
@@ -3752,13 +4881,19 @@ i915_gem_load(struct drm_device *dev)
 	INIT_LIST_HEAD(&dev_priv->mm.inactive_list);
 	INIT_LIST_HEAD(&dev_priv->mm.unbound_list);
 	INIT_LIST_HEAD(&dev_priv->mm.bound_list);
+	INIT_LIST_HEAD(&dev_priv->mm.purgeable_list);
 	INIT_LIST_HEAD(&dev_priv->mm.fence_list);
+	INIT_LIST_HEAD(&dev_priv->mm.ppgtt_list);
+	INIT_LIST_HEAD(&dev_priv->mm.fault_view_list);
+	i915_sched_init(dev);
 	for (i = 0; i < I915_NUM_RINGS; i++)
 		init_ring_lists(&dev_priv->ring[i]);
 	for (i = 0; i < I915_MAX_NUM_FENCES; i++)
 		INIT_LIST_HEAD(&dev_priv->fence_regs[i].lru_list);
 
 	INIT_WORK(&dev_priv->mm.retire_work, i915_gem_retire_work_handler);
+	INIT_WORK(&dev_priv->mm.retire_irq_work,
+	    i915_gem_retire_irq_work_handler);
 	setup_timer(&dev_priv->mm.retire_timer, i915_gem_retire_work_timer,
 			(void *)dev);	
 
@@ -3783,11 +4918,48 @@ i915_gem_load(struct drm_device *dev)
 
 	/* Initialize fence registers to zero */
 	INIT_LIST_HEAD(&dev_priv->mm.fence_list);
+	dev_priv->fence_free = dev_priv->num_fence_regs >= 32 ? ~0U :
+	    (1U << dev_priv->num_fence_regs) - 1;
 	i915_gem_restore_fences(dev);
 
 	i915_gem_detect_bit_6_swizzle(dev);
 	DRM_INIT_WAITQUEUE(&dev_priv->pending_flip_queue, DRM_INTR_PRI(dev));
 	dev_priv->mm.interruptible = true;
+
+	/*
+	 * Nothing is ever allocated from this cache, it only gets us called
+	 * back by the kmem reaper when memory runs low, so that DONTNEED
+	 * objects can be purged.
+	 */
+	(void) snprintf(name, sizeof (name), "i915_gem_purge_%d",
+	    ddi_get_instance(dev->devinfo));
+	dev_priv->mm.purge_cache = kmem_cache_create(name, sizeof (uint64_t),
+	    0, NULL, NULL, i915_gem_reclaim, dev, NULL, 0);
+}
+
+void
+i915_gem_unload(struct drm_device *dev)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+
+	/*
+	 * The workqueues go away after us, so stop the interrupt driven
+	 * retire pass for good. A pass that saw the flag too late may
+	 * have armed the timer once more; the second round catches it.
+	 */
+	dev_priv->mm.retire_irq_shutdown = 1;
+	membar_producer();
+	(void) untimeout(dev_priv->mm.retire_irq_timer);
+	flush_workqueue(dev_priv->wq);
+	(void) untimeout(dev_priv->mm.retire_irq_timer);
+	flush_workqueue(dev_priv->wq);
+
+	if (dev_priv->mm.purge_cache != NULL) {
+		kmem_cache_destroy(dev_priv->mm.purge_cache);
+		dev_priv->mm.purge_cache = NULL;
+	}
+
+	i915_sched_fini(dev);
 }
 
 /*
@@ -3966,6 +5138,8 @@ i915_gem_phys_pwrite(struct drm_device *dev,
 void i915_gem_release(struct drm_device * dev, struct drm_file *file)
 {
 	struct drm_i915_file_private *file_priv = file->driver_priv;
+	struct drm_i915_pending_fence *fence;
+	unsigned long flags;
 
 	file_priv->status = 0;
 
@@ -3987,6 +5161,14 @@ void i915_gem_release(struct drm_device * dev, struct drm_file *file)
 					   client_list);
 		list_del(&request->client_list);
 		request->file_priv = NULL;
+
+		/* Nobody is left to read it */
+		spin_lock_irqsave(&dev->event_lock, flags);
+		fence = request->fence;
+		request->fence = NULL;
+		spin_unlock_irqrestore(&dev->event_lock, flags);
+		if (fence != NULL)
+			i915_gem_fence_event_destroy(fence, 0);
 	}
 	spin_unlock(&file_priv->mm.lock);
 }
@@ -106,6 +106,7 @@
 static struct i915_hw_context *
 i915_gem_context_get(struct drm_i915_file_private *file_priv, u32 id);
 static int do_switch(struct i915_hw_context *to);
+static void context_cache_release(struct i915_hw_context *ctx);
 
 static int get_context_size(struct drm_device *dev)
 {
@@ -137,6 +138,8 @@ void i915_gem_context_free(struct kref *ctx_ref)
 	struct i915_hw_context *ctx = container_of(ctx_ref,
 						   struct i915_hw_context, ref);
 
+	if (ctx->ppgtt != NULL)
+		i915_ppgtt_destroy(ctx->ppgtt);
 	drm_gem_object_unreference(&ctx->obj->base);
 	kfree(ctx, sizeof(*ctx));
 }
@@ -154,6 +157,7 @@ create_hw_context(struct drm_device *dev,
 		return NULL;
 
 	kref_init(&ctx->ref);
+	i915_sched_entity_init(&ctx->sched);
 	ctx->obj = i915_gem_alloc_object(dev, dev_priv->hw_context_size);
 	if (ctx->obj == NULL) {
 		kfree(ctx, sizeof(*ctx));
@@ -178,6 +182,12 @@ create_hw_context(struct drm_device *dev,
 	if (file_priv == NULL)
 		return ctx;
 
+	/* Without an address space of its own it shares the global one */
+	if (dev_priv->mm.full_ppgtt) {
+		ctx->ppgtt = i915_ppgtt_create(dev);
+		if (ctx->ppgtt == NULL)
+			DRM_DEBUG_DRIVER("PPGTT allocation failed\n");
+	}
 
 again:
 	if (idr_pre_get(&file_priv->context_idr, GFP_KERNEL) == 0) {
@@ -294,6 +304,8 @@ void i915_gem_context_fini(struct drm_device *dev)
 	if (dev_priv->hw_contexts_disabled)
 		return;
 
+	i915_gem_context_cache_flush(dev);
+
 	/* The only known way to stop the gpu from accessing the hw context is
 	 * to reset it. Do this as the very last operation to avoid confusing
 	 * other code, leading to spurious errors. */
@@ -325,6 +337,7 @@ static int context_idr_cleanup(int id, void *p, void *data)
 
 	BUG_ON(id == DEFAULT_CONTEXT_ID);
 
+	context_cache_release(ctx);
 	i915_gem_context_unreference(ctx);
 	return 0;
 }
@@ -357,6 +370,62 @@ i915_gem_context_get_hang_stats(struct intel_ring_buffer *ring,
 	return &to->hang_stats;
 }
 
+/*
+ * The scheduling entity for batches submitted on context id, with *ctxp set
+ * to the context unless id is the default context. Returns NULL if there is
+ * no such context. Called with struct_mutex held.
+ */
+struct i915_sched_entity *
+i915_gem_context_sched_entity(struct drm_file *file, u32 id,
+			      struct i915_hw_context **ctxp)
+{
+	struct drm_i915_file_private *file_priv = file->driver_priv;
+	struct i915_hw_context *ctx;
+
+	*ctxp = NULL;
+	if (id == DEFAULT_CONTEXT_ID)
+		return &file_priv->sched;
+
+	ctx = i915_gem_context_get(file_priv, id);
+	if (ctx == NULL)
+		return NULL;
+
+	*ctxp = ctx;
+	return &ctx->sched;
+}
+
+/* The address space ctx's batches run in, NULL for the global one */
+static struct i915_hw_ppgtt *context_ppgtt(struct i915_hw_context *ctx)
+{
+	struct drm_i915_private *dev_priv = ctx->ring->dev->dev_private;
+
+	return dev_priv->mm.full_ppgtt ? ctx->ppgtt : NULL;
+}
+
+/*
+ * The PPGTT batches on context id are bound into, if it has its own, with
+ * a reference on the context taken for the caller in *ctxp. Called with
+ * struct_mutex held.
+ */
+struct i915_hw_ppgtt *
+i915_gem_context_get_ppgtt(struct drm_file *file, u32 id,
+			   struct i915_hw_context **ctxp)
+{
+	struct i915_hw_context *ctx;
+
+	*ctxp = NULL;
+	if (id == DEFAULT_CONTEXT_ID)
+		return NULL;
+
+	ctx = i915_gem_context_get(file->driver_priv, id);
+	if (ctx == NULL || context_ppgtt(ctx) == NULL)
+		return NULL;
+
+	i915_gem_context_reference(ctx);
+	*ctxp = ctx;
+	return ctx->ppgtt;
+}
+
 void i915_gem_context_close(struct drm_device *dev, struct drm_file *file)
 {
 	struct drm_i915_file_private *file_priv = file->driver_priv;
@@ -421,31 +490,132 @@ mi_set_context(struct intel_ring_buffer *ring,
 	return ret;
 }
 
+static int context_cache_find(struct intel_ring_buffer *ring,
+			      struct i915_hw_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ring->ctx_cache_count; i++)
+		if (ring->ctx_cache[i] == ctx)
+			return i;
+	return -1;
+}
+
+static void context_cache_remove(struct intel_ring_buffer *ring, int i)
+{
+	ring->ctx_cache[i] = ring->ctx_cache[--ring->ctx_cache_count];
+	ring->ctx_cache[ring->ctx_cache_count] = NULL;
+}
+
+/* Drop the pin and reference the cache holds on ctx, if any */
+static void context_cache_release(struct i915_hw_context *ctx)
+{
+	struct intel_ring_buffer *ring = ctx->ring;
+	int i = context_cache_find(ring, ctx);
+
+	if (i < 0)
+		return;
+
+	context_cache_remove(ring, i);
+	i915_gem_object_unpin(ctx->obj);
+	i915_gem_context_unreference(ctx);
+}
+
+void i915_gem_context_cache_flush(struct drm_device *dev)
+{
+	struct drm_i915_private *dev_priv = dev->dev_private;
+	struct intel_ring_buffer *ring = &dev_priv->ring[RCS];
+
+	while (ring->ctx_cache_count > 0)
+		context_cache_release(ring->ctx_cache[0]);
+}
+
+/*
+ * A rough cost of evicting ctx from the cache. The more often it has come
+ * back while cached, and the more recently it ran, the more likely we
+ * are to need it again soon. The default context is always pinned and
+ * never restored, so keeping it costs a slot and gains nothing.
+ */
+static u64 context_cache_value(struct intel_ring_buffer *ring,
+			       struct i915_hw_context *ctx)
+{
+	u64 age = ring->ctx_switches - ctx->last_switch;
+
+	if (is_default_context(ctx))
+		return 0;
+
+	return (((u64)ctx->cache_hits + 1) << 10) / (age + 1);
+}
+
+/*
+ * Keep ctx, which was just switched away from, pinned along with the
+ * reference it held as last_context, evicting the cheapest entry if the
+ * cache is full.
+ */
+static void context_cache_insert(struct intel_ring_buffer *ring,
+				 struct i915_hw_context *ctx)
+{
+	int size = min(i915_ctx_cache_size, I915_CTX_CACHE_MAX);
+	int i, victim;
+
+	if (size <= 0) {
+		i915_gem_object_unpin(ctx->obj);
+		i915_gem_context_unreference(ctx);
+		return;
+	}
+
+	if (ring->ctx_cache_count >= size) {
+		victim = 0;
+		for (i = 1; i < ring->ctx_cache_count; i++) {
+			if (context_cache_value(ring, ring->ctx_cache[i]) <
+			    context_cache_value(ring, ring->ctx_cache[victim]))
+				victim = i;
+		}
+		context_cache_release(ring->ctx_cache[victim]);
+	}
+
+	ring->ctx_cache[ring->ctx_cache_count++] = ctx;
+}
+
 static int do_switch(struct i915_hw_context *to)
 {
 	struct intel_ring_buffer *ring = to->ring;
 	struct i915_hw_context *from = ring->last_context;
 	u32 hw_flags = 0;
+	int cached;
 	int ret;
 
 	BUG_ON(from != NULL && from->obj != NULL && from->obj->pin_count == 0);
 
-	if (from == to)
-		return 0;
-
-	ret = i915_gem_object_pin(to->obj, CONTEXT_ALIGN, false, false);
+	/* Its address space first, the restored state refers to it */
+	ret = i915_ppgtt_switch(ring, context_ppgtt(to));
 	if (ret)
 		return ret;
 
-	/* Clear this page out of any CPU caches for coherent swap-in/out. Note
-	 * that thanks to write = false in this call and us not setting any gpu
-	 * write domains when putting a context object onto the active list
-	 * (when switching away from it), this won't block.
-	 * XXX: We need a real interface to do this instead of trickery. */
-	ret = i915_gem_object_set_to_gtt_domain(to->obj, false);
-	if (ret) {
-		i915_gem_object_unpin(to->obj);
-		return ret;
+	if (from == to) {
+		ring->ctx_elided++;
+		return 0;
+	}
+
+	/* A cached context is still pinned, bound and in the GTT domain */
+	cached = context_cache_find(ring, to);
+	if (cached < 0) {
+		ret = i915_gem_object_pin(to->obj, CONTEXT_ALIGN, false, false);
+		if (ret)
+			return ret;
+
+		/* Clear this page out of any CPU caches for coherent
+		 * swap-in/out. Note that thanks to write = false in this call
+		 * and us not setting any gpu write domains when putting a
+		 * context object onto the active list (when switching away
+		 * from it), this won't block.
+		 * XXX: We need a real interface to do this instead of
+		 * trickery. */
+		ret = i915_gem_object_set_to_gtt_domain(to->obj, false);
+		if (ret) {
+			i915_gem_object_unpin(to->obj);
+			return ret;
+		}
 	}
 
 	if (!to->obj->has_global_gtt_mapping)
@@ -461,7 +631,8 @@ static int do_switch(struct i915_hw_context *to)
 
 	ret = mi_set_context(ring, to, hw_flags);
 	if (ret) {
-		i915_gem_object_unpin(to->obj);
+		if (cached < 0)
+			i915_gem_object_unpin(to->obj);
 		return ret;
 	}
 
@@ -494,12 +665,23 @@ static int do_switch(struct i915_hw_context *to)
 			WARN_ON(mi_set_context(ring, from, MI_RESTORE_INHIBIT));
 			return ret;
 		}
+	}
 
-		i915_gem_object_unpin(from->obj);
-		i915_gem_context_unreference(from);
+	/* The cache's pin and reference on to now belong to last_context */
+	if (cached >= 0) {
+		context_cache_remove(ring, cached);
+		to->cache_hits++;
+		ring->ctx_cache_hits++;
+	} else {
+		i915_gem_context_reference(to);
 	}
 
-	i915_gem_context_reference(to);
+	/* and last_context's on from to the cache */
+	if (from != NULL)
+		context_cache_insert(ring, from);
+
+	ring->ctx_switches++;
+	to->last_switch = ring->ctx_switches;
 	ring->last_context = to;
 	to->is_initialized = true;
 
@@ -562,11 +744,22 @@ int i915_gem_context_create_ioctl(DRM_IOCTL_ARGS)
 	if (dev_priv->hw_contexts_disabled)
 		return -ENODEV;
 
+	if (args->priority > I915_CONTEXT_MAX_USER_PRIORITY ||
+	    args->priority < I915_CONTEXT_MIN_USER_PRIORITY)
+		return -EINVAL;
+
+	/* Raising priority above the default is privileged */
+	if (args->priority > I915_CONTEXT_DEFAULT_PRIORITY &&
+	    !file->is_master && !DRM_SUSER(credp))
+		return -EPERM;
+
 	ret = i915_mutex_lock_interruptible(dev);
 	if (ret)
 		return ret;
 
 	ctx = create_hw_context(dev, file_priv);
+	if (ctx != NULL)
+		ctx->sched.priority = args->priority;
 	mutex_unlock(&dev->struct_mutex);
 	if (ctx == NULL)
 		return (-ENOMEM);
@@ -598,6 +791,7 @@ int i915_gem_context_destroy_ioctl(DRM_IOCTL_ARGS)
 	}
 
 	idr_remove(&ctx->file_priv->context_idr, ctx->id);
+	context_cache_release(ctx);
 	i915_gem_context_unreference(ctx);
 	mutex_unlock(&dev->struct_mutex);
 
@@ -605,6 +799,102 @@ int i915_gem_context_destroy_ioctl(DRM_IOCTL_ARGS)
 	return 0;
 }
 
+int i915_gem_context_getparam_ioctl(DRM_IOCTL_ARGS)
+{
+	struct drm_i915_private *dev_priv = dev->dev_private;
+	struct drm_i915_gem_context_param *args = data;
+	struct i915_sched_entity *entity;
+	struct i915_hw_context *ctx;
+	int ret;
+
+	ret = i915_mutex_lock_interruptible(dev);
+	if (ret)
+		return ret;
+
+	entity = i915_gem_context_sched_entity(file, args->ctx_id, &ctx);
+	if (entity == NULL) {
+		mutex_unlock(&dev->struct_mutex);
+		return -ENOENT;
+	}
+
+	args->size = 0;
+	switch (args->param) {
+	case I915_CONTEXT_PARAM_PRIORITY:
+		args->value = (__s64)entity->priority;
+		break;
+	case I915_CONTEXT_PARAM_GTT_SIZE:
+		if (ctx != NULL && context_ppgtt(ctx) != NULL)
+			args->value = I915_PPGTT_SIZE;
+		else
+			args->value = dev_priv->gtt.total;
+		break;
+	case I915_CONTEXT_PARAM_VM_BOUND:
+	case I915_CONTEXT_PARAM_VM_OBJECTS:
+		if (ctx == NULL || context_ppgtt(ctx) == NULL) {
+			ret = -ENODEV;
+			break;
+		}
+		if (args->param == I915_CONTEXT_PARAM_VM_BOUND)
+			args->value = ctx->ppgtt->bound;
+		else
+			args->value = ctx->ppgtt->vma_count;
+		break;
+	case I915_CONTEXT_PARAM_SCHED_QUEUED:
+	case I915_CONTEXT_PARAM_SCHED_INFLIGHT:
+	case I915_CONTEXT_PARAM_SCHED_SUBMITTED:
+	case I915_CONTEXT_PARAM_SCHED_WAIT_NS:
+	case I915_CONTEXT_PARAM_SCHED_WAIT_MAX_NS:
+	case I915_CONTEXT_PARAM_SCHED_GPU_NS:
+		args->value = i915_sched_entity_stat(dev, entity, args->param);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	mutex_unlock(&dev->struct_mutex);
+
+	return ret;
+}
+
+int i915_gem_context_setparam_ioctl(DRM_IOCTL_ARGS)
+{
+	struct drm_i915_gem_context_param *args = data;
+	struct i915_sched_entity *entity;
+	struct i915_hw_context *ctx;
+	int64_t priority;
+	int ret;
+
+	if (args->size != 0)
+		return -EINVAL;
+
+	switch (args->param) {
+	case I915_CONTEXT_PARAM_PRIORITY:
+		priority = (int64_t)args->value;
+		if (priority > I915_CONTEXT_MAX_USER_PRIORITY ||
+		    priority < I915_CONTEXT_MIN_USER_PRIORITY)
+			return -EINVAL;
+		if (priority > I915_CONTEXT_DEFAULT_PRIORITY &&
+		    !file->is_master && !DRM_SUSER(credp))
+			return -EPERM;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ret = i915_mutex_lock_interruptible(dev);
+	if (ret)
+		return ret;
+
+	entity = i915_gem_context_sched_entity(file, args->ctx_id, &ctx);
+	if (entity == NULL)
+		ret = -ENOENT;
+	else
+		entity->priority = (int)priority;
+	mutex_unlock(&dev->struct_mutex);
+
+	return ret;
+}
+
 void i915_gem_context_reference(struct i915_hw_context *ctx)
 {
 	kref_get(&ctx->ref);
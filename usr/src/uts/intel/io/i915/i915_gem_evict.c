@@ -116,6 +116,11 @@ none:
 		list_del_init(&obj->exec_list);
 	}
 
+	/* Partial views for GTT mmap faults are only ever in the mappable
+	 * aperture, and cheap to make again: let the caller retry */
+	if (i915_gem_release_fault_views(dev))
+		return 0;
+
 	/* We expect the caller to unpin, evict all and try again, or give up.
 	 * So calling i915_gem_evict_everything() is unnecessary.
 	 */
@@ -161,7 +166,8 @@ i915_gem_evict_everything(struct drm_device *dev)
 	int ret;
 
 	lists_empty = (list_empty(&dev_priv->mm.inactive_list) &&
-		       list_empty(&dev_priv->mm.active_list));
+		       list_empty(&dev_priv->mm.active_list) &&
+		       list_empty(&dev_priv->mm.fault_view_list));
 	if (lists_empty)
 		return -ENOSPC;
 
@@ -175,6 +181,9 @@ i915_gem_evict_everything(struct drm_device *dev)
 
 	i915_gem_retire_requests(dev);
 
+	/* Let go of the contexts kept pinned for quick switching back */
+	i915_gem_context_cache_flush(dev);
+
 	/* Having flushed everything, unbind() should never raise an error */
 	list_for_each_entry_safe(obj, next, struct drm_i915_gem_object,
 				&dev_priv->mm.inactive_list, mm_list)
@@ -182,5 +191,95 @@ i915_gem_evict_everything(struct drm_device *dev)
 		if (obj->pin_count == 0)
 			WARN_ON(i915_gem_object_unbind(obj, true));
 
+	(void) i915_gem_release_fault_views(dev);
+
+	return 0;
+}
+
+/*
+ * Make room for min_size bytes in a context's PPGTT by unbinding its
+ * least recently used objects, as i915_gem_evict_something() does for
+ * the global GTT. Objects in use by the execbuffer being reserved are
+ * pinned and left alone.
+ */
+int
+i915_ppgtt_evict_something(struct i915_hw_ppgtt *ppgtt,
+			   unsigned long min_size, unsigned alignment,
+			   unsigned cache_level)
+{
+	drm_i915_private_t *dev_priv = ppgtt->dev->dev_private;
+	struct list_head eviction_list, unwind_list;
+	struct i915_vma *vma, *next;
+	int ret = 0;
+
+	INIT_LIST_HEAD(&unwind_list);
+	drm_mm_init_scan(&ppgtt->mm, min_size, alignment, cache_level);
+
+	list_for_each_entry(vma, struct i915_vma, &ppgtt->vma_list, vm_link) {
+		if (vma->pin_count)
+			continue;
+
+		list_add(&vma->evict_link, &unwind_list, (caddr_t)vma);
+		if (drm_mm_scan_add_block(vma->node))
+			goto found;
+	}
+
+	/* Nothing found, clean up and bail out! */
+	list_for_each_entry_safe(vma, next, struct i915_vma,
+	    &unwind_list, evict_link) {
+		ret = drm_mm_scan_remove_block(vma->node);
+		BUG_ON(ret);
+		list_del_init(&vma->evict_link);
+	}
+	return -ENOSPC;
+
+found:
+	INIT_LIST_HEAD(&eviction_list);
+	list_for_each_entry_safe(vma, next, struct i915_vma,
+	    &unwind_list, evict_link) {
+		if (drm_mm_scan_remove_block(vma->node)) {
+			list_move(&vma->evict_link, &eviction_list,
+			    (caddr_t)vma);
+			continue;
+		}
+		list_del_init(&vma->evict_link);
+	}
+
+	/* Unbinding waits for the GPU to finish with each of them */
+	list_for_each_entry_safe(vma, next, struct i915_vma,
+	    &eviction_list, evict_link) {
+		list_del_init(&vma->evict_link);
+		if (ret == 0) {
+			ret = i915_vma_unbind(vma);
+			if (ret == 0)
+				I915_STAT_INC(dev_priv, I915_STAT_VMA_EVICT);
+		}
+	}
+
+	return ret;
+}
+
+/* Unbind everything not pinned from a context's PPGTT */
+int
+i915_ppgtt_evict_everything(struct i915_hw_ppgtt *ppgtt)
+{
+	drm_i915_private_t *dev_priv = ppgtt->dev->dev_private;
+	struct i915_vma *vma, *next;
+	int ret;
+
+	if (list_empty(&ppgtt->vma_list))
+		return -ENOSPC;
+
+	list_for_each_entry_safe(vma, next, struct i915_vma,
+	    &ppgtt->vma_list, vm_link) {
+		if (vma->pin_count)
+			continue;
+
+		ret = i915_vma_unbind(vma);
+		if (ret)
+			return ret;
+		I915_STAT_INC(dev_priv, I915_STAT_VMA_EVICT);
+	}
+
 	return 0;
 }
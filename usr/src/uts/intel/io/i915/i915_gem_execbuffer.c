@@ -35,44 +35,110 @@
 #include "i915_drm.h"
 #include "i915_drv.h"
 #include "intel_drv.h"
+#include <sys/sdt.h>
 
+/*
+ * Per-execbuffer lookup table from relocation target handle to object,
+ * built once while the exec list is looked up so that relocations never
+ * go back to the file's handle table.
+ *
+ * With I915_EXEC_HANDLE_LUT the target "handle" is the index of the
+ * object in the exec list and slots[] is indexed directly; "and" is then
+ * minus the buffer count. Otherwise slots[] is an open-addressing hash
+ * keyed on the GEM handle with linear probing, kept at most half full,
+ * and "and" is the mask of its power-of-two size.
+ *
+ * ppgtt is the context's own address space the objects are bound into,
+ * NULL if they go into the global GTT.
+ */
 struct eb_objects {
 	int and;
+	int size;
 	struct drm_file *file_priv;
+	struct i915_hw_ppgtt *ppgtt;
+	struct drm_i915_gem_object *slots[1];
 };
 
+#define	EB_OBJECTS_SIZE(n)	\
+	(sizeof (struct eb_objects) + \
+	((n) - 1) * sizeof (struct drm_i915_gem_object *))
+
 static struct eb_objects *
-eb_create(int size, struct drm_file *file_priv)
+eb_create(struct drm_i915_gem_execbuffer2 *args, struct drm_file *file_priv)
 {
 	struct eb_objects *eb;
-	eb = kzalloc(sizeof(struct eb_objects), GFP_KERNEL);
+	int count = args->buffer_count;
+	int size;
+
+	if (args->flags & I915_EXEC_HANDLE_LUT) {
+		size = count;
+	} else {
+		size = 16;
+		while (size < 2 * count)
+			size <<= 1;
+	}
+
+	eb = kzalloc(EB_OBJECTS_SIZE(size), GFP_KERNEL);
 	if (eb == NULL)
 		return eb;
 	eb->file_priv = file_priv;
-	eb->and = size;
+	eb->size = size;
+	if (args->flags & I915_EXEC_HANDLE_LUT)
+		eb->and = -count;
+	else
+		eb->and = size - 1;
 	return eb;
 }
 
 static void
 eb_reset(struct eb_objects *eb)
 {
+	(void) memset(eb->slots, 0, eb->size * sizeof (eb->slots[0]));
 }
 
 static void
-eb_add_object(struct eb_objects *eb, struct drm_i915_gem_object *obj)
+eb_add_object(struct eb_objects *eb, struct drm_i915_gem_object *obj,
+    int index)
 {
+	unsigned long i;
+
+	if (eb->and < 0) {
+		eb->slots[index] = obj;
+		return;
+	}
+
+	/* Duplicates are rejected before we get here, so just probe */
+	for (i = obj->exec_handle & eb->and; eb->slots[i] != NULL;
+	    i = (i + 1) & eb->and)
+		;
+	eb->slots[i] = obj;
 }
 
 static struct drm_i915_gem_object *
 eb_get_object(struct eb_objects *eb, unsigned long handle)
 {
+	struct drm_i915_gem_object *obj;
+	unsigned long i;
+
+	if (eb->and < 0) {
+		if (handle >= -eb->and)
+			return NULL;
+		return eb->slots[handle];
+	}
+
+	for (i = handle & eb->and; (obj = eb->slots[i]) != NULL;
+	    i = (i + 1) & eb->and) {
+		if (obj->exec_handle == handle)
+			return obj;
+	}
+
 	return NULL;
 }
 
 static void
 eb_destroy(struct eb_objects *eb)
 {
-	kfree(eb, sizeof(struct eb_objects));
+	kfree(eb, EB_OBJECTS_SIZE(eb->size));
 }
 
 static inline int use_cpu_reloc(struct drm_i915_gem_object *obj)
@@ -82,26 +148,32 @@ static inline int use_cpu_reloc(struct drm_i915_gem_object *obj)
 		obj->cache_level != I915_CACHE_NONE);
 }
 
+/*
+ * Look up and validate a relocation and account its target domains.
+ * Returns 1 if the relocation has to be written, with the new target
+ * offset already stored in reloc->presumed_offset, 0 if the presumed
+ * offset was right, or a negative error.
+ */
 static int
-i915_gem_execbuffer_relocate_entry(struct drm_i915_gem_object *obj,
-				   struct eb_objects *eb,
-				   struct drm_i915_gem_relocation_entry *reloc)
+i915_gem_execbuffer_check_reloc(struct drm_i915_gem_object *obj,
+				struct eb_objects *eb,
+				struct drm_i915_gem_relocation_entry *reloc)
 {
 	struct drm_device *dev = obj->base.dev;
 	struct drm_gem_object *target_obj;
 	struct drm_i915_gem_object *target_i915_obj;
-	uint32_t reloc_val, reloc_offset;
 	uint32_t target_offset;
-	uint32_t *reloc_entry;
-	int ret = -EINVAL;
 
-	target_obj = drm_gem_object_lookup(dev, eb->file_priv,
-					   reloc->target_handle);
-	if (target_obj == NULL)
+	/* The exec list holds a reference on every valid target */
+	target_i915_obj = eb_get_object(eb, reloc->target_handle);
+	if (target_i915_obj == NULL)
 		return -ENOENT;
 
-	target_i915_obj = to_intel_bo(target_obj);
-	target_offset = target_i915_obj->gtt_offset;
+	target_obj = &target_i915_obj->base;
+	if (eb->ppgtt != NULL)
+		target_offset = target_i915_obj->exec_entry->offset;
+	else
+		target_offset = target_i915_obj->gtt_offset;
 
 	/* Sandybridge PPGTT errata: We need a global gtt mapping for MI and
 	 * pipe_control writes because the gpu doesn't properly redirect them
@@ -122,7 +194,7 @@ i915_gem_execbuffer_relocate_entry(struct drm_i915_gem_object *obj,
 			  (int) reloc->offset,
 			  reloc->read_domains,
 			  reloc->write_domain);
-		goto err;
+		return -EINVAL;
 	}
 	if (unlikely((reloc->write_domain | reloc->read_domains)
 		     & ~I915_GEM_GPU_DOMAINS)) {
@@ -133,7 +205,7 @@ i915_gem_execbuffer_relocate_entry(struct drm_i915_gem_object *obj,
 			  (int) reloc->offset,
 			  reloc->read_domains,
 			  reloc->write_domain);
-		goto err;
+		return -EINVAL;
 	}
 
 	target_obj->pending_read_domains |= reloc->read_domains;
@@ -143,7 +215,7 @@ i915_gem_execbuffer_relocate_entry(struct drm_i915_gem_object *obj,
 	 * more work needs to be done.
 	 */
 	if (target_offset == reloc->presumed_offset)
-		goto out;
+		return 0;
 
 	/* Check that the relocation address is valid... */
 	if (reloc->offset > obj->base.size - 4) {
@@ -152,88 +224,203 @@ i915_gem_execbuffer_relocate_entry(struct drm_i915_gem_object *obj,
 			  obj, reloc->target_handle,
 			  (int) reloc->offset,
 			  (int) obj->base.size);
-		goto err;
+		return -EINVAL;
 	}
 	if (reloc->offset & 3) {
 		DRM_ERROR("Relocation not 4-byte aligned: "
 			  "obj %p target %d offset %d.\n",
 			  obj, reloc->target_handle,
 			  (int) reloc->offset);
-		goto err;
+		return -EINVAL;
 	}
 
-		ret = i915_gem_object_set_to_gtt_domain(obj, true);
-		if (ret)
-			return ret;
+	/* and update the user's relocation entry */
+	reloc->presumed_offset = target_offset;
+	return 1;
+}
 
-		ret = i915_gem_object_put_fence(obj);
+/*
+ * Get obj ready for relocations to be written into it. Only needed once
+ * per object and execbuffer, *prepared remembers that it has been done.
+ */
+static int
+i915_gem_execbuffer_prepare_reloc(struct drm_i915_gem_object *obj,
+				  struct eb_objects *eb,
+				  bool *prepared)
+{
+	int ret;
+
+	if (*prepared)
+		return 0;
+
+	/* Not necessarily in the global GTT, flushed on its way to the GPU */
+	if (eb->ppgtt != NULL) {
+		ret = i915_gem_object_set_to_cpu_domain(obj, true);
 		if (ret)
 			return ret;
-	
-	/* Map the page containing the relocation we're going to
-	 * perform.
-	 */
-	int reloc_base = (reloc->offset & ~(PAGE_SIZE-1));
-	reloc_offset = reloc->offset & (PAGE_SIZE-1);
-	reloc_entry = (uint32_t *)(uintptr_t)(obj->page_list[reloc_base/PAGE_SIZE] + reloc_offset);
-	reloc_val = target_offset + reloc->delta;
-	
-	*reloc_entry = reloc_val;
 
-	/* and update the user's relocation entry */
-	reloc->presumed_offset = target_offset;
+		*prepared = true;
+		return 0;
+	}
 
-out:
-	ret = 0;
-err:
-	drm_gem_object_unreference(target_obj);
-	return ret;
+	ret = i915_gem_object_set_to_gtt_domain(obj, true);
+	if (ret)
+		return ret;
+
+	ret = i915_gem_object_put_fence(obj);
+	if (ret)
+		return ret;
+
+	*prepared = true;
+	return 0;
+}
+
+static void
+i915_gem_execbuffer_write_reloc(struct drm_i915_gem_object *obj,
+				struct drm_i915_gem_relocation_entry *reloc)
+{
+	uint32_t *reloc_entry;
+
+	reloc_entry = (uint32_t *)(uintptr_t)
+	    (obj->page_list[reloc->offset >> PAGE_SHIFT] +
+	    (reloc->offset & (PAGE_SIZE - 1)));
+	*reloc_entry = (uint32_t)reloc->presumed_offset + reloc->delta;
 }
 
+static int
+i915_gem_execbuffer_relocate_entry(struct drm_i915_gem_object *obj,
+				   struct eb_objects *eb,
+				   struct drm_i915_gem_relocation_entry *reloc,
+				   bool *prepared)
+{
+	int ret;
+
+	ret = i915_gem_execbuffer_check_reloc(obj, eb, reloc);
+	if (ret <= 0)
+		return ret;
+
+	ret = i915_gem_execbuffer_prepare_reloc(obj, eb, prepared);
+	if (ret)
+		return ret;
+
+	i915_gem_execbuffer_write_reloc(obj, reloc);
+	return 0;
+}
+
+/*
+ * Relocations are copied in I915_RELOC_CHUNK entries at a time. A chunk
+ * is checked as a whole first, so one whose presumed offsets are all
+ * right never touches the object. The rest are written in page order,
+ * and the new presumed offsets are copied back with a single copyout
+ * covering the entries that changed.
+ */
+#define	I915_RELOC_CHUNK	512
+
+/*
+ * Ring space reserved before an execbuffer starts emitting, covering the
+ * worst case of semaphore waits, cache flushes, the context switch, the
+ * INSTPM and SOL updates, the dispatch and the closing request, so that
+ * a full ring stalls us once, before anything has been written. Each
+ * cliprect emits its own box and dispatch on top of this.
+ */
+#define	I915_EXEC_RING_DWORDS	192
+
+#define	I915_EXEC_NPHASES	(I915_HIST_EXEC_DISPATCH - I915_HIST_EXEC_LOCK + 1)
+
+/*
+ * Mark the end of an execbuffer phase: the sdt:::i915-exec-<phase> probe
+ * fires with the ring, context id, buffer count and relocation count, and
+ * the phase's latency is kept in phase_ns. The histograms are only fed
+ * once the batch has been dispatched.
+ */
+#define	I915_EXEC_PHASE(probe, hist) do {				\
+	hrtime_t now = gethrtime();					\
+	phase_ns[(hist) - I915_HIST_EXEC_LOCK] = now - phase_start;	\
+	phase_start = now;						\
+	DTRACE_PROBE4(probe, int, ring->id, u32, ctx_id,		\
+	    u32, args->buffer_count, u32, nrelocs);			\
+} while (0)
+
+struct i915_reloc_chunk {
+	struct drm_i915_gem_relocation_entry *relocs;
+	struct drm_i915_gem_relocation_entry **order;
+	int size;
+};
+
 static int
 i915_gem_execbuffer_relocate_object(struct drm_i915_gem_object *obj,
-				    struct eb_objects *eb)
+				    struct eb_objects *eb,
+				    struct i915_reloc_chunk *chunk)
 {
-#define N_RELOC(x) ((x) / sizeof(struct drm_i915_gem_relocation_entry))
-	struct drm_i915_gem_relocation_entry stack_reloc[N_RELOC(512)];
+	struct drm_i915_private *dev_priv = obj->base.dev->dev_private;
 	struct drm_i915_gem_relocation_entry __user *user_relocs;
 	struct drm_i915_gem_exec_object2 *entry = obj->exec_entry;
-	int remain, ret;
+	struct drm_i915_gem_relocation_entry *r, **order = chunk->order;
+	bool prepared = false;
+	int remain, count, first, last, n, i, j, ret;
+	bool sorted;
 
 	user_relocs = (void __user *)(uintptr_t)entry->relocs_ptr;
 
 	remain = entry->relocation_count;
 	while (remain) {
-		struct drm_i915_gem_relocation_entry *r = stack_reloc;
-		int count = remain;
-		if (count > ARRAY_SIZE(stack_reloc))
-			count = ARRAY_SIZE(stack_reloc);
+		count = min(remain, chunk->size);
 		remain -= count;
 
-		if (DRM_COPY_FROM_USER(r, user_relocs, count*sizeof(r[0])))
+		if (DRM_COPY_FROM_USER(chunk->relocs, user_relocs,
+		    count * sizeof (chunk->relocs[0])))
 			return -EFAULT;
 
-		do {
-			u64 offset = r->presumed_offset;
+		n = 0;
+		first = last = -1;
+		sorted = true;
+		for (i = 0; i < count; i++) {
+			r = &chunk->relocs[i];
+			ret = i915_gem_execbuffer_check_reloc(obj, eb, r);
+			if (ret < 0)
+				return ret;
+			if (ret == 0)
+				continue;
+
+			if (n > 0 && r->offset < order[n - 1]->offset)
+				sorted = false;
+			order[n++] = r;
+			if (first < 0)
+				first = i;
+			last = i;
+		}
+
+		I915_STAT_ADD(dev_priv, I915_STAT_RELOC_APPLIED, n);
+		I915_STAT_ADD(dev_priv, I915_STAT_RELOC_SKIPPED, count - n);
 
-			ret = i915_gem_execbuffer_relocate_entry(obj, eb, r);
+		if (n > 0) {
+			ret = i915_gem_execbuffer_prepare_reloc(obj, eb,
+			    &prepared);
 			if (ret)
 				return ret;
 
-			if (r->presumed_offset != offset &&
-				DRM_COPY_TO_USER(&user_relocs->presumed_offset,
-						    &r->presumed_offset,
-						    sizeof(r->presumed_offset))) {
-				return -EFAULT;
+			/* Mostly in order already, insertion sort is cheap */
+			for (i = 1; !sorted && i < n; i++) {
+				r = order[i];
+				for (j = i; j > 0 && order[j - 1]->offset >
+				    r->offset; j--)
+					order[j] = order[j - 1];
+				order[j] = r;
 			}
 
-			user_relocs++;
-			r++;
-		} while (--count);
+			for (i = 0; i < n; i++)
+				i915_gem_execbuffer_write_reloc(obj, order[i]);
+
+			if (DRM_COPY_TO_USER(&user_relocs[first],
+			    &chunk->relocs[first],
+			    (last - first + 1) * sizeof (chunk->relocs[0])))
+				return -EFAULT;
+		}
+
+		user_relocs += count;
 	}
 
 	return 0;
-#undef N_RELOC
 }
 
 static int
@@ -242,10 +429,12 @@ i915_gem_execbuffer_relocate_object_slow(struct drm_i915_gem_object *obj,
 					 struct drm_i915_gem_relocation_entry *relocs)
 {
 	const struct drm_i915_gem_exec_object2 *entry = obj->exec_entry;
+	bool prepared = false;
 	int i, ret;
 
 	for (i = 0; i < entry->relocation_count; i++) {
-		ret = i915_gem_execbuffer_relocate_entry(obj, eb, &relocs[i]);
+		ret = i915_gem_execbuffer_relocate_entry(obj, eb, &relocs[i],
+		    &prepared);
 		if (ret)
 			return ret;
 	}
@@ -259,18 +448,38 @@ i915_gem_execbuffer_relocate(struct drm_device *dev,
 			     struct list_head *objects)
 {
 	struct drm_i915_gem_object *obj;
+	struct i915_reloc_chunk chunk;
 	int ret = 0;
 
+	/* Size the chunk for the largest relocation list, up to the limit */
+	chunk.size = 0;
 	list_for_each_entry(obj, struct drm_i915_gem_object, objects, exec_list) {
-		ret = i915_gem_execbuffer_relocate_object(obj, eb);
+		if (obj->exec_entry->relocation_count > chunk.size)
+			chunk.size = min(obj->exec_entry->relocation_count,
+			    I915_RELOC_CHUNK);
+	}
+	if (chunk.size == 0)
+		return 0;
+
+	chunk.relocs = kmem_alloc(chunk.size * sizeof (*chunk.relocs),
+	    KM_SLEEP);
+	chunk.order = kmem_alloc(chunk.size * sizeof (*chunk.order),
+	    KM_SLEEP);
+
+	list_for_each_entry(obj, struct drm_i915_gem_object, objects, exec_list) {
+		ret = i915_gem_execbuffer_relocate_object(obj, eb, &chunk);
 		if (ret)
 			break;
 	}
+
+	kmem_free(chunk.relocs, chunk.size * sizeof (*chunk.relocs));
+	kmem_free(chunk.order, chunk.size * sizeof (*chunk.order));
 	return ret;
 }
 
 #define  __EXEC_OBJECT_HAS_PIN (1UL<<31)
 #define  __EXEC_OBJECT_HAS_FENCE (1UL<<30)
+#define  __EXEC_OBJECT_HAS_GTT_PIN (1UL<<29)
 
 static int
 need_reloc_mappable(struct drm_i915_gem_object *obj)
@@ -364,9 +573,133 @@ i915_gem_execbuffer_unreserve_object(struct drm_i915_gem_object *obj)
 	entry->flags &= ~(__EXEC_OBJECT_HAS_FENCE | __EXEC_OBJECT_HAS_PIN);
 }
 
+static int
+i915_gem_execbuffer_reserve_vma(struct drm_i915_gem_object *obj,
+				struct i915_vma *vma,
+				bool *need_relocs)
+{
+	struct drm_i915_gem_exec_object2 *entry = obj->exec_entry;
+	int ret;
+
+	vma->pin_count++;
+	entry->flags |= __EXEC_OBJECT_HAS_PIN;
+
+	/* Most recently used last, for eviction */
+	list_move_tail(&vma->vm_link, &vma->ppgtt->vma_list, (caddr_t)vma);
+
+	if (entry->flags & EXEC_OBJECT_NEEDS_GTT) {
+		ret = i915_gem_object_pin(obj, 0, false, false);
+		if (ret)
+			return ret;
+
+		entry->flags |= __EXEC_OBJECT_HAS_GTT_PIN;
+		if (!obj->has_global_gtt_mapping)
+			i915_gem_gtt_bind_object(obj, obj->cache_level);
+	}
+
+	if (entry->offset != vma->node->start) {
+		entry->offset = vma->node->start;
+		*need_relocs = true;
+	}
+
+	if (entry->flags & EXEC_OBJECT_WRITE) {
+		obj->base.pending_read_domains = I915_GEM_DOMAIN_RENDER;
+		obj->base.pending_write_domain = I915_GEM_DOMAIN_RENDER;
+	}
+
+	return 0;
+}
+
+static void
+i915_gem_execbuffer_unreserve_vma(struct drm_i915_gem_object *obj,
+				  struct i915_hw_ppgtt *ppgtt)
+{
+	struct drm_i915_gem_exec_object2 *entry = obj->exec_entry;
+
+	if (entry->flags & __EXEC_OBJECT_HAS_GTT_PIN)
+		i915_gem_object_unpin(obj);
+
+	if (entry->flags & __EXEC_OBJECT_HAS_PIN)
+		i915_vma_lookup(ppgtt, obj)->pin_count--;
+
+	entry->flags &= ~(__EXEC_OBJECT_HAS_PIN | __EXEC_OBJECT_HAS_GTT_PIN);
+}
+
+/*
+ * Bind the objects into the context's own PPGTT, in the same phases as
+ * the global GTT below. Without mappable or fence constraints only the
+ * alignment can make an object ill-fitting. Those the GPU must also see
+ * through the global GTT are pinned there as well.
+ */
+static int
+i915_gem_execbuffer_reserve_vm(struct i915_hw_ppgtt *ppgtt,
+			       struct list_head *objects,
+			       bool *need_relocs)
+{
+	struct drm_i915_gem_object *obj;
+	struct drm_i915_gem_exec_object2 *entry;
+	struct i915_vma *vma;
+	int retry, ret;
+
+	list_for_each_entry(obj, struct drm_i915_gem_object, objects, exec_list) {
+		obj->base.pending_read_domains = I915_GEM_GPU_DOMAINS & ~I915_GEM_DOMAIN_COMMAND;
+		obj->base.pending_write_domain = 0;
+		obj->pending_fenced_gpu_access = false;
+	}
+
+	retry = 0;
+	do {
+		ret = 0;
+
+		/* Unbind any ill-fitting objects or pin. */
+		list_for_each_entry(obj, struct drm_i915_gem_object, objects, exec_list) {
+			entry = obj->exec_entry;
+			vma = i915_vma_lookup(ppgtt, obj);
+			if (vma == NULL)
+				continue;
+
+			if (entry->alignment &&
+			    vma->node->start & (entry->alignment - 1))
+				ret = i915_vma_unbind(vma);
+			else
+				ret = i915_gem_execbuffer_reserve_vma(obj, vma,
+				    need_relocs);
+			if (ret)
+				goto err;
+		}
+
+		/* Bind fresh objects */
+		list_for_each_entry(obj, struct drm_i915_gem_object, objects, exec_list) {
+			entry = obj->exec_entry;
+			if (entry->flags & __EXEC_OBJECT_HAS_PIN)
+				continue;
+
+			ret = i915_vma_bind(ppgtt, obj, entry->alignment, &vma);
+			if (ret == 0)
+				ret = i915_gem_execbuffer_reserve_vma(obj, vma,
+				    need_relocs);
+			if (ret)
+				goto err;
+		}
+
+err:		/* Decrement pin count for bound objects */
+		list_for_each_entry(obj, struct drm_i915_gem_object, objects, exec_list)
+			i915_gem_execbuffer_unreserve_vma(obj, ppgtt);
+
+		if (ret != -ENOSPC || retry++)
+			return ret;
+
+		ret = i915_ppgtt_evict_everything(ppgtt);
+		if (ret)
+			return ret;
+	} while (1);
+/* LINTED */
+}
+
 static int
 i915_gem_execbuffer_reserve(struct intel_ring_buffer *ring,
 			    struct drm_file *file,
+			    struct i915_hw_ppgtt *ppgtt,
 			    struct list_head *objects,
 			    bool *need_relocs)
 {
@@ -376,6 +709,11 @@ i915_gem_execbuffer_reserve(struct intel_ring_buffer *ring,
 	bool has_fenced_gpu_access = INTEL_INFO(ring->dev)->gen < 4;
 	struct drm_i915_gem_object *batch_obj;
 	int retry;
+
+	if (ppgtt != NULL)
+		return i915_gem_execbuffer_reserve_vm(ppgtt, objects,
+		    need_relocs);
+
 	batch_obj = list_entry(objects->prev,
 				struct drm_i915_gem_object,
 				exec_list);
@@ -568,12 +906,13 @@ i915_gem_execbuffer_relocate_slow(struct drm_device *dev,
 		list_add_tail(&obj->exec_list, objects, (caddr_t)obj);
 		obj->exec_handle = exec[i].handle;
 		obj->exec_entry = &exec[i];
-		eb_add_object(eb, obj);
+		eb_add_object(eb, obj, i);
 	}
 
 	need_relocs = (args->flags & I915_EXEC_NO_RELOC) == 0;
 
-	ret = i915_gem_execbuffer_reserve(ring, file, objects, &need_relocs);
+	ret = i915_gem_execbuffer_reserve(ring, file, eb->ppgtt, objects,
+	    &need_relocs);
 	if (ret)
 		goto err;
 
@@ -703,13 +1042,34 @@ static void
 i915_gem_execbuffer_retire_commands(struct drm_device *dev,
 				    struct drm_file *file,
 				    struct intel_ring_buffer *ring,
-				    struct drm_i915_gem_object *obj)
+				    struct drm_i915_gem_object *obj,
+				    struct drm_i915_pending_fence **fence,
+				    u32 *fence_id)
 {
+	struct drm_i915_gem_request *request;
+	unsigned long flags;
+	u32 seqno;
+
 	/* Unconditionally force add_request to emit a full flush. */
 	ring->gpu_caches_dirty = true;
 
 	/* Add a breadcrumb for the completion of the batch buffer */
-	(void)__i915_add_request(ring, file, obj, NULL);
+	if (__i915_add_request(ring, file, obj, &seqno) || *fence == NULL)
+		return;
+
+	/* Hand the completion event to the request just added */
+	request = list_entry(ring->request_list.prev,
+	    struct drm_i915_gem_request, list);
+	if (request->seqno != seqno || request->file_priv == NULL)
+		return;
+
+	spin_lock_irqsave(&dev->event_lock, flags);
+	(*fence)->event.fence = seqno;
+	request->fence = *fence;
+	spin_unlock_irqrestore(&dev->event_lock, flags);
+
+	*fence = NULL;
+	*fence_id = seqno;
 }
 
 static int
@@ -752,6 +1112,14 @@ i915_gem_do_execbuffer(struct drm_device *dev, void *data,
 	struct intel_ring_buffer *ring;
 	u32 ctx_id = i915_execbuffer2_get_context_id(*args);
 	struct batch_info_list *node = NULL;
+	struct drm_i915_pending_fence *fence = NULL;
+	u32 fence_id = 0;
+	struct i915_sched_entity *entity;
+	struct i915_hw_context *ctx, *vm_ctx = NULL;
+	bool sched_held = false;
+	hrtime_t start = gethrtime(), phase_start = start;
+	hrtime_t phase_ns[I915_EXEC_NPHASES];
+	u32 nrelocs = 0;
 	u32 exec_start, exec_len;
 	u32 mask, flags;
 	int ret, mode, i;
@@ -766,6 +1134,9 @@ i915_gem_do_execbuffer(struct drm_device *dev, void *data,
 	if (ret)
 		return ret;
 
+	for (i = 0; i < args->buffer_count; i++)
+		nrelocs += exec[i].relocation_count;
+
 	flags = 0;
 	if (args->flags & I915_EXEC_SECURE) {
 		if (!file->is_master)
@@ -880,23 +1251,52 @@ i915_gem_do_execbuffer(struct drm_device *dev, void *data,
 		}
 	}
 
+	if (args->flags & I915_EXEC_FENCE_EVENT) {
+		fence = i915_gem_fence_event_alloc(dev, file, args->rsvd2);
+		if (fence == NULL) {
+			ret = -EBUSY;
+			goto pre_mutex_err;
+		}
+	}
+
 	ret = i915_mutex_lock_interruptible(dev);
 	if (ret)
 		goto pre_mutex_err;
 
+	entity = i915_gem_context_sched_entity(file, ctx_id, &ctx);
+	if (entity == NULL) {
+		mutex_unlock(&dev->struct_mutex);
+		ret = -ENOENT;
+		goto pre_mutex_err;
+	}
+
+	/* May drop struct_mutex while other submitters go first */
+	ret = i915_sched_enter(dev, entity, ctx);
+	if (ret)
+		goto pre_mutex_err;
+	sched_held = true;
+	I915_EXEC_PHASE(i915__exec__lock, I915_HIST_EXEC_LOCK);
+
 	if (dev_priv->mm.suspended || dev_priv->gpu_hang) {
 		mutex_unlock(&dev->struct_mutex);
 		ret = -EBUSY;
 		goto pre_mutex_err;
 	}
 
-	eb = eb_create(args->buffer_count, file);
+	eb = eb_create(args, file);
 	if (eb == NULL) {
 		mutex_unlock(&dev->struct_mutex);
 		ret = -ENOMEM;
 		goto pre_mutex_err;
 	}
 
+	/*
+	 * The context may have its own address space, kept until we're done.
+	 * A secure batch runs from the global GTT, and so do its targets.
+	 */
+	if (!(flags & I915_DISPATCH_SECURE))
+		eb->ppgtt = i915_gem_context_get_ppgtt(file, ctx_id, &vm_ctx);
+
 	if (MDB_TRACK_ENABLE) {
 		node = drm_alloc(sizeof (struct batch_info_list), DRM_MEM_MAPS);
 		node->num = args->buffer_count;
@@ -928,7 +1328,7 @@ i915_gem_do_execbuffer(struct drm_device *dev, void *data,
 		list_add_tail(&obj->exec_list, &objects, (caddr_t)obj);
 		obj->exec_handle = exec[i].handle;
 		obj->exec_entry = &exec[i];
-		eb_add_object(eb, obj);
+		eb_add_object(eb, obj, i);
 
 		/*
 		 * The condition here was: if (MDB_TRACK_ENABLE)...
@@ -943,12 +1343,15 @@ i915_gem_do_execbuffer(struct drm_device *dev, void *data,
 	batch_obj = list_entry(objects.prev,
 			       struct drm_i915_gem_object,
 			       exec_list);
+	I915_EXEC_PHASE(i915__exec__lookup, I915_HIST_EXEC_LOOKUP);
 
 	/* Move the objects en-masse into the GTT, evicting if necessary. */
 	need_relocs = (args->flags & I915_EXEC_NO_RELOC) == 0;
-	ret = i915_gem_execbuffer_reserve(ring, file, &objects, &need_relocs);
+	ret = i915_gem_execbuffer_reserve(ring, file, eb->ppgtt, &objects,
+	    &need_relocs);
 		if (ret)
 			goto err;
+	I915_EXEC_PHASE(i915__exec__reserve, I915_HIST_EXEC_RESERVE);
 
 	/* The objects are in their final locations, apply the relocations. */
 	if (need_relocs)
@@ -964,6 +1367,7 @@ i915_gem_do_execbuffer(struct drm_device *dev, void *data,
 		if (ret)
 			goto err;
 	}
+	I915_EXEC_PHASE(i915__exec__reloc, I915_HIST_EXEC_RELOC);
 
 	/* Set the pending read domains for the batch buffer to COMMAND */
 	if (batch_obj->base.pending_write_domain) {
@@ -980,9 +1384,14 @@ i915_gem_do_execbuffer(struct drm_device *dev, void *data,
 	if (flags & I915_DISPATCH_SECURE && !batch_obj->has_global_gtt_mapping)
 		i915_gem_gtt_bind_object(batch_obj, batch_obj->cache_level);
 
+	ret = intel_ring_reserve(ring, I915_EXEC_RING_DWORDS);
+	if (ret)
+		goto err;
+
 	ret = i915_gem_execbuffer_move_to_gpu(ring, &objects);
 	if (ret)
 		goto err;
+	I915_EXEC_PHASE(i915__exec__flush, I915_HIST_EXEC_FLUSH);
 
 	ret = i915_switch_context(ring, file, ctx_id);
 	if (ret)
@@ -1009,7 +1418,13 @@ i915_gem_do_execbuffer(struct drm_device *dev, void *data,
 			goto err;
 	}
 
-	exec_start = batch_obj->gtt_offset + args->batch_start_offset;
+	I915_EXEC_PHASE(i915__exec__switch, I915_HIST_EXEC_SWITCH);
+
+	if (eb->ppgtt != NULL)
+		exec_start = batch_obj->exec_entry->offset;
+	else
+		exec_start = batch_obj->gtt_offset;
+	exec_start += args->batch_start_offset;
 	exec_len = args->batch_len;
 	if (cliprects) {
 		for (i = 0; i < args->num_cliprects; i++) {
@@ -1033,7 +1448,14 @@ i915_gem_do_execbuffer(struct drm_device *dev, void *data,
 	}
 
 	i915_gem_execbuffer_move_to_active(&objects, ring);
-	i915_gem_execbuffer_retire_commands(dev, file, ring, batch_obj);
+	i915_gem_execbuffer_retire_commands(dev, file, ring, batch_obj,
+	    &fence, &fence_id);
+	if (args->flags & I915_EXEC_FENCE_EVENT)
+		args->rsvd2 = fence_id;
+	I915_EXEC_PHASE(i915__exec__dispatch, I915_HIST_EXEC_DISPATCH);
+	for (i = 0; i < I915_EXEC_NPHASES; i++)
+		i915_hist_add(dev_priv, I915_HIST_EXEC_LOCK + i, phase_ns[i]);
+	i915_hist_add(dev_priv, I915_HIST_EXEC_TOTAL, phase_start - start);
 
 err:
 	eb_destroy(eb);
@@ -1047,10 +1469,16 @@ err:
 		list_del_init(&obj->exec_list);
 		drm_gem_object_unreference(&obj->base);
 	}
+	if (vm_ctx != NULL)
+		i915_gem_context_unreference(vm_ctx);
 
 	mutex_unlock(&dev->struct_mutex);
 
 pre_mutex_err:
+	if (sched_held)
+		i915_sched_exit(dev);
+	if (fence != NULL)
+		i915_gem_fence_event_free(dev, fence);
 
 	drm_free(cliprects, args->num_cliprects * sizeof(*cliprects),
 		 DRM_MEM_DRIVER);
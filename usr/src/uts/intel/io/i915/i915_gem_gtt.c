@@ -220,10 +220,17 @@ static void gen6_write_pdes(struct i915_hw_ppgtt *ppgtt)
 			pd_addr, pd_entry);
 				
 	}
+	membar_producer();
 	(void) ddi_get32(dev_priv->gtt.gtt_mapping.acc_handle, 
 			(gen6_gtt_pte_t *)(uintptr_t)((caddr_t)dev_priv->gtt.virtual_gtt +  ppgtt->pd_offset));
 }
 
+/* The RING_PP_DIR_BASE value pointing at ppgtt's page directory */
+static uint32_t gen6_pd_base(struct i915_hw_ppgtt *ppgtt)
+{
+	return (ppgtt->pd_offset / 64) << 16;	/* in cachelines */
+}
+
 static int gen6_ppgtt_enable(struct drm_device *dev)
 {
 	drm_i915_private_t *dev_priv = dev->dev_private;
@@ -236,9 +243,7 @@ static int gen6_ppgtt_enable(struct drm_device *dev)
 
 	gen6_write_pdes(ppgtt);
 
-	pd_offset = ppgtt->pd_offset;
-	pd_offset /= 64; /* in cachelines, */
-	pd_offset <<= 16;
+	pd_offset = gen6_pd_base(ppgtt);
 
 	if (INTEL_INFO(dev)->gen == 6) {
 		uint32_t ecochk, gab_ctl, ecobits;
@@ -278,6 +283,7 @@ static int gen6_ppgtt_enable(struct drm_device *dev)
 
 		I915_WRITE(RING_PP_DIR_DCLV(ring), PP_DIR_DCLV_2G);
 		I915_WRITE(RING_PP_DIR_BASE(ring), pd_offset);
+		ring->ppgtt = ppgtt;
 	}
 	return 0;
 }
@@ -345,18 +351,16 @@ static void gen6_ppgtt_cleanup(struct i915_hw_ppgtt *ppgtt)
 	kfree(ppgtt, sizeof(*ppgtt));
 }
 
-static int gen6_ppgtt_init(struct i915_hw_ppgtt *ppgtt)
+/*
+ * ppgtt PDEs reside in the global gtt pagetable, which has 512*1024
+ * entries, starting at first_pd_entry_in_global_pt.
+ */
+static int gen6_ppgtt_init(struct i915_hw_ppgtt *ppgtt,
+			   unsigned first_pd_entry_in_global_pt)
 {
 	struct drm_device *dev = ppgtt->dev;
-	struct drm_i915_private *dev_priv = dev->dev_private;
-	unsigned first_pd_entry_in_global_pt;
 	int ret = -ENOMEM;
 
-	/* ppgtt PDEs reside in the global gtt pagetable, which has 512*1024
-	 * entries. For aliasing ppgtt support we just steal them at the end for
-	 * now. */
-       first_pd_entry_in_global_pt = gtt_total_entries(dev_priv->gtt);
-
 	if (IS_HASWELL(dev)) {
 		ppgtt->pte_encode = hsw_pte_encode;
 	} else if (IS_VALLEYVIEW(dev)) {
@@ -395,8 +399,9 @@ static int i915_gem_init_aliasing_ppgtt(struct drm_device *dev)
 	ppgtt->dev = dev;
 	ppgtt->scratch_page_paddr = ptob(dev_priv->gtt.scratch_page->pfnarray[0]);
 
+	/* For aliasing ppgtt support we just steal the PDEs at the end */
 	if (INTEL_INFO(dev)->gen < 8)
-		ret = gen6_ppgtt_init(ppgtt);
+		ret = gen6_ppgtt_init(ppgtt, gtt_total_entries(dev_priv->gtt));
 	else {
 		BUG();
 		DRM_ERROR("ppgtt is not supported");
@@ -420,6 +425,7 @@ void i915_gem_cleanup_aliasing_ppgtt(struct drm_device *dev)
 
 	ppgtt->cleanup(ppgtt);
 	dev_priv->mm.aliasing_ppgtt = NULL;
+	dev_priv->mm.full_ppgtt = false;
 }
 
 void i915_ppgtt_bind_object(struct i915_hw_ppgtt *ppgtt,
@@ -446,6 +452,7 @@ void i915_gem_restore_gtt_mappings(struct drm_device *dev)
 {
 	struct drm_i915_private *dev_priv = dev->dev_private;
 	struct drm_i915_gem_object *obj;
+	struct i915_hw_ppgtt *ppgtt;
 
 	/* First fill our portion of the GTT with scratch pages */
 /*
@@ -458,6 +465,14 @@ void i915_gem_restore_gtt_mappings(struct drm_device *dev)
 		i915_gem_gtt_bind_object(obj, obj->cache_level);
 	}
 
+	/* The contexts' page directories live in the global GTT too */
+	list_for_each_entry(ppgtt, struct i915_hw_ppgtt, &dev_priv->mm.ppgtt_list, link)
+		gen6_write_pdes(ppgtt);
+
+	/* and so do the partial views of GTT mmapped objects */
+	list_for_each_entry(obj, struct drm_i915_gem_object, &dev_priv->mm.fault_view_list, fault_view_link)
+		i915_gem_gtt_bind_view(obj, obj->fault_view, obj->fault_view_offset);
+
 	i915_gem_chipset_flush(dev);
 }
 
@@ -476,35 +491,71 @@ int i915_gem_gtt_prepare_object(struct drm_i915_gem_object *obj)
 	return 0;
 }
 
+/* PTEs encoded on the stack before being streamed out to the GTT */
+#define	GEN6_GTT_STAGING_PTES	256
+
 /*
- * Binds an object into the global gtt with the specified cache level. The object
- * will be accessible to the GPU via commands whose operands reference offsets
- * within the global GTT as well as accessible by the GPU through the GMADR
- * mapped BAR (dev_priv->mm.gtt->gtt).
+ * Copy count already encoded PTEs to the global GTT, starting at entry
+ * first_entry. The GTT is mapped write-combined, so the bulk of the
+ * range goes out as 64-bit stores which the CPU merges into full
+ * write-combining bursts; only a misaligned head or tail entry is
+ * written on its own. Callers issue the posting read and TLB flush once
+ * for the whole range.
  */
-static void gen6_ggtt_insert_entries(struct drm_i915_gem_object *obj,
+static void gen6_ggtt_write_ptes(struct drm_i915_private *dev_priv,
+				 unsigned first_entry,
+				 gen6_gtt_pte_t *ptes, unsigned count)
+{
+	ddi_acc_handle_t handle = dev_priv->gtt.gtt_mapping.acc_handle;
+	gen6_gtt_pte_t *gtt_addr;
+
+	gtt_addr = (gen6_gtt_pte_t *)(uintptr_t)
+	    ((caddr_t)dev_priv->gtt.virtual_gtt +
+	    first_entry * sizeof(gen6_gtt_pte_t));
+
+	if (count != 0 && ((uintptr_t)gtt_addr & 7) != 0) {
+		ddi_put32(handle, gtt_addr++, *ptes++);
+		count--;
+	}
+	if (count >= 2) {
+		ddi_rep_put64(handle, (uint64_t *)(uintptr_t)ptes,
+		    (uint64_t *)(uintptr_t)gtt_addr, count / 2,
+		    DDI_DEV_AUTOINCR);
+		gtt_addr += count & ~1U;
+		ptes += count & ~1U;
+	}
+	if (count & 1)
+		ddi_put32(handle, gtt_addr, *ptes);
+}
+
+/*
+ * Point num_entries global GTT entries from first_entry on at the pages
+ * in pfns, and flush the TLBs.
+ */
+static void gen6_ggtt_insert_pfns(struct drm_device *dev, pfn_t *pfns,
+				  unsigned first_entry, unsigned num_entries,
 				  enum i915_cache_level level)
 {
-	struct drm_device *dev = obj->base.dev;
 	struct drm_i915_private *dev_priv = dev->dev_private;
-	unsigned first_entry = obj->gtt_offset >> PAGE_SHIFT;
-	unsigned num_entries = obj->base.size / PAGE_SIZE;
 	/* LINTED */
 	const int max_entries = gtt_total_entries(dev_priv->gtt);
-	uint64_t page_addr;
-	gtt_pte_t *gtt_addr;
-	int i, j;
-
-	for (i = first_entry, j = 0; i < ( first_entry + num_entries); i++, j++) {
-		gtt_addr = (gtt_pte_t *)(uintptr_t)((caddr_t)dev_priv->gtt.virtual_gtt + i * sizeof(gtt_pte_t));
-		page_addr = obj->base.pfnarray[j] << PAGE_SHIFT;
-		ddi_put32(dev_priv->gtt.gtt_mapping.acc_handle,
-			    gtt_addr,
-			    dev_priv->gtt.pte_encode(dev, page_addr, level));
+	gen6_gtt_pte_t ptes[GEN6_GTT_STAGING_PTES];
+	gen6_gtt_pte_t *gtt_addr;
+	unsigned i, j, n;
+
+	BUG_ON(first_entry + num_entries > max_entries);
+
+	for (i = 0; i < num_entries; i += n) {
+		n = min(num_entries - i, GEN6_GTT_STAGING_PTES);
+		for (j = 0; j < n; j++)
+			ptes[j] = dev_priv->gtt.pte_encode(dev,
+			    (uint64_t)pfns[i + j] << PAGE_SHIFT,
+			    level);
+		gen6_ggtt_write_ptes(dev_priv, first_entry + i, ptes, n);
 	}
 
-	BUG_ON(i > max_entries);
-	BUG_ON(j != obj->base.size / PAGE_SIZE);
+	/* Drain the write-combining buffers before reading back */
+	membar_producer();
 
 	/* XXX: This serves as a posting read to make sure that the PTE has
 	 * actually been updated. There is some concern that even though
@@ -512,11 +563,14 @@ static void gen6_ggtt_insert_entries(struct drm_i915_gem_object *obj,
 	 * of NUMA access patterns. Therefore, even with the way we assume
 	 * hardware should work, we must keep this posting read for paranoia.
 	 */
-	if (i != 0) {
-		gtt_addr = (gtt_pte_t *)(uintptr_t)((caddr_t)dev_priv->gtt.virtual_gtt + (i-1)*sizeof(gtt_pte_t));
-		page_addr = obj->base.pfnarray[j-1] << PAGE_SHIFT;
+	if (num_entries != 0) {
+		gtt_addr = (gen6_gtt_pte_t *)(uintptr_t)
+		    ((caddr_t)dev_priv->gtt.virtual_gtt +
+		    (first_entry + num_entries - 1) * sizeof(gen6_gtt_pte_t));
 		WARN_ON(ddi_get32(dev_priv->gtt.gtt_mapping.acc_handle, gtt_addr) !=
-			dev_priv->gtt.pte_encode(dev, page_addr, level));
+			dev_priv->gtt.pte_encode(dev,
+			    (uint64_t)pfns[num_entries - 1] << PAGE_SHIFT,
+			    level));
 	}
 
 	/* This next bit makes the above posting read even more important. We
@@ -527,18 +581,38 @@ static void gen6_ggtt_insert_entries(struct drm_i915_gem_object *obj,
 	POSTING_READ(GFX_FLSH_CNTL_GEN6);
 }
 
-static void gen6_ggtt_clear_range(struct drm_device *dev,
-				 struct drm_i915_gem_object *obj,
-				 uint32_t type)
+/**
+ * Binds an object into the global gtt with the specified cache level. The object
+ * will be accessible to the GPU via commands whose operands reference offsets
+ * within the global GTT as well as accessible by the GPU through the GMADR
+ * mapped BAR (dev_priv->mm.gtt->gtt).
+ */
+static void gen6_ggtt_insert_entries(struct drm_i915_gem_object *obj,
+				  enum i915_cache_level level)
+{
+	gen6_ggtt_insert_pfns(obj->base.dev, obj->base.pfnarray,
+	    obj->gtt_offset >> PAGE_SHIFT, obj->base.size / PAGE_SIZE, level);
+}
+
+static void gen6_ggtt_insert_view(struct drm_i915_gem_object *obj,
+				  unsigned first_page, unsigned num_pages,
+				  uint32_t gtt_offset,
+				  enum i915_cache_level level)
+{
+	gen6_ggtt_insert_pfns(obj->base.dev, obj->base.pfnarray + first_page,
+	    gtt_offset >> PAGE_SHIFT, num_pages, level);
+}
+
+/* Point num_entries global GTT entries from first_entry on at scratch */
+static void gen6_ggtt_clear_entries(struct drm_device *dev,
+				    unsigned first_entry, unsigned num_entries)
 {
 	struct drm_i915_private *dev_priv = dev->dev_private;
-	gtt_pte_t scratch_pte;
-	unsigned first_entry = obj->gtt_offset >> PAGE_SHIFT;
-	unsigned num_entries = obj->base.size / PAGE_SIZE;
+	gen6_gtt_pte_t ptes[GEN6_GTT_STAGING_PTES];
+	gen6_gtt_pte_t scratch_pte;
 	const int max_entries = gtt_total_entries(dev_priv->gtt) - first_entry;
 	uint64_t scratch_page_addr = dev_priv->gtt.scratch_page->pfnarray[0] << PAGE_SHIFT;
-	gtt_pte_t *gtt_addr;
-	int i;
+	unsigned i, n;
 
 	if (num_entries > max_entries) {
 		 DRM_ERROR("First entry = %d; Num entries = %d (max=%d)\n",
@@ -546,12 +620,36 @@ static void gen6_ggtt_clear_range(struct drm_device *dev,
 		num_entries = max_entries;
 	}
 
-	for (i = first_entry ; i < ( first_entry + num_entries); i++) {
-		gtt_addr = (gtt_pte_t *)(uintptr_t)((caddr_t)dev_priv->gtt.virtual_gtt + i * sizeof(gtt_pte_t));
-		scratch_pte = dev_priv->gtt.pte_encode(dev, scratch_page_addr, I915_CACHE_LLC);
-		ddi_put32(dev_priv->gtt.gtt_mapping.acc_handle,
-			    gtt_addr, scratch_pte);
+	/* Every entry points at the scratch page, encode it just once */
+	scratch_pte = dev_priv->gtt.pte_encode(dev, scratch_page_addr, I915_CACHE_LLC);
+	n = min(num_entries, GEN6_GTT_STAGING_PTES);
+	for (i = 0; i < n; i++)
+		ptes[i] = scratch_pte;
+
+	for (i = 0; i < num_entries; i += n) {
+		n = min(num_entries - i, GEN6_GTT_STAGING_PTES);
+		gen6_ggtt_write_ptes(dev_priv, first_entry + i, ptes, n);
 	}
+
+	membar_producer();
+	(void) ddi_get32(dev_priv->gtt.gtt_mapping.acc_handle,
+	    (gen6_gtt_pte_t *)(uintptr_t)dev_priv->gtt.virtual_gtt);
+}
+
+static void gen6_ggtt_clear_range(struct drm_device *dev,
+				 struct drm_i915_gem_object *obj,
+				 uint32_t type)
+{
+	gen6_ggtt_clear_entries(dev, obj->gtt_offset >> PAGE_SHIFT,
+	    obj->base.size / PAGE_SIZE);
+}
+
+static void gen6_ggtt_clear_view(struct drm_i915_gem_object *obj,
+				 unsigned first_page, unsigned num_pages,
+				 uint32_t gtt_offset)
+{
+	gen6_ggtt_clear_entries(obj->base.dev, gtt_offset >> PAGE_SHIFT,
+	    num_pages);
 }
 
 void i915_ggtt_insert_entries(struct drm_i915_gem_object *obj,
@@ -585,6 +683,31 @@ static void i915_ggtt_clear_range(struct drm_device *dev,
 
 }
 
+static void i915_ggtt_insert_view(struct drm_i915_gem_object *obj,
+				  unsigned first_page, unsigned num_pages,
+				  uint32_t gtt_offset,
+				  enum i915_cache_level cache_level)
+{
+	unsigned int agp_type = (cache_level == I915_CACHE_NONE) ?
+			AGP_USER_MEMORY : AGP_USER_CACHED_MEMORY;
+
+	(void) drm_agp_bind_pages(obj->base.dev,
+				obj->base.pfnarray + first_page,
+				num_pages, gtt_offset, agp_type);
+}
+
+static void i915_ggtt_clear_view(struct drm_i915_gem_object *obj,
+				 unsigned first_page, unsigned num_pages,
+				 uint32_t gtt_offset)
+{
+	struct drm_i915_private *dev_priv = obj->base.dev->dev_private;
+
+	(void) drm_agp_unbind_pages(obj->base.dev,
+				obj->base.pfnarray + first_page, num_pages,
+				gtt_offset,
+				dev_priv->gtt.scratch_page->pfnarray[0], 1);
+}
+
 void i915_gem_gtt_bind_object(struct drm_i915_gem_object *obj,
 			      enum i915_cache_level cache_level)
 {
@@ -605,6 +728,28 @@ void i915_gem_gtt_unbind_object(struct drm_i915_gem_object *obj, uint32_t type)
 	obj->has_global_gtt_mapping = 0;
 }
 
+/*
+ * Map the pages of obj from byte offset on into node, a slot of global
+ * GTT space of its own, see i915_gem_fault().
+ */
+void i915_gem_gtt_bind_view(struct drm_i915_gem_object *obj,
+			    struct drm_mm_node *node, unsigned long offset)
+{
+	struct drm_i915_private *dev_priv = obj->base.dev->dev_private;
+
+	dev_priv->gtt.gtt_insert_view(obj, offset >> PAGE_SHIFT,
+	    node->size >> PAGE_SHIFT, node->start, obj->cache_level);
+}
+
+void i915_gem_gtt_unbind_view(struct drm_i915_gem_object *obj,
+			      struct drm_mm_node *node, unsigned long offset)
+{
+	struct drm_i915_private *dev_priv = obj->base.dev->dev_private;
+
+	dev_priv->gtt.gtt_clear_view(obj, offset >> PAGE_SHIFT,
+	    node->size >> PAGE_SHIFT, node->start);
+}
+
 void i915_gem_gtt_finish_object(struct drm_i915_gem_object *obj)
 {
 }
@@ -626,6 +771,286 @@ static void i915_gtt_color_adjust(struct drm_mm_node *node,
 	}
 }
 
+/*
+ * Per-context PPGTTs, gen7 only (see i915_enable_ppgtt): on gen6 MI and
+ * PIPE_CONTROL writes from non-secure batches bypass the PPGTT and need
+ * the target at the same global GTT offset, which a separate address
+ * space cannot give them.
+ *
+ * Each context created by a client gets its own 2GB address space and
+ * page tables. Its objects are bound there at execbuffer time through a
+ * struct i915_vma, and stay bound until evicted to make room in that
+ * same space, so clients no longer compete for the global GTT. The page
+ * directory is loaded into the ring on context switch.
+ */
+#define	I915_PPGTT_PD_ALIGN	(64 << 10)	/* PDEs 64 byte aligned */
+
+struct i915_hw_ppgtt *
+i915_ppgtt_create(struct drm_device *dev)
+{
+	struct drm_i915_private *dev_priv = dev->dev_private;
+	unsigned long pd_size = I915_PPGTT_PD_ENTRIES * PAGE_SIZE;
+	struct i915_hw_ppgtt *ppgtt;
+	struct drm_mm_node *node;
+	int ret;
+
+	ppgtt = kzalloc(sizeof(*ppgtt), GFP_KERNEL);
+	if (ppgtt == NULL)
+		return NULL;
+
+	node = kzalloc(sizeof(*node), GFP_KERNEL);
+	if (node == NULL) {
+		kfree(ppgtt, sizeof(*ppgtt));
+		return NULL;
+	}
+
+	/* The PDEs take the place of the global GTT PTEs of a slot of GTT
+	 * space, preferably out of the mappable aperture. */
+	ret = drm_mm_insert_node_in_range_generic(&dev_priv->mm.gtt_space,
+	    node, pd_size, I915_PPGTT_PD_ALIGN, 0,
+	    dev_priv->gtt.mappable_end, dev_priv->gtt.total);
+	if (ret)
+		ret = drm_mm_insert_node_in_range_generic(
+		    &dev_priv->mm.gtt_space, node, pd_size,
+		    I915_PPGTT_PD_ALIGN, 0, 0, dev_priv->gtt.total);
+	if (ret) {
+		ret = i915_gem_evict_something(dev, pd_size,
+		    I915_PPGTT_PD_ALIGN, 0, false, false);
+		if (ret == 0)
+			ret = drm_mm_insert_node_in_range_generic(
+			    &dev_priv->mm.gtt_space, node, pd_size,
+			    I915_PPGTT_PD_ALIGN, 0, 0, dev_priv->gtt.total);
+	}
+	if (ret) {
+		kfree(node, sizeof(*node));
+		kfree(ppgtt, sizeof(*ppgtt));
+		return NULL;
+	}
+
+	ppgtt->dev = dev;
+	ppgtt->scratch_page_paddr = ptob(dev_priv->gtt.scratch_page->pfnarray[0]);
+	ret = gen6_ppgtt_init(ppgtt, node->start >> PAGE_SHIFT);
+	if (ret) {
+		drm_mm_put_block(node);
+		kfree(ppgtt, sizeof(*ppgtt));
+		return NULL;
+	}
+	ppgtt->pd_node = node;
+
+	/* Leave a guard page at the end, as for the global GTT */
+	drm_mm_init(&ppgtt->mm, 0, I915_PPGTT_SIZE - PAGE_SIZE);
+	if (!HAS_LLC(dev))
+		ppgtt->mm.color_adjust = i915_gtt_color_adjust;
+	INIT_LIST_HEAD(&ppgtt->vma_list);
+
+	gen6_write_pdes(ppgtt);
+	list_add_tail(&ppgtt->link, &dev_priv->mm.ppgtt_list, (caddr_t)ppgtt);
+
+	return ppgtt;
+}
+
+/* Drop vma's binding, the GPU being done with it */
+static void
+i915_vma_release(struct i915_vma *vma)
+{
+	struct drm_i915_gem_object *obj = vma->obj;
+	struct i915_hw_ppgtt *ppgtt = vma->ppgtt;
+
+	ppgtt->clear_range(ppgtt, vma->node->start >> PAGE_SHIFT,
+			   obj->base.size >> PAGE_SHIFT);
+
+	list_del(&vma->obj_link);
+	list_del(&vma->vm_link);
+	ppgtt->bound -= obj->base.size;
+	ppgtt->vma_count--;
+
+	drm_mm_put_block(vma->node);
+	kfree(vma, sizeof(*vma));
+	i915_gem_object_unpin_pages(obj);
+}
+
+void
+i915_ppgtt_destroy(struct i915_hw_ppgtt *ppgtt)
+{
+	struct drm_device *dev = ppgtt->dev;
+	struct drm_i915_private *dev_priv = dev->dev_private;
+	struct intel_ring_buffer *ring;
+	struct i915_vma *vma, *next;
+	bool was_interruptible;
+	int i;
+
+	was_interruptible = dev_priv->mm.interruptible;
+	dev_priv->mm.interruptible = false;
+	list_for_each_entry_safe(vma, next, struct i915_vma,
+	    &ppgtt->vma_list, vm_link) {
+		/* Only fails once the GPU is wedged, let go anyway */
+		if (i915_vma_unbind(vma))
+			i915_vma_release(vma);
+	}
+	dev_priv->mm.interruptible = was_interruptible;
+
+	/* Make sure a new directory in the same slot gets loaded */
+	for_each_ring(ring, dev_priv, i) {
+		if (ring->ppgtt == ppgtt)
+			ring->ppgtt = NULL;
+	}
+
+	list_del(&ppgtt->link);
+	drm_mm_takedown(&ppgtt->mm);
+	drm_mm_put_block(ppgtt->pd_node);
+	ppgtt->cleanup(ppgtt);
+}
+
+/*
+ * Load ppgtt's page directory into ring, or the aliasing PPGTT's if
+ * ppgtt is NULL, for the batches that follow. This goes through the
+ * ring so that earlier batches still run in their own address space.
+ */
+int
+i915_ppgtt_switch(struct intel_ring_buffer *ring, struct i915_hw_ppgtt *ppgtt)
+{
+	struct drm_i915_private *dev_priv = ring->dev->dev_private;
+	int ret;
+
+	if (ppgtt == NULL)
+		ppgtt = dev_priv->mm.aliasing_ppgtt;
+	if (ppgtt == NULL || ring->ppgtt == ppgtt)
+		return 0;
+
+	/* Nothing may still be using translations from the old directory */
+	ret = ring->flush(ring, I915_GEM_GPU_DOMAINS, I915_GEM_GPU_DOMAINS);
+	if (ret)
+		return ret;
+
+	ret = intel_ring_begin(ring, 6);
+	if (ret)
+		return ret;
+
+	intel_ring_emit(ring, MI_NOOP);
+	intel_ring_emit(ring, MI_LOAD_REGISTER_IMM(2));
+	intel_ring_emit(ring, RING_PP_DIR_DCLV(ring));
+	intel_ring_emit(ring, PP_DIR_DCLV_2G);
+	intel_ring_emit(ring, RING_PP_DIR_BASE(ring));
+	intel_ring_emit(ring, gen6_pd_base(ppgtt));
+	intel_ring_advance(ring);
+
+	ring->ppgtt = ppgtt;
+	I915_STAT_INC(dev_priv, I915_STAT_PPGTT_SWITCH);
+	return 0;
+}
+
+struct i915_vma *
+i915_vma_lookup(struct i915_hw_ppgtt *ppgtt, struct drm_i915_gem_object *obj)
+{
+	struct i915_vma *vma;
+
+	list_for_each_entry(vma, struct i915_vma, &obj->vma_list, obj_link) {
+		if (vma->ppgtt == ppgtt)
+			return vma;
+	}
+	return NULL;
+}
+
+/*
+ * Bind obj into ppgtt, evicting other objects from ppgtt if it is full.
+ * The binding comes back most recently used.
+ */
+int
+i915_vma_bind(struct i915_hw_ppgtt *ppgtt, struct drm_i915_gem_object *obj,
+	      uint32_t alignment, struct i915_vma **vmap)
+{
+	struct drm_i915_private *dev_priv = ppgtt->dev->dev_private;
+	struct i915_vma *vma;
+	struct drm_mm_node *node;
+	int ret;
+
+	if (obj->base.size > I915_PPGTT_SIZE - PAGE_SIZE)
+		return -E2BIG;
+
+	ret = i915_gem_object_get_pages(obj);
+	if (ret)
+		return ret;
+
+	i915_gem_object_pin_pages(obj);
+
+	vma = kzalloc(sizeof(*vma), GFP_KERNEL);
+	node = kzalloc(sizeof(*node), GFP_KERNEL);
+	if (vma == NULL || node == NULL) {
+		if (vma != NULL)
+			kfree(vma, sizeof(*vma));
+		if (node != NULL)
+			kfree(node, sizeof(*node));
+		i915_gem_object_unpin_pages(obj);
+		return -ENOMEM;
+	}
+
+search_free:
+	ret = drm_mm_insert_node_generic(&ppgtt->mm, node, obj->base.size,
+					 alignment, obj->cache_level);
+	if (ret) {
+		ret = i915_ppgtt_evict_something(ppgtt, obj->base.size,
+						 alignment, obj->cache_level);
+		if (ret == 0)
+			goto search_free;
+
+		kfree(vma, sizeof(*vma));
+		kfree(node, sizeof(*node));
+		i915_gem_object_unpin_pages(obj);
+		return ret;
+	}
+
+	ppgtt->insert_entries(ppgtt, node->start >> PAGE_SHIFT,
+			      obj->base.size >> PAGE_SHIFT,
+			      obj->base.pfnarray, obj->cache_level);
+	/* Drain the write-combining buffers before the GPU walks them */
+	membar_producer();
+
+	vma->node = node;
+	vma->obj = obj;
+	vma->ppgtt = ppgtt;
+	INIT_LIST_HEAD(&vma->evict_link);
+	list_add_tail(&vma->obj_link, &obj->vma_list, (caddr_t)vma);
+	list_add_tail(&vma->vm_link, &ppgtt->vma_list, (caddr_t)vma);
+	ppgtt->bound += obj->base.size;
+	ppgtt->vma_count++;
+
+	I915_STAT_INC(dev_priv, I915_STAT_VMA_BIND);
+	*vmap = vma;
+	return 0;
+}
+
+int
+i915_vma_unbind(struct i915_vma *vma)
+{
+	int ret;
+
+	if (vma->pin_count)
+		return -EBUSY;
+
+	/* Wait for the GPU to be done with the pages before unmapping them */
+	ret = i915_gem_object_finish_gpu(vma->obj);
+	if (ret)
+		return ret;
+
+	i915_vma_release(vma);
+	return 0;
+}
+
+int
+i915_gem_object_unbind_vmas(struct drm_i915_gem_object *obj)
+{
+	struct i915_vma *vma, *next;
+	int ret;
+
+	list_for_each_entry_safe(vma, next, struct i915_vma,
+	    &obj->vma_list, obj_link) {
+		ret = i915_vma_unbind(vma);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
 void i915_gem_setup_global_gtt(struct drm_device *dev,
 			      unsigned long start,
 			      unsigned long mappable_end,
@@ -704,8 +1129,11 @@ int i915_gem_init_global_gtt(struct drm_device *dev)
 
 	if (intel_enable_ppgtt(dev) && HAS_ALIASING_PPGTT(dev)) {
 		ret = i915_gem_init_aliasing_ppgtt(dev);
-		if (!ret)
+		if (!ret) {
+			dev_priv->mm.full_ppgtt =
+			    i915_enable_ppgtt >= 2 && IS_GEN7(dev);
 			return 0;
+		}
 		DRM_ERROR("Aliased PPGTT setup failed %d\n", ret);
 		drm_mm_takedown(&dev_priv->mm.gtt_space);
 		gtt_size += I915_PPGTT_PD_ENTRIES*PAGE_SIZE;
@@ -744,6 +1172,15 @@ i915_setup_scratch_page(struct drm_device *dev)
 		DRM_ERROR("setup_scratch_page: gem object init failed");
 		return (-ENOMEM);
 	}
+	/* The scratch page is handed to the GTT right away, back it now */
+	if (drm_gem_object_populate(dev_priv->gtt.scratch_page) != 0) {
+		drm_gem_object_release(dev_priv->gtt.scratch_page);
+		kmem_free(dev_priv->gtt.scratch_page,
+		    sizeof (struct drm_i915_gem_object));
+		dev_priv->gtt.scratch_page = NULL;
+		DRM_ERROR("setup_scratch_page: gem object populate failed");
+		return (-ENOMEM);
+	}
 	(void) memset(dev_priv->gtt.scratch_page->kaddr, 0, DRM_PAGE_SIZE);
 
 	return 0;
@@ -777,10 +1214,15 @@ static inline size_t gen6_get_stolen_size(u16 snb_gmch_ctl)
 	return snb_gmch_ctl << 25; /* 32 MB units */
 }
 
+/*
+ * The GTT page table is mapped on its own and write-combined, apart from
+ * the strictly ordered register space that shares the BAR. PTE updates
+ * are followed by a barrier and a posting read.
+ */
 static ddi_device_acc_attr_t gtt_attr = {
 	DDI_DEVICE_ATTR_V0,
 	DDI_NEVERSWAP_ACC,
-	DDI_STRICTORDER_ACC,
+	DDI_MERGING_OK_ACC,
 };
 
 #define GEN6_GTTMMADR	1
@@ -792,14 +1234,16 @@ static void i915_gen6_gtt_ioremap(struct drm_local_map *map, struct drm_device *
 	int ret;
 
 	ret = ddi_regs_map_setup(dev->devinfo, GEN6_GTTMMADR,
-			(caddr_t *)&base, 0, 0,
+			(caddr_t *)&base, GEN6_GTT_OFFSET, map->size,
 			&gtt_attr, &map->acc_handle);
 
 	if (ret != DDI_SUCCESS) {
 		DRM_ERROR("failed to map GTT");
+		map->handle = NULL;
+		return;
 	}
 
-	map->handle = (void *)(base + GEN6_GTT_OFFSET);
+	map->handle = (void *)base;
 }
 
 static int gen6_gmch_probe(struct drm_device *dev,
@@ -846,6 +1290,8 @@ static int gen6_gmch_probe(struct drm_device *dev,
 
 	dev_priv->gtt.gtt_clear_range = gen6_ggtt_clear_range;
 	dev_priv->gtt.gtt_insert_entries = gen6_ggtt_insert_entries;
+	dev_priv->gtt.gtt_clear_view = gen6_ggtt_clear_view;
+	dev_priv->gtt.gtt_insert_view = gen6_ggtt_insert_view;
 
 	return 0;
 }
@@ -1091,6 +1537,8 @@ static int i915_gmch_probe(struct drm_device *dev,
 
 	dev_priv->gtt.gtt_clear_range = i915_ggtt_clear_range;
 	dev_priv->gtt.gtt_insert_entries = i915_ggtt_insert_entries;
+	dev_priv->gtt.gtt_clear_view = i915_ggtt_clear_view;
+	dev_priv->gtt.gtt_insert_view = i915_ggtt_insert_view;
 
 	return 0;
 }
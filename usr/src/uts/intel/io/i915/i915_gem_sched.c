@@ -0,0 +1,267 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Execbuffer submission scheduling.
+ *
+ * Batches are still written to the ring by the submitting thread under
+ * struct_mutex, but each submitter first takes the device's submission
+ * slot here. While the slot is free nobody waits. When it is contended,
+ * the waiters are granted it in order of
+ *
+ *  - effective priority: the entity's priority, plus one level for every
+ *    i915_sched_age_us spent waiting, so that nobody starves;
+ *  - GPU time used (vruntime), so entities of equal priority get a fair
+ *    share of the GPU;
+ *  - arrival.
+ *
+ * An entity is a hardware context, or a file for the batches it submits
+ * on the default context. Dependencies between batches are unaffected:
+ * objects are only looked up once the slot is held, and every batch still
+ * goes through i915_gem_object_sync on its way to the ring.
+ */
+
+#include "drmP.h"
+#include "i915_drm.h"
+#include "i915_drv.h"
+
+struct i915_sched_waiter {
+	struct list_head link;
+	struct i915_sched_entity *entity;
+	hrtime_t enqueued;
+	bool granted;
+	kcondvar_t cv;
+};
+
+void
+i915_sched_init(struct drm_device *dev)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	struct i915_sched *sched = &dev_priv->sched;
+
+	mutex_init(&sched->lock, NULL, MUTEX_DRIVER, NULL);
+	INIT_LIST_HEAD(&sched->waiters);
+	sched->busy = false;
+	sched->vruntime_floor = 0;
+}
+
+void
+i915_sched_fini(struct drm_device *dev)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+
+	mutex_destroy(&dev_priv->sched.lock);
+}
+
+void
+i915_sched_entity_init(struct i915_sched_entity *entity)
+{
+	(void) memset(entity, 0, sizeof (*entity));
+	entity->priority = I915_CONTEXT_DEFAULT_PRIORITY;
+}
+
+static int64_t
+i915_sched_effective_priority(struct i915_sched_waiter *w, hrtime_t now)
+{
+	int64_t prio = w->entity->priority;
+
+	if (i915_sched_age_us > 0)
+		prio += (now - w->enqueued) / ((hrtime_t)i915_sched_age_us * 1000);
+	return (prio);
+}
+
+static bool
+i915_sched_before(struct i915_sched_waiter *a, struct i915_sched_waiter *b,
+    hrtime_t now)
+{
+	int64_t pa = i915_sched_effective_priority(a, now);
+	int64_t pb = i915_sched_effective_priority(b, now);
+
+	if (pa != pb)
+		return (pa > pb);
+	if (a->entity->vruntime != b->entity->vruntime)
+		return (a->entity->vruntime < b->entity->vruntime);
+	return (a->enqueued < b->enqueued);
+}
+
+/*
+ * An entity coming back from idle starts at the floor rather than with
+ * the credit it built up while not submitting.
+ */
+static void
+i915_sched_catch_up(struct i915_sched *sched, struct i915_sched_entity *entity)
+{
+	if (entity->vruntime < sched->vruntime_floor)
+		entity->vruntime = sched->vruntime_floor;
+	else
+		sched->vruntime_floor = entity->vruntime;
+}
+
+/*
+ * Take the submission slot for a batch from entity. Called with
+ * struct_mutex held, and returns 0 with it held and the slot taken. If
+ * the slot is busy, struct_mutex is dropped while we wait; ctx, which
+ * entity belongs to if not NULL, is kept referenced meanwhile. On error
+ * neither struct_mutex nor the slot is held.
+ */
+int
+i915_sched_enter(struct drm_device *dev, struct i915_sched_entity *entity,
+    struct i915_hw_context *ctx)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	struct i915_sched *sched = &dev_priv->sched;
+	struct i915_sched_waiter w;
+	hrtime_t waited;
+	int ret;
+
+	mutex_enter(&sched->lock);
+	entity->submitted++;
+	if (!sched->busy && list_empty(&sched->waiters)) {
+		sched->busy = true;
+		i915_sched_catch_up(sched, entity);
+		mutex_exit(&sched->lock);
+		return 0;
+	}
+
+	if (entity->vruntime < sched->vruntime_floor)
+		entity->vruntime = sched->vruntime_floor;
+	w.entity = entity;
+	w.enqueued = gethrtime();
+	w.granted = false;
+	cv_init(&w.cv, NULL, CV_DRIVER, NULL);
+	list_add_tail(&w.link, &sched->waiters, (caddr_t)&w);
+	entity->queued++;
+
+	if (ctx != NULL)
+		i915_gem_context_reference(ctx);
+	mutex_unlock(&dev->struct_mutex);
+
+	while (!w.granted) {
+		if (cv_wait_sig(&w.cv, &sched->lock) == 0)
+			break;
+	}
+	if (!w.granted)
+		list_del(&w.link);
+
+	entity->queued--;
+	waited = gethrtime() - w.enqueued;
+	entity->wait_ns += waited;
+	if (waited > entity->wait_max_ns)
+		entity->wait_max_ns = waited;
+	mutex_exit(&sched->lock);
+	cv_destroy(&w.cv);
+
+	I915_STAT_INC(dev_priv, I915_STAT_SCHED_WAIT);
+	I915_STAT_ADD(dev_priv, I915_STAT_SCHED_WAIT_NS, waited);
+
+	if (!w.granted)
+		ret = -EINTR;
+	else if ((ret = i915_mutex_lock_interruptible(dev)) != 0)
+		i915_sched_exit(dev);
+
+	if (ctx != NULL) {
+		if (ret)
+			mutex_lock(&dev->struct_mutex);
+		i915_gem_context_unreference(ctx);
+		if (ret)
+			mutex_unlock(&dev->struct_mutex);
+	}
+
+	return ret;
+}
+
+/* Give up the submission slot, handing it to the best waiter if any */
+void
+i915_sched_exit(struct drm_device *dev)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	struct i915_sched *sched = &dev_priv->sched;
+	struct i915_sched_waiter *w, *best = NULL;
+	hrtime_t now = gethrtime();
+
+	mutex_enter(&sched->lock);
+	ASSERT(sched->busy);
+	list_for_each_entry(w, struct i915_sched_waiter, &sched->waiters, link) {
+		if (best == NULL || i915_sched_before(w, best, now))
+			best = w;
+	}
+
+	if (best == NULL) {
+		sched->busy = false;
+	} else {
+		list_del(&best->link);
+		i915_sched_catch_up(sched, best->entity);
+		best->granted = true;
+		cv_signal(&best->cv);
+	}
+	mutex_exit(&sched->lock);
+}
+
+/* A request from entity went to the ring */
+void
+i915_sched_request_add(struct drm_device *dev,
+    struct i915_sched_entity *entity)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+
+	mutex_enter(&dev_priv->sched.lock);
+	entity->inflight++;
+	mutex_exit(&dev_priv->sched.lock);
+}
+
+/* A request from entity retired, having kept the GPU busy for gpu_ns */
+void
+i915_sched_request_retire(struct drm_device *dev,
+    struct i915_sched_entity *entity, uint64_t gpu_ns)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+
+	mutex_enter(&dev_priv->sched.lock);
+	if (entity->inflight > 0)
+		entity->inflight--;
+	entity->vruntime += gpu_ns;
+	entity->gpu_ns += gpu_ns;
+	mutex_exit(&dev_priv->sched.lock);
+}
+
+/* Snapshot one of entity's statistics for the context getparam ioctl */
+uint64_t
+i915_sched_entity_stat(struct drm_device *dev,
+    struct i915_sched_entity *entity, uint64_t param)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	uint64_t value = 0;
+
+	mutex_enter(&dev_priv->sched.lock);
+	switch (param) {
+	case I915_CONTEXT_PARAM_SCHED_QUEUED:
+		value = entity->queued;
+		break;
+	case I915_CONTEXT_PARAM_SCHED_INFLIGHT:
+		value = entity->inflight;
+		break;
+	case I915_CONTEXT_PARAM_SCHED_SUBMITTED:
+		value = entity->submitted;
+		break;
+	case I915_CONTEXT_PARAM_SCHED_WAIT_NS:
+		value = entity->wait_ns;
+		break;
+	case I915_CONTEXT_PARAM_SCHED_WAIT_MAX_NS:
+		value = entity->wait_max_ns;
+		break;
+	case I915_CONTEXT_PARAM_SCHED_GPU_NS:
+		value = entity->gpu_ns;
+		break;
+	}
+	mutex_exit(&dev_priv->sched.lock);
+
+	return (value);
+}
@@ -362,13 +362,16 @@ i915_gem_set_tiling(DRM_IOCTL_ARGS)
 		 * whilst executing a fenced command for an untiled object.
 		 */
 
+		/* A partial view starts on a row of the old tiling */
+		ret = i915_gem_object_release_fault_view(obj);
+
 		obj->map_and_fenceable =
 			obj->gtt_space == NULL ||
 			(obj->gtt_offset + obj->base.size <= dev_priv->gtt.mappable_end &&
 			 i915_gem_object_fence_ok(obj, args->tiling_mode));
 
 		/* Rebind if we need a change of alignment */
-		if (!obj->map_and_fenceable) {
+		if (ret == 0 && !obj->map_and_fenceable) {
 			u32 unfenced_alignment =
 				i915_gem_get_gtt_alignment(dev, obj->base.size,
 							    args->tiling_mode,
@@ -457,6 +460,28 @@ i915_gem_get_tiling(DRM_IOCTL_ARGS)
 	return 0;
 }
 
+/*
+ * Swap the 64-byte halves of each 128-byte block from src into dst, a
+ * word pair at a time so that it can be done in place (dst == src).
+ */
+static void
+i915_gem_swizzle_blocks(caddr_t dst, caddr_t src, int length)
+{
+	uint64_t *d = (uint64_t *)(uintptr_t)dst;
+	uint64_t *s = (uint64_t *)(uintptr_t)src;
+	uint64_t lo, hi;
+	int i, j;
+
+	for (i = 0; i < length; i += 128, d += 16, s += 16) {
+		for (j = 0; j < 8; j++) {
+			lo = s[j];
+			hi = s[j + 8];
+			d[j] = hi;
+			d[j + 8] = lo;
+		}
+	}
+}
+
 /**
  * Swap every 64 bytes of this page around, to account for it having a new
  * bit 17 of its physical address and therefore being interpreted differently
@@ -465,18 +490,43 @@ i915_gem_get_tiling(DRM_IOCTL_ARGS)
 static void
 i915_gem_swizzle_page(caddr_t va)
 {
-	char temp[64];
-	char *vaddr;
-	int i;
-
-	vaddr = (char *)(uintptr_t) va;
+	i915_gem_swizzle_blocks(va, va, PAGE_SIZE);
+}
 
-	for (i = 0; i < PAGE_SIZE; i += 128) {
-		(void) memcpy(temp, &vaddr[i], 64);
-		(void) memcpy(&vaddr[i], &vaddr[i + 64], 64);
-		(void) memcpy(&vaddr[i + 64], temp, 64);
+/**
+ * Copy length bytes at offset within a page whose bit 17 is set, XORing A6
+ * with A17, to (is_read) or from linear. Whole 128-byte blocks are swapped
+ * directly, the ragged ends one cacheline at a time.
+ */
+void
+i915_gem_swizzle_copy(caddr_t page, caddr_t linear, int offset, int length,
+    bool is_read)
+{
+	int this_length;
+
+	while (length > 0) {
+		if ((offset & 127) == 0 && length >= 128) {
+			this_length = length & ~127;
+			if (is_read)
+				i915_gem_swizzle_blocks(linear, page + offset,
+				    this_length);
+			else
+				i915_gem_swizzle_blocks(page + offset, linear,
+				    this_length);
+		} else {
+			this_length = min(ALIGN(offset + 1, 64) - offset,
+			    length);
+			if (is_read)
+				(void) memcpy(linear, page + (offset ^ 64),
+				    this_length);
+			else
+				(void) memcpy(page + (offset ^ 64), linear,
+				    this_length);
+		}
+		offset += this_length;
+		linear += this_length;
+		length -= this_length;
 	}
-
 }
 
 void
@@ -489,8 +539,7 @@ i915_gem_object_do_bit_17_swizzle(struct drm_i915_gem_object *obj)
 		return;
 
 	for (i = 0; i < page_count; i++) {
-		char new_bit_17 = (char)(page_to_phys(obj->page_list[i]) >> 17);
-		if ((new_bit_17 & 0x1) !=
+		if (i915_gem_object_page_bit17(obj, i) !=
 		    (test_bit(i, obj->bit_17) != 0)) {
 			i915_gem_swizzle_page(obj->page_list[i]);
 		}
@@ -514,9 +563,193 @@ i915_gem_object_save_bit_17_swizzle(struct drm_i915_gem_object *obj)
 	}
 
 	for (i = 0; i < page_count; i++) {
-		if (page_to_phys(obj->page_list[i]) & (1 << 17))
+		if (i915_gem_object_page_bit17(obj, i))
 			set_bit(i, obj->bit_17);
 		else
 			clear_bit(i, obj->bit_17);
 	}
 }
+
+/*
+ * CPU side detiling for the rectangle pread/pwrite ioctls. X tiles are 8
+ * rows of 512 bytes, Y tiles 32 rows of 128 bytes stored as 16-byte wide
+ * columns; both are 4KB, laid out left to right along stride.
+ */
+static void
+i915_gem_rect_tile_size(struct drm_i915_gem_object *obj, int *tile_width,
+    int *tile_height)
+{
+	if (obj->tiling_mode == I915_TILING_X) {
+		*tile_width = 512;
+		*tile_height = 8;
+	} else {
+		*tile_width = 128;
+		*tile_height = 32;
+	}
+}
+
+/*
+ * Validate the rectangle of args against obj, and return the range of
+ * the object it lies in, whole rows of tiles.
+ */
+int
+i915_gem_object_rect_range(struct drm_i915_gem_object *obj,
+    struct drm_i915_gem_prw_rect *args, uint64_t *offset, uint64_t *size)
+{
+	struct drm_device *dev = obj->base.dev;
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	uint32_t swizzle;
+	int tile_width, tile_height;
+	uint64_t row_size, end;
+
+	if (args->flags != 0 || args->pitch < args->width)
+		return -EINVAL;
+
+	/* Only the 4KB tile layouts are handled */
+	if (IS_GEN2(dev) || obj->tiling_mode == I915_TILING_NONE ||
+	    (obj->tiling_mode == I915_TILING_Y && !HAS_128_BYTE_Y_TILING(dev)))
+		return -EINVAL;
+
+	if (obj->tiling_mode == I915_TILING_X)
+		swizzle = dev_priv->mm.bit_6_swizzle_x;
+	else
+		swizzle = dev_priv->mm.bit_6_swizzle_y;
+	if (swizzle == I915_BIT_6_SWIZZLE_UNKNOWN)
+		return -ENODEV;
+
+	if ((uint64_t)args->x + args->width > obj->stride)
+		return -EINVAL;
+
+	i915_gem_rect_tile_size(obj, &tile_width, &tile_height);
+	row_size = (uint64_t)obj->stride * tile_height;
+	*offset = (args->y / tile_height) * row_size;
+	end = (((uint64_t)args->y + args->height + tile_height - 1) /
+	    tile_height) * row_size;
+	if (end > obj->base.size)
+		return -EINVAL;
+	*size = end - *offset;
+
+	return 0;
+}
+
+/* Object offset of byte x of row y, before bit 6 swizzling */
+static uint64_t
+i915_gem_rect_offset(struct drm_i915_gem_object *obj, int tile_width,
+    int tile_height, uint32_t x, uint32_t y)
+{
+	uint64_t offset;
+
+	offset = (uint64_t)(y / tile_height) * obj->stride * tile_height +
+	    (x / tile_width) * PAGE_SIZE;
+	x %= tile_width;
+	y %= tile_height;
+	if (obj->tiling_mode == I915_TILING_X)
+		return offset + y * tile_width + x;
+	return offset + (x / 16) * tile_height * 16 + y * 16 + (x % 16);
+}
+
+/* Bit 6 of the address the GPU sees for offset, under swizzle mode */
+static uint64_t
+i915_gem_rect_swizzle(struct drm_i915_gem_object *obj, uint32_t swizzle,
+    uint64_t offset)
+{
+	uint64_t bit6 = 0;
+
+	switch (swizzle) {
+	case I915_BIT_6_SWIZZLE_9:
+		bit6 = offset >> 3;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10:
+		bit6 = (offset >> 3) ^ (offset >> 4);
+		break;
+	case I915_BIT_6_SWIZZLE_9_11:
+		bit6 = (offset >> 3) ^ (offset >> 5);
+		break;
+	case I915_BIT_6_SWIZZLE_9_10_11:
+		bit6 = (offset >> 3) ^ (offset >> 4) ^ (offset >> 5);
+		break;
+	case I915_BIT_6_SWIZZLE_9_17:
+		bit6 = offset >> 3;
+		if (i915_gem_object_page_bit17(obj, offset >> PAGE_SHIFT))
+			bit6 ^= 64;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10_17:
+		bit6 = (offset >> 3) ^ (offset >> 4);
+		if (i915_gem_object_page_bit17(obj, offset >> PAGE_SHIFT))
+			bit6 ^= 64;
+		break;
+	}
+	return offset ^ (bit6 & 64);
+}
+
+/**
+ * Copy the rectangle of args between obj, whose pages are pinned and
+ * made coherent by the caller, and the user buffer. Each row goes
+ * through a bounce buffer with a single copyin or copyout; within the
+ * row, spans are contiguous up to the end of the tile row for X tiles
+ * left unswizzled, a 64-byte half otherwise, and a 16-byte column for
+ * Y tiles.
+ */
+int
+i915_gem_object_rect_copy(struct drm_i915_gem_object *obj,
+    struct drm_i915_gem_prw_rect *args, bool is_read)
+{
+	drm_i915_private_t *dev_priv = obj->base.dev->dev_private;
+	caddr_t user_data = (caddr_t)(uintptr_t)args->data_ptr;
+	caddr_t bounce;
+	uint32_t swizzle, row, col, x, len;
+	uint64_t offset, swizzled;
+	int tile_width, tile_height;
+	int ret = 0;
+
+	if (args->width == 0 || args->height == 0)
+		return 0;
+
+	i915_gem_rect_tile_size(obj, &tile_width, &tile_height);
+	if (obj->tiling_mode == I915_TILING_X)
+		swizzle = dev_priv->mm.bit_6_swizzle_x;
+	else
+		swizzle = dev_priv->mm.bit_6_swizzle_y;
+
+	bounce = kmem_alloc(args->width, KM_SLEEP);
+
+	for (row = 0; row < args->height; row++) {
+		if (!is_read && DRM_COPY_FROM_USER(bounce, user_data,
+		    args->width) != 0) {
+			ret = -EFAULT;
+			break;
+		}
+
+		for (col = 0; col < args->width; col += len) {
+			x = args->x + col;
+			offset = i915_gem_rect_offset(obj, tile_width,
+			    tile_height, x, args->y + row);
+			if (obj->tiling_mode == I915_TILING_X)
+				len = tile_width - (x % tile_width);
+			else
+				len = 16 - (x % 16);
+			len = MIN(len, args->width - col);
+
+			swizzled = i915_gem_rect_swizzle(obj, swizzle, offset);
+			if (swizzled != offset)
+				len = MIN(len, 64 - (offset % 64));
+
+			if (is_read)
+				(void) memcpy(bounce + col,
+				    obj->base.kaddr + swizzled, len);
+			else
+				(void) memcpy(obj->base.kaddr + swizzled,
+				    bounce + col, len);
+		}
+
+		if (is_read && DRM_COPY_TO_USER(user_data, bounce,
+		    args->width) != 0) {
+			ret = -EFAULT;
+			break;
+		}
+		user_data += args->pitch;
+	}
+
+	kmem_free(bounce, args->width);
+	return ret;
+}
@@ -646,6 +646,52 @@ static void ironlake_handle_rps_change(struct drm_device *dev)
 	return;
 }
 
+int
+i915_waiter_compare(const void *a, const void *b)
+{
+	const struct i915_waiter *wa = a;
+	const struct i915_waiter *wb = b;
+	int32_t diff = (int32_t)(wa->seqno - wb->seqno);
+
+	/* Outstanding seqnos are always within 2^31 of each other */
+	if (diff != 0)
+		return (diff < 0 ? -1 : 1);
+	if (wa < wb)
+		return (-1);
+	return (wa > wb);
+}
+
+/*
+ * Wake the waiters on ring whose seqno has passed, or all of them on a
+ * reset or hang, where each has to recheck for itself. Broadcasting on
+ * irq_queue covers the waiters not in the tree.
+ */
+void
+i915_ring_wake_waiters(struct intel_ring_buffer *ring, bool all)
+{
+	struct drm_i915_private *dev_priv = ring->dev->dev_private;
+	struct i915_waiter *w;
+	u32 seqno = 0;
+	int n = 0;
+
+	mutex_enter(&ring->irq_queue.lock);
+	if (!all && avl_numnodes(&ring->waiters) != 0)
+		seqno = ring->get_seqno(ring, false);
+	while ((w = avl_first(&ring->waiters)) != NULL) {
+		if (!all && !i915_seqno_passed(seqno, w->seqno))
+			break;
+		avl_remove(&ring->waiters, w);
+		w->woken = true;
+		cv_signal(&w->cv);
+		n++;
+	}
+	cv_broadcast(&ring->irq_queue.cv);
+	mutex_exit(&ring->irq_queue.lock);
+
+	if (n != 0)
+		I915_STAT_ADD(dev_priv, I915_STAT_WAIT_WOKEN, n);
+}
+
 static void notify_ring(struct drm_device *dev,
 			struct intel_ring_buffer *ring)
 {
@@ -654,7 +700,12 @@ static void notify_ring(struct drm_device *dev,
 	if (ring->obj == NULL)
 		return;
 
-	DRM_WAKEUP(&ring->irq_queue);
+	i915_ring_wake_waiters(ring, false);
+	if (ring->retire_irq) {
+		(void) atomic_cas_64((volatile uint64_t *)&ring->retire_irq_time,
+		    0, (uint64_t)gethrtime());
+		i915_gem_retire_irq_kick(dev_priv);
+	}
 	if (i915_enable_hangcheck && !dev_priv->gpu_hang) {
 		mod_timer(&dev_priv->gpu_error.hangcheck_timer,
 			msecs_to_jiffies(DRM_I915_HANGCHECK_PERIOD));
@@ -1418,7 +1469,7 @@ static void i915_error_work_func(struct work_struct *work)
 		}
 
 		for_each_ring(ring, dev_priv, i)
-			wake_up_all(&ring->irq_queue);
+			i915_ring_wake_waiters(ring, true);
 
 		wake_up_all(&dev_priv->gpu_error.reset_queue);
 		DRM_INFO("resetting done");
@@ -2093,7 +2144,7 @@ void i915_handle_error(struct drm_device *dev, bool wedged)
 		 * Wakeup waiting processes so they don't hang
 		 */
 		for_each_ring(ring, dev_priv, i)
-			wake_up_all(&ring->irq_queue);
+			i915_ring_wake_waiters(ring, true);
 	}
 
 	(void) queue_work(dev_priv->wq, &dev_priv->gpu_error.work);
@@ -2445,7 +2496,7 @@ void i915_hangcheck_elapsed(void* data)
 					/* Issue a wake-up to catch stuck h/w. */
 					DRM_ERROR("Hangcheck timer elapsed... %s idle\n",
 						  ring->name);
-					wake_up_all(&ring->irq_queue);
+					i915_ring_wake_waiters(ring, true);
 					ring->hangcheck.score += HUNG;
 				} else
 					busy = false;
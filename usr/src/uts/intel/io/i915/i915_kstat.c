@@ -0,0 +1,274 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * i915 driver statistics, see enum i915_stat in i915_drv.h.
+ *
+ *	kstat -m i915 -n i915stat
+ *
+ * latency histograms, see enum i915_hist, one kstat each:
+ *
+ *	kstat -m i915 -n ring_stall
+ *	kstat -m i915 -n 'exec_*'
+ *	kstat -m i915 -n gtt_fault
+ *
+ * and per-ring context switch counters:
+ *
+ *	kstat -m i915 -n context
+ */
+
+#include "drmP.h"
+#include "i915_drv.h"
+#include <sys/kstat.h>
+#include <sys/ddi.h>
+#include <sys/sunddi.h>
+
+static char *i915kstat_name[I915_STAT_NUM] = {
+	[I915_STAT_WAIT_SPIN] =		"wait_spin",
+	[I915_STAT_WAIT_SLEEP] =	"wait_sleep",
+	[I915_STAT_WAIT_MISSED_IRQ] =	"wait_missed_irq",
+	[I915_STAT_WAIT_WOKEN] =	"wait_woken",
+	[I915_STAT_WAIT_SPURIOUS] =	"wait_spurious",
+	[I915_STAT_RELOC_APPLIED] =	"reloc_applied",
+	[I915_STAT_RELOC_SKIPPED] =	"reloc_skipped",
+	[I915_STAT_RETIRE_IRQ] =	"retire_irq",
+	[I915_STAT_RETIRE_LAT_NS] =	"retire_latency_ns",
+	[I915_STAT_SCHED_WAIT] =	"sched_wait",
+	[I915_STAT_SCHED_WAIT_NS] =	"sched_wait_ns",
+	[I915_STAT_RING_STALL] =	"ring_stall",
+	[I915_STAT_RING_STALL_NS] =	"ring_stall_ns",
+	[I915_STAT_FENCE_HIT] =		"fence_hit",
+	[I915_STAT_FENCE_MISS] =	"fence_miss",
+	[I915_STAT_FENCE_STEAL] =	"fence_steal",
+	[I915_STAT_FENCE_WRITE_SKIPPED] = "fence_write_skipped",
+	[I915_STAT_PPGTT_SWITCH] =	"ppgtt_switch",
+	[I915_STAT_VMA_BIND] =		"vma_bind",
+	[I915_STAT_VMA_EVICT] =		"vma_evict",
+	[I915_STAT_GTT_FAULT] =		"gtt_fault",
+	[I915_STAT_GTT_FAULT_BYTES] =	"gtt_fault_bytes",
+	[I915_STAT_GTT_FAULT_VIEW] =	"gtt_fault_view",
+};
+
+static char *i915kstat_hist_name[I915_HIST_NUM] = {
+	[I915_HIST_RING_STALL] =	"ring_stall",
+	[I915_HIST_EXEC_LOCK] =		"exec_lock",
+	[I915_HIST_EXEC_LOOKUP] =	"exec_lookup",
+	[I915_HIST_EXEC_RESERVE] =	"exec_reserve",
+	[I915_HIST_EXEC_RELOC] =	"exec_reloc",
+	[I915_HIST_EXEC_FLUSH] =	"exec_flush",
+	[I915_HIST_EXEC_SWITCH] =	"exec_switch",
+	[I915_HIST_EXEC_DISPATCH] =	"exec_dispatch",
+	[I915_HIST_EXEC_TOTAL] =	"exec_total",
+	[I915_HIST_GTT_FAULT] =		"gtt_fault",
+};
+
+static int
+i915_kstat_update(kstat_t *ksp, int flag)
+{
+	drm_i915_private_t *dev_priv;
+	kstat_named_t *knp;
+	int i;
+
+	if (flag != KSTAT_READ)
+		return (EACCES);
+
+	dev_priv = ksp->ks_private;
+	knp = ksp->ks_data;
+
+	for (i = 0; i < I915_STAT_NUM; i++)
+		(knp++)->value.ui64 = dev_priv->stats[i];
+
+	return (0);
+}
+
+static char *i915kstat_ring_name[I915_NUM_RINGS] = {
+	[RCS] =		"rcs",
+	[VCS] =		"vcs",
+	[BCS] =		"bcs",
+	[VECS] =	"vecs",
+};
+
+#define	I915_KSTAT_CTX_NUM	3	/* counters per ring */
+
+static int
+i915_kstat_ctx_update(kstat_t *ksp, int flag)
+{
+	drm_i915_private_t *dev_priv;
+	struct intel_ring_buffer *ring;
+	kstat_named_t *knp;
+	int i;
+
+	if (flag != KSTAT_READ)
+		return (EACCES);
+
+	dev_priv = ksp->ks_private;
+	knp = ksp->ks_data;
+
+	for (i = 0; i < I915_NUM_RINGS; i++) {
+		ring = &dev_priv->ring[i];
+		(knp++)->value.ui64 = ring->ctx_switches;
+		(knp++)->value.ui64 = ring->ctx_elided;
+		(knp++)->value.ui64 = ring->ctx_cache_hits;
+	}
+
+	return (0);
+}
+
+static kstat_t *
+i915_init_kstat_ctx(struct drm_device *dev)
+{
+	static char *suffix[I915_KSTAT_CTX_NUM] = {
+		"switch", "elided", "cache_hit"
+	};
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+	kstat_named_t *knp;
+	int i, j;
+
+	ksp = kstat_create("i915", ddi_get_instance(dev->devinfo), "context",
+	    "drm", KSTAT_TYPE_NAMED, I915_NUM_RINGS * I915_KSTAT_CTX_NUM, 0);
+	if (ksp == NULL)
+		return (NULL);
+
+	ksp->ks_private = dev->dev_private;
+	ksp->ks_update = i915_kstat_ctx_update;
+	knp = ksp->ks_data;
+	for (i = 0; i < I915_NUM_RINGS; i++) {
+		for (j = 0; j < I915_KSTAT_CTX_NUM; j++) {
+			(void) snprintf(name, sizeof (name), "%s_%s",
+			    i915kstat_ring_name[i], suffix[j]);
+			kstat_named_init(knp++, name, KSTAT_DATA_UINT64);
+		}
+	}
+	kstat_install(ksp);
+
+	return (ksp);
+}
+
+static int
+i915_kstat_hist_update(kstat_t *ksp, int flag)
+{
+	volatile uint64_t *bucket;
+	kstat_named_t *knp;
+	int i;
+
+	if (flag != KSTAT_READ)
+		return (EACCES);
+
+	bucket = ksp->ks_private;
+	knp = ksp->ks_data;
+
+	for (i = 0; i < I915_HIST_BUCKETS; i++)
+		(knp++)->value.ui64 = bucket[i];
+
+	return (0);
+}
+
+/*
+ * Bucket 0 counts samples under 1us, bucket i those under 2^i us, and the
+ * last one everything beyond.
+ */
+void
+i915_hist_add(drm_i915_private_t *dev_priv, enum i915_hist hist, hrtime_t ns)
+{
+	uint64_t us = ns > 0 ? ns / 1000 : 0;
+	int i = 0;
+
+	while (us != 0 && i < I915_HIST_BUCKETS - 1) {
+		us >>= 1;
+		i++;
+	}
+	atomic_inc_64(&dev_priv->hist[hist][i]);
+}
+
+static kstat_t *
+i915_init_kstat_hist(struct drm_device *dev, enum i915_hist hist)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+	kstat_named_t *knp;
+	int i;
+
+	ksp = kstat_create("i915", ddi_get_instance(dev->devinfo),
+	    i915kstat_hist_name[hist], "drm", KSTAT_TYPE_NAMED,
+	    I915_HIST_BUCKETS, 0);
+	if (ksp == NULL)
+		return (NULL);
+
+	ksp->ks_private = (void *)&dev_priv->hist[hist][0];
+	ksp->ks_update = i915_kstat_hist_update;
+	for (knp = ksp->ks_data, i = 0; i < I915_HIST_BUCKETS; knp++, i++) {
+		if (i < I915_HIST_BUCKETS - 1)
+			(void) snprintf(name, sizeof (name), "lt_%lluus",
+			    1ULL << i);
+		else
+			(void) snprintf(name, sizeof (name), "ge_%lluus",
+			    1ULL << (i - 1));
+		kstat_named_init(knp, name, KSTAT_DATA_UINT64);
+	}
+	kstat_install(ksp);
+
+	return (ksp);
+}
+
+int
+i915_init_kstats(struct drm_device *dev)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	kstat_t *ksp;
+	kstat_named_t *knp;
+	int i;
+
+	ksp = kstat_create("i915", ddi_get_instance(dev->devinfo), "i915stat",
+	    "drm", KSTAT_TYPE_NAMED, I915_STAT_NUM, 0);
+	if (ksp == NULL)
+		return (-1);
+
+	ksp->ks_private = dev_priv;
+	ksp->ks_update = i915_kstat_update;
+	for (knp = ksp->ks_data, i = 0; i < I915_STAT_NUM; knp++, i++)
+		kstat_named_init(knp, i915kstat_name[i], KSTAT_DATA_UINT64);
+	kstat_install(ksp);
+
+	dev_priv->ksp = ksp;
+
+	/* The histograms and context counters are optional */
+	for (i = 0; i < I915_HIST_NUM; i++)
+		dev_priv->hist_ksp[i] = i915_init_kstat_hist(dev, i);
+	dev_priv->ctx_ksp = i915_init_kstat_ctx(dev);
+
+	return (0);
+}
+
+void
+i915_fini_kstats(struct drm_device *dev)
+{
+	drm_i915_private_t *dev_priv = dev->dev_private;
+	int i;
+
+	if (dev_priv->ctx_ksp != NULL) {
+		kstat_delete(dev_priv->ctx_ksp);
+		dev_priv->ctx_ksp = NULL;
+	}
+
+	for (i = 0; i < I915_HIST_NUM; i++) {
+		if (dev_priv->hist_ksp[i] != NULL) {
+			kstat_delete(dev_priv->hist_ksp[i]);
+			dev_priv->hist_ksp[i] = NULL;
+		}
+	}
+
+	if (dev_priv->ksp != NULL) {
+		kstat_delete(dev_priv->ksp);
+		dev_priv->ksp = NULL;
+	}
+}
@@ -470,7 +470,7 @@ static int init_ring_common(struct intel_ring_buffer *ring)
 		ring->head = I915_READ_HEAD(ring);
 		ring->tail = I915_READ_TAIL(ring) & TAIL_ADDR;
 		ring->space = ring_space(ring);
-		ring->last_retired_head = 0xffffffff;
+		intel_ring_resync_pos(ring);
 	}
 
 	(void)memset(&ring->hangcheck, 0, sizeof(ring->hangcheck));
@@ -1294,16 +1294,18 @@ static int intel_init_ring_buffer(struct drm_device *dev,
 	memset(ring->sync_seqno, 0, sizeof(ring->sync_seqno));
 
 	DRM_INIT_WAITQUEUE(&ring->irq_queue, DRM_INTR_PRI(dev));
+	avl_create(&ring->waiters, i915_waiter_compare,
+	    sizeof (struct i915_waiter), offsetof(struct i915_waiter, link));
 
 	if (I915_NEED_GFX_HWS(dev)) {
 		ret = init_status_page(ring);
 		if (ret)
-			return ret;
+			goto err_waiters;
 	} else {
 		BUG_ON(ring->id != RCS);
 		ret = init_phys_status_page(ring);
 		if (ret)
-			return ret;
+			goto err_waiters;
 	}
 
 	obj = NULL;
@@ -1363,6 +1365,8 @@ err_unref:
 	ring->obj = NULL;
 err_hws:
 	cleanup_status_page(ring);
+err_waiters:
+	avl_destroy(&ring->waiters);
 	return ret;
 }
 
@@ -1393,72 +1397,71 @@ void intel_cleanup_ring_buffer(struct intel_ring_buffer *ring)
 		ring->cleanup(ring);
 
 	cleanup_status_page(ring);
+
+	/* The ring is idle, so every waiter has been woken and gone */
+	ASSERT(avl_numnodes(&ring->waiters) == 0);
+	avl_destroy(&ring->waiters);
 }
 
-static int intel_ring_wait_seqno(struct intel_ring_buffer *ring, u32 seqno)
+/* head and tail were just reloaded from the hardware */
+void intel_ring_resync_pos(struct intel_ring_buffer *ring)
 {
-	int ret;
+	ring->head_pos = ring->pos -
+	    ((ring->tail - (ring->head & HEAD_ADDR)) & (ring->size - 1));
+	ring->retired_pos = ring->head_pos;
+}
 
-	ret = i915_wait_seqno(ring, seqno);
-	if (!ret)
-		i915_gem_retire_requests_ring(ring);
+/* Move head up to pos, if that is further along, and recompute space */
+static void ring_advance_head(struct intel_ring_buffer *ring, u64 pos)
+{
+	if (pos > ring->head_pos) {
+		ring->head_pos = pos;
+		ring->head = (ring->tail - (u32)(ring->pos - pos)) &
+		    (ring->size - 1);
+	}
+	ring->space = ring_space(ring);
+}
 
-	return ret;
+/* The running position of the hardware head, good between emissions */
+static u64 ring_hw_head_pos(struct intel_ring_buffer *ring)
+{
+	struct drm_i915_private *dev_priv = ring->dev->dev_private;
+	u32 head = I915_READ_HEAD(ring) & HEAD_ADDR;
+
+	return ring->pos - ((ring->tail - head) & (ring->size - 1));
 }
 
+/*
+ * Wait for the oldest request whose completion frees n bytes. The request
+ * is not retired here; its tail is all we need.
+ */
 static int intel_ring_wait_request(struct intel_ring_buffer *ring, int n)
 {
 	struct drm_i915_gem_request *request;
+	u64 pos = 0;
 	u32 seqno = 0;
 	int ret;
 
-	i915_gem_retire_requests_ring(ring);
-
-	if (ring->last_retired_head != 0xffffffff) {
-		ring->head = ring->last_retired_head;
-		ring->last_retired_head = 0xffffffff;
-		ring->space = ring_space(ring);
-		if (ring->space >= n)
-			return 0;
-	}
-
 	list_for_each_entry(request, struct drm_i915_gem_request, &ring->request_list, list) {
-		int space;
-
-		if (request->tail == 0xffffffff)
+		if (request->tail_pos <= ring->head_pos)
 			continue;
 
-		space = request->tail - (ring->tail + I915_RING_FREE_SPACE);
-		if (space < 0)
-			space += ring->size;
-		if (space >= n) {
+		if (request->tail_pos + ring->size >=
+		    ring->pos + n + I915_RING_FREE_SPACE) {
 			seqno = request->seqno;
+			pos = request->tail_pos;
 			break;
 		}
-
-		/* Consume this request in case we need more space than
-		 * is available and so need to prevent a race between
-		 * updating last_retired_head and direct reads of
-		 * I915_RING_HEAD. It also provides a nice sanity check.
-		 */
-		request->tail = 0xffffffff;
 	}
 
 	if (seqno == 0)
 		return -ENOSPC;
 
-	ret = intel_ring_wait_seqno(ring, seqno);
+	ret = i915_wait_seqno(ring, seqno);
 	if (ret)
 		return ret;
 
-	if (ring->last_retired_head == 0xffffffff) {
-		WARN_ON(ring->last_retired_head == 0xffffffff);
-		return -ENOSPC;
-	}
-
-	ring->head = ring->last_retired_head;
-	ring->last_retired_head = 0xffffffff;
-	ring->space = ring_space(ring);
+	ring_advance_head(ring, pos);
 	if (ring->space < n) {
 		WARN_ON(ring->space < n);
 		return -ENOSPC;
@@ -1467,17 +1470,13 @@ static int intel_ring_wait_request(struct intel_ring_buffer *ring, int n)
 	return 0;
 }
 
-static int ring_wait_for_space(struct intel_ring_buffer *ring, int n)
+static int ring_poll_for_space(struct intel_ring_buffer *ring, int n)
 {
 	struct drm_device *dev = ring->dev;
 	struct drm_i915_private *dev_priv = dev->dev_private;
 	unsigned long end;
 	int ret;
 
-	ret = intel_ring_wait_request(ring, n);
-	if (ret != -ENOSPC)
-		return ret;
-
 	/* With GEM the hangcheck timer should kick us out of the loop,
 	 * leaving it early runs the risk of corrupting GEM state (due
 	 * to running on almost untested codepaths). But on resume
@@ -1486,8 +1485,7 @@ static int ring_wait_for_space(struct intel_ring_buffer *ring, int n)
 	end = jiffies + 60 * DRM_HZ;
 
 	do {
-		ring->head = I915_READ_HEAD(ring);
-		ring->space = ring_space(ring);
+		ring_advance_head(ring, ring_hw_head_pos(ring));
 		if (ring->space >= n) {
 			return 0;
 		}
@@ -1508,6 +1506,31 @@ static int ring_wait_for_space(struct intel_ring_buffer *ring, int n)
 	return -EBUSY;
 }
 
+static int ring_wait_for_space(struct intel_ring_buffer *ring, int n)
+{
+	struct drm_i915_private *dev_priv = ring->dev->dev_private;
+	u64 hw_pos = ring_hw_head_pos(ring);
+	hrtime_t start, stall;
+	int ret;
+
+	/* Whatever has been retired, or the GPU has read, is free already */
+	ring_advance_head(ring, MAX(ring->retired_pos, hw_pos));
+	if (ring->space >= n)
+		return 0;
+
+	start = gethrtime();
+	ret = intel_ring_wait_request(ring, n);
+	if (ret == -ENOSPC)
+		ret = ring_poll_for_space(ring, n);
+	stall = gethrtime() - start;
+
+	I915_STAT_INC(dev_priv, I915_STAT_RING_STALL);
+	I915_STAT_ADD(dev_priv, I915_STAT_RING_STALL_NS, stall);
+	i915_hist_add(dev_priv, I915_HIST_RING_STALL, stall);
+
+	return ret;
+}
+
 static int intel_wrap_ring_buffer(struct intel_ring_buffer *ring)
 {
 	unsigned int *virt;
@@ -1520,6 +1543,7 @@ static int intel_wrap_ring_buffer(struct intel_ring_buffer *ring)
 	}
 
 	virt = (unsigned int *)(uintptr_t)((caddr_t)ring->virtual_start + ring->tail);
+	ring->pos += rem;
 	rem = (int)(rem / 4);
 	while (rem--) {
 		*virt++ = MI_NOOP;
@@ -1583,6 +1607,7 @@ static int __intel_ring_begin(struct intel_ring_buffer *ring,
 	}
 
 	ring->space -= bytes;
+	ring->pos += bytes;
 	return 0;
 }
 
@@ -1605,6 +1630,35 @@ int intel_ring_begin(struct intel_ring_buffer *ring,
 	return __intel_ring_begin(ring, num_dwords * sizeof(uint32_t));
 	}
 
+/*
+ * Make room for num_dwords to be emitted by the intel_ring_begin() calls
+ * that follow, without wrapping or waiting for space, so that a caller
+ * emitting a sequence of commands stalls at most once, up front, rather
+ * than part way through.
+ */
+int intel_ring_reserve(struct intel_ring_buffer *ring, int num_dwords)
+{
+	struct drm_i915_private *dev_priv = ring->dev->dev_private;
+	int bytes = num_dwords * sizeof(uint32_t);
+	int ret;
+
+	ret = i915_gem_check_wedge(&dev_priv->gpu_error,
+				   dev_priv->mm.interruptible);
+	if (ret)
+		return ret;
+
+	if (ring->tail + bytes > ring->effective_size) {
+		ret = intel_wrap_ring_buffer(ring);
+		if (ret)
+			return ret;
+	}
+
+	if (ring->space < bytes)
+		return ring_wait_for_space(ring, bytes);
+
+	return 0;
+}
+
 void intel_ring_init_seqno(struct intel_ring_buffer *ring, u32 seqno)
 {
 	struct drm_i915_private *dev_priv = ring->dev->dev_private;
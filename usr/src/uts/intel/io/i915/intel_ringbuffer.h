@@ -51,6 +51,18 @@ struct  intel_hw_status_page {
 	struct		drm_i915_gem_object *obj;
 };
 
+/*
+ * A thread sleeping in __wait_seqno. Waiters are kept in ring->waiters in
+ * seqno order, under ring->irq_queue.lock, so the user interrupt only has
+ * to signal the ones whose seqno has passed.
+ */
+struct i915_waiter {
+	avl_node_t	link;
+	u32		seqno;
+	bool		woken;	/* not in the tree: signalled or not queued */
+	kcondvar_t	cv;
+};
+
 #define I915_READ_TAIL(ring) I915_READ(RING_TAIL((ring)->mmio_base))
 #define I915_WRITE_TAIL(ring, val) I915_WRITE(RING_TAIL((ring)->mmio_base), val)
 
@@ -101,15 +113,18 @@ struct  intel_ring_buffer {
 	int		effective_size;
 	struct intel_hw_status_page status_page;
 
-	/** We track the position of the requests in the ring buffer, and
-	 * when each is retired we increment last_retired_head as the GPU
-	 * must have finished processing the request and so we know we
-	 * can advance the ringbuffer up to that position.
+	/** Ring positions as running byte counts, which unlike head and
+	 * tail can be compared without worrying about wraparound.
 	 *
-	 * last_retired_head is set to -1 after the value is consumed so
-	 * we can detect new retirements.
+	 * pos is where the next intel_ring_begin() starts, head_pos is
+	 * where head and space were last computed from, and retired_pos is
+	 * the tail of the last request retired. The GPU is known to have
+	 * consumed everything before retired_pos and before the hardware
+	 * head, so either can advance head without retiring anything.
 	 */
-	u32		last_retired_head;
+	u64		pos;
+	u64		head_pos;
+	u64		retired_pos;
 
 	struct {
 		u32	gt; /*  protected by dev_priv->irq_lock */
@@ -117,6 +132,9 @@ struct  intel_ring_buffer {
 	} irq_refcount;
 	u32		irq_enable_mask;	/* bitmask to enable ring interrupt */
 	u32		trace_irq_seqno;
+	bool		retire_irq;	/* holds a user IRQ ref for retiring */
+	hrtime_t	retire_irq_time; /* first unserviced IRQ, 0 if none */
+	hrtime_t	last_retired_ns; /* for charging GPU time to contexts */
 	u32		sync_seqno[I915_NUM_RINGS-1];
 	bool		(*irq_get)(struct intel_ring_buffer *ring);
 	void		(*irq_put)(struct intel_ring_buffer *ring);
@@ -180,6 +198,7 @@ struct  intel_ring_buffer {
 	bool fbc_dirty;
 
 	wait_queue_head_t irq_queue;
+	avl_tree_t waiters;	/* struct i915_waiter, by seqno */
 	drm_local_map_t map;
 
 	/**
@@ -189,6 +208,20 @@ struct  intel_ring_buffer {
 	struct i915_hw_context *default_context;
 	struct i915_hw_context *last_context;
 
+	/**
+	 * Contexts recently switched away from, kept pinned and referenced
+	 * so that switching back to them doesn't rebind their image.
+	 */
+#define I915_CTX_CACHE_MAX 8
+	struct i915_hw_context *ctx_cache[I915_CTX_CACHE_MAX];
+	int ctx_cache_count;
+	u64 ctx_switches;	/* MI_SET_CONTEXTs emitted */
+	u64 ctx_elided;		/* switches to the current context skipped */
+	u64 ctx_cache_hits;	/* switches to a context still pinned */
+
+	/** Page directory loaded, see i915_ppgtt_switch() */
+	struct i915_hw_ppgtt *ppgtt;
+
 	struct intel_ring_hangcheck hangcheck;
 
 	void *private;
@@ -266,6 +299,8 @@ int intel_wait_ring_buffer(struct intel_ring_buffer *ring, int n);
 int intel_wait_ring_idle(struct intel_ring_buffer *ring);
 
 int intel_ring_begin(struct intel_ring_buffer *ring, int n);
+int intel_ring_reserve(struct intel_ring_buffer *ring, int n);
+void intel_ring_resync_pos(struct intel_ring_buffer *ring);
 
 static inline void intel_ring_emit(struct intel_ring_buffer *ring,
 				   u32 data)